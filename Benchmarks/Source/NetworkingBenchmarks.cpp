@@ -0,0 +1,401 @@
+#include "Walnut/Networking/Server.h"
+#include "Walnut/Networking/Client.h"
+#include "Walnut/Networking/ClientGroup.h"
+#include "Walnut/Networking/NetworkingContext.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+
+#include <spdlog/fmt/fmt.h>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Loopback benchmarks for Server/Client
+//
+// Usage: Walnut-Networking-Benchmarks [--quick] [--port <port>] [--json <file>]
+//
+// Human readable results go to stdout. With --json, every result is also written as one JSON object per line
+// ({"benchmark": ..., "metric": value, ...}) so runs can be diffed across releases.
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+using namespace Walnut;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+	struct BenchmarkOptions
+	{
+		bool Quick = false;
+		int Port = 28500;
+		std::string JsonPath;
+	};
+
+	// Listen sockets are torn down asynchronously, so every run gets its own port
+	int NextPort(const BenchmarkOptions& options)
+	{
+		static int s_RunIndex = 0;
+		return options.Port + s_RunIndex++;
+	}
+
+	class ResultWriter
+	{
+	public:
+		ResultWriter(const std::string& path)
+		{
+			if (!path.empty())
+				m_Stream.open(path, std::ios::out | std::ios::trunc);
+		}
+
+		void Write(const std::string& json)
+		{
+			if (m_Stream.is_open())
+				m_Stream << json << '\n';
+		}
+	private:
+		std::ofstream m_Stream;
+	};
+
+	// Timestamp sent with each ping, echoed back by the server
+	struct PingMessage
+	{
+		uint64_t Sequence;
+		int64_t SendTime;
+	};
+
+	int64_t NowMicroseconds()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+	}
+
+	template<typename Predicate>
+	bool WaitFor(Predicate predicate, std::chrono::milliseconds timeout)
+	{
+		auto deadline = Clock::now() + timeout;
+		while (!predicate())
+		{
+			if (Clock::now() > deadline)
+				return false;
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		return true;
+	}
+
+	NetworkThreadSettings GetBenchmarkThreadSettings()
+	{
+		NetworkThreadSettings settings;
+		settings.Mode = NetworkThreadMode::WaitOnActivity;
+		settings.MinIdleWait = std::chrono::microseconds(50);
+		settings.MaxIdleWait = std::chrono::milliseconds(1);
+		return settings;
+	}
+
+	uint64_t Percentile(const std::vector<uint64_t>& sorted, double percentile)
+	{
+		if (sorted.empty())
+			return 0;
+
+		size_t index = (size_t)(percentile * (double)(sorted.size() - 1) + 0.5);
+		return sorted[std::min(index, sorted.size() - 1)];
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Throughput - client streams messages to the server
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	void RunThroughput(const BenchmarkOptions& options, ResultWriter& writer, uint32_t payloadSize, bool reliable)
+	{
+		std::atomic<uint64_t> receivedCount = 0;
+		std::atomic<uint64_t> receivedBytes = 0;
+
+		int port = NextPort(options);
+		Server server(port);
+		server.SetNetworkThreadSettings(GetBenchmarkThreadSettings());
+		server.SetDataReceivedBatchCallback([&](std::span<const ClientMessage> messages)
+		{
+			uint64_t bytes = 0;
+			for (const ClientMessage& message : messages)
+				bytes += message.Data.Size;
+
+			receivedBytes.fetch_add(bytes, std::memory_order_relaxed);
+			receivedCount.fetch_add(messages.size(), std::memory_order_relaxed);
+		});
+		server.Start();
+
+		Client client;
+		client.SetNetworkThreadSettings(GetBenchmarkThreadSettings());
+		client.ConnectToServer(fmt::format("127.0.0.1:{}", port));
+
+		if (!WaitFor([&]() { return client.GetConnectionStatus() == Client::ConnectionStatus::Connected; }, std::chrono::seconds(5)))
+		{
+			std::cout << "throughput: failed to connect" << std::endl;
+			client.Disconnect();
+			server.Stop();
+			return;
+		}
+
+		// Keep a bounded amount in flight so reliable sends never run into the send buffer limit
+		const uint64_t messageCount = options.Quick ? 20000 : 200000;
+		const uint64_t windowBytes = 256 * 1024;
+		const uint64_t window = std::clamp<uint64_t>(windowBytes / payloadSize, 4, 4096);
+
+		std::vector<uint8_t> payload(payloadSize, 0xAB);
+
+		auto start = Clock::now();
+		uint64_t sentCount = 0;
+		while (sentCount < messageCount)
+		{
+			if (sentCount - receivedCount.load(std::memory_order_relaxed) >= window)
+			{
+				// Unreliable messages can be dropped, so don't wait on them forever
+				if (!reliable && Clock::now() - start > std::chrono::seconds(30))
+					break;
+
+				std::this_thread::yield();
+				continue;
+			}
+
+			client.SendBuffer(Buffer(payload.data(), payloadSize), reliable);
+			sentCount++;
+		}
+
+		WaitFor([&]() { return receivedCount.load() >= sentCount; }, std::chrono::seconds(reliable ? 10 : 1));
+		auto end = Clock::now();
+
+		double seconds = std::chrono::duration<double>(end - start).count();
+		uint64_t received = receivedCount.load();
+		double messagesPerSecond = (double)received / seconds;
+		double megabytesPerSecond = (double)receivedBytes.load() / (1024.0 * 1024.0) / seconds;
+		double lossPercent = sentCount ? 100.0 * (double)(sentCount - std::min(received, sentCount)) / (double)sentCount : 0.0;
+
+		const char* mode = reliable ? "reliable" : "unreliable";
+		std::cout << fmt::format("throughput  {:>10} {:>7} B  {:>12.0f} msg/s  {:>9.2f} MB/s  loss {:.2f}%", mode, payloadSize, messagesPerSecond, megabytesPerSecond, lossPercent) << std::endl;
+		writer.Write(fmt::format(R"({{"benchmark":"throughput","mode":"{}","payload_bytes":{},"sent":{},"received":{},"seconds":{:.6f},"messages_per_sec":{:.1f},"mb_per_sec":{:.3f},"loss_percent":{:.3f}}})",
+			mode, payloadSize, sentCount, received, seconds, messagesPerSecond, megabytesPerSecond, lossPercent));
+
+		client.Disconnect();
+		server.Stop();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Latency - one ping in flight at a time, echoed by the server
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	void RunLatency(const BenchmarkOptions& options, ResultWriter& writer, bool reliable)
+	{
+		int port = NextPort(options);
+		Server server(port);
+		server.SetNetworkThreadSettings(GetBenchmarkThreadSettings());
+		server.SetDataReceivedCallback([&](const ClientInfo& client, const Buffer buffer)
+		{
+			server.SendBufferToClient(client.ID, buffer, reliable);
+		});
+		server.Start();
+
+		std::mutex samplesMutex;
+		std::vector<uint64_t> samples;
+		std::atomic<uint64_t> lastReceived = 0;
+
+		Client client;
+		client.SetNetworkThreadSettings(GetBenchmarkThreadSettings());
+		client.SetDataReceivedCallback([&](const Buffer buffer)
+		{
+			if (buffer.Size < sizeof(PingMessage))
+				return;
+
+			PingMessage ping;
+			memcpy(&ping, buffer.Data, sizeof(PingMessage));
+
+			std::scoped_lock lock(samplesMutex);
+			samples.push_back((uint64_t)(NowMicroseconds() - ping.SendTime));
+			lastReceived.store(ping.Sequence, std::memory_order_release);
+		});
+		client.ConnectToServer(fmt::format("127.0.0.1:{}", port));
+
+		if (!WaitFor([&]() { return client.GetConnectionStatus() == Client::ConnectionStatus::Connected; }, std::chrono::seconds(5)))
+		{
+			std::cout << "latency: failed to connect" << std::endl;
+			client.Disconnect();
+			server.Stop();
+			return;
+		}
+
+		const uint64_t pingCount = options.Quick ? 2000 : 20000;
+		for (uint64_t sequence = 1; sequence <= pingCount; sequence++)
+		{
+			PingMessage ping{ sequence, NowMicroseconds() };
+			client.SendData(ping, reliable);
+
+			// Lost unreliable pings just time out
+			WaitFor([&]() { return lastReceived.load(std::memory_order_acquire) >= sequence; }, std::chrono::milliseconds(100));
+		}
+
+		std::vector<uint64_t> sorted;
+		{
+			std::scoped_lock lock(samplesMutex);
+			sorted = samples;
+		}
+		std::sort(sorted.begin(), sorted.end());
+
+		uint64_t p50 = Percentile(sorted, 0.50);
+		uint64_t p99 = Percentile(sorted, 0.99);
+		uint64_t p999 = Percentile(sorted, 0.999);
+		uint64_t max = sorted.empty() ? 0 : sorted.back();
+
+		const char* mode = reliable ? "reliable" : "unreliable";
+		std::cout << fmt::format("latency     {:>10}  samples {:>6}  p50 {:>6} us  p99 {:>6} us  p999 {:>6} us  max {:>6} us", mode, sorted.size(), p50, p99, p999, max) << std::endl;
+		writer.Write(fmt::format(R"({{"benchmark":"latency","mode":"{}","samples":{},"p50_us":{},"p99_us":{},"p999_us":{},"max_us":{}}})",
+			mode, sorted.size(), p50, p99, p999, max));
+
+		client.Disconnect();
+		server.Stop();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Broadcast fan-out - cost of SendBufferToAllClients and time until every client has everything
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	void RunFanOut(const BenchmarkOptions& options, ResultWriter& writer, uint32_t clientCount)
+	{
+		std::atomic<uint32_t> connectedCount = 0;
+		std::atomic<uint64_t> receivedCount = 0;
+
+		int port = NextPort(options);
+		Server server(port);
+		server.SetNetworkThreadSettings(GetBenchmarkThreadSettings());
+		server.SetClientConnectedCallback([&](const ClientInfo&) { connectedCount++; });
+		server.Start();
+
+		// All clients share one network thread
+		ClientGroup group;
+		group.SetNetworkThreadSettings(GetBenchmarkThreadSettings());
+		group.Start();
+
+		std::vector<std::unique_ptr<Client>> clients;
+		for (uint32_t i = 0; i < clientCount; i++)
+		{
+			auto& client = clients.emplace_back(std::make_unique<Client>());
+			client->SetDataReceivedBatchCallback([&](std::span<const Buffer> messages) { receivedCount.fetch_add(messages.size(), std::memory_order_relaxed); });
+			group.AddClient(*client);
+			client->ConnectToServer(fmt::format("127.0.0.1:{}", port));
+		}
+
+		auto cleanup = [&]()
+		{
+			for (auto& client : clients)
+				group.RemoveClient(*client);
+			group.Stop();
+			server.Stop();
+		};
+
+		if (!WaitFor([&]() { return connectedCount.load() == clientCount; }, std::chrono::seconds(10)))
+		{
+			std::cout << fmt::format("fan-out: only {}/{} clients connected", connectedCount.load(), clientCount) << std::endl;
+			cleanup();
+			return;
+		}
+
+		const uint32_t payloadSize = 256;
+		const uint64_t broadcastCount = options.Quick ? 200 : 2000;
+		std::vector<uint8_t> payload(payloadSize, 0xCD);
+
+		auto start = Clock::now();
+		Clock::duration sendTime{};
+		for (uint64_t i = 0; i < broadcastCount; i++)
+		{
+			// Pace so the per-connection send buffers don't fill up
+			WaitFor([&]() { return receivedCount.load(std::memory_order_relaxed) + 64 * clientCount >= i * clientCount; }, std::chrono::seconds(5));
+
+			auto sendStart = Clock::now();
+			server.SendBufferToAllClients(Buffer(payload.data(), payloadSize));
+			sendTime += Clock::now() - sendStart;
+		}
+
+		bool delivered = WaitFor([&]() { return receivedCount.load() >= broadcastCount * clientCount; }, std::chrono::seconds(10));
+		auto end = Clock::now();
+
+		double sendMicroseconds = std::chrono::duration<double, std::micro>(sendTime).count() / (double)broadcastCount;
+		double perRecipientNanoseconds = sendMicroseconds * 1000.0 / (double)clientCount;
+		double deliverySeconds = std::chrono::duration<double>(end - start).count();
+		double deliveredPerSecond = (double)receivedCount.load() / deliverySeconds;
+
+		std::cout << fmt::format("fan-out     {:>5} clients  send {:>8.2f} us/broadcast  {:>8.1f} ns/recipient  {:>12.0f} deliveries/s{}",
+			clientCount, sendMicroseconds, perRecipientNanoseconds, deliveredPerSecond, delivered ? "" : "  (incomplete)") << std::endl;
+		writer.Write(fmt::format(R"({{"benchmark":"fanout","clients":{},"payload_bytes":{},"broadcasts":{},"send_us_per_broadcast":{:.3f},"send_ns_per_recipient":{:.1f},"deliveries_per_sec":{:.1f},"complete":{}}})",
+			clientCount, payloadSize, broadcastCount, sendMicroseconds, perRecipientNanoseconds, deliveredPerSecond, delivered));
+
+		cleanup();
+	}
+
+	bool ParseOptions(int argc, char** argv, BenchmarkOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--quick")
+				options.Quick = true;
+			else if (arg == "--port" && i + 1 < argc)
+				options.Port = std::stoi(argv[++i]);
+			else if (arg == "--json" && i + 1 < argc)
+				options.JsonPath = argv[++i];
+			else
+				return false;
+		}
+		return true;
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		std::cout << "Usage: " << argv[0] << " [--quick] [--port <port>] [--json <file>]" << std::endl;
+		return 1;
+	}
+
+	// Hold the library for the whole run so settings stick between benchmarks
+	std::string errorMessage;
+	if (!NetworkingContext::Acquire(errorMessage))
+	{
+		std::cout << "GameNetworkingSockets_Init failed: " << errorMessage << std::endl;
+		return 1;
+	}
+
+	// Defaults are tuned for internet play - don't let the rate limiter be what we measure
+	SteamNetworkingUtils()->SetGlobalConfigValueInt32(k_ESteamNetworkingConfig_SendRateMin, 512 * 1024 * 1024);
+	SteamNetworkingUtils()->SetGlobalConfigValueInt32(k_ESteamNetworkingConfig_SendRateMax, 512 * 1024 * 1024);
+	SteamNetworkingUtils()->SetGlobalConfigValueInt32(k_ESteamNetworkingConfig_SendBufferSize, 4 * 1024 * 1024);
+	// Nagle would add its 5ms on both ends of every ping
+	SteamNetworkingUtils()->SetGlobalConfigValueInt32(k_ESteamNetworkingConfig_NagleTime, 0);
+
+	ResultWriter writer(options.JsonPath);
+
+	const uint32_t payloadSizes[] = { 16, 256, 1024, 16 * 1024 };
+	for (bool reliable : { true, false })
+	{
+		for (uint32_t payloadSize : payloadSizes)
+		{
+			// Large unreliable messages are fragmented and lost as a whole, not worth measuring
+			if (!reliable && payloadSize > 1024)
+				continue;
+
+			RunThroughput(options, writer, payloadSize, reliable);
+		}
+	}
+
+	RunLatency(options, writer, true);
+	RunLatency(options, writer, false);
+
+	std::vector<uint32_t> clientCounts = options.Quick ? std::vector<uint32_t>{ 1, 8, 32 } : std::vector<uint32_t>{ 1, 8, 32, 128, 256 };
+	for (uint32_t clientCount : clientCounts)
+		RunFanOut(options, writer, clientCount);
+
+	NetworkingContext::Release();
+	return 0;
+}
@@ -0,0 +1,78 @@
+-- Tests for Walnut-Networking
+-- Include alongside Build-Walnut-Networking.lua, eg:
+--   include "Walnut/Walnut-Networking/Build-Walnut-Networking-Tests.lua"
+project "Walnut-Networking-Tests"
+   kind "ConsoleApp"
+   language "C++"
+   cppdialect "C++20"
+   targetdir "bin/%{cfg.buildcfg}"
+   staticruntime "off"
+
+   files { "Tests/Source/**.h", "Tests/Source/**.cpp" }
+
+   includedirs
+   {
+      "Source",
+
+      "vendor/GameNetworkingSockets/include",
+
+      --------------------------------------------------------
+      -- Walnut includes
+      -- Assumes we are in Walnut-Modules/Walnut-Networking
+      "../../Walnut/Source",
+
+      "../../vendor/spdlog/include",
+      --------------------------------------------------------
+   }
+
+   links
+   {
+      "Walnut-Networking",
+   }
+
+   targetdir ("../../bin/" .. outputdir .. "/%{prj.name}")
+   objdir ("../../bin-int/" .. outputdir .. "/%{prj.name}")
+
+   filter "system:windows"
+      systemversion "latest"
+      defines { "WL_PLATFORM_WINDOWS" }
+      links { "Walnut", "Ws2_32.lib", "Bcrypt.lib" }
+      buildoptions { "/utf-8" }
+
+   filter "system:linux"
+      defines { "WL_PLATFORM_LINUX" }
+      libdirs { "vendor/GameNetworkingSockets/bin/Linux" }
+      links { "GameNetworkingSockets" }
+      linkoptions { "-Wl,-rpath,'$$ORIGIN'" }
+      postbuildcommands
+      {
+          "{COPYFILE} %{prj.location}/vendor/GameNetworkingSockets/bin/Linux/libGameNetworkingSockets.so %{cfg.targetdir}",
+          "{COPYFILE} %{prj.location}/vendor/GameNetworkingSockets/bin/Linux/libprotobuf.so.23 %{cfg.targetdir}"
+      }
+
+  filter { "system:windows", "configurations:Debug" }
+      postbuildcommands { "{COPYFILE} %{prj.location}/vendor/GameNetworkingSockets/bin/Windows/Debug/GameNetworkingSockets.dll %{cfg.targetdir}" }
+
+  filter { "system:windows", "configurations:Release or configurations:Dist" }
+      postbuildcommands
+      {
+          "{COPYFILE} %{prj.location}/vendor/GameNetworkingSockets/bin/Windows/Release/GameNetworkingSockets.dll %{cfg.targetdir}",
+          "{COPYFILE} %{prj.location}/vendor/GameNetworkingSockets/bin/Windows/Release/libprotobuf.dll %{cfg.targetdir}"
+      }
+
+   filter "configurations:Debug"
+      defines { "WL_DEBUG" }
+      runtime "Debug"
+      symbols "On"
+
+   filter "configurations:Release"
+      defines { "WL_RELEASE" }
+      runtime "Release"
+      optimize "On"
+      symbols "On"
+
+   filter "configurations:Dist"
+      defines { "WL_DIST" }
+      runtime "Release"
+      optimize "On"
+      symbols "Off"
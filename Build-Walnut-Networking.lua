@@ -33,7 +33,7 @@ project "Walnut-Networking"
       defines { "WL_PLATFORM_WINDOWS" }
       files { "Platform/Windows/**.h", "Platform/Windows/**.cpp" }
       includedirs { "Platform/Windows" }
-      links { "Ws2_32.lib" }
+      links { "Ws2_32.lib", "Bcrypt.lib" }
       buildoptions { "/utf-8" }
 
    filter "system:linux"
@@ -1,11 +1,176 @@
 #include "Walnut/Networking/NetworkingUtils.h"
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <future>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
 namespace Walnut::Utils {
 
+	static std::vector<std::string> LookupHostAddresses(const std::string& hostName, int family, int& error)
+	{
+		addrinfo hints{};
+		hints.ai_family = family;
+		hints.ai_socktype = SOCK_DGRAM; // One result per address instead of one per socket type
+
+		addrinfo* addressResult = nullptr;
+		error = getaddrinfo(hostName.c_str(), nullptr, &hints, &addressResult);
+		if (error != 0)
+			return {};
+
+		std::vector<std::string> addresses;
+		for (addrinfo* ptr = addressResult; ptr != nullptr; ptr = ptr->ai_next)
+		{
+			char buffer[INET6_ADDRSTRLEN];
+			const void* address = nullptr;
+			if (ptr->ai_family == AF_INET)
+				address = &((sockaddr_in*)ptr->ai_addr)->sin_addr;
+			else if (ptr->ai_family == AF_INET6)
+				address = &((sockaddr_in6*)ptr->ai_addr)->sin6_addr;
+
+			if (address && inet_ntop(ptr->ai_family, address, buffer, sizeof(buffer)))
+			{
+				if (std::find(addresses.begin(), addresses.end(), buffer) == addresses.end())
+					addresses.emplace_back(buffer);
+			}
+		}
+
+		freeaddrinfo(addressResult);
+		return addresses;
+	}
+
+	std::vector<std::string> LookupHostAddresses(std::string_view hostName)
+	{
+		std::string name(hostName);
+
+		// A and AAAA lookups in parallel, so a slow or broken IPv6 path doesn't hold up IPv4
+		int ipv4Error = 0, ipv6Error = 0;
+		std::future<std::vector<std::string>> ipv6 = std::async(std::launch::async, [&name, &ipv6Error]() { return LookupHostAddresses(name, AF_INET6, ipv6Error); });
+		std::vector<std::string> addresses = LookupHostAddresses(name, AF_INET, ipv4Error);
+
+		std::vector<std::string> ipv6Addresses = ipv6.get();
+		addresses.insert(addresses.end(), ipv6Addresses.begin(), ipv6Addresses.end());
+
+		// No addresses of one family is normal, only report when both lookups came back empty
+		if (addresses.empty())
+			std::cout << "getaddrinfo failed for " << name << ": " << gai_strerror(ipv4Error ? ipv4Error : ipv6Error) << std::endl;
+
+		return addresses;
+	}
+
 	std::string ResolveDomainName(std::string_view name)
 	{
-        // TODO(Yan): implement this
-        return {};
+		std::string host, port;
+		size_t colon = name.rfind(':');
+		if (colon != std::string_view::npos && name.find(':') == colon)
+		{
+			host = name.substr(0, colon);
+			port = name.substr(colon + 1);
+		}
+		else
+		{
+			host = name;
+		}
+
+		std::vector<std::string> addresses = LookupHostAddresses(host);
+		if (addresses.empty())
+			return {};
+
+		const std::string& address = addresses.front();
+		if (port.empty())
+			return address;
+
+		bool isIPv6 = address.find(':') != std::string::npos;
+		return isIPv6 ? ("[" + address + "]:" + port) : (address + ":" + port);
+	}
+
+	bool GetSecureRandomBytes(void* data, size_t size)
+	{
+		std::byte* out = (std::byte*)data;
+		while (size)
+		{
+			ssize_t result = getrandom(out, size, 0);
+			if (result < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				std::cout << "Could not get random bytes: " << strerror(errno) << std::endl;
+				return false;
+			}
+
+			out += result;
+			size -= (size_t)result;
+		}
+		return true;
+	}
+
+	bool MapFile(const std::string& path, uint64_t size, bool writable, MappedFile& file)
+	{
+		int fd = writable ? open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			std::cout << "Could not open " << path << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+
+		if (writable)
+		{
+			if (ftruncate(fd, (off_t)size) != 0)
+			{
+				std::cout << "Could not resize " << path << ": " << strerror(errno) << std::endl;
+				close(fd);
+				return false;
+			}
+		}
+		else
+		{
+			struct stat info;
+			if (fstat(fd, &info) != 0 || info.st_size == 0)
+			{
+				close(fd);
+				return false;
+			}
+			size = (uint64_t)info.st_size;
+		}
+
+		void* data = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			std::cout << "Could not map " << path << ": " << strerror(errno) << std::endl;
+			close(fd);
+			return false;
+		}
+
+		file.Data = (std::byte*)data;
+		file.Size = size;
+		file.Writable = writable;
+		file.FileHandle = fd;
+		return true;
+	}
+
+	void UnmapFile(MappedFile& file, uint64_t finalSize)
+	{
+		if (!file.Data)
+			return;
+
+		munmap(file.Data, file.Size);
+		if (file.Writable && ftruncate((int)file.FileHandle, (off_t)finalSize) != 0)
+			std::cout << "Could not resize mapped file: " << strerror(errno) << std::endl;
+		close((int)file.FileHandle);
+
+		file = MappedFile();
 	}
 
-}
\ No newline at end of file
+}
@@ -4,8 +4,10 @@
 
 #include <WinSock2.h>
 #include <ws2tcpip.h>
+#include <bcrypt.h>
 
 #include <vector>
+#include <algorithm>
 
 namespace Walnut::Utils {
 
@@ -91,4 +93,139 @@ namespace Walnut::Utils {
 		return hasPort ? (ipAddressStr + ":" + port) : ipAddressStr;
 	}
 
+	std::vector<std::string> LookupHostAddresses(std::string_view hostName)
+	{
+		WSADATA wsaData;
+		int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
+		if (iResult != 0)
+		{
+			printf("WSAStartup failed with %u\n", WSAGetLastError());
+			return {};
+		}
+
+		addrinfo hints;
+		ZeroMemory(&hints, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+
+		std::string name(hostName);
+		addrinfo* addressResult = NULL;
+		DWORD dwRetval = getaddrinfo(name.c_str(), nullptr, &hints, &addressResult);
+		if (dwRetval != 0)
+		{
+			printf("getaddrinfo failed with error: %d\n", dwRetval);
+			WSACleanup();
+			return {};
+		}
+
+		std::vector<std::string> ipv4Addresses, ipv6Addresses;
+		for (addrinfo* ptr = addressResult; ptr != NULL; ptr = ptr->ai_next)
+		{
+			char buffer[INET6_ADDRSTRLEN];
+			if (ptr->ai_family == AF_INET)
+			{
+				if (inet_ntop(AF_INET, &((sockaddr_in*)ptr->ai_addr)->sin_addr, buffer, sizeof(buffer)))
+					ipv4Addresses.emplace_back(buffer);
+			}
+			else if (ptr->ai_family == AF_INET6)
+			{
+				if (inet_ntop(AF_INET6, &((sockaddr_in6*)ptr->ai_addr)->sin6_addr, buffer, sizeof(buffer)))
+					ipv6Addresses.emplace_back(buffer);
+			}
+		}
+
+		freeaddrinfo(addressResult);
+		WSACleanup();
+
+		ipv4Addresses.insert(ipv4Addresses.end(), ipv6Addresses.begin(), ipv6Addresses.end());
+		return ipv4Addresses;
+	}
+
+	bool GetSecureRandomBytes(void* data, size_t size)
+	{
+		std::byte* out = (std::byte*)data;
+		while (size)
+		{
+			ULONG chunk = (ULONG)std::min<size_t>(size, 0xFFFFFFFF);
+			NTSTATUS status = BCryptGenRandom(nullptr, (PUCHAR)out, chunk, BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+			if (!BCRYPT_SUCCESS(status))
+			{
+				printf("Could not get random bytes (status 0x%08x)\n", (unsigned)status);
+				return false;
+			}
+
+			out += chunk;
+			size -= chunk;
+		}
+		return true;
+	}
+
+	bool MapFile(const std::string& path, uint64_t size, bool writable, MappedFile& file)
+	{
+		HANDLE fileHandle = CreateFileA(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr,
+			writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE)
+		{
+			printf("Could not open %s (error %u)\n", path.c_str(), GetLastError());
+			return false;
+		}
+
+		if (!writable)
+		{
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+			{
+				CloseHandle(fileHandle);
+				return false;
+			}
+			size = (uint64_t)fileSize.QuadPart;
+		}
+
+		// A writable mapping extends the file to its size
+		HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), nullptr);
+		if (!mappingHandle)
+		{
+			printf("Could not map %s (error %u)\n", path.c_str(), GetLastError());
+			CloseHandle(fileHandle);
+			return false;
+		}
+
+		void* data = MapViewOfFile(mappingHandle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)size);
+		if (!data)
+		{
+			printf("Could not map %s (error %u)\n", path.c_str(), GetLastError());
+			CloseHandle(mappingHandle);
+			CloseHandle(fileHandle);
+			return false;
+		}
+
+		file.Data = (std::byte*)data;
+		file.Size = size;
+		file.Writable = writable;
+		file.FileHandle = (int64_t)fileHandle;
+		file.MappingHandle = mappingHandle;
+		return true;
+	}
+
+	void UnmapFile(MappedFile& file, uint64_t finalSize)
+	{
+		if (!file.Data)
+			return;
+
+		HANDLE fileHandle = (HANDLE)file.FileHandle;
+		UnmapViewOfFile(file.Data);
+		CloseHandle((HANDLE)file.MappingHandle);
+
+		if (file.Writable)
+		{
+			LARGE_INTEGER position;
+			position.QuadPart = (LONGLONG)finalSize;
+			if (!SetFilePointerEx(fileHandle, position, nullptr, FILE_BEGIN) || !SetEndOfFile(fileHandle))
+				printf("Could not resize mapped file (error %u)\n", GetLastError());
+		}
+		CloseHandle(fileHandle);
+
+		file = MappedFile();
+	}
+
 }
\ No newline at end of file
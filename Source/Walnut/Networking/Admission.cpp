@@ -0,0 +1,197 @@
+#include "Admission.h"
+
+#include <cstring>
+
+namespace Walnut {
+
+	// Idle per-IP buckets (refilled to full) are dropped this often
+	static constexpr std::chrono::seconds AddressPruneInterval = std::chrono::seconds(10);
+
+	void AdmissionController::SetSettings(const AdmissionSettings& settings)
+	{
+		m_Settings = settings;
+
+		auto now = std::chrono::steady_clock::now();
+		m_AcceptBucket.Configure(settings.ConnectionsPerSecond, settings.ConnectionBurst, now);
+		m_AddressBuckets.clear();
+	}
+
+	void AdmissionController::Resolve(HSteamNetConnection connection, bool accept, std::string_view reason)
+	{
+		std::scoped_lock lock(m_DecisionMutex);
+		m_Decisions.push_back({ connection, accept, std::string(reason) });
+	}
+
+	void AdmissionController::OnConnecting(ISteamNetworkingSockets* networkInterface, const SteamNetConnectionStatusChangedCallback_t& status, uint32_t connectedCount)
+	{
+		HSteamNetConnection connection = status.m_hConn;
+		auto now = std::chrono::steady_clock::now();
+
+		// Cheap rejections first, nothing is allocated for these
+		if (m_Settings.MaxClients > 0 && connectedCount >= m_Settings.MaxClients)
+		{
+			Reject(networkInterface, connection, "Server full", m_RejectedFull);
+			return;
+		}
+
+		if (!ConsumeAddressToken(status.m_info.m_addrRemote, now))
+		{
+			Reject(networkInterface, connection, "Too many connection attempts", m_RejectedRate);
+			return;
+		}
+
+		if (m_Pending.size() >= m_Settings.MaxPendingConnections)
+		{
+			Reject(networkInterface, connection, "Server busy", m_RejectedRate);
+			return;
+		}
+
+		PendingConnection& pending = m_Pending[connection];
+		pending.Deadline = now + m_Settings.PendingTimeout;
+		pending.Approved = !m_ConnectionRequestCallback;
+		m_PendingOrder.push_back(connection);
+		m_PendingCount.store((uint32_t)m_Pending.size(), std::memory_order_relaxed);
+
+		if (m_ConnectionRequestCallback)
+		{
+			ConnectionRequest request;
+			request.Connection = connection;
+			request.Address = status.m_info.m_addrRemote;
+			request.ConnectionDesc = status.m_info.m_szConnectionDescription;
+			m_ConnectionRequestCallback(request);
+		}
+	}
+
+	void AdmissionController::OnClosed(HSteamNetConnection connection)
+	{
+		if (m_Pending.erase(connection))
+		{
+			m_Abandoned.fetch_add(1, std::memory_order_relaxed);
+			m_PendingCount.store((uint32_t)m_Pending.size(), std::memory_order_relaxed);
+		}
+	}
+
+	void AdmissionController::Update(ISteamNetworkingSockets* networkInterface, uint32_t connectedCount, std::vector<HSteamNetConnection>& accepted)
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		{
+			std::scoped_lock lock(m_DecisionMutex);
+			m_ApplyingDecisions.swap(m_Decisions);
+		}
+
+		for (const Decision& decision : m_ApplyingDecisions)
+		{
+			auto it = m_Pending.find(decision.Connection);
+			if (it == m_Pending.end())
+				continue;
+
+			if (decision.Accept)
+				it->second.Approved = true;
+			else
+				Reject(networkInterface, decision.Connection, decision.Reason.empty() ? "Connection refused" : decision.Reason.c_str(), m_RejectedByHook);
+		}
+		m_ApplyingDecisions.clear();
+
+		// Everything has the same timeout, so deadlines are in arrival order
+		while (!m_PendingOrder.empty())
+		{
+			auto it = m_Pending.find(m_PendingOrder.front());
+			if (it != m_Pending.end())
+			{
+				if (it->second.Deadline > now)
+					break;
+
+				Reject(networkInterface, it->first, "Connection attempt timed out", m_TimedOut);
+			}
+			m_PendingOrder.pop_front();
+		}
+
+		// Approved attempts in arrival order, as far as the accept rate allows
+		for (HSteamNetConnection connection : m_PendingOrder)
+		{
+			if (accepted.size() >= m_Settings.MaxAcceptsPerUpdate)
+				break;
+
+			auto it = m_Pending.find(connection);
+			if (it == m_Pending.end() || !it->second.Approved)
+				continue;
+
+			if (m_Settings.MaxClients > 0 && connectedCount + accepted.size() >= m_Settings.MaxClients)
+			{
+				Reject(networkInterface, connection, "Server full", m_RejectedFull);
+				continue;
+			}
+
+			if (!m_AcceptBucket.TryConsume(1.0, now))
+				break;
+
+			m_Pending.erase(it);
+			accepted.push_back(connection);
+		}
+
+		// Entries that were just accepted or rejected are skipped here and popped once they reach the front
+		while (!m_PendingOrder.empty() && !m_Pending.contains(m_PendingOrder.front()))
+			m_PendingOrder.pop_front();
+
+		m_PendingCount.store((uint32_t)m_Pending.size(), std::memory_order_relaxed);
+
+		if (now >= m_NextAddressPrune)
+		{
+			std::erase_if(m_AddressBuckets, [now](const auto& entry) { return entry.second.IsFull(now); });
+			m_NextAddressPrune = now + AddressPruneInterval;
+		}
+	}
+
+	void AdmissionController::Clear(ISteamNetworkingSockets* networkInterface)
+	{
+		for (const auto& [connection, pending] : m_Pending)
+			networkInterface->CloseConnection(connection, k_ESteamNetConnectionEnd_App_Generic, "Server Shutdown", false);
+
+		m_Pending.clear();
+		m_PendingOrder.clear();
+		m_AddressBuckets.clear();
+		m_PendingCount.store(0, std::memory_order_relaxed);
+
+		std::scoped_lock lock(m_DecisionMutex);
+		m_Decisions.clear();
+	}
+
+	AdmissionStats AdmissionController::GetStats() const
+	{
+		AdmissionStats stats;
+		stats.Accepted = m_Accepted.load(std::memory_order_relaxed);
+		stats.RejectedFull = m_RejectedFull.load(std::memory_order_relaxed);
+		stats.RejectedRate = m_RejectedRate.load(std::memory_order_relaxed);
+		stats.RejectedByHook = m_RejectedByHook.load(std::memory_order_relaxed);
+		stats.TimedOut = m_TimedOut.load(std::memory_order_relaxed);
+		stats.Abandoned = m_Abandoned.load(std::memory_order_relaxed);
+		stats.Pending = m_PendingCount.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	void AdmissionController::Reject(ISteamNetworkingSockets* networkInterface, HSteamNetConnection connection, const char* reason, std::atomic<uint64_t>& counter)
+	{
+		networkInterface->CloseConnection(connection, k_ESteamNetConnectionEnd_App_Generic, reason, false);
+		m_Pending.erase(connection);
+		counter.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	bool AdmissionController::ConsumeAddressToken(const SteamNetworkingIPAddr& address, std::chrono::steady_clock::time_point now)
+	{
+		if (m_Settings.ConnectionsPerSecondPerIP <= 0.0)
+			return true;
+
+		// IPv4 addresses are stored IPv4-mapped, so the 16 bytes cover both
+		AddressKey key;
+		std::memcpy(&key.High, address.m_ipv6, sizeof(key.High));
+		std::memcpy(&key.Low, address.m_ipv6 + sizeof(key.High), sizeof(key.Low));
+
+		auto [it, inserted] = m_AddressBuckets.try_emplace(key);
+		if (inserted)
+			it->second.Configure(m_Settings.ConnectionsPerSecondPerIP, m_Settings.ConnectionBurstPerIP, now);
+
+		return it->second.TryConsume(1.0, now);
+	}
+
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "RateLimiter.h"
+
+#include <steam/steamnetworkingsockets.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace Walnut {
+
+	struct AdmissionSettings
+	{
+		// Attempts beyond this many connected clients are rejected right away (0 = only limited by the client table)
+		uint32_t MaxClients = 0;
+
+		// Accepts per second across all clients, attempts above it wait in the pending queue (0 = unlimited)
+		double ConnectionsPerSecond = 0.0;
+		double ConnectionBurst = 64.0;
+
+		// Attempts per second from one IP address, attempts above it are rejected right away (0 = unlimited)
+		double ConnectionsPerSecondPerIP = 0.0;
+		double ConnectionBurstPerIP = 8.0;
+
+		// Attempts waiting for the accept hook or for the accept rate. New attempts are rejected while it's full
+		uint32_t MaxPendingConnections = 4096;
+
+		// Spreads an accept storm over several network thread iterations, so connected clients keep being serviced
+		uint32_t MaxAcceptsPerUpdate = 64;
+
+		// Pending attempts not accepted by then are rejected
+		std::chrono::milliseconds PendingTimeout = std::chrono::milliseconds(5000);
+	};
+
+	struct AdmissionStats
+	{
+		uint64_t Accepted = 0;
+		uint64_t RejectedFull = 0;     // MaxClients reached, or the client table is full
+		uint64_t RejectedRate = 0;     // Per-IP rate exceeded, or the pending queue was full
+		uint64_t RejectedByHook = 0;
+		uint64_t TimedOut = 0;
+		uint64_t Abandoned = 0;        // Closed by the peer while pending
+		uint32_t Pending = 0;          // Waiting right now
+	};
+
+	// A connection attempt waiting for a decision
+	struct ConnectionRequest
+	{
+		HSteamNetConnection Connection = k_HSteamNetConnection_Invalid; // Becomes ClientInfo::ID once accepted
+		SteamNetworkingIPAddr Address;
+		std::string_view ConnectionDesc; // Only valid during the callback
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Admission control
+	// Connection attempts go through a pending queue instead of being accepted as they arrive. Attempts over the client
+	// cap, from an IP address over its rate, or while the queue is full are rejected right away, before the library
+	// sets anything up for them. The rest wait for the optional accept hook and are then accepted at the global
+	// rate, at most MaxAcceptsPerUpdate per network thread iteration, so a reconnect storm after a restart doesn't
+	// stall message processing for clients that are already connected.
+	//
+	// Everything except Resolve is called from the server thread.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class AdmissionController
+	{
+	public:
+		// Called from the server thread for each attempt that passed the fast checks. Decide with Resolve(),
+		// from inside the callback or later from any thread (eg. after an async auth lookup)
+		using ConnectionRequestCallback = std::function<void(const ConnectionRequest& request)>;
+	public:
+		void SetSettings(const AdmissionSettings& settings);
+		const AdmissionSettings& GetSettings() const { return m_Settings; }
+
+		void SetConnectionRequestCallback(const ConnectionRequestCallback& function) { m_ConnectionRequestCallback = function; }
+
+		// Any thread. Unknown or already decided connections are ignored
+		void Resolve(HSteamNetConnection connection, bool accept, std::string_view reason = {});
+
+		// A new attempt, still in the Connecting state
+		void OnConnecting(ISteamNetworkingSockets* networkInterface, const SteamNetConnectionStatusChangedCallback_t& status, uint32_t connectedCount);
+
+		// Closed by the peer (or timed out in the library) before it was accepted
+		void OnClosed(HSteamNetConnection connection);
+
+		// Applies decisions and timeouts, and hands out the attempts to accept this iteration.
+		// The caller accepts them and reports back with OnAccepted/OnAcceptFailed
+		void Update(ISteamNetworkingSockets* networkInterface, uint32_t connectedCount, std::vector<HSteamNetConnection>& accepted);
+
+		void OnAccepted() { m_Accepted.fetch_add(1, std::memory_order_relaxed); }
+		void OnAcceptFailed() { m_RejectedFull.fetch_add(1, std::memory_order_relaxed); }
+
+		// Rejects everything still pending (eg. on shutdown)
+		void Clear(ISteamNetworkingSockets* networkInterface);
+
+		// Any thread
+		AdmissionStats GetStats() const;
+	private:
+		struct PendingConnection
+		{
+			std::chrono::steady_clock::time_point Deadline;
+			bool Approved = false;
+		};
+
+		struct Decision
+		{
+			HSteamNetConnection Connection;
+			bool Accept;
+			std::string Reason;
+		};
+
+		struct AddressKey
+		{
+			uint64_t High, Low;
+			bool operator==(const AddressKey& other) const { return High == other.High && Low == other.Low; }
+		};
+
+		struct AddressKeyHash
+		{
+			size_t operator()(const AddressKey& key) const { return std::hash<uint64_t>()(key.High * 0x9E3779B97F4A7C15ull ^ key.Low); }
+		};
+
+		void Reject(ISteamNetworkingSockets* networkInterface, HSteamNetConnection connection, const char* reason, std::atomic<uint64_t>& counter);
+		bool ConsumeAddressToken(const SteamNetworkingIPAddr& address, std::chrono::steady_clock::time_point now);
+	private:
+		AdmissionSettings m_Settings;
+		ConnectionRequestCallback m_ConnectionRequestCallback;
+
+		// Server thread only
+		std::unordered_map<HSteamNetConnection, PendingConnection> m_Pending;
+		std::deque<HSteamNetConnection> m_PendingOrder; // Arrival order, entries no longer in m_Pending are skipped
+		TokenBucket m_AcceptBucket;
+		std::unordered_map<AddressKey, TokenBucket, AddressKeyHash> m_AddressBuckets;
+		std::chrono::steady_clock::time_point m_NextAddressPrune{};
+
+		std::mutex m_DecisionMutex;
+		std::vector<Decision> m_Decisions;
+		std::vector<Decision> m_ApplyingDecisions;
+
+		std::atomic<uint64_t> m_Accepted = 0;
+		std::atomic<uint64_t> m_RejectedFull = 0;
+		std::atomic<uint64_t> m_RejectedRate = 0;
+		std::atomic<uint64_t> m_RejectedByHook = 0;
+		std::atomic<uint64_t> m_TimedOut = 0;
+		std::atomic<uint64_t> m_Abandoned = 0;
+		std::atomic<uint32_t> m_PendingCount = 0;
+	};
+
+}
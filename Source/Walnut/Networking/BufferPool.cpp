@@ -0,0 +1,151 @@
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <bit>
+#include <new>
+#include <cstring>
+
+namespace Walnut {
+
+	// Sits right before the data, 16 bytes so the data stays 16-byte aligned
+	struct alignas(16) BufferPool::BlockHeader
+	{
+		uint32_t SizeClass;
+		uint32_t Capacity;
+		BlockHeader* Next; // Free list link, only while cached
+
+		void* GetData() { return this + 1; }
+		static BlockHeader* FromData(void* data) { return (BlockHeader*)data - 1; }
+	};
+
+	static constexpr uint32_t HeapSizeClass = UINT32_MAX;
+	static constexpr uint32_t MinCachedBlocks = 4;
+
+	static uint32_t GetSizeClass(uint32_t size)
+	{
+		if (size <= BufferPool::MinBlockSize)
+			return 0;
+
+		return (uint32_t)std::bit_width(size - 1) - (uint32_t)std::countr_zero(BufferPool::MinBlockSize);
+	}
+
+	static_assert((BufferPool::MinBlockSize << (BufferPool::SizeClassCount - 1)) == BufferPool::MaxBlockSize);
+
+	BufferPool& BufferPool::Get()
+	{
+		static BufferPool s_Pool;
+		return s_Pool;
+	}
+
+	BufferPool::~BufferPool()
+	{
+		Trim();
+	}
+
+	void* BufferPool::Allocate(uint32_t size)
+	{
+		m_Allocations.fetch_add(1, std::memory_order_relaxed);
+
+		uint32_t sizeClass = size <= MaxBlockSize ? GetSizeClass(size) : HeapSizeClass;
+		if (sizeClass != HeapSizeClass)
+		{
+			SizeClass& pool = m_SizeClasses[sizeClass];
+			BlockHeader* block = nullptr;
+			{
+				std::scoped_lock lock(pool.Mutex);
+				if (pool.FreeList)
+				{
+					block = pool.FreeList;
+					pool.FreeList = block->Next;
+					pool.CachedCount--;
+				}
+			}
+
+			if (block)
+			{
+				m_PoolHits.fetch_add(1, std::memory_order_relaxed);
+				m_CachedBytes.fetch_sub(block->Capacity, std::memory_order_relaxed);
+				return block->GetData();
+			}
+		}
+
+		m_HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+		uint32_t capacity = sizeClass != HeapSizeClass ? MinBlockSize << sizeClass : size;
+		BlockHeader* block = new (::operator new(sizeof(BlockHeader) + capacity, std::align_val_t(alignof(BlockHeader)))) BlockHeader{ sizeClass, capacity, nullptr };
+		return block->GetData();
+	}
+
+	void BufferPool::Free(void* data)
+	{
+		if (data)
+			Get().FreeBlock(BlockHeader::FromData(data));
+	}
+
+	void BufferPool::FreeBlock(BlockHeader* block)
+	{
+		if (block->SizeClass != HeapSizeClass)
+		{
+			size_t maxCachedBlocks = std::max<size_t>(m_MaxCachedBytes.load(std::memory_order_relaxed) / block->Capacity, MinCachedBlocks);
+
+			SizeClass& pool = m_SizeClasses[block->SizeClass];
+			std::scoped_lock lock(pool.Mutex);
+			if (pool.CachedCount < maxCachedBlocks)
+			{
+				block->Next = pool.FreeList;
+				pool.FreeList = block;
+				pool.CachedCount++;
+				m_CachedBytes.fetch_add(block->Capacity, std::memory_order_relaxed);
+				return;
+			}
+		}
+
+		::operator delete(block, std::align_val_t(alignof(BlockHeader)));
+	}
+
+	PooledBuffer BufferPool::AllocateBuffer(uint32_t size)
+	{
+		return PooledBuffer(Allocate(size), size);
+	}
+
+	PooledBuffer BufferPool::Copy(const Buffer& buffer)
+	{
+		PooledBuffer copy = AllocateBuffer((uint32_t)buffer.Size);
+		if (buffer.Size)
+			memcpy(copy.GetData(), buffer.Data, buffer.Size);
+		return copy;
+	}
+
+	void BufferPool::Trim()
+	{
+		for (SizeClass& pool : m_SizeClasses)
+		{
+			BlockHeader* freeList;
+			{
+				std::scoped_lock lock(pool.Mutex);
+				freeList = pool.FreeList;
+				pool.FreeList = nullptr;
+				pool.CachedCount = 0;
+			}
+
+			while (freeList)
+			{
+				BlockHeader* next = freeList->Next;
+				m_CachedBytes.fetch_sub(freeList->Capacity, std::memory_order_relaxed);
+				::operator delete(freeList, std::align_val_t(alignof(BlockHeader)));
+				freeList = next;
+			}
+		}
+	}
+
+	BufferPoolStats BufferPool::GetStats() const
+	{
+		BufferPoolStats stats;
+		stats.Allocations = m_Allocations.load(std::memory_order_relaxed);
+		stats.PoolHits = m_PoolHits.load(std::memory_order_relaxed);
+		stats.HeapAllocations = m_HeapAllocations.load(std::memory_order_relaxed);
+		stats.CachedBytes = m_CachedBytes.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Walnut/Core/Buffer.h"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+namespace Walnut {
+
+	struct BufferPoolStats
+	{
+		uint64_t Allocations = 0;
+		uint64_t PoolHits = 0;        // Served from a free list
+		uint64_t HeapAllocations = 0; // Free list was empty, or the size was too large to pool
+		uint64_t CachedBytes = 0;     // Held in free lists right now
+	};
+
+	class PooledBuffer;
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Size-class pool for message payloads
+	// Power of two size classes from MinBlockSize to MaxBlockSize, each with its own free list. Once the free lists
+	// have warmed up, allocating and freeing blocks doesn't touch the heap. Larger sizes go straight to the heap.
+	// Any thread. Blocks can be freed from a different thread than the one that allocated them.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class BufferPool
+	{
+	public:
+		static constexpr uint32_t MinBlockSize = 64;
+		static constexpr uint32_t MaxBlockSize = 512 * 1024; // Largest message GameNetworkingSockets sends
+		static constexpr uint32_t SizeClassCount = 14;
+		static constexpr size_t DefaultMaxCachedBytes = 4 * 1024 * 1024;
+	public:
+		static BufferPool& Get();
+
+		BufferPool(const BufferPool&) = delete;
+		BufferPool& operator=(const BufferPool&) = delete;
+
+		// At least size bytes, aligned to 16 bytes. Free with BufferPool::Free
+		void* Allocate(uint32_t size);
+		static void Free(void* data);
+
+		PooledBuffer AllocateBuffer(uint32_t size);
+		PooledBuffer Copy(const Buffer& buffer);
+
+		// Upper bound on the free bytes kept per size class, the rest go back to the heap (at least 4 blocks are kept)
+		void SetMaxCachedBytes(size_t maxCachedBytesPerClass) { m_MaxCachedBytes.store(maxCachedBytesPerClass, std::memory_order_relaxed); }
+
+		// Returns every cached block to the heap
+		void Trim();
+
+		BufferPoolStats GetStats() const;
+	private:
+		BufferPool() = default;
+		~BufferPool();
+
+		struct BlockHeader;
+		void FreeBlock(BlockHeader* block);
+
+		struct SizeClass
+		{
+			std::mutex Mutex;
+			BlockHeader* FreeList = nullptr;
+			uint32_t CachedCount = 0;
+		};
+	private:
+		std::array<SizeClass, SizeClassCount> m_SizeClasses;
+		std::atomic<size_t> m_MaxCachedBytes = DefaultMaxCachedBytes;
+
+		std::atomic<uint64_t> m_Allocations = 0;
+		std::atomic<uint64_t> m_PoolHits = 0;
+		std::atomic<uint64_t> m_HeapAllocations = 0;
+		std::atomic<uint64_t> m_CachedBytes = 0;
+	};
+
+	// Owning handle to a pooled block, returned to the pool when destroyed
+	class PooledBuffer
+	{
+	public:
+		PooledBuffer() = default;
+		PooledBuffer(void* data, uint32_t size)
+			: m_Data(data), m_Size(size) {}
+		~PooledBuffer() { Release(); }
+
+		PooledBuffer(const PooledBuffer&) = delete;
+		PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+		PooledBuffer(PooledBuffer&& other) noexcept
+			: m_Data(other.m_Data), m_Size(other.m_Size)
+		{
+			other.m_Data = nullptr;
+			other.m_Size = 0;
+		}
+
+		PooledBuffer& operator=(PooledBuffer&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Release();
+				m_Data = other.m_Data;
+				m_Size = other.m_Size;
+				other.m_Data = nullptr;
+				other.m_Size = 0;
+			}
+			return *this;
+		}
+
+		void Release()
+		{
+			if (m_Data)
+				BufferPool::Free(m_Data);
+
+			m_Data = nullptr;
+			m_Size = 0;
+		}
+
+		void* GetData() const { return m_Data; }
+		uint32_t GetSize() const { return m_Size; }
+
+		// Non-owning view
+		Buffer GetBuffer() const { return Buffer(m_Data, m_Size); }
+
+		explicit operator bool() const { return m_Data != nullptr; }
+	private:
+		void* m_Data = nullptr;
+		uint32_t m_Size = 0;
+	};
+
+}
@@ -1,18 +1,23 @@
 #include "Client.h"
 
 #include "Walnut/Networking/NetworkingUtils.h"
+#include "Walnut/Networking/ReceivedMessage.h"
+#include "Walnut/Networking/ClientGroup.h"
+#include "Walnut/Networking/DomainNameResolver.h"
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 
 #include <spdlog/spdlog.h>
 
 namespace Walnut {
 
-	// Can only have one server instance per-process
-	static Client* s_Instance = nullptr;
-
 	Client::~Client()
 	{
+		if (m_Group)
+			m_Group->RemoveClient(*this);
+
 		if (m_NetworkThread.joinable())
 			m_NetworkThread.join();
 	}
@@ -22,10 +27,19 @@ namespace Walnut {
 		if (m_Running)
 			return;
 
+		m_ServerAddress = serverAddress;
+
+		// Connection is opened and updated by the group's network thread
+		if (m_Group)
+		{
+			m_ConnectRequested = true;
+			m_Group->Wake();
+			return;
+		}
+
 		if (m_NetworkThread.joinable())
 			m_NetworkThread.join();
 
-		m_ServerAddress = serverAddress;
 		m_NetworkThread = std::thread([this]() { NetworkThreadFunc(); });
 	}
 
@@ -33,6 +47,16 @@ namespace Walnut {
 	{
 		m_Running = false;
 
+		// The group's network thread closes the connection on its next update
+		if (m_Group)
+		{
+			m_ConnectRequested = false;
+			m_Group->Wake();
+			return;
+		}
+
+		m_Scheduler.Wake();
+
 		if (m_NetworkThread.joinable())
 			m_NetworkThread.join();
 	}
@@ -52,28 +76,107 @@ namespace Walnut {
 		m_ServerDisconnectedCallback = function;
 	}
 
+	void Client::SetDataReceivedBatchCallback(const DataReceivedBatchCallback& function)
+	{
+		m_DataReceivedBatchCallback = function;
+	}
+
+	void Client::SetCongestionCallback(const CongestionCallback& function)
+	{
+		m_CongestionCallback = function;
+	}
+
+	void Client::SetReconnectingCallback(const ReconnectingCallback& function)
+	{
+		m_ReconnectingCallback = function;
+	}
+
+	void Client::SetReceiveBatchSize(int batchSize)
+	{
+		m_ReceiveBatchSize = batchSize;
+	}
+
 	void Client::NetworkThreadFunc()
 	{
-		s_Instance = this;
+		if (!OpenConnection())
+			return;
+
+		while (m_Running)
+		{
+			uint32_t activity = Update();
+			m_Scheduler.Wait(activity > 0);
+		}
+
+		CloseConnection();
+	}
 
+	bool Client::OpenConnection()
+	{
 		// Reset connection status
 		m_ConnectionStatus = ConnectionStatus::Connecting;
 
-		SteamDatagramErrMsg errMsg;
-		if (!GameNetworkingSockets_Init(nullptr, errMsg))
+		std::string errorMessage;
+		if (!NetworkingContext::Acquire(errorMessage))
 		{
 			m_ConnectionDebugMessage = "Could not initialize GameNetworkingSockets";
 			m_ConnectionStatus = ConnectionStatus::FailedToConnect;
-			return;
+			return false;
 		}
 
 		// Select instance to use.  For now we'll always use the default.
 		m_Interface = SteamNetworkingSockets();
+		m_InstanceID = NetworkingContext::RegisterInstance();
+		m_Connection = k_HSteamNetConnection_Invalid;
 
 		if (Utils::IsValidIPAddress(m_ServerAddress))
-			m_ServerIPAddress = m_ServerAddress;
+		{
+			if (!ConnectToAddress(m_ServerAddress))
+			{
+				ReleaseNetworkingContext();
+				return false;
+			}
+		}
 		else
-			m_ServerIPAddress = Utils::ResolveDomainName(m_ServerAddress);
+		{
+			// Resolve off the network thread, Update() connects once the result is in
+			auto pendingResolve = std::make_shared<PendingResolve>();
+			pendingResolve->Wake = [this]() { WakeNetworkThread(); };
+			m_PendingResolve = pendingResolve;
+
+			DomainNameResolver::Get().Resolve(m_ServerAddress, [pendingResolve](const std::vector<std::string>& addresses)
+			{
+				std::scoped_lock lock(pendingResolve->Mutex);
+				pendingResolve->Addresses = addresses;
+				pendingResolve->Completed = true;
+				if (pendingResolve->Wake)
+					pendingResolve->Wake();
+			});
+		}
+
+		m_ReceiveBatch.resize(std::max(m_ReceiveBatchSize, 1));
+		m_DispatchBatch.reserve(m_ReceiveBatch.size());
+		m_DispatchTimesReceived.reserve(m_ReceiveBatch.size());
+
+		m_Received.Reset();
+		m_Sent.Reset();
+		m_CallbackMicroseconds = 0;
+		m_Compressor.ResetStats();
+		m_Stats.store(nullptr);
+		m_NextStatsSample = {};
+
+		m_SessionToken = {};
+		m_SessionResumed = false;
+		m_HasConnected = false;
+		m_ReconnectAttempt = 0;
+
+		m_ConnectionOpen = true;
+		m_Running = true;
+		return true;
+	}
+
+	bool Client::ConnectToAddress(const std::string& ipAddress, std::chrono::milliseconds timeout)
+	{
+		m_ServerIPAddress = ipAddress;
 
 		// Start connecting
 		SteamNetworkingIPAddr address;
@@ -82,30 +185,149 @@ namespace Walnut {
 			OnFatalError(fmt::format("Invalid IP address - could not parse {}", m_ServerIPAddress));
 			m_ConnectionDebugMessage = "Invalid IP address";
 			m_ConnectionStatus = ConnectionStatus::FailedToConnect;
-			return;
+			return false;
 		}
 
-		SteamNetworkingConfigValue_t options;
-		options.SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged, (void*)ConnectionStatusChangedCallback);
-		m_Connection = m_Interface->ConnectByIPAddress(address, 1, &options);
+		// User data routes status callbacks for this connection back to us
+		SteamNetworkingConfigValue_t options[3];
+		NetworkingContext::SetConnectionOptions(options, m_InstanceID);
+		int optionCount = 2;
+		if (timeout.count() > 0)
+			options[optionCount++].SetInt32(k_ESteamNetworkingConfig_TimeoutInitial, (int32_t)timeout.count());
+
+		m_Connection = m_Interface->ConnectByIPAddress(address, optionCount, options);
 		if (m_Connection == k_HSteamNetConnection_Invalid)
 		{
 			m_ConnectionDebugMessage = "Failed to create connection";
 			m_ConnectionStatus = ConnectionStatus::FailedToConnect;
-			return;
+			return false;
 		}
 
-		m_Running = true;
-		while (m_Running)
+		// Lanes for what we send, configured before anything can be sent
+		if (!Utils::ConfigureConnectionLanes(m_Interface, m_Connection, m_Lanes))
+			std::cout << "Failed to configure connection lanes" << std::endl;
+
+		return true;
+	}
+
+	bool Client::UpdatePendingResolve()
+	{
+		std::vector<std::string> addresses;
+		{
+			std::scoped_lock lock(m_PendingResolve->Mutex);
+			if (!m_PendingResolve->Completed)
+				return false;
+
+			addresses = std::move(m_PendingResolve->Addresses);
+		}
+		m_PendingResolve.reset();
+
+		if (addresses.empty())
+		{
+			OnFatalError(fmt::format("Could not resolve {}", m_ServerAddress));
+			m_ConnectionDebugMessage = "Could not resolve domain name";
+			m_ConnectionStatus = ConnectionStatus::FailedToConnect;
+			return false;
+		}
+
+		if (!ConnectToAddress(addresses.front()))
+		{
+			m_Running = false;
+			return false;
+		}
+
+		return true;
+	}
+
+	uint32_t Client::Update()
+	{
+		InstrumentationTimer loopTimer(m_Instrumentation, m_Instrumentation.LoopIteration);
+
+		// Nothing to do until the server address is resolved
+		if (m_PendingResolve && !UpdatePendingResolve())
+			return 0;
+
+		// Or until it's time to retry a dropped connection
+		if (m_Connection == k_HSteamNetConnection_Invalid && m_ConnectionStatus == ConnectionStatus::Reconnecting && !UpdateReconnect())
+			return 0;
+
+		uint32_t activity = PollIncomingMessages();
+		if (IsStreamingEnabled())
+			activity += m_Streams.Update(m_Interface);
+		activity += FlushOutboundQueue();
+		PollConnectionStateChanges();
+
+		auto now = std::chrono::steady_clock::now();
+		if (m_CongestionSettings.CheckInterval.count() > 0 && now >= m_NextCongestionCheck)
+			CheckCongestion();
+
+		if (m_StatsInterval.count() > 0 && now >= m_NextStatsSample)
+			SampleStats();
+
+		return activity;
+	}
+
+	void Client::CloseConnection()
+	{
+		// The resolver may still call back, but must not touch us anymore
+		if (m_PendingResolve)
 		{
-			PollIncomingMessages();
-			PollConnectionStateChanges();
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			std::scoped_lock lock(m_PendingResolve->Mutex);
+			m_PendingResolve->Wake = nullptr;
 		}
+		m_PendingResolve.reset();
 
-		m_Interface->CloseConnection(m_Connection, 0, nullptr, false);
-		m_ConnectionStatus = ConnectionStatus::Disconnected;
-		GameNetworkingSockets_Kill();
+		// Streams that haven't finished are failed, the rest of their chunks are never sent
+		m_Streams.Clear();
+
+		// Send anything still queued before closing (the connection lingers to deliver it)
+		FlushOutboundQueue();
+
+		// An application reason code, so the server doesn't keep a session for us
+		m_Interface->CloseConnection(m_Connection, k_ESteamNetConnectionEnd_App_Generic, nullptr, true);
+		if (m_ConnectionStatus != ConnectionStatus::FailedToConnect)
+			m_ConnectionStatus = ConnectionStatus::Disconnected;
+		m_ConnectionOpen = false;
+		m_Congested = false;
+
+		DiscardPendingEvents();
+		ReleaseNetworkingContext();
+	}
+
+	void Client::ReleaseNetworkingContext()
+	{
+		NetworkingContext::UnregisterInstance(m_InstanceID);
+		m_InstanceID = NetworkingContext::InvalidInstanceID;
+		NetworkingContext::Release();
+	}
+
+	uint32_t Client::UpdateFromGroup()
+	{
+		if (m_ConnectRequested.exchange(false))
+			OpenConnection();
+
+		if (!m_ConnectionOpen)
+			return 0;
+
+		if (m_Running)
+			return Update();
+
+		CloseConnection();
+		return 0;
+	}
+
+	void Client::WakeNetworkThread()
+	{
+		// Only worth cutting the wait short when the thread is waiting on activity
+		if (m_Group)
+		{
+			if (m_Group->GetNetworkThreadSettings().Mode == NetworkThreadMode::WaitOnActivity)
+				m_Group->Wake();
+		}
+		else if (m_Scheduler.GetSettings().Mode == NetworkThreadMode::WaitOnActivity)
+		{
+			m_Scheduler.Wake();
+		}
 	}
 
 	void Client::Shutdown()
@@ -113,24 +335,219 @@ namespace Walnut {
 		m_Running = false;
 	}
 
-	void Client::SendBuffer(Buffer buffer, bool reliable)
+	SendResult Client::SendBuffer(const Buffer& buffer, bool reliable, LaneIndex lane)
 	{
+		// Compression adds a trailer, even to payloads it doesn't compress
+		uint32_t maxSize = IsCompressionEnabled() ? PayloadCompressor::GetMaxPayloadSize() : (uint32_t)k_cbMaxSteamNetworkingSocketsMessageSizeSend;
+		if (buffer.Size > maxSize)
+		{
+			std::cout << fmt::format("ERROR: {} byte message is over the {} byte limit, use SendStream", buffer.Size, maxSize) << std::endl;
+			return SendResult::TooLarge;
+		}
+
+		// SendMessageToConnection can only send on lane 0
+		if (IsOutboundQueueEnabled() || IsCompressionEnabled() || lane != 0)
+		{
+			SteamNetworkingMessage_t* message;
+			if (IsCompressionEnabled())
+			{
+				message = m_Compressor.CreateEncodedMessage(buffer.Data, (uint32_t)buffer.Size);
+			}
+			else
+			{
+				message = AllocateMessage((uint32_t)buffer.Size);
+				memcpy(message->m_pData, buffer.Data, buffer.Size);
+			}
+
+			message->m_nFlags = reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable;
+			message->m_idxLane = lane;
+			return SubmitMessage(message);
+		}
+
+		InstrumentationTimer sendTimer(m_Instrumentation, m_Instrumentation.SendCall);
 		EResult result = m_Interface->SendMessageToConnection(m_Connection, buffer.Data, (uint32_t)buffer.Size, reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable, nullptr);
-		// handle result?
+		sendTimer.Stop();
+
+		if (result != k_EResultOK)
+		{
+			m_SendFailures.fetch_add(1, std::memory_order_relaxed);
+			return Utils::ToSendResult(result);
+		}
+
+		m_Sent.AddConcurrent(1, buffer.Size);
+		return SendResult::Sent;
+	}
+
+	SendResult Client::SendString(const std::string& string, bool reliable, LaneIndex lane)
+	{
+		return SendBuffer(Buffer(string.data(), string.size()), reliable, lane);
 	}
 
-	void Client::SendString(const std::string& string, bool reliable)
+	SteamNetworkingMessage_t* Client::AllocateMessage(uint32_t size)
 	{
-		SendBuffer(Buffer(string.data(), string.size()), reliable);
+		return SteamNetworkingUtils()->AllocateMessage((int)size);
 	}
 
-	void Client::PollIncomingMessages()
+	SendResult Client::SendAllocatedMessage(SteamNetworkingMessage_t* message, bool reliable, LaneIndex lane)
 	{
+		message->m_nFlags = reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable;
+		message->m_idxLane = lane;
+		return SubmitMessage(IsCompressionEnabled() ? m_Compressor.EncodeMessage(message) : message);
+	}
+
+	SendResult Client::SendOwnedBuffer(Buffer&& buffer, bool reliable, LaneIndex lane)
+	{
+		SteamNetworkingMessage_t* message = Utils::CreateMessageFromOwnedBuffer(buffer, k_HSteamNetConnection_Invalid, reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable);
+		message->m_idxLane = lane;
+		buffer = Buffer();
+
+		return SubmitMessage(IsCompressionEnabled() ? m_Compressor.EncodeMessage(message) : message);
+	}
+
+	void Client::EnableCompression(const CompressionSettings& settings)
+	{
+		if (m_Running)
+			return;
+
+		m_Compressor.Enable(settings);
+	}
+
+	void Client::EnableReconnect(const ReconnectSettings& settings)
+	{
+		if (m_Running)
+			return;
+
+		m_ReconnectEnabled = true;
+		m_ReconnectSettings = settings;
+	}
+
+	void Client::EnableSessions()
+	{
+		if (m_Running)
+			return;
+
+		m_SessionsEnabled = true;
+	}
+
+	void Client::EnableStreaming(const StreamSettings& settings)
+	{
+		if (m_Running)
+			return;
+
+		m_Streams.Enable(settings, [this](HSteamNetConnection, SteamNetworkingMessage_t* message, LaneIndex lane)
+		{
+			SendAllocatedMessage(message, true, lane);
+		});
+	}
+
+	StreamID Client::SendStream(Buffer&& data, const StreamOptions& options)
+	{
+		if (!IsStreamingEnabled() || m_ConnectionStatus != ConnectionStatus::Connected)
+		{
+			std::cout << "ERROR: SendStream needs EnableStreaming() and a connection" << std::endl;
+			data.Release();
+			return 0;
+		}
+
+		StreamID stream = m_Streams.Send(m_Connection, std::move(data), options);
+		WakeNetworkThread();
+		return stream;
+	}
+
+	void Client::SetLanes(std::span<const LaneConfig> lanes)
+	{
+		if (m_Running)
+			return;
+
+		m_Lanes.assign(lanes.begin(), lanes.end());
+	}
+
+	void Client::EnableOutboundQueue(uint32_t capacity)
+	{
+		if (m_Running)
+			return;
+
+		m_OutboundQueue.Init(capacity);
+	}
+
+	SendResult Client::SubmitMessage(SteamNetworkingMessage_t* message)
+	{
+		uint32_t size = (uint32_t)message->m_cbSize;
+		if (!IsOutboundQueueEnabled())
+		{
+			message->m_conn = m_Connection;
+			InstrumentationTimer sendTimer(m_Instrumentation, m_Instrumentation.SendCall);
+			SendResult result = Utils::SendNetworkMessage(m_Interface, message);
+			sendTimer.Stop();
+
+			if (result == SendResult::Sent)
+				m_Sent.AddConcurrent(1, size);
+			else
+				m_SendFailures.fetch_add(1, std::memory_order_relaxed);
+			return result;
+		}
+
+		if (!m_OutboundQueue.Push(std::move(message)))
+		{
+			// Queue full - drop (counted in the queue stats)
+			message->Release();
+			return SendResult::QueueFull;
+		}
+
+		WakeNetworkThread();
+		return SendResult::Queued;
+	}
+
+	uint32_t Client::FlushOutboundQueue()
+	{
+		if (!IsOutboundQueueEnabled())
+			return 0;
+
+		m_OutboundBatch.clear();
+
+		SteamNetworkingMessage_t* message;
+		while (m_OutboundQueue.Pop(message))
+		{
+			message->m_conn = m_Connection;
+			m_OutboundBatch.push_back(message);
+		}
+
+		if (!m_OutboundBatch.empty())
+		{
+			InstrumentationTimer sendTimer(m_Instrumentation, m_Instrumentation.SendCall);
+			uint64_t sentBytes = 0;
+			uint32_t failures = Utils::SendNetworkMessages(m_Interface, m_OutboundBatch, &sentBytes);
+			sendTimer.Stop();
+
+			// Counted once the library has taken them, not when queued
+			m_Sent.AddConcurrent(m_OutboundBatch.size() - failures, sentBytes);
+			if (failures)
+				m_SendFailures.fetch_add(failures, std::memory_order_relaxed);
+		}
+
+		return (uint32_t)m_OutboundBatch.size();
+	}
+
+	uint32_t Client::PollIncomingMessages()
+	{
+		uint32_t totalMessageCount = 0;
+
 		// Process all messages
 		while (m_Running)
 		{
-			ISteamNetworkingMessage* incomingMessage = nullptr;
-			int messageCount = m_Interface->ReceiveMessagesOnConnection(m_Connection, &incomingMessage, 1);
+			int maxMessages = (int)m_ReceiveBatch.size();
+			if (IsDeferredDispatchEnabled())
+			{
+				// If the application isn't keeping up, leave messages queued in the library
+				if (!FlushPendingOverflow())
+					break;
+
+				maxMessages = std::min(maxMessages, (int)m_PendingEvents.GetFreeSpace());
+				if (maxMessages == 0)
+					break;
+			}
+
+			int messageCount = m_Interface->ReceiveMessagesOnConnection(m_Connection, m_ReceiveBatch.data(), maxMessages);
 			if (messageCount == 0)
 				break;
 
@@ -138,22 +555,307 @@ namespace Walnut {
 			{
 				// messageCount < 0 means critical error?
 				m_Running = false;
-				return;
+				break;
+			}
+
+			// Messages that fail to decode are dropped here
+			if (IsCompressionEnabled())
+			{
+				messageCount = m_Compressor.DecodeReceivedMessages(m_ReceiveBatch.data(), messageCount);
+				if (messageCount == 0)
+					continue;
+			}
+
+			SteamNetworkingMicroseconds now = SteamNetworkingUtils()->GetLocalTimestamp();
+
+			if (IsDeferredDispatchEnabled())
+			{
+				// Messages are released by DispatchPending() once the callback returns
+				for (int i = 0; i < messageCount; i++)
+				{
+					m_DispatchLatency.Record(m_ReceiveBatch[i]->m_usecTimeReceived, now);
+					m_Received.Add(1, m_ReceiveBatch[i]->m_cbSize);
+
+					if (IsSessionsEnabled() && HandleSessionMessage(m_ReceiveBatch[i]))
+					{
+						m_ReceiveBatch[i]->Release();
+						continue;
+					}
+
+					// Stream messages are handled right away, they never reach the application's queue
+					if (IsStreamingEnabled() && m_Streams.HandleReceivedMessage(m_Connection, Buffer(m_ReceiveBatch[i]->m_pData, m_ReceiveBatch[i]->m_cbSize)))
+					{
+						m_ReceiveBatch[i]->Release();
+						continue;
+					}
+
+					PostEvent({ PendingEvent::Type::DataReceived, m_ReceiveBatch[i] });
+				}
+
+				totalMessageCount += messageCount;
+				if (messageCount < maxMessages)
+					break;
+
+				continue;
 			}
 
-			m_DataReceivedCallback(Buffer(incomingMessage->m_pData, incomingMessage->m_cbSize));
+			// Releases the messages when done, unless a callback retained them
+			Utils::ReceivedMessageScope messageScope(std::span(m_ReceiveBatch.data(), messageCount));
+
+			m_DispatchBatch.clear();
+			m_DispatchTimesReceived.clear();
+			for (int i = 0; i < messageCount; i++)
+			{
+				m_DispatchLatency.Record(m_ReceiveBatch[i]->m_usecTimeReceived, now);
+				m_Received.Add(1, m_ReceiveBatch[i]->m_cbSize);
+
+				if (IsSessionsEnabled() && HandleSessionMessage(m_ReceiveBatch[i]))
+					continue;
+
+				Buffer buffer(m_ReceiveBatch[i]->m_pData, m_ReceiveBatch[i]->m_cbSize);
+				if (IsStreamingEnabled() && m_Streams.HandleReceivedMessage(m_Connection, buffer))
+					continue;
+
+				m_DispatchBatch.push_back(buffer);
+				m_DispatchTimesReceived.push_back(m_ReceiveBatch[i]->m_usecTimeReceived);
+			}
 
-			// Release when done
-			incomingMessage->Release();
+			auto callbackStart = std::chrono::steady_clock::now();
+
+			if (m_DataReceivedBatchCallback)
+			{
+				// One callback starts every message in the batch
+				if (m_Instrumentation.IsEnabled())
+				{
+					SteamNetworkingMicroseconds callbackNow = SteamNetworkingUtils()->GetLocalTimestamp();
+					for (SteamNetworkingMicroseconds timeReceived : m_DispatchTimesReceived)
+						m_Instrumentation.RecordReceiveToCallback(timeReceived, callbackNow);
+				}
+
+				InstrumentationTimer callbackTimer(m_Instrumentation, m_Instrumentation.CallbackDuration);
+				m_DataReceivedBatchCallback(m_DispatchBatch);
+			}
+			else if (m_DataReceivedCallback)
+			{
+				for (size_t i = 0; i < m_DispatchBatch.size(); i++)
+				{
+					if (m_Instrumentation.IsEnabled())
+						m_Instrumentation.RecordReceiveToCallback(m_DispatchTimesReceived[i], SteamNetworkingUtils()->GetLocalTimestamp());
+
+					InstrumentationTimer callbackTimer(m_Instrumentation, m_Instrumentation.CallbackDuration);
+					m_DataReceivedCallback(m_DispatchBatch[i]);
+				}
+			}
+
+			auto callbackTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - callbackStart);
+			m_CallbackMicroseconds.fetch_add(callbackTime.count(), std::memory_order_relaxed);
+
+			totalMessageCount += messageCount;
+
+			// Drained everything that was queued
+			if (messageCount < maxMessages)
+				break;
 		}
+
+		return totalMessageCount;
 	}
 
-	void Client::PollConnectionStateChanges()
+	void Client::EnableDeferredDispatch(uint32_t capacity)
+	{
+		if (m_Running)
+			return;
+
+		m_PendingEvents.Init(capacity);
+	}
+
+	void Client::PostEvent(PendingEvent&& event)
+	{
+		// Keep ordering - once something has overflowed, everything goes through the overflow until it drains
+		if (!m_PendingOverflow.empty() || !m_PendingEvents.Push(std::move(event)))
+			m_PendingOverflow.push_back(std::move(event));
+	}
+
+	bool Client::FlushPendingOverflow()
+	{
+		size_t flushed = 0;
+		while (flushed < m_PendingOverflow.size() && m_PendingEvents.Push(std::move(m_PendingOverflow[flushed])))
+			flushed++;
+
+		m_PendingOverflow.erase(m_PendingOverflow.begin(), m_PendingOverflow.begin() + flushed);
+		return m_PendingOverflow.empty();
+	}
+
+	uint32_t Client::DispatchPending(uint32_t maxEvents)
+	{
+		if (!IsDeferredDispatchEnabled())
+			return 0;
+
+		std::scoped_lock lock(m_DispatchMutex);
+
+		uint32_t eventCount = 0;
+		while (eventCount < maxEvents)
+		{
+			PendingEvent* event = m_PendingEvents.Front();
+			if (!event)
+				break;
+
+			switch (event->EventType)
+			{
+				case PendingEvent::Type::DataReceived:
+				{
+					if (m_Instrumentation.IsEnabled())
+						m_Instrumentation.RecordReceiveToCallback(event->Message->m_usecTimeReceived, SteamNetworkingUtils()->GetLocalTimestamp());
+
+					if (m_DataReceivedBatchCallback)
+					{
+						// Released together with the rest of the batch
+						m_DeferredBatch.emplace_back(event->Message->m_pData, event->Message->m_cbSize);
+						m_DeferredMessages.push_back(event->Message);
+						break;
+					}
+
+					// Released as soon as the callback returns, unless it retained the message
+					Utils::ReceivedMessageScope messageScope(std::span(&event->Message, 1));
+					if (m_DataReceivedCallback)
+					{
+						auto callbackStart = std::chrono::steady_clock::now();
+						InstrumentationTimer callbackTimer(m_Instrumentation, m_Instrumentation.CallbackDuration);
+						m_DataReceivedCallback(Buffer(event->Message->m_pData, event->Message->m_cbSize));
+						callbackTimer.Stop();
+						auto callbackTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - callbackStart);
+						m_CallbackMicroseconds.fetch_add(callbackTime.count(), std::memory_order_relaxed);
+					}
+					break;
+				}
+
+				case PendingEvent::Type::ServerConnected:
+				{
+					FlushDeferredBatch();
+
+					if (m_ServerConnectedCallback)
+						m_ServerConnectedCallback();
+					break;
+				}
+
+				default:
+					break;
+			}
+
+			m_PendingEvents.PopFront();
+			eventCount++;
+		}
+
+		FlushDeferredBatch();
+		return eventCount;
+	}
+
+	void Client::FlushDeferredBatch()
+	{
+		if (m_DeferredBatch.empty())
+			return;
+
+		auto callbackStart = std::chrono::steady_clock::now();
+		{
+			Utils::ReceivedMessageScope messageScope(m_DeferredMessages);
+			InstrumentationTimer callbackTimer(m_Instrumentation, m_Instrumentation.CallbackDuration);
+			m_DataReceivedBatchCallback(m_DeferredBatch);
+		}
+		auto callbackTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - callbackStart);
+		m_CallbackMicroseconds.fetch_add(callbackTime.count(), std::memory_order_relaxed);
+
+		m_DeferredBatch.clear();
+		m_DeferredMessages.clear();
+	}
+
+	void Client::DiscardPendingEvents()
+	{
+		// Received messages must go back to the library before it's shut down
+		std::scoped_lock lock(m_DispatchMutex);
+
+		while (PendingEvent* event = m_PendingEvents.Front())
+		{
+			if (event->EventType == PendingEvent::Type::DataReceived)
+				event->Message->Release();
+			m_PendingEvents.PopFront();
+		}
+
+		for (PendingEvent& event : m_PendingOverflow)
+		{
+			if (event.EventType == PendingEvent::Type::DataReceived)
+				event.Message->Release();
+		}
+		m_PendingOverflow.clear();
+	}
+
+	void Client::CheckCongestion()
+	{
+		m_NextCongestionCheck = std::chrono::steady_clock::now() + m_CongestionSettings.CheckInterval;
+
+		FlowControlStatus status;
+		Utils::GetFlowControlStatus(m_Interface, m_Connection, status);
+
+		bool wasCongested = m_Congested;
+		status.Congested = Utils::UpdateCongestionState(wasCongested, status, m_CongestionSettings);
+		if (status.Congested == wasCongested)
+			return;
+
+		m_Congested = status.Congested;
+		if (m_CongestionCallback)
+			m_CongestionCallback(status);
+	}
+
+	FlowControlStatus Client::GetFlowControlStatus() const
 	{
-		m_Interface->RunCallbacks();
+		FlowControlStatus status;
+		if (m_Interface && Utils::GetFlowControlStatus(m_Interface, m_Connection, status))
+			status.Congested = m_Congested;
+		return status;
 	}
 
-	void Client::ConnectionStatusChangedCallback(SteamNetConnectionStatusChangedCallback_t* info) { s_Instance->OnConnectionStatusChanged(info); }
+	void Client::SampleStats()
+	{
+		m_NextStatsSample = std::chrono::steady_clock::now() + m_StatsInterval;
+
+		auto stats = std::make_shared<NetworkStats>();
+		stats->Timestamp = SteamNetworkingUtils()->GetLocalTimestamp();
+		stats->MessagesIn = m_Received.Messages.load(std::memory_order_relaxed);
+		stats->BytesIn = m_Received.Bytes.load(std::memory_order_relaxed);
+		stats->MessagesOut = m_Sent.Messages.load(std::memory_order_relaxed);
+		stats->BytesOut = m_Sent.Bytes.load(std::memory_order_relaxed);
+		stats->CallbackMicroseconds = m_CallbackMicroseconds.load(std::memory_order_relaxed);
+		stats->SendFailures = m_SendFailures.load(std::memory_order_relaxed);
+		if (IsOutboundQueueEnabled())
+			stats->OutboundQueue = m_OutboundQueue.GetStats();
+		stats->DispatchLatency = m_DispatchLatency.GetStats();
+		stats->Compression = m_Compressor.GetStats();
+
+		ConnectionStats connection;
+		if (m_Connection != k_HSteamNetConnection_Invalid && Utils::SampleConnectionStats(m_Interface, m_Connection, connection, (int)m_Lanes.size()))
+		{
+			connection.Description = m_ServerAddress;
+			connection.Congested = m_Congested;
+			connection.MessagesIn = stats->MessagesIn;
+			connection.BytesIn = stats->BytesIn;
+			stats->Connections.push_back(std::move(connection));
+		}
+
+		m_Stats.store(std::move(stats), std::memory_order_release);
+	}
+
+	std::string Client::GetMetricsText(std::string_view prefix) const
+	{
+		std::shared_ptr<const NetworkStats> stats = GetStats();
+		return stats ? Utils::FormatMetricsText(*stats, prefix) : std::string();
+	}
+
+	void Client::PollConnectionStateChanges()
+	{
+		// A group runs library callbacks once per pass for all of its clients
+		if (!m_Group)
+			NetworkingContext::RunCallbacks();
+
+		NetworkingContext::ConsumeConnectionStatusChanges(m_InstanceID, [this](SteamNetConnectionStatusChangedCallback_t* info) { OnConnectionStatusChanged(info); });
+	}
 
 	void Client::OnConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* info)
 	{
@@ -169,6 +871,23 @@ namespace Walnut {
 			case k_ESteamNetworkingConnectionState_ClosedByPeer:
 			case k_ESteamNetworkingConnectionState_ProblemDetectedLocally:
 			{
+				if (CanReconnect(*info))
+				{
+					std::cout << "Lost connection with remote host, reconnecting. " << info->m_info.m_szEndDebug << std::endl;
+					m_ConnectionDebugMessage = info->m_info.m_szEndDebug;
+
+					// Only the connection is replaced, the instance and the resolved address are kept
+					m_Interface->CloseConnection(info->m_hConn, 0, nullptr, false);
+					m_Connection = k_HSteamNetConnection_Invalid;
+					m_Congested = false;
+
+					if (IsStreamingEnabled())
+						m_Streams.RemoveConnection(info->m_hConn);
+
+					ScheduleReconnect();
+					break;
+				}
+
 				m_Running = false;
 				m_ConnectionStatus = ConnectionStatus::FailedToConnect;
 				m_ConnectionDebugMessage = info->m_info.m_szEndDebug;
@@ -198,6 +917,9 @@ namespace Walnut {
 				// so we just pass 0s.
 				m_Interface->CloseConnection(info->m_hConn, 0, nullptr, false);
 				m_Connection = k_HSteamNetConnection_Invalid;
+
+				if (IsStreamingEnabled())
+					m_Streams.RemoveConnection(info->m_hConn);
 				m_ConnectionStatus = ConnectionStatus::Disconnected;
 				break;
 			}
@@ -208,16 +930,97 @@ namespace Walnut {
 				break;
 
 			case k_ESteamNetworkingConnectionState_Connected:
-				m_ConnectionStatus = ConnectionStatus::Connected;
-				if (m_ServerConnectedCallback)
-					m_ServerConnectedCallback();
+			{
+				if (IsSessionsEnabled())
+				{
+					// Connected once the server has answered, see HandleSessionMessage()
+					SessionHelloMessage hello;
+					hello.Token = m_SessionToken;
+					SendTypedMessage(hello);
+					break;
+				}
+
+				OnServerConnected();
 				break;
+			}
 
 			default:
 				break;
 		}
 	}
 
+	void Client::OnServerConnected()
+	{
+		m_ConnectionStatus = ConnectionStatus::Connected;
+		m_HasConnected = true;
+		m_ReconnectAttempt = 0;
+
+		if (IsDeferredDispatchEnabled())
+			PostEvent({ PendingEvent::Type::ServerConnected });
+		else if (m_ServerConnectedCallback)
+			m_ServerConnectedCallback();
+	}
+
+	bool Client::HandleSessionMessage(const ISteamNetworkingMessage* message)
+	{
+		// Only expected once per connection, before anything else
+		if (m_ConnectionStatus == ConnectionStatus::Connected)
+			return false;
+
+		SessionWelcomeMessage welcome;
+		if (!Utils::ReadSessionWelcome(Buffer(message->m_pData, message->m_cbSize), welcome))
+			return false;
+
+		m_SessionToken = welcome.Token;
+		m_SessionResumed = welcome.Resumed != 0;
+		OnServerConnected();
+		return true;
+	}
+
+	bool Client::CanReconnect(const SteamNetConnectionStatusChangedCallback_t& info) const
+	{
+		// Never for the first connection, or once Disconnect() has been called
+		if (!IsReconnectEnabled() || !m_HasConnected || !m_Running)
+			return false;
+
+		if (m_ReconnectSettings.MaxAttempts > 0 && m_ReconnectAttempt >= m_ReconnectSettings.MaxAttempts)
+			return false;
+
+		// Only if it dropped (a timed out attempt counts), never if the server closed or refused it with an application reason
+		return Utils::IsDroppedConnection(info.m_info.m_eEndReason);
+	}
+
+	void Client::ScheduleReconnect()
+	{
+		m_ReconnectAttempt++;
+		std::chrono::milliseconds delay = Utils::GetReconnectDelay(m_ReconnectSettings, m_ReconnectAttempt);
+		m_NextReconnect = std::chrono::steady_clock::now() + delay;
+		m_ConnectionStatus = ConnectionStatus::Reconnecting;
+
+		if (m_ReconnectingCallback)
+			m_ReconnectingCallback(m_ReconnectAttempt, delay);
+	}
+
+	bool Client::UpdateReconnect()
+	{
+		if (std::chrono::steady_clock::now() < m_NextReconnect)
+			return false;
+
+		if (ConnectToAddress(m_ServerIPAddress, m_ReconnectSettings.AttemptTimeout))
+		{
+			m_ConnectionStatus = ConnectionStatus::Reconnecting;
+			return true;
+		}
+
+		// Couldn't even create the connection, counts as a failed attempt
+		if (m_ReconnectSettings.MaxAttempts == 0 || m_ReconnectAttempt < m_ReconnectSettings.MaxAttempts)
+			ScheduleReconnect();
+		else
+			m_Running = false;
+
+		return false;
+	}
+
 	void Client::OnFatalError(const std::string& message)
 	{
 		std::cout << message << std::endl;
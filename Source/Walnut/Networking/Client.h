@@ -2,6 +2,20 @@
 
 #include "Walnut/Core/Buffer.h"
 
+#include "NetworkScheduler.h"
+#include "NetworkingContext.h"
+#include "MPSCQueue.h"
+#include "SPSCQueue.h"
+#include "NetworkStats.h"
+#include "LatencyHistogram.h"
+#include "MessageProtocol.h"
+#include "Lanes.h"
+#include "ReceivedMessage.h"
+#include "BufferPool.h"
+#include "Streaming.h"
+#include "FlowControl.h"
+#include "Sessions.h"
+
 #include <steam/steamnetworkingsockets.h>
 #include <steam/isteamnetworkingutils.h>
 #ifndef STEAMNETWORKINGSOCKETS_OPENSOURCE
@@ -9,50 +23,225 @@
 #endif
 
 #include <string>
+#include <string_view>
 #include <map>
+#include <atomic>
+#include <vector>
+#include <span>
 #include <thread>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <functional>
 
 namespace Walnut {
 
+	class ClientGroup;
+
 	class Client
 	{
 	public:
 		enum class ConnectionStatus
 		{
-			Disconnected = 0, Connected, Connecting, FailedToConnect
+			Disconnected = 0, Connected, Connecting, FailedToConnect, Reconnecting
 		};
 	public:
 		using DataReceivedCallback = std::function<void(const Buffer)>;
 		using ServerConnectedCallback = std::function<void()>;
 		using ServerDisconnectedCallback = std::function<void()>;
+
+		// Called once per receive batch, instead of DataReceivedCallback per message.
+		// Buffers are only valid for the duration of the callback.
+		using DataReceivedBatchCallback = std::function<void(std::span<const Buffer>)>;
+
+		// Called when the connection becomes congested or recovers (FlowControlStatus::Congested)
+		using CongestionCallback = std::function<void(const FlowControlStatus&)>;
+
+		// Called when a dropped connection is about to be retried, attempt is 1 for the first retry
+		using ReconnectingCallback = std::function<void(uint32_t attempt, std::chrono::milliseconds delay)>;
 	public:
 		Client() = default;
 		~Client();
 
+		// Address is an IP address or a domain name, with a port ("host:port").
+		// Domain names are resolved without blocking by DomainNameResolver, the connection is made once resolved.
 		void ConnectToServer(const std::string& serverAddress);
 		void Disconnect();
 
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		// Set callbacks for server events
-		// These callbacks will be called from the network thread
+		// These callbacks will be called from the network thread, or from DispatchPending() if deferred dispatch is enabled
+		// Received buffers are only valid during the callback. To keep one without copying, retain the message
+		// with ReceivedMessage::Retain(buffer), or copy it into a pooled block with BufferPool::Get().Copy(buffer)
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		void SetDataReceivedCallback(const DataReceivedCallback& function);
 		void SetServerConnectedCallback(const ServerConnectedCallback& function);
 		void SetServerDisconnectedCallback(const ServerDisconnectedCallback& function);
+		void SetDataReceivedBatchCallback(const DataReceivedBatchCallback& function);
+
+		// Max number of messages drained from the connection per receive call (default 64)
+		// Must be set before ConnectToServer()
+		void SetReceiveBatchSize(int batchSize);
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Deferred Dispatch
+		// When enabled, the network thread only queues events (received messages are not copied) and callbacks
+		// run inside DispatchPending(), which should be called regularly from a single application thread.
+		// Each message is released as soon as its callback returns. If the application falls behind,
+		// the network thread stops receiving and messages stay queued in the library.
+		// Events that haven't been dispatched by the time the connection is closed are discarded.
+		// Must be enabled before ConnectToServer()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableDeferredDispatch(uint32_t capacity = 8192);
+		bool IsDeferredDispatchEnabled() const { return m_PendingEvents.IsInitialized(); }
+
+		// Returns number of events dispatched
+		uint32_t DispatchPending(uint32_t maxEvents = UINT32_MAX);
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Network thread scheduling
+		// Settings must be set before ConnectToServer()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void SetNetworkThreadSettings(const NetworkThreadSettings& settings) { m_Scheduler.SetSettings(settings); }
+		const NetworkThreadSettings& GetNetworkThreadSettings() const { return m_Scheduler.GetSettings(); }
+		DispatchLatencyStats GetDispatchLatencyStats() const { return m_DispatchLatency.GetStats(); }
+		void ResetDispatchLatencyStats() { m_DispatchLatency.Reset(); }
 
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		// Send Data
+		// The payload is copied, so the buffer can be reused as soon as these return. Returns a SendResult, see FlowControl.h
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		void SendBuffer(Buffer buffer, bool reliable = true);
-		void SendString(const std::string& string, bool reliable = true);
+		SendResult SendBuffer(const Buffer& buffer, bool reliable = true, LaneIndex lane = 0);
+		SendResult SendString(const std::string& string, bool reliable = true, LaneIndex lane = 0);
 
 		template<typename T>
-		void SendData(const T& data, bool reliable = true)
+		SendResult SendData(const T& data, bool reliable = true, LaneIndex lane = 0)
 		{
-			SendBuffer(Buffer(&data, sizeof(T)), reliable);
+			return SendBuffer(Buffer(&data, sizeof(T)), reliable, lane);
 		}
 
+		// Encoded straight into a library message, see MessageProtocol.h
+		template<NetworkMessage T>
+		SendResult SendTypedMessage(const T& message, bool reliable = true, std::span<const std::byte> trailingData = {}, LaneIndex lane = 0)
+		{
+			SteamNetworkingMessage_t* networkMessage = AllocateMessage(GetEncodedMessageSize<T>(trailingData.size()));
+			EncodeMessage(networkMessage->m_pData, message, trailingData);
+			return SendAllocatedMessage(networkMessage, reliable, lane);
+		}
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Zero-copy Send
+		// Either allocate a message and write the payload straight into message->m_pData, or hand over a buffer
+		// allocated with Buffer::Allocate/Buffer::Copy. Ownership passes to the library and the payload is freed once sent.
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		SteamNetworkingMessage_t* AllocateMessage(uint32_t size);
+		SendResult SendAllocatedMessage(SteamNetworkingMessage_t* message, bool reliable = true, LaneIndex lane = 0);
+		SendResult SendOwnedBuffer(Buffer&& buffer, bool reliable = true, LaneIndex lane = 0);
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Lanes
+		// Configures the lanes this client sends on, see Lanes.h. Every Send* function takes a lane index,
+		// and NetworkStats reports the queued bytes of each lane.
+		// Must be set before ConnectToServer()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void SetLanes(std::span<const LaneConfig> lanes);
+		uint32_t GetLaneCount() const { return m_Lanes.empty() ? 1 : (uint32_t)m_Lanes.size(); }
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Flow Control
+		// How much the library has queued for the server and how fast it drains, see FlowControl.h. Any thread.
+		// The network thread checks the connection at CongestionSettings::CheckInterval and calls the congestion
+		// callback (from the network thread) when it becomes congested or recovers.
+		// Settings must be set before ConnectToServer()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		FlowControlStatus GetFlowControlStatus() const;
+		bool IsCongested() const { return m_Congested; }
+
+		void SetCongestionSettings(const CongestionSettings& settings) { m_CongestionSettings = settings; }
+		const CongestionSettings& GetCongestionSettings() const { return m_CongestionSettings; }
+		void SetCongestionCallback(const CongestionCallback& function);
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Outbound Queue
+		// When enabled, all Send* functions can be called from any thread. They only push onto a lock-free queue
+		// which the network thread drains and submits in one SendMessages batch per iteration.
+		// Sends that don't fit in the queue are dropped and counted in QueueStats::TotalRejected.
+		// Must be enabled before ConnectToServer()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableOutboundQueue(uint32_t capacity = 4096);
+		bool IsOutboundQueueEnabled() const { return m_OutboundQueue.IsInitialized(); }
+		QueueStats GetOutboundQueueStats() const { return m_OutboundQueue.GetStats(); }
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Compression
+		// Opt-in payload compression on every send and receive path. The server must enable it with the same settings,
+		// since every payload carries a trailer saying how it was encoded. Payloads below the threshold, or that
+		// don't get smaller, are sent as-is. Ratio and CPU time are reported in NetworkStats::Compression.
+		// Must be enabled before ConnectToServer()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableCompression(const CompressionSettings& settings = {});
+		bool IsCompressionEnabled() const { return m_Compressor.IsEnabled(); }
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Streaming
+		// Sends payloads of any size as paced chunks, see Streaming.h. The server must enable it too.
+		// Stream callbacks are called from the network thread.
+		// Must be enabled before ConnectToServer()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableStreaming(const StreamSettings& settings = {});
+		bool IsStreamingEnabled() const { return m_Streams.IsEnabled(); }
+
+		void SetIncomingStreamCallback(const StreamManager::IncomingStreamCallback& function) { m_Streams.SetIncomingStreamCallback(function); }
+		void SetStreamChunkCallback(const StreamManager::StreamChunkCallback& function) { m_Streams.SetStreamChunkCallback(function); }
+		void SetStreamProgressCallback(const StreamManager::StreamProgressCallback& function) { m_Streams.SetStreamProgressCallback(function); }
+
+		// Any thread. Takes ownership of data (allocated with Buffer::Allocate/Buffer::Copy).
+		// Returns 0 if streaming isn't enabled or the client isn't connected
+		StreamID SendStream(Buffer&& data, const StreamOptions& options = {});
+		void CancelStream(StreamID stream) { m_Streams.Cancel(stream); }
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Reconnect & Sessions
+		// With reconnect enabled, a connection that drops (rather than being closed by the server) is retried with jittered
+		// exponential backoff, see Sessions.h. The status is Reconnecting until it's back, and the connected callback is
+		// called again once it is. The reconnecting callback is called from the network thread.
+		// With sessions enabled (on the server too), the server keeps this client's state while it's away and the connected
+		// callback waits for the server's answer, after which IsSessionResumed() says whether the state was kept.
+		// Must be enabled before ConnectToServer()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableReconnect(const ReconnectSettings& settings = {});
+		bool IsReconnectEnabled() const { return m_ReconnectEnabled; }
+		void SetReconnectingCallback(const ReconnectingCallback& function);
+
+		void EnableSessions();
+		bool IsSessionsEnabled() const { return m_SessionsEnabled; }
+		bool IsSessionResumed() const { return m_SessionResumed; }
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Stats
+		// The network thread samples the connection at the stats interval and publishes an immutable snapshot,
+		// so GetStats() is cheap and can be called from any thread.
+		// Interval must be set before ConnectToServer(), 0 disables sampling
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void SetStatsInterval(std::chrono::milliseconds interval) { m_StatsInterval = interval; }
+		std::chrono::milliseconds GetStatsInterval() const { return m_StatsInterval; }
+
+		// Latest snapshot, nullptr until the first sample
+		std::shared_ptr<const NetworkStats> GetStats() const { return m_Stats.load(std::memory_order_acquire); }
+
+		// Latest snapshot in Prometheus text format
+		std::string GetMetricsText(std::string_view prefix = "walnut_net") const;
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Instrumentation
+		// Hot-path latency histograms, see InstrumentationSnapshot. Off by default, and compiled out entirely
+		// when WL_NETWORK_INSTRUMENTATION is 0 (the default for Dist builds)
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableInstrumentation(bool enabled = true) { m_Instrumentation.SetEnabled(enabled); }
+		bool IsInstrumentationEnabled() const { return m_Instrumentation.IsEnabled(); }
+		InstrumentationSnapshot GetInstrumentationSnapshot() const { return m_Instrumentation.GetSnapshot(); }
+		void ResetInstrumentation() { m_Instrumentation.Reset(); }
+
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		// Connection Status & Debugging
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -64,28 +253,134 @@ namespace Walnut {
 	private:
 		void NetworkThreadFunc();
 		void Shutdown();
+
+		bool OpenConnection();
+		bool ConnectToAddress(const std::string& ipAddress, std::chrono::milliseconds timeout = {});
+		bool UpdatePendingResolve();
+		uint32_t Update();
+		void CloseConnection();
+		void ReleaseNetworkingContext();
+
+		// Called from the network thread of the ClientGroup this client belongs to
+		uint32_t UpdateFromGroup();
+		void WakeNetworkThread();
 	private:
-		static void ConnectionStatusChangedCallback(SteamNetConnectionStatusChangedCallback_t* info);
 		void OnConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* info);
+		void OnServerConnected();
+
+		// Reconnect & Sessions
+		bool HandleSessionMessage(const ISteamNetworkingMessage* message);
+		bool CanReconnect(const SteamNetConnectionStatusChangedCallback_t& info) const;
+		void ScheduleReconnect();
+		bool UpdateReconnect();
 
-		void PollIncomingMessages();
+		uint32_t PollIncomingMessages();
 		void PollConnectionStateChanges();
+		void SampleStats();
+		void CheckCongestion();
+
+		// Deferred dispatch
+		struct PendingEvent;
+		void PostEvent(PendingEvent&& event);
+		bool FlushPendingOverflow();
+		void FlushDeferredBatch();
+		void DiscardPendingEvents();
+
+		// Sends right away, or pushes onto the outbound queue if enabled
+		SendResult SubmitMessage(SteamNetworkingMessage_t* message);
+		uint32_t FlushOutboundQueue();
 
 		void OnFatalError(const std::string& message);
 	private:
 		std::thread m_NetworkThread;
+		NetworkScheduler m_Scheduler;
+		DispatchLatencyCounter m_DispatchLatency; // Written by the network thread
 		DataReceivedCallback m_DataReceivedCallback;
 		ServerConnectedCallback m_ServerConnectedCallback;
 		ServerDisconnectedCallback m_ServerDisconnectedCallback;
+		DataReceivedBatchCallback m_DataReceivedBatchCallback;
+		CongestionCallback m_CongestionCallback;
+		ReconnectingCallback m_ReconnectingCallback;
+
+		int m_ReceiveBatchSize = 64;
+		std::vector<LaneConfig> m_Lanes;
+		std::vector<ISteamNetworkingMessage*> m_ReceiveBatch;
+		std::vector<Buffer> m_DispatchBatch;
+		std::vector<SteamNetworkingMicroseconds> m_DispatchTimesReceived; // Alongside m_DispatchBatch, for instrumentation
 
 		ConnectionStatus m_ConnectionStatus = ConnectionStatus::Disconnected;
 		std::string m_ConnectionDebugMessage;
 
+		struct PendingEvent
+		{
+			enum class Type : uint8_t { None = 0, DataReceived, ServerConnected };
+
+			Type EventType = Type::None;
+			ISteamNetworkingMessage* Message = nullptr;
+		};
+		SPSCQueue<PendingEvent> m_PendingEvents;
+		std::vector<PendingEvent> m_PendingOverflow; // Network thread only
+
+		// Held by DispatchPending(), so the network thread can discard what's left when the connection closes
+		std::mutex m_DispatchMutex;
+
+		// Application thread only
+		std::vector<Buffer> m_DeferredBatch;
+		std::vector<ISteamNetworkingMessage*> m_DeferredMessages;
+
+		// Messages are queued without a connection handle, it's filled in on the network thread
+		MPSCQueue<SteamNetworkingMessage_t*> m_OutboundQueue;
+		std::vector<SteamNetworkingMessage_t*> m_OutboundBatch;
+
+		TrafficCounter m_Received; // Network thread only writes
+		TrafficCounter m_Sent;
+		std::atomic<uint64_t> m_SendFailures = 0;
+		std::atomic<uint64_t> m_CallbackMicroseconds = 0;
+
+		std::chrono::milliseconds m_StatsInterval = DefaultStatsInterval;
+		std::chrono::steady_clock::time_point m_NextStatsSample{};
+		std::atomic<std::shared_ptr<const NetworkStats>> m_Stats;
+
+		CongestionSettings m_CongestionSettings;
+		std::chrono::steady_clock::time_point m_NextCongestionCheck{};
+		std::atomic<bool> m_Congested = false;
+
+		NetworkInstrumentation m_Instrumentation;
+		PayloadCompressor m_Compressor;
+		StreamManager m_Streams;
+
 		std::string m_ServerAddress, m_ServerIPAddress;
-		bool m_Running = false;
+
+		// Reconnect & Sessions, network thread only (except the resumed flag)
+		bool m_ReconnectEnabled = false;
+		ReconnectSettings m_ReconnectSettings;
+		bool m_SessionsEnabled = false;
+		SessionToken m_SessionToken;
+		std::atomic<bool> m_SessionResumed = false;
+		bool m_HasConnected = false;
+		uint32_t m_ReconnectAttempt = 0;
+		std::chrono::steady_clock::time_point m_NextReconnect{};
+
+		// Shared with the resolver callback, which may outlive the connection attempt
+		struct PendingResolve
+		{
+			std::mutex Mutex;
+			bool Completed = false;
+			std::vector<std::string> Addresses;
+			std::function<void()> Wake;
+		};
+		std::shared_ptr<PendingResolve> m_PendingResolve; // Network thread only
+		std::atomic<bool> m_Running = false;
 
 		ISteamNetworkingSockets* m_Interface = nullptr;
+		NetworkingContext::InstanceID m_InstanceID = NetworkingContext::InvalidInstanceID;
 		HSteamNetConnection m_Connection = 0;
+
+		ClientGroup* m_Group = nullptr;
+		std::atomic<bool> m_ConnectRequested = false;
+		bool m_ConnectionOpen = false;
+
+		friend class ClientGroup;
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include "ClientGroup.h"
+
+#include "Client.h"
+#include "NetworkingContext.h"
+
+#include <algorithm>
+
+namespace Walnut {
+
+	// The group whose network thread this is, if any
+	static thread_local const ClientGroup* s_NetworkThreadGroup = nullptr;
+
+	ClientGroup::~ClientGroup()
+	{
+		Stop();
+
+		std::scoped_lock lock(m_ClientsMutex);
+		for (Client* client : m_Clients)
+			client->m_Group = nullptr;
+		m_Clients.clear();
+	}
+
+	void ClientGroup::Start()
+	{
+		if (m_Running)
+			return;
+
+		if (m_NetworkThread.joinable())
+			m_NetworkThread.join();
+
+		m_Running = true;
+		m_NetworkThread = std::thread([this]() { NetworkThreadFunc(); });
+	}
+
+	void ClientGroup::Stop()
+	{
+		m_Running = false;
+		m_Scheduler.Wake();
+
+		if (m_NetworkThread.joinable())
+			m_NetworkThread.join();
+	}
+
+	void ClientGroup::AddClient(Client& client)
+	{
+		// Called from a client callback, the network thread already holds the lock
+		if (IsNetworkThread())
+		{
+			AddClientFromNetworkThread(client);
+			return;
+		}
+
+		std::scoped_lock lock(m_ClientsMutex);
+
+		if (client.m_Group == this)
+			return;
+
+		client.m_Group = this;
+		m_Clients.push_back(&client);
+	}
+
+	void ClientGroup::RemoveClient(Client& client)
+	{
+		if (IsNetworkThread())
+		{
+			RemoveClientFromNetworkThread(client);
+			return;
+		}
+
+		std::scoped_lock lock(m_ClientsMutex);
+
+		auto it = std::find(m_Clients.begin(), m_Clients.end(), &client);
+		if (it == m_Clients.end())
+			return;
+
+		// The network thread isn't touching the client while we hold the lock
+		DetachClient(client);
+		m_Clients.erase(it);
+	}
+
+	bool ClientGroup::IsNetworkThread() const
+	{
+		return s_NetworkThreadGroup == this;
+	}
+
+	void ClientGroup::AddClientFromNetworkThread(Client& client)
+	{
+		// Removed from its own callback and added back before the pass ended - it stays, and
+		// closes its connection on its next update since it's no longer running
+		auto deferred = std::find(m_DeferredCloses.begin(), m_DeferredCloses.end(), &client);
+		if (deferred != m_DeferredCloses.end())
+		{
+			m_DeferredCloses.erase(deferred);
+			m_Clients.push_back(&client);
+			return;
+		}
+
+		if (client.m_Group == this)
+			return;
+
+		// Updated later in the same pass
+		client.m_Group = this;
+		m_Clients.push_back(&client);
+	}
+
+	void ClientGroup::RemoveClientFromNetworkThread(Client& client)
+	{
+		// Removed from its own callback earlier in this pass, and now being destroyed
+		auto deferred = std::find(m_DeferredCloses.begin(), m_DeferredCloses.end(), &client);
+		if (deferred != m_DeferredCloses.end())
+		{
+			m_DeferredCloses.erase(deferred);
+			DetachClient(client);
+			return;
+		}
+
+		auto it = std::find(m_Clients.begin(), m_Clients.end(), &client);
+		if (it == m_Clients.end())
+			return;
+
+		// Erased once the pass is done, so the update loop's position stays valid
+		*it = nullptr;
+
+		// Still in the middle of its own update, so its connection is closed once that returns
+		if (&client == m_UpdatingClient)
+		{
+			client.m_Running = false;
+			client.m_ConnectRequested = false;
+			m_DeferredCloses.push_back(&client);
+			return;
+		}
+
+		DetachClient(client);
+	}
+
+	void ClientGroup::DetachClient(Client& client)
+	{
+		client.m_Running = false;
+		client.m_ConnectRequested = false;
+		if (client.m_ConnectionOpen)
+			client.CloseConnection();
+
+		client.m_Group = nullptr;
+	}
+
+	void ClientGroup::NetworkThreadFunc()
+	{
+		s_NetworkThreadGroup = this;
+
+		while (m_Running)
+		{
+			uint32_t activity = 0;
+			{
+				std::scoped_lock lock(m_ClientsMutex);
+
+				if (!m_Clients.empty())
+					NetworkingContext::RunCallbacks();
+
+				// Callbacks can add and remove clients, so the list can change during the pass
+				for (size_t i = 0; i < m_Clients.size(); i++)
+				{
+					m_UpdatingClient = m_Clients[i];
+					if (m_UpdatingClient)
+						activity += m_UpdatingClient->UpdateFromGroup();
+				}
+				m_UpdatingClient = nullptr;
+
+				std::erase(m_Clients, nullptr);
+
+				for (Client* client : m_DeferredCloses)
+					DetachClient(*client);
+				m_DeferredCloses.clear();
+			}
+
+			m_Scheduler.Wait(activity > 0);
+		}
+
+		// Close everything that's still open
+		std::scoped_lock lock(m_ClientsMutex);
+		for (Client* client : m_Clients)
+		{
+			client->m_Running = false;
+			client->m_ConnectRequested = false;
+			if (client->m_ConnectionOpen)
+				client->CloseConnection();
+		}
+
+		s_NetworkThreadGroup = nullptr;
+	}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "NetworkScheduler.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Walnut {
+
+	class Client;
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Drives many Clients from one shared network thread, instead of a thread per Client.
+	// Clients must be added before calling ConnectToServer() on them. Client callbacks are called
+	// from the group's network thread (or from Client::DispatchPending() if deferred dispatch is enabled).
+	// Callbacks can add, remove and destroy other clients of the group, and remove their own client,
+	// but a client can't be destroyed from its own callbacks.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class ClientGroup
+	{
+	public:
+		ClientGroup() = default;
+		~ClientGroup();
+
+		ClientGroup(const ClientGroup&) = delete;
+		ClientGroup& operator=(const ClientGroup&) = delete;
+
+		void Start();
+		void Stop();
+
+		// Thread-safe. Removing a connected client closes its connection
+		void AddClient(Client& client);
+		void RemoveClient(Client& client);
+
+		// Settings must be set before Start()
+		void SetNetworkThreadSettings(const NetworkThreadSettings& settings) { m_Scheduler.SetSettings(settings); }
+		const NetworkThreadSettings& GetNetworkThreadSettings() const { return m_Scheduler.GetSettings(); }
+
+		// Cut the network thread's current wait short
+		void Wake() { m_Scheduler.Wake(); }
+
+		bool IsRunning() const { return m_Running; }
+	private:
+		void NetworkThreadFunc();
+
+		// Network thread only, while it holds m_ClientsMutex (ie. from client callbacks)
+		bool IsNetworkThread() const;
+		void AddClientFromNetworkThread(Client& client);
+		void RemoveClientFromNetworkThread(Client& client);
+
+		// Takes the client out of the group, closing its connection
+		void DetachClient(Client& client);
+	private:
+		std::thread m_NetworkThread;
+		NetworkScheduler m_Scheduler;
+		std::atomic<bool> m_Running = false;
+
+		// Held by the network thread for a whole update pass. Clients removed during
+		// a pass are set to nullptr and erased once it's done
+		std::mutex m_ClientsMutex;
+		std::vector<Client*> m_Clients;
+
+		// Network thread only
+		Client* m_UpdatingClient = nullptr;
+		std::vector<Client*> m_DeferredCloses; // Removed from their own callbacks
+	};
+
+}
@@ -0,0 +1,139 @@
+#include "ClientRegistry.h"
+
+namespace Walnut {
+
+	ClientRegistry::ClientRegistry()
+		: m_Chunks(std::make_unique<std::atomic<Chunk*>[]>(MaxChunks))
+	{
+		for (uint32_t i = 0; i < MaxChunks; i++)
+			m_Chunks[i].store(nullptr, std::memory_order_relaxed);
+	}
+
+	uint32_t ClientRegistry::Add(ClientID clientID, uint32_t shard, const char* connectionDesc)
+	{
+		uint32_t slot = InvalidSlot;
+		{
+			std::scoped_lock lock(m_FreeSlotsMutex);
+			if (!m_FreeSlots.empty())
+			{
+				slot = m_FreeSlots.back();
+				m_FreeSlots.pop_back();
+			}
+			else if (m_NextSlot < ChunkSize * MaxChunks)
+			{
+				slot = m_NextSlot++;
+			}
+		}
+
+		if (slot == InvalidSlot)
+			return InvalidSlot;
+
+		uint32_t chunkIndex = slot / ChunkSize;
+		Chunk* chunk = m_Chunks[chunkIndex].load(std::memory_order_relaxed);
+		if (!chunk)
+		{
+			m_OwnedChunks.push_back(std::make_unique<Chunk>());
+			chunk = m_OwnedChunks.back().get();
+			m_Chunks[chunkIndex].store(chunk, std::memory_order_release);
+		}
+
+		uint32_t index = slot % ChunkSize;
+		chunk->ConnectionDescs[index] = connectionDesc;
+		chunk->Active[index] = false;
+		chunk->Received[index].Reset();
+		chunk->Congested[index].store(false, std::memory_order_relaxed);
+
+		ClientInfo& client = chunk->Clients[index];
+		client.ID = clientID;
+		client.Slot = slot;
+		client.Shard = shard;
+		client.UserData = nullptr;
+		client.ConnectionDesc = chunk->ConnectionDescs[index];
+
+		// Lookups by ID can see the client from here on
+		chunk->IDs[index].store(clientID, std::memory_order_release);
+
+		std::unique_lock lock(m_Mutex);
+		chunk->ConnectedIndex[index] = (uint32_t)m_Connected.size();
+		m_Connected.push_back(slot);
+		return slot;
+	}
+
+	void ClientRegistry::Remove(uint32_t slot)
+	{
+		std::unique_lock lock(m_Mutex);
+
+		// Swap with the last connected slot
+		uint32_t index = GetChunk(slot).ConnectedIndex[slot % ChunkSize];
+		uint32_t lastSlot = m_Connected.back();
+		m_Connected[index] = lastSlot;
+		GetChunk(lastSlot).ConnectedIndex[lastSlot % ChunkSize] = index;
+		m_Connected.pop_back();
+	}
+
+	void ClientRegistry::CarryCounters(uint32_t fromSlot, uint32_t toSlot)
+	{
+		const TrafficCounter& received = GetReceivedCounter(fromSlot);
+		GetReceivedCounter(toSlot).Add(received.Messages.load(std::memory_order_relaxed), received.Bytes.load(std::memory_order_relaxed));
+
+		const InboundLimitState& fromLimits = GetInboundLimitState(fromSlot);
+		InboundLimitState& toLimits = GetInboundLimitState(toSlot);
+		toLimits.Dropped.Add(fromLimits.Dropped.Messages.load(std::memory_order_relaxed), fromLimits.Dropped.Bytes.load(std::memory_order_relaxed));
+		toLimits.DeferredTotal.fetch_add(fromLimits.DeferredTotal.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+
+	void ClientRegistry::RemoveAll()
+	{
+		std::unique_lock lock(m_Mutex);
+		m_Connected.clear();
+	}
+
+	void ClientRegistry::Release(uint32_t slot)
+	{
+		Chunk& chunk = GetChunk(slot);
+		uint32_t index = slot % ChunkSize;
+
+		// Before anything is reset, so lookups by ID fail from here on
+		chunk.IDs[index].store(0, std::memory_order_release);
+
+		chunk.Clients[index] = ClientInfo();
+		chunk.ConnectionDescs[index].clear();
+		chunk.Active[index] = false;
+
+		std::scoped_lock lock(m_FreeSlotsMutex);
+		m_FreeSlots.push_back(slot);
+	}
+
+	void ClientRegistry::Clear()
+	{
+		std::unique_lock lock(m_Mutex);
+		std::scoped_lock freeSlotsLock(m_FreeSlotsMutex);
+
+		// Keep the chunks around, just reset every slot
+		for (auto& chunk : m_OwnedChunks)
+		{
+			for (uint32_t i = 0; i < ChunkSize; i++)
+			{
+				chunk->IDs[i].store(0, std::memory_order_relaxed);
+				chunk->Clients[i] = ClientInfo();
+				chunk->ConnectionDescs[i].clear();
+				chunk->Active[i] = false;
+			}
+		}
+
+		m_Connected.clear();
+		m_FreeSlots.clear();
+		m_NextSlot = 1;
+	}
+
+	ClientInfo* ClientRegistry::Find(ClientID clientID) const
+	{
+		for (uint32_t slot : m_Connected)
+		{
+			if (GetID(slot) == clientID)
+				return Get(slot);
+		}
+		return nullptr;
+	}
+
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "NetworkStats.h"
+#include "InboundLimits.h"
+
+#include <steam/steamnetworkingtypes.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace Walnut {
+
+	using ClientID = HSteamNetConnection;
+
+	struct ClientInfo
+	{
+		ClientID ID = 0;
+		uint32_t Slot = 0;   // Index in the server's client table, stable while connected
+		uint32_t Shard = 0;
+		void* UserData = nullptr; // Set with Server::SetClientUserData
+		std::string_view ConnectionDesc;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Dense slot table of connected clients
+	//
+	// - Slots live in fixed-size chunks that never move, so ClientInfo references stay valid until the slot is released
+	//   and lookups by slot are safe from any thread
+	// - Hot fields (ClientInfo) are stored contiguously, connection descriptions separately
+	// - Slot 0 is never used, so a connection whose user data hasn't been set yet reads as invalid
+	// - Add/Remove are called by the server thread. Release can be called from any thread once
+	//   nothing refers to the slot anymore (ie. after the disconnect or resumed callback)
+	// - Each slot's ClientID is also kept in an atomic, published once the ClientInfo is filled in and cleared
+	//   before it's reset, which is what lookups from other threads check against
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class ClientRegistry
+	{
+	public:
+		static constexpr uint32_t InvalidSlot = 0;
+		static constexpr uint32_t ChunkSize = 256;
+		static constexpr uint32_t MaxChunks = 4096;
+	private:
+		struct Chunk
+		{
+			ClientInfo Clients[ChunkSize];
+			std::atomic<ClientID> IDs[ChunkSize] = {};
+			uint32_t ConnectedIndex[ChunkSize];
+			bool Active[ChunkSize] = {};
+			TrafficCounter Received[ChunkSize];
+			std::atomic<bool> Congested[ChunkSize] = {};
+			InboundLimitState InboundLimits[ChunkSize];
+			std::string ConnectionDescs[ChunkSize];
+		};
+	public:
+		// Iterates over connected clients
+		class View
+		{
+		public:
+			class Iterator
+			{
+			public:
+				Iterator(const ClientRegistry* registry, const uint32_t* slot)
+					: m_Registry(registry), m_Slot(slot) {}
+
+				const ClientInfo& operator*() const { return *m_Registry->Get(*m_Slot); }
+				const ClientInfo* operator->() const { return m_Registry->Get(*m_Slot); }
+				Iterator& operator++() { m_Slot++; return *this; }
+				bool operator==(const Iterator& other) const { return m_Slot == other.m_Slot; }
+				bool operator!=(const Iterator& other) const { return m_Slot != other.m_Slot; }
+			private:
+				const ClientRegistry* m_Registry;
+				const uint32_t* m_Slot;
+			};
+
+			View(const ClientRegistry* registry)
+				: m_Registry(registry) {}
+
+			Iterator begin() const { return Iterator(m_Registry, m_Registry->m_Connected.data()); }
+			Iterator end() const { return Iterator(m_Registry, m_Registry->m_Connected.data() + m_Registry->m_Connected.size()); }
+			size_t size() const { return m_Registry->m_Connected.size(); }
+			bool empty() const { return m_Registry->m_Connected.empty(); }
+		private:
+			const ClientRegistry* m_Registry;
+		};
+	public:
+		ClientRegistry();
+
+		ClientRegistry(const ClientRegistry&) = delete;
+		ClientRegistry& operator=(const ClientRegistry&) = delete;
+
+		// Server thread. Returns InvalidSlot if the table is full
+		uint32_t Add(ClientID clientID, uint32_t shard, const char* connectionDesc);
+		// Server thread. Takes the client out of the connected set, the slot stays valid until released
+		void Remove(uint32_t slot);
+		// Any thread, once per removed slot
+		void Release(uint32_t slot);
+		// Server thread. Takes every client out of the connected set, slots stay valid
+		void RemoveAll();
+		// Server thread, while nothing else is running. Invalidates every slot
+		void Clear();
+
+		// Any thread. Valid from Add until Release, nullptr for slots that were never allocated
+		ClientInfo* Get(uint32_t slot) const
+		{
+			if (slot == InvalidSlot || slot >= ChunkSize * MaxChunks)
+				return nullptr;
+
+			Chunk* chunk = m_Chunks[slot / ChunkSize].load(std::memory_order_acquire);
+			return chunk ? &chunk->Clients[slot % ChunkSize] : nullptr;
+		}
+
+		// Any thread. The client in the slot, 0 if it's free (or never allocated)
+		ClientID GetID(uint32_t slot) const
+		{
+			if (slot == InvalidSlot || slot >= ChunkSize * MaxChunks)
+				return 0;
+
+			Chunk* chunk = m_Chunks[slot / ChunkSize].load(std::memory_order_acquire);
+			return chunk ? chunk->IDs[slot % ChunkSize].load(std::memory_order_acquire) : 0;
+		}
+
+		// Any thread. Returns nullptr if the slot doesn't hold this client. The ClientInfo is only valid
+		// until the slot is released, so the caller must know the client can't disconnect in the meantime
+		ClientInfo* Get(uint32_t slot, ClientID clientID) const
+		{
+			return clientID != 0 && GetID(slot) == clientID ? Get(slot) : nullptr;
+		}
+
+		// Server thread. Linear search, for when the slot isn't known
+		ClientInfo* Find(ClientID clientID) const;
+
+		// Whether the connect callback has been called for this slot
+		// Only touched by the thread that calls the owning shard's callbacks
+		bool IsActive(uint32_t slot) const { return GetChunk(slot).Active[slot % ChunkSize]; }
+		void SetActive(uint32_t slot, bool active) { GetChunk(slot).Active[slot % ChunkSize] = active; }
+
+		// Written by the owning shard, readable from any thread
+		TrafficCounter& GetReceivedCounter(uint32_t slot) const { return GetChunk(slot).Received[slot % ChunkSize]; }
+
+		// Written by the server thread's congestion check, readable from any thread
+		bool IsCongested(uint32_t slot) const { return GetChunk(slot).Congested[slot % ChunkSize].load(std::memory_order_relaxed); }
+		void SetCongested(uint32_t slot, bool congested) { GetChunk(slot).Congested[slot % ChunkSize].store(congested, std::memory_order_relaxed); }
+
+		// Reset by the server when the client is accepted, then owned by the client's shard (see InboundLimitState)
+		InboundLimitState& GetInboundLimitState(uint32_t slot) const { return GetChunk(slot).InboundLimits[slot % ChunkSize]; }
+
+		// Owning shard. Adds one slot's received and inbound limit counters to another's, for a client that
+		// resumed its session on a new slot
+		void CarryCounters(uint32_t fromSlot, uint32_t toSlot);
+
+		// Server thread. Whether the slot is still in the connected set (ie. hasn't been removed)
+		bool IsConnected(uint32_t slot) const
+		{
+			uint32_t index = GetChunk(slot).ConnectedIndex[slot % ChunkSize];
+			return index < m_Connected.size() && m_Connected[index] == slot;
+		}
+
+		// Server thread only, or while holding GetMutex() shared
+		View GetConnected() const { return View(this); }
+		uint32_t GetConnectedCount() const { return (uint32_t)m_Connected.size(); }
+
+		// Held exclusively by Add/Remove, take it shared to iterate from other threads
+		std::shared_mutex& GetMutex() const { return m_Mutex; }
+	private:
+		Chunk& GetChunk(uint32_t slot) const { return *m_Chunks[slot / ChunkSize].load(std::memory_order_acquire); }
+	private:
+		std::unique_ptr<std::atomic<Chunk*>[]> m_Chunks;
+		std::vector<std::unique_ptr<Chunk>> m_OwnedChunks; // Server thread only
+
+		// Dense list of connected slots
+		std::vector<uint32_t> m_Connected;
+		mutable std::shared_mutex m_Mutex;
+
+		std::mutex m_FreeSlotsMutex;
+		std::vector<uint32_t> m_FreeSlots;
+		uint32_t m_NextSlot = 1;
+	};
+
+}
@@ -0,0 +1,619 @@
+#include "Compression.h"
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <queue>
+#include <unordered_map>
+#include <cstring>
+
+namespace Walnut {
+
+	namespace {
+
+		constexpr uint32_t MinMatch = 4;
+		constexpr uint32_t MaxOffset = 65535;
+		constexpr uint32_t DictionaryHashBits = 12;
+		constexpr uint32_t MaxHashBits = 12;
+		constexpr uint32_t EmptySlot = 0xFFFFFFFF;
+
+		constexpr uint8_t FlagCompressed = 1 << 0;
+		constexpr uint8_t FlagDictionary = 1 << 1;
+
+		// Dictionary training
+		constexpr uint32_t TrainingSegmentSize = 32;
+		constexpr uint32_t TrainingDmerSize = 8;
+
+		uint32_t Read32(const uint8_t* data)
+		{
+			uint32_t value;
+			memcpy(&value, data, sizeof(value));
+			return value;
+		}
+
+		uint32_t Hash(uint32_t value, uint32_t bits)
+		{
+			return (value * 2654435761u) >> (32 - bits);
+		}
+
+		uint32_t CountMatching(const uint8_t* a, const uint8_t* b, const uint8_t* bEnd)
+		{
+			const uint8_t* start = b;
+			while (b < bEnd && *a == *b)
+			{
+				a++;
+				b++;
+			}
+			return (uint32_t)(b - start);
+		}
+
+		// Writes the 255-run continuation of a length field
+		bool WriteLength(uint8_t*& out, const uint8_t* outEnd, uint32_t length)
+		{
+			while (length >= 255)
+			{
+				if (out >= outEnd)
+					return false;
+				*out++ = 255;
+				length -= 255;
+			}
+
+			if (out >= outEnd)
+				return false;
+			*out++ = (uint8_t)length;
+			return true;
+		}
+
+		bool ReadLength(const uint8_t*& in, const uint8_t* inEnd, uint32_t& length)
+		{
+			uint8_t value;
+			do
+			{
+				if (in >= inEnd)
+					return false;
+				value = *in++;
+				length += value;
+			} while (value == 255);
+			return true;
+		}
+
+		bool WriteSequence(uint8_t*& out, const uint8_t* outEnd, const uint8_t* literals, uint32_t literalCount, uint32_t offset, uint32_t matchLength)
+		{
+			if (out >= outEnd)
+				return false;
+
+			uint8_t* token = out++;
+			*token = (uint8_t)(std::min(literalCount, 15u) << 4);
+			if (literalCount >= 15 && !WriteLength(out, outEnd, literalCount - 15))
+				return false;
+
+			if ((size_t)(outEnd - out) < literalCount)
+				return false;
+			// Literals are null for empty input
+			if (literalCount)
+				memcpy(out, literals, literalCount);
+			out += literalCount;
+
+			// Final sequence is literals only
+			if (matchLength == 0)
+				return true;
+
+			if (outEnd - out < 2)
+				return false;
+			*out++ = (uint8_t)(offset & 0xFF);
+			*out++ = (uint8_t)(offset >> 8);
+
+			uint32_t matchCode = matchLength - MinMatch;
+			*token |= (uint8_t)std::min(matchCode, 15u);
+			if (matchCode >= 15 && !WriteLength(out, outEnd, matchCode - 15))
+				return false;
+
+			return true;
+		}
+
+		uint32_t HashDictionaryID(std::span<const std::byte> data)
+		{
+			// FNV-1a
+			uint32_t hash = 2166136261u;
+			for (std::byte b : data)
+			{
+				hash ^= (uint32_t)b;
+				hash *= 16777619u;
+			}
+			return hash;
+		}
+
+		uint64_t ReadDmer(const uint8_t* data)
+		{
+			uint64_t value;
+			memcpy(&value, data, sizeof(value));
+			return value;
+		}
+
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// CompressionDictionary
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	CompressionDictionary::CompressionDictionary(std::vector<std::byte>&& data)
+		: m_Data(std::move(data))
+	{
+		m_ID = HashDictionaryID(m_Data);
+
+		// Later positions overwrite earlier ones, so matches prefer the end of the dictionary (shorter offsets)
+		m_HashTable.assign((size_t)1 << DictionaryHashBits, EmptySlot);
+		const uint8_t* bytes = (const uint8_t*)m_Data.data();
+		for (size_t i = 0; i + MinMatch <= m_Data.size(); i++)
+			m_HashTable[Hash(Read32(bytes + i), DictionaryHashBits)] = (uint32_t)i;
+	}
+
+	std::shared_ptr<const CompressionDictionary> CompressionDictionary::Create(const Buffer& data)
+	{
+		size_t size = std::min((size_t)data.Size, MaxSize);
+		const std::byte* end = (const std::byte*)data.Data + data.Size;
+		std::vector<std::byte> bytes(end - size, end);
+
+		return std::shared_ptr<const CompressionDictionary>(new CompressionDictionary(std::move(bytes)));
+	}
+
+	std::shared_ptr<const CompressionDictionary> CompressionDictionary::Train(std::span<const Buffer> samples, size_t maxSize)
+	{
+		maxSize = std::min(maxSize, MaxSize);
+
+		// Number of samples each dmer (8 byte sequence) appears in
+		std::unordered_map<uint64_t, uint32_t> dmerCounts;
+		std::vector<uint64_t> dmers;
+		for (const Buffer& sample : samples)
+		{
+			if (sample.Size < TrainingDmerSize)
+				continue;
+
+			dmers.clear();
+			const uint8_t* bytes = (const uint8_t*)sample.Data;
+			for (size_t i = 0; i + TrainingDmerSize <= sample.Size; i++)
+				dmers.push_back(ReadDmer(bytes + i));
+
+			std::sort(dmers.begin(), dmers.end());
+			dmers.erase(std::unique(dmers.begin(), dmers.end()), dmers.end());
+			for (uint64_t dmer : dmers)
+				dmerCounts[dmer]++;
+		}
+
+		// Segments are worth the number of samples their (distinct) dmers appear in, ignoring dmers unique to one sample
+		auto scoreSegment = [&dmerCounts](const uint8_t* segment, uint32_t size)
+		{
+			uint64_t segmentDmers[TrainingSegmentSize];
+			uint32_t dmerCount = 0;
+			for (uint32_t i = 0; i + TrainingDmerSize <= size; i++)
+				segmentDmers[dmerCount++] = ReadDmer(segment + i);
+
+			std::sort(segmentDmers, segmentDmers + dmerCount);
+			uint64_t score = 0;
+			for (uint32_t i = 0; i < dmerCount; i++)
+			{
+				if (i > 0 && segmentDmers[i] == segmentDmers[i - 1])
+					continue;
+
+				auto it = dmerCounts.find(segmentDmers[i]);
+				if (it != dmerCounts.end() && it->second > 1)
+					score += it->second;
+			}
+			return score;
+		};
+
+		struct Candidate
+		{
+			uint64_t Score;
+			const uint8_t* Segment;
+			uint32_t Size;
+
+			bool operator<(const Candidate& other) const { return Score < other.Score; }
+		};
+
+		std::priority_queue<Candidate> candidates;
+		for (const Buffer& sample : samples)
+		{
+			const uint8_t* bytes = (const uint8_t*)sample.Data;
+			for (size_t offset = 0; offset + TrainingDmerSize <= sample.Size; offset += TrainingSegmentSize / 2)
+			{
+				uint32_t size = (uint32_t)std::min<size_t>(TrainingSegmentSize, sample.Size - offset);
+				uint64_t score = scoreSegment(bytes + offset, size);
+				if (score > 0)
+					candidates.push({ score, bytes + offset, size });
+			}
+		}
+
+		// Greedy with lazy re-scoring - scores only drop as dmers get covered, so a candidate whose
+		// re-computed score still beats the next best is the best one
+		std::vector<Candidate> selected;
+		size_t totalSize = 0;
+		while (!candidates.empty() && totalSize < maxSize)
+		{
+			Candidate candidate = candidates.top();
+			candidates.pop();
+
+			candidate.Score = scoreSegment(candidate.Segment, candidate.Size);
+			if (candidate.Score == 0)
+				continue;
+
+			if (!candidates.empty() && candidate.Score < candidates.top().Score)
+			{
+				candidates.push(candidate);
+				continue;
+			}
+
+			candidate.Size = (uint32_t)std::min<size_t>(candidate.Size, maxSize - totalSize);
+			selected.push_back(candidate);
+			totalSize += candidate.Size;
+
+			for (uint32_t i = 0; i + TrainingDmerSize <= candidate.Size; i++)
+				dmerCounts.erase(ReadDmer(candidate.Segment + i));
+		}
+
+		// Best segments last, closest to the data being compressed
+		std::vector<std::byte> data;
+		data.reserve(totalSize);
+		for (auto it = selected.rbegin(); it != selected.rend(); it++)
+			data.insert(data.end(), (const std::byte*)it->Segment, (const std::byte*)it->Segment + it->Size);
+
+		return std::shared_ptr<const CompressionDictionary>(new CompressionDictionary(std::move(data)));
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// PayloadCompressor
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void PayloadCompressor::Enable(const CompressionSettings& settings)
+	{
+		m_Settings = settings;
+		m_Enabled = true;
+	}
+
+	uint32_t PayloadCompressor::GetMaxEncodedSize(uint32_t size)
+	{
+		// Compressed payloads are only used if they end up smaller than the raw payload and its flag byte
+		return size + 1;
+	}
+
+	uint32_t PayloadCompressor::GetMaxPayloadSize()
+	{
+		// GetMaxEncodedSize adds a constant amount to any size
+		return (uint32_t)k_cbMaxSteamNetworkingSocketsMessageSizeSend - GetMaxEncodedSize(0);
+	}
+
+	uint32_t PayloadCompressor::Encode(const void* data, uint32_t size, void* destination)
+	{
+		uint8_t* out = (uint8_t*)destination;
+		const CompressionDictionary* dictionary = m_Settings.Dictionary.get();
+		uint32_t trailerSize = dictionary ? 9 : 5;
+
+		if (size >= m_Settings.Threshold && size > trailerSize)
+		{
+			auto start = std::chrono::steady_clock::now();
+			uint32_t compressedSize = Utils::CompressBlock(data, size, out, size - trailerSize, dictionary);
+			m_CompressNanoseconds.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+
+			if (compressedSize > 0)
+			{
+				uint8_t* trailer = out + compressedSize;
+				if (dictionary)
+				{
+					uint32_t dictionaryID = dictionary->GetID();
+					memcpy(trailer, &dictionaryID, sizeof(uint32_t));
+					trailer += sizeof(uint32_t);
+				}
+				memcpy(trailer, &size, sizeof(uint32_t));
+				trailer[sizeof(uint32_t)] = FlagCompressed | (dictionary ? FlagDictionary : 0);
+
+				m_MessagesCompressed.fetch_add(1, std::memory_order_relaxed);
+				m_BytesBeforeCompression.fetch_add(size, std::memory_order_relaxed);
+				m_BytesAfterCompression.fetch_add(compressedSize + trailerSize, std::memory_order_relaxed);
+				return compressedSize + trailerSize;
+			}
+		}
+
+		if (size)
+			memcpy(out, data, size);
+		out[size] = 0;
+		m_MessagesUncompressed.fetch_add(1, std::memory_order_relaxed);
+		return size + 1;
+	}
+
+	SteamNetworkingMessage_t* PayloadCompressor::CreateEncodedMessage(const void* data, uint32_t size)
+	{
+		SteamNetworkingMessage_t* message = SteamNetworkingUtils()->AllocateMessage((int)GetMaxEncodedSize(size));
+		message->m_cbSize = (int)Encode(data, size, message->m_pData);
+		return message;
+	}
+
+	SteamNetworkingMessage_t* PayloadCompressor::EncodeMessage(SteamNetworkingMessage_t* message)
+	{
+		SteamNetworkingMessage_t* encoded = CreateEncodedMessage(message->m_pData, (uint32_t)message->m_cbSize);
+		encoded->m_conn = message->m_conn;
+		encoded->m_nFlags = message->m_nFlags;
+		encoded->m_idxLane = message->m_idxLane;
+		encoded->m_nUserData = message->m_nUserData;
+
+		message->Release();
+		return encoded;
+	}
+
+	Buffer PayloadCompressor::EncodeToBuffer(const Buffer& payload, std::vector<std::byte>& scratch)
+	{
+		scratch.resize(GetMaxEncodedSize((uint32_t)payload.Size));
+		uint32_t size = Encode(payload.Data, (uint32_t)payload.Size, scratch.data());
+		return Buffer(scratch.data(), size);
+	}
+
+	static void FreePooledPayload(SteamNetworkingMessage_t* message)
+	{
+		// Can be called from any GameNetworkingSockets thread
+		BufferPool::Free(message->m_pData);
+	}
+
+	int PayloadCompressor::DecodeReceivedMessages(ISteamNetworkingMessage** messages, int messageCount)
+	{
+		int count = 0;
+		for (int i = 0; i < messageCount; i++)
+		{
+			if (ISteamNetworkingMessage* message = DecodeReceivedMessage(messages[i]))
+				messages[count++] = message;
+		}
+		return count;
+	}
+
+	ISteamNetworkingMessage* PayloadCompressor::DecodeReceivedMessage(ISteamNetworkingMessage* message)
+	{
+		const uint8_t* data = (const uint8_t*)message->m_pData;
+		uint32_t size = (uint32_t)message->m_cbSize;
+
+		auto fail = [this, message]() -> ISteamNetworkingMessage*
+		{
+			m_DecodeErrors.fetch_add(1, std::memory_order_relaxed);
+			message->Release();
+			return nullptr;
+		};
+
+		if (size == 0)
+			return fail();
+
+		uint8_t flags = data[size - 1];
+		if (flags == 0)
+		{
+			// Sent as-is, just drop the flag byte
+			message->m_cbSize--;
+			return message;
+		}
+
+		if ((flags & ~(FlagCompressed | FlagDictionary)) != 0 || !(flags & FlagCompressed))
+			return fail();
+
+		const CompressionDictionary* dictionary = nullptr;
+		uint32_t trailerSize = (flags & FlagDictionary) ? 9 : 5;
+		if (size < trailerSize)
+			return fail();
+
+		uint32_t originalSize;
+		memcpy(&originalSize, data + size - 5, sizeof(uint32_t));
+		if (originalSize > (uint32_t)k_cbMaxSteamNetworkingSocketsMessageSizeSend)
+			return fail();
+
+		if (flags & FlagDictionary)
+		{
+			uint32_t dictionaryID;
+			memcpy(&dictionaryID, data + size - 9, sizeof(uint32_t));
+
+			dictionary = m_Settings.Dictionary.get();
+			if (!dictionary || dictionary->GetID() != dictionaryID)
+				return fail();
+		}
+
+		// Payload comes from the pool, so decompressing doesn't allocate once the pool has warmed up
+		SteamNetworkingMessage_t* decoded = SteamNetworkingUtils()->AllocateMessage(0);
+		decoded->m_pData = BufferPool::Get().Allocate(originalSize);
+		decoded->m_cbSize = (int)originalSize;
+		decoded->m_pfnFreeData = FreePooledPayload;
+
+		auto start = std::chrono::steady_clock::now();
+		bool success = Utils::DecompressBlock(data, size - trailerSize, decoded->m_pData, originalSize, dictionary);
+		m_DecompressNanoseconds.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+
+		if (!success)
+		{
+			decoded->Release();
+			return fail();
+		}
+
+		decoded->m_conn = message->m_conn;
+		decoded->m_identityPeer = message->m_identityPeer;
+		decoded->m_nConnUserData = message->m_nConnUserData;
+		decoded->m_usecTimeReceived = message->m_usecTimeReceived;
+		decoded->m_nMessageNumber = message->m_nMessageNumber;
+		decoded->m_nChannel = message->m_nChannel;
+		decoded->m_nFlags = message->m_nFlags;
+		decoded->m_idxLane = message->m_idxLane;
+
+		m_MessagesDecompressed.fetch_add(1, std::memory_order_relaxed);
+		message->Release();
+		return decoded;
+	}
+
+	CompressionStats PayloadCompressor::GetStats() const
+	{
+		CompressionStats stats;
+		stats.MessagesCompressed = m_MessagesCompressed.load(std::memory_order_relaxed);
+		stats.MessagesUncompressed = m_MessagesUncompressed.load(std::memory_order_relaxed);
+		stats.BytesBeforeCompression = m_BytesBeforeCompression.load(std::memory_order_relaxed);
+		stats.BytesAfterCompression = m_BytesAfterCompression.load(std::memory_order_relaxed);
+		stats.CompressMicroseconds = m_CompressNanoseconds.load(std::memory_order_relaxed) / 1000;
+		stats.MessagesDecompressed = m_MessagesDecompressed.load(std::memory_order_relaxed);
+		stats.DecompressMicroseconds = m_DecompressNanoseconds.load(std::memory_order_relaxed) / 1000;
+		stats.DecodeErrors = m_DecodeErrors.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	void PayloadCompressor::ResetStats()
+	{
+		m_MessagesCompressed = 0;
+		m_MessagesUncompressed = 0;
+		m_BytesBeforeCompression = 0;
+		m_BytesAfterCompression = 0;
+		m_CompressNanoseconds = 0;
+		m_MessagesDecompressed = 0;
+		m_DecompressNanoseconds = 0;
+		m_DecodeErrors = 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Block codec
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	namespace Utils {
+
+		uint32_t GetMaxCompressedSize(uint32_t size)
+		{
+			return size + size / 255 + 16;
+		}
+
+		uint32_t CompressBlock(const void* source, uint32_t sourceSize, void* destination, uint32_t destinationCapacity, const CompressionDictionary* dictionary)
+		{
+			const uint8_t* src = (const uint8_t*)source;
+			uint8_t* out = (uint8_t*)destination;
+			const uint8_t* outEnd = out + destinationCapacity;
+
+			const uint8_t* dict = dictionary ? (const uint8_t*)dictionary->GetData().data() : nullptr;
+			uint32_t dictSize = dictionary ? (uint32_t)dictionary->GetData().size() : 0;
+			const uint32_t* dictTable = dictionary ? dictionary->GetHashTable() : nullptr;
+
+			// Table sized to the input so small messages don't pay for clearing a big one
+			uint32_t hashBits = std::clamp((uint32_t)std::bit_width(sourceSize), 6u, MaxHashBits);
+			uint32_t hashTable[1 << MaxHashBits];
+			std::fill_n(hashTable, (size_t)1 << hashBits, EmptySlot);
+
+			uint32_t anchor = 0;
+			uint32_t position = 0;
+			while (position + MinMatch <= sourceSize)
+			{
+				uint32_t value = Read32(src + position);
+				uint32_t hash = value * 2654435761u;
+				uint32_t* slot = &hashTable[hash >> (32 - hashBits)];
+				uint32_t candidate = *slot;
+				*slot = position;
+
+				uint32_t matchLength = 0;
+				uint32_t offset = 0;
+				if (candidate != EmptySlot && position - candidate <= MaxOffset && Read32(src + candidate) == value)
+				{
+					offset = position - candidate;
+					matchLength = MinMatch + CountMatching(src + candidate + MinMatch, src + position + MinMatch, src + sourceSize);
+				}
+				else if (dictTable)
+				{
+					uint32_t dictPosition = dictTable[hash >> (32 - DictionaryHashBits)];
+					if (dictPosition != EmptySlot && dictSize - dictPosition + position <= MaxOffset && Read32(dict + dictPosition) == value)
+					{
+						offset = dictSize - dictPosition + position;
+
+						// Matches can run off the end of the dictionary and continue into the data
+						uint32_t dictRemaining = dictSize - dictPosition;
+						uint32_t sourceRemaining = sourceSize - position;
+						matchLength = CountMatching(dict + dictPosition, src + position, src + position + std::min(dictRemaining, sourceRemaining));
+						if (matchLength == dictRemaining)
+							matchLength += CountMatching(src, src + position + matchLength, src + sourceSize);
+					}
+				}
+
+				if (matchLength < MinMatch)
+				{
+					// Skip faster through data that isn't compressing
+					position += 1 + ((position - anchor) >> 5);
+					continue;
+				}
+
+				if (!WriteSequence(out, outEnd, src + anchor, position - anchor, offset, matchLength))
+					return 0;
+
+				position += matchLength;
+				anchor = position;
+
+				// Index inside the match too, so the next sequence can find it
+				if (position >= 2 && position - 2 + MinMatch <= sourceSize)
+					hashTable[Hash(Read32(src + position - 2), hashBits)] = position - 2;
+			}
+
+			if (!WriteSequence(out, outEnd, src + anchor, sourceSize - anchor, 0, 0))
+				return 0;
+
+			return (uint32_t)(out - (uint8_t*)destination);
+		}
+
+		bool DecompressBlock(const void* source, uint32_t sourceSize, void* destination, uint32_t destinationSize, const CompressionDictionary* dictionary)
+		{
+			const uint8_t* in = (const uint8_t*)source;
+			const uint8_t* inEnd = in + sourceSize;
+			uint8_t* out = (uint8_t*)destination;
+			uint32_t written = 0;
+
+			const uint8_t* dict = dictionary ? (const uint8_t*)dictionary->GetData().data() : nullptr;
+			uint32_t dictSize = dictionary ? (uint32_t)dictionary->GetData().size() : 0;
+
+			while (true)
+			{
+				if (in >= inEnd)
+					return false;
+
+				uint8_t token = *in++;
+
+				uint32_t literalCount = token >> 4;
+				if (literalCount == 15 && !ReadLength(in, inEnd, literalCount))
+					return false;
+
+				if (literalCount > (uint32_t)(inEnd - in) || literalCount > destinationSize - written)
+					return false;
+
+				// Destination can be null for empty output
+				if (literalCount)
+					memcpy(out + written, in, literalCount);
+				in += literalCount;
+				written += literalCount;
+
+				// Final sequence has no match
+				if (in == inEnd)
+					return written == destinationSize;
+
+				if (inEnd - in < 2)
+					return false;
+
+				uint32_t offset = (uint32_t)in[0] | ((uint32_t)in[1] << 8);
+				in += 2;
+
+				uint32_t matchLength = token & 15;
+				if (matchLength == 15 && !ReadLength(in, inEnd, matchLength))
+					return false;
+				matchLength += MinMatch;
+
+				if (offset == 0 || offset > written + dictSize || matchLength > destinationSize - written)
+					return false;
+
+				if (offset <= written && offset >= matchLength)
+				{
+					memcpy(out + written, out + written - offset, matchLength);
+					written += matchLength;
+					continue;
+				}
+
+				// Overlapping, or starting in the dictionary
+				for (uint32_t i = 0; i < matchLength; i++)
+				{
+					int64_t from = (int64_t)written - (int64_t)offset;
+					out[written] = from >= 0 ? out[from] : dict[dictSize + from];
+					written++;
+				}
+			}
+		}
+
+	}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "Walnut/Core/Buffer.h"
+
+#include <steam/steamnetworkingsockets.h>
+#include <steam/isteamnetworkingutils.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Dictionary for compressing small messages
+	// Compression matches against the dictionary as if it preceded every message, so a dictionary made of typical
+	// message content (keys, common strings) makes even messages of a few dozen bytes compress well.
+	// Both ends must use the exact same dictionary - its ID is a hash of the content, and is checked on receive.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class CompressionDictionary
+	{
+	public:
+		// Matches reach back at most 64KB, so larger dictionaries only use their last 64KB
+		static constexpr size_t MaxSize = 64 * 1024;
+		static constexpr size_t DefaultTrainedSize = 16 * 1024;
+	public:
+		// From previously trained/saved dictionary data
+		static std::shared_ptr<const CompressionDictionary> Create(const Buffer& data);
+
+		// Picks the byte segments shared by the most samples, with the most common ones last (closest to the message)
+		static std::shared_ptr<const CompressionDictionary> Train(std::span<const Buffer> samples, size_t maxSize = DefaultTrainedSize);
+
+		uint32_t GetID() const { return m_ID; }
+		std::span<const std::byte> GetData() const { return m_Data; }
+
+		// Hash table of dictionary positions, used by the compressor
+		const uint32_t* GetHashTable() const { return m_HashTable.data(); }
+	private:
+		CompressionDictionary(std::vector<std::byte>&& data);
+	private:
+		std::vector<std::byte> m_Data;
+		std::vector<uint32_t> m_HashTable;
+		uint32_t m_ID = 0;
+	};
+
+	struct CompressionSettings
+	{
+		// Payloads smaller than this are sent as-is
+		uint32_t Threshold = 64;
+
+		// Optional, must be the same on both ends
+		std::shared_ptr<const CompressionDictionary> Dictionary;
+	};
+
+	struct CompressionStats
+	{
+		// Sending
+		uint64_t MessagesCompressed = 0;
+		uint64_t MessagesUncompressed = 0; // Below the threshold, or didn't get smaller
+		uint64_t BytesBeforeCompression = 0; // Of compressed messages only
+		uint64_t BytesAfterCompression = 0;
+		uint64_t CompressMicroseconds = 0;
+
+		// Receiving
+		uint64_t MessagesDecompressed = 0;
+		uint64_t DecompressMicroseconds = 0;
+		uint64_t DecodeErrors = 0; // Corrupt data or dictionary mismatch, message dropped
+
+		double GetCompressionRatio() const { return BytesAfterCompression ? (double)BytesBeforeCompression / (double)BytesAfterCompression : 1.0; }
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Payload compression for Client/Server
+	// Every payload gets a trailer when compression is enabled, so both ends must enable it:
+	//   [payload][flags]                                      - sent as-is
+	//   [compressed][original size][flags]                    - compressed
+	//   [compressed][dictionary ID][original size][flags]     - compressed with a dictionary
+	// The trailer goes at the end so uncompressed payloads keep the alignment of the received buffer.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class PayloadCompressor
+	{
+	public:
+		void Enable(const CompressionSettings& settings);
+		bool IsEnabled() const { return m_Enabled; }
+		const CompressionSettings& GetSettings() const { return m_Settings; }
+
+		// Encoded size is at most GetMaxEncodedSize(size)
+		static uint32_t GetMaxEncodedSize(uint32_t size);
+
+		// Largest payload whose encoding is guaranteed to fit in one library message
+		static uint32_t GetMaxPayloadSize();
+
+		// Returns the encoded size, destination must have GetMaxEncodedSize(size) bytes. Any thread.
+		uint32_t Encode(const void* data, uint32_t size, void* destination);
+
+		// New library message with the encoded payload. Any thread.
+		SteamNetworkingMessage_t* CreateEncodedMessage(const void* data, uint32_t size);
+
+		// Replaces the message with an encoded copy, keeping its connection, flags and lane
+		SteamNetworkingMessage_t* EncodeMessage(SteamNetworkingMessage_t* message);
+
+		// Encodes into the scratch vector and returns a buffer pointing at it
+		Buffer EncodeToBuffer(const Buffer& payload, std::vector<std::byte>& scratch);
+
+		// Decodes received messages in place, replacing compressed ones with decompressed copies.
+		// Messages that fail to decode are released and removed. Returns the new message count.
+		int DecodeReceivedMessages(ISteamNetworkingMessage** messages, int messageCount);
+
+		CompressionStats GetStats() const;
+		void ResetStats();
+	private:
+		ISteamNetworkingMessage* DecodeReceivedMessage(ISteamNetworkingMessage* message);
+	private:
+		bool m_Enabled = false;
+		CompressionSettings m_Settings;
+
+		std::atomic<uint64_t> m_MessagesCompressed = 0;
+		std::atomic<uint64_t> m_MessagesUncompressed = 0;
+		std::atomic<uint64_t> m_BytesBeforeCompression = 0;
+		std::atomic<uint64_t> m_BytesAfterCompression = 0;
+		std::atomic<uint64_t> m_CompressNanoseconds = 0;
+		std::atomic<uint64_t> m_MessagesDecompressed = 0;
+		std::atomic<uint64_t> m_DecompressNanoseconds = 0;
+		std::atomic<uint64_t> m_DecodeErrors = 0;
+	};
+
+	namespace Utils {
+
+		// LZ77 block codec (LZ4-style sequences of literals and matches with 16-bit offsets).
+		// The dictionary, if any, acts as history preceding the data.
+		uint32_t GetMaxCompressedSize(uint32_t size);
+
+		// Returns the compressed size, or 0 if it didn't fit in destinationCapacity
+		uint32_t CompressBlock(const void* source, uint32_t sourceSize, void* destination, uint32_t destinationCapacity, const CompressionDictionary* dictionary = nullptr);
+
+		// Returns false if the data is corrupt or doesn't decompress to exactly destinationSize bytes
+		bool DecompressBlock(const void* source, uint32_t sourceSize, void* destination, uint32_t destinationSize, const CompressionDictionary* dictionary = nullptr);
+
+	}
+
+}
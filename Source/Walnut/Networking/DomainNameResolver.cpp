@@ -0,0 +1,232 @@
+#include "DomainNameResolver.h"
+
+#include "NetworkingUtils.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+
+namespace Walnut {
+
+	// Domain names are case insensitive, cache keys and hosts file entries are compared in lower case
+	static void ToLower(std::string& string)
+	{
+		std::transform(string.begin(), string.end(), string.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	}
+
+	DomainNameResolver& DomainNameResolver::Get()
+	{
+		static DomainNameResolver s_Resolver;
+		return s_Resolver;
+	}
+
+	DomainNameResolver::~DomainNameResolver()
+	{
+		StopWorkers();
+	}
+
+	void DomainNameResolver::Resolve(std::string_view name, ResolveCallback callback)
+	{
+		std::string host, port;
+		SplitHostAndPort(name, host, port);
+
+		std::unique_lock lock(m_Mutex);
+
+		CacheEntry& entry = m_Cache[host];
+		if (!entry.InFlight && std::chrono::steady_clock::now() < entry.Expiry)
+		{
+			std::vector<std::string> addresses = AppendPort(entry.Addresses, port);
+			lock.unlock();
+
+			callback(addresses);
+			return;
+		}
+
+		entry.Waiting.emplace_back(port, std::move(callback));
+		if (entry.InFlight)
+			return;
+
+		entry.InFlight = true;
+		m_PendingLookups.push_back(host);
+
+		if (m_Workers.empty())
+			StartWorkers();
+
+		m_WorkAvailable.notify_one();
+	}
+
+	bool DomainNameResolver::TryGetCached(std::string_view name, std::vector<std::string>& addresses)
+	{
+		std::string host, port;
+		SplitHostAndPort(name, host, port);
+
+		std::scoped_lock lock(m_Mutex);
+
+		auto it = m_Cache.find(host);
+		if (it == m_Cache.end() || it->second.InFlight || std::chrono::steady_clock::now() >= it->second.Expiry)
+			return false;
+
+		addresses = AppendPort(it->second.Addresses, port);
+		return true;
+	}
+
+	void DomainNameResolver::SetLookupFunction(LookupFunction function)
+	{
+		std::scoped_lock lock(m_Mutex);
+		m_LookupFunction = std::move(function);
+	}
+
+	void DomainNameResolver::SetWorkerCount(uint32_t count)
+	{
+		std::scoped_lock lock(m_Mutex);
+
+		// Takes effect when the workers are started by the first lookup
+		if (m_Workers.empty())
+			m_WorkerCount = std::max(count, 1u);
+	}
+
+	void DomainNameResolver::ClearCache()
+	{
+		std::scoped_lock lock(m_Mutex);
+
+		// Entries with a lookup in flight still have callbacks waiting on them
+		std::erase_if(m_Cache, [](const auto& item) { return !item.second.InFlight; });
+	}
+
+	DomainNameResolver::LookupFunction DomainNameResolver::CreateHostsFileLookup(const std::string& filepath)
+	{
+		return [filepath](const std::string& hostName)
+		{
+			LookupResult result;
+			std::string name = hostName;
+			ToLower(name);
+
+			// Read on every lookup so edits are picked up once cached entries expire
+			std::ifstream stream(filepath);
+			std::string line;
+			while (std::getline(stream, line))
+			{
+				line = line.substr(0, line.find('#'));
+
+				std::istringstream tokens(line);
+				std::string address, alias;
+				if (!(tokens >> address))
+					continue;
+
+				while (tokens >> alias)
+				{
+					ToLower(alias);
+					if (alias == name)
+					{
+						result.Addresses.push_back(address);
+						break;
+					}
+				}
+			}
+
+			std::stable_partition(result.Addresses.begin(), result.Addresses.end(), [](const std::string& address) { return address.find(':') == std::string::npos; });
+			return result;
+		};
+	}
+
+	void DomainNameResolver::SplitHostAndPort(std::string_view name, std::string& host, std::string& port)
+	{
+		// "host:port" or "[IPv6]:port" - a name with several colons and no brackets is all host
+		size_t colon = name.rfind(':');
+		bool hasPort = colon != std::string_view::npos && (name.find(':') == colon || (!name.empty() && name.front() == '[' && colon > 0 && name[colon - 1] == ']'));
+		if (!hasPort)
+		{
+			host = name;
+			port.clear();
+			ToLower(host);
+			return;
+		}
+
+		std::string_view hostPart = name.substr(0, colon);
+		if (hostPart.size() >= 2 && hostPart.front() == '[' && hostPart.back() == ']')
+			hostPart = hostPart.substr(1, hostPart.size() - 2);
+
+		host = hostPart;
+		port = name.substr(colon + 1);
+		ToLower(host);
+	}
+
+	std::vector<std::string> DomainNameResolver::AppendPort(const std::vector<std::string>& addresses, const std::string& port)
+	{
+		if (port.empty())
+			return addresses;
+
+		std::vector<std::string> result;
+		result.reserve(addresses.size());
+		for (const std::string& address : addresses)
+		{
+			bool isIPv6 = address.find(':') != std::string::npos;
+			result.push_back(isIPv6 ? ("[" + address + "]:" + port) : (address + ":" + port));
+		}
+		return result;
+	}
+
+	void DomainNameResolver::StartWorkers()
+	{
+		m_Stopping = false;
+		for (uint32_t i = 0; i < m_WorkerCount; i++)
+			m_Workers.emplace_back([this]() { WorkerThreadFunc(); });
+	}
+
+	void DomainNameResolver::StopWorkers()
+	{
+		std::vector<std::thread> workers;
+		{
+			std::scoped_lock lock(m_Mutex);
+			m_Stopping = true;
+			workers.swap(m_Workers);
+		}
+
+		m_WorkAvailable.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	void DomainNameResolver::WorkerThreadFunc()
+	{
+		std::unique_lock lock(m_Mutex);
+		while (true)
+		{
+			m_WorkAvailable.wait(lock, [this]() { return m_Stopping || !m_PendingLookups.empty(); });
+			if (m_Stopping)
+				return;
+
+			std::string host = std::move(m_PendingLookups.front());
+			m_PendingLookups.pop_front();
+			LookupFunction lookup = m_LookupFunction;
+			lock.unlock();
+
+			LookupResult result;
+			if (lookup)
+				result = lookup(host);
+			else
+				result.Addresses = Utils::LookupHostAddresses(host);
+
+			lock.lock();
+
+			std::chrono::seconds ttl = result.TTL.count() > 0 ? result.TTL : (result.Addresses.empty() ? m_NegativeTTL : m_DefaultTTL);
+
+			CacheEntry& entry = m_Cache[host];
+			entry.Addresses = std::move(result.Addresses);
+			entry.Expiry = std::chrono::steady_clock::now() + ttl;
+			entry.InFlight = false;
+
+			std::vector<std::pair<std::string, ResolveCallback>> waiting;
+			waiting.swap(entry.Waiting);
+			std::vector<std::string> addresses = entry.Addresses;
+			lock.unlock();
+
+			for (auto& [port, callback] : waiting)
+				callback(AppendPort(addresses, port));
+
+			lock.lock();
+		}
+	}
+
+}
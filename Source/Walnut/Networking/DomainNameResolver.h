@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Non-blocking domain name resolution with a TTL cache
+	//
+	// - Lookups run on resolver worker threads, never on a network thread
+	// - Results (including failures) are cached, so reconnect storms after a server restart
+	//   only cost one lookup per name per TTL
+	// - Concurrent requests for a name that is already being looked up join that lookup
+	//   instead of starting another one
+	// - The lookup function can be replaced, e.g. with a hosts file or a stub for testing
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class DomainNameResolver
+	{
+	public:
+		struct LookupResult
+		{
+			std::vector<std::string> Addresses; // IP addresses without port, IPv4 first
+			std::chrono::seconds TTL{ 0 };      // 0 uses the resolver's default (or negative TTL for empty results)
+		};
+
+		// Blocking lookup of a host name (no port), called on a resolver worker thread
+		using LookupFunction = std::function<LookupResult(const std::string& hostName)>;
+
+		// Addresses are in "ip:port" form if the name had a port, empty if resolution failed.
+		// Called on a resolver worker thread, or on the calling thread if the result was cached.
+		using ResolveCallback = std::function<void(const std::vector<std::string>& addresses)>;
+	public:
+		// Process-wide resolver used by Client
+		static DomainNameResolver& Get();
+
+		DomainNameResolver() = default;
+		~DomainNameResolver();
+
+		DomainNameResolver(const DomainNameResolver&) = delete;
+		DomainNameResolver& operator=(const DomainNameResolver&) = delete;
+
+		// Name is "host" or "host:port"
+		void Resolve(std::string_view name, ResolveCallback callback);
+
+		// Returns true and fills in addresses if there's an unexpired cache entry for the name
+		bool TryGetCached(std::string_view name, std::vector<std::string>& addresses);
+
+		// nullptr restores the system resolver (Utils::LookupHostAddresses)
+		void SetLookupFunction(LookupFunction function);
+
+		// Lookup function that answers from a hosts file ("address name [aliases...]" per line)
+		static LookupFunction CreateHostsFileLookup(const std::string& filepath);
+
+		void SetDefaultTTL(std::chrono::seconds ttl) { std::scoped_lock lock(m_Mutex); m_DefaultTTL = ttl; }
+		void SetNegativeTTL(std::chrono::seconds ttl) { std::scoped_lock lock(m_Mutex); m_NegativeTTL = ttl; }
+		void SetWorkerCount(uint32_t count);
+
+		void ClearCache();
+	private:
+		struct CacheEntry
+		{
+			std::vector<std::string> Addresses;
+			std::chrono::steady_clock::time_point Expiry;
+			bool InFlight = false;
+			std::vector<std::pair<std::string, ResolveCallback>> Waiting; // Port and callback
+		};
+
+		static void SplitHostAndPort(std::string_view name, std::string& host, std::string& port);
+		static std::vector<std::string> AppendPort(const std::vector<std::string>& addresses, const std::string& port);
+
+		void StartWorkers();
+		void StopWorkers();
+		void WorkerThreadFunc();
+	private:
+		std::mutex m_Mutex;
+		std::condition_variable m_WorkAvailable;
+		std::deque<std::string> m_PendingLookups;
+		std::unordered_map<std::string, CacheEntry> m_Cache;
+		std::vector<std::thread> m_Workers;
+		uint32_t m_WorkerCount = 2;
+		bool m_Stopping = false;
+
+		LookupFunction m_LookupFunction;
+		std::chrono::seconds m_DefaultTTL{ 60 };
+		std::chrono::seconds m_NegativeTTL{ 5 };
+	};
+
+}
@@ -0,0 +1,91 @@
+#include "FlowControl.h"
+
+#include <algorithm>
+
+namespace Walnut::Utils {
+
+	SendResult ToSendResult(EResult result)
+	{
+		switch (result)
+		{
+			case k_EResultOK:            return SendResult::Sent;
+			case k_EResultLimitExceeded: return SendResult::LimitExceeded;
+			case k_EResultNoConnection:
+			case k_EResultInvalidState:
+			case k_EResultInvalidParam:  return SendResult::NoConnection; // Invalid handle, SendNetworkMessage checks the size
+			default:                     return SendResult::Failed;
+		}
+	}
+
+	SendResult SendNetworkMessage(ISteamNetworkingSockets* networkInterface, SteamNetworkingMessage_t* message)
+	{
+		// The library reports oversized messages the same way as invalid connections
+		bool tooLarge = message->m_cbSize > k_cbMaxSteamNetworkingSocketsMessageSizeSend;
+
+		// Message number on success, negated EResult on failure
+		int64 result = 0;
+		networkInterface->SendMessages(1, &message, &result);
+		if (result >= 0)
+			return SendResult::Sent;
+
+		return tooLarge ? SendResult::TooLarge : ToSendResult((EResult)-result);
+	}
+
+	uint32_t SendNetworkMessages(ISteamNetworkingSockets* networkInterface, std::span<SteamNetworkingMessage_t* const> messages, uint64_t* sentBytes)
+	{
+		// Messages are consumed by SendMessages, sizes have to be read before
+		static thread_local std::vector<uint32_t> s_Sizes;
+		if (sentBytes)
+		{
+			s_Sizes.resize(messages.size());
+			for (size_t i = 0; i < messages.size(); i++)
+				s_Sizes[i] = (uint32_t)messages[i]->m_cbSize;
+		}
+
+		static thread_local std::vector<int64> s_Results;
+		s_Results.resize(messages.size());
+		networkInterface->SendMessages((int)messages.size(), messages.data(), s_Results.data());
+
+		uint32_t failures = 0;
+		uint64_t bytes = 0;
+		for (size_t i = 0; i < messages.size(); i++)
+		{
+			if (s_Results[i] < 0)
+				failures++;
+			else if (sentBytes)
+				bytes += s_Sizes[i];
+		}
+
+		if (sentBytes)
+			*sentBytes = bytes;
+		return failures;
+	}
+
+	bool GetFlowControlStatus(ISteamNetworkingSockets* networkInterface, HSteamNetConnection connection, FlowControlStatus& status)
+	{
+		SteamNetConnectionRealTimeStatus_t realTimeStatus;
+		if (networkInterface->GetConnectionRealTimeStatus(connection, &realTimeStatus, 0, nullptr) != k_EResultOK)
+		{
+			status.Connected = false;
+			return false;
+		}
+
+		status.Connected = realTimeStatus.m_eState == k_ESteamNetworkingConnectionState_Connected;
+		status.SendRateBytesPerSecond = realTimeStatus.m_nSendRateBytesPerSecond;
+		status.PendingReliableBytes = realTimeStatus.m_cbPendingReliable;
+		status.PendingUnreliableBytes = realTimeStatus.m_cbPendingUnreliable;
+		status.SentUnackedReliableBytes = realTimeStatus.m_cbSentUnackedReliable;
+		status.PingMilliseconds = realTimeStatus.m_nPing;
+		status.QueueTime = std::chrono::microseconds(realTimeStatus.m_usecQueueTime);
+		return true;
+	}
+
+	bool UpdateCongestionState(bool congested, const FlowControlStatus& status, const CongestionSettings& settings)
+	{
+		if (!status.Connected)
+			return false;
+
+		return congested ? status.QueueTime >= settings.ClearThreshold : status.QueueTime >= settings.QueueTimeThreshold;
+	}
+
+}
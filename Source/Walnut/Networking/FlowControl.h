@@ -0,0 +1,98 @@
+#pragma once
+
+#include <steam/steamnetworkingsockets.h>
+
+#include <chrono>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Send results and flow control
+	//
+	// Single-recipient sends return a SendResult. Without the outbound queue it comes straight from the library,
+	// with the queue it only says whether the message was queued - failures when the network thread submits it are
+	// counted in NetworkStats::SendFailures.
+	//
+	// FlowControlStatus is what the library has queued for a connection and how fast it can drain it, so callers can
+	// scale back (lower update rate, drop optional data) for connections that can't keep up. The network thread also
+	// checks every connection against CongestionSettings and reports changes through the congestion callback.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	enum class SendResult : uint8_t
+	{
+		Sent = 0,      // Handed to the library
+		Queued,        // Pushed onto the outbound queue, the network thread hands it to the library
+		QueueFull,     // Outbound queue full, dropped
+		LimitExceeded, // The connection's send buffer is full - the peer isn't keeping up
+		NoConnection,  // Invalid or closed connection
+		TooLarge,      // Over the library's message size limit, see SendStream
+		Failed         // Any other library error
+	};
+
+	inline bool IsSendSuccessful(SendResult result)
+	{
+		return result == SendResult::Sent || result == SendResult::Queued;
+	}
+
+	inline const char* SendResultToString(SendResult result)
+	{
+		switch (result)
+		{
+			case SendResult::Sent:          return "Sent";
+			case SendResult::Queued:        return "Queued";
+			case SendResult::QueueFull:     return "QueueFull";
+			case SendResult::LimitExceeded: return "LimitExceeded";
+			case SendResult::NoConnection:  return "NoConnection";
+			case SendResult::TooLarge:      return "TooLarge";
+			case SendResult::Failed:        return "Failed";
+		}
+		return "Unknown";
+	}
+
+	struct FlowControlStatus
+	{
+		bool Connected = false;
+		bool Congested = false; // As of the network thread's last check, see CongestionSettings
+
+		int SendRateBytesPerSecond = 0;   // Estimated bandwidth
+		int PendingReliableBytes = 0;     // Queued, not yet sent
+		int PendingUnreliableBytes = 0;   // Queued, not yet sent
+		int SentUnackedReliableBytes = 0; // Sent, waiting for acknowledgement
+		int PingMilliseconds = -1;
+
+		// How long a message sent now would wait before going on the wire
+		std::chrono::microseconds QueueTime{ 0 };
+	};
+
+	struct CongestionSettings
+	{
+		// A connection is congested once a message sent now would wait this long...
+		std::chrono::milliseconds QueueTimeThreshold{ 100 };
+
+		// ...and stops being congested once it drops back under this, so the callback doesn't flap
+		std::chrono::milliseconds ClearThreshold{ 25 };
+
+		std::chrono::milliseconds CheckInterval{ 50 };
+	};
+
+	namespace Utils {
+
+		SendResult ToSendResult(EResult result);
+
+		// Sends through SendMessages and translates its per-message result. The message is always consumed
+		SendResult SendNetworkMessage(ISteamNetworkingSockets* networkInterface, SteamNetworkingMessage_t* message);
+
+		// Batched version, returns the number of messages the library refused. sentBytes gets the size of the ones it took
+		uint32_t SendNetworkMessages(ISteamNetworkingSockets* networkInterface, std::span<SteamNetworkingMessage_t* const> messages, uint64_t* sentBytes = nullptr);
+
+		// Returns false if the connection is invalid. Congested is left as is
+		bool GetFlowControlStatus(ISteamNetworkingSockets* networkInterface, HSteamNetConnection connection, FlowControlStatus& status);
+
+		// New congestion state given the previous one
+		bool UpdateCongestionState(bool congested, const FlowControlStatus& status, const CongestionSettings& settings);
+
+	}
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "RateLimiter.h"
+#include "NetworkStats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace Walnut {
+
+	enum class InboundLimitPolicy : uint8_t
+	{
+		Drop = 0, // Messages over the limit are dropped
+		Defer,    // Held back (in order) and dispatched on a later tick once the client is under its limit again
+		Kick      // The client is kicked on its first message over the limit
+	};
+
+	struct InboundLimitSettings
+	{
+		// 0 = unlimited. A burst of 0 allows one second's worth
+		double MessagesPerSecond = 0.0;
+		double MessageBurst = 0.0;
+		double BytesPerSecond = 0.0;
+		double ByteBurst = 0.0;
+
+		InboundLimitPolicy Policy = InboundLimitPolicy::Drop;
+
+		// Defer only - messages held back per client, any more are dropped
+		uint32_t MaxDeferredMessages = 1024;
+
+		bool IsEnabled() const { return MessagesPerSecond > 0.0 || BytesPerSecond > 0.0; }
+	};
+
+	struct InboundLimitStats
+	{
+		uint64_t DroppedMessages = 0;
+		uint64_t DroppedBytes = 0;
+		uint64_t DeferredMessages = 0; // Total held back, each is counted once
+		bool Kicked = false;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Inbound limits
+	// Per-client token buckets checked by the client's shard before anything is dispatched, so a client flooding the
+	// server costs a bucket check per message rather than a callback. A message has to fit in both buckets; one that's
+	// larger than the byte burst is let through whenever the byte bucket is full, so it can't be stuck forever.
+	//
+	// Buckets and Deferred are only touched by the owning shard, the counters can be read from any thread.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	struct InboundLimitState
+	{
+		TokenBucket Messages;
+		TokenBucket Bytes;
+		uint32_t Deferred = 0;    // Messages currently held back
+		uint32_t BlockedPass = 0; // Last deferred pass that couldn't dispatch for this client
+
+		TrafficCounter Dropped;
+		std::atomic<uint64_t> DeferredTotal = 0;
+		std::atomic<bool> Kicked = false;
+
+		void Reset(const InboundLimitSettings& settings, TokenBucket::Clock::time_point now)
+		{
+			Messages.Configure(settings.MessagesPerSecond, settings.MessageBurst > 0.0 ? settings.MessageBurst : settings.MessagesPerSecond, now);
+			Bytes.Configure(settings.BytesPerSecond, settings.ByteBurst > 0.0 ? settings.ByteBurst : settings.BytesPerSecond, now);
+			Deferred = 0;
+			BlockedPass = 0;
+
+			Dropped.Reset();
+			DeferredTotal.store(0, std::memory_order_relaxed);
+			Kicked.store(false, std::memory_order_relaxed);
+		}
+
+		bool TryConsume(uint32_t size, TokenBucket::Clock::time_point now)
+		{
+			double bytes = std::min((double)size, Bytes.GetBurst());
+			if (!Messages.CanConsume(1.0, now) || !Bytes.CanConsume(bytes, now))
+				return false;
+
+			Messages.TryConsume(1.0, now);
+			Bytes.TryConsume(bytes, now);
+			return true;
+		}
+
+		InboundLimitStats GetStats() const
+		{
+			InboundLimitStats stats;
+			stats.DroppedMessages = Dropped.Messages.load(std::memory_order_relaxed);
+			stats.DroppedBytes = Dropped.Bytes.load(std::memory_order_relaxed);
+			stats.DeferredMessages = DeferredTotal.load(std::memory_order_relaxed);
+			stats.Kicked = Kicked.load(std::memory_order_relaxed);
+			return stats;
+		}
+	};
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <steam/steamnetworkingsockets.h>
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Lanes
+	// Each lane of a connection is its own ordered stream, so a large reliable transfer on one lane doesn't hold up
+	// small messages on another. Lanes only describe how each end sends - the receiving end sees one stream of
+	// messages regardless - so Client and Server configure their lanes independently.
+	//
+	// Lower priority values are sent first. Lanes with the same priority share the bandwidth by weight.
+	// Sending on a lane that hasn't been configured fails, and lane 0 always exists.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	using LaneIndex = uint16_t;
+
+	struct LaneConfig
+	{
+		int Priority = 0;
+		uint16_t Weight = 1;
+	};
+
+	struct LaneStats
+	{
+		int PendingUnreliableBytes = 0;
+		int PendingReliableBytes = 0;
+		int SentUnackedReliableBytes = 0;
+		SteamNetworkingMicroseconds QueueTimeMicroseconds = 0; // Expected wait for a message sent on this lane now
+	};
+
+	namespace Utils {
+
+		inline bool ConfigureConnectionLanes(ISteamNetworkingSockets* networkInterface, HSteamNetConnection connection, std::span<const LaneConfig> lanes)
+		{
+			if (lanes.empty())
+				return true;
+
+			std::vector<int> priorities(lanes.size());
+			std::vector<uint16> weights(lanes.size());
+			for (size_t i = 0; i < lanes.size(); i++)
+			{
+				priorities[i] = lanes[i].Priority;
+				weights[i] = lanes[i].Weight;
+			}
+
+			return networkInterface->ConfigureConnectionLanes(connection, (int)lanes.size(), priorities.data(), weights.data()) == k_EResultOK;
+		}
+
+	}
+
+}
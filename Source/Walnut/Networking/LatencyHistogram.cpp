@@ -0,0 +1,79 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+namespace Walnut {
+
+	uint32_t LatencyHistogram::GetBucketIndex(uint64_t value)
+	{
+		if (value < SubBucketCount)
+			return (uint32_t)value;
+
+		uint32_t exponent = std::min((uint32_t)std::bit_width(value) - 1, MaxExponent);
+		if (exponent == MaxExponent)
+			return BucketCount - 1;
+
+		// Top SubBucketBits bits below the leading one pick the sub-bucket
+		uint32_t subBucket = (uint32_t)(value >> (exponent - SubBucketBits)) & (SubBucketCount - 1);
+		return (exponent - SubBucketBits + 1) * SubBucketCount + subBucket;
+	}
+
+	uint64_t LatencyHistogram::GetBucketUpperBound(uint32_t index)
+	{
+		if (index < SubBucketCount)
+			return index;
+
+		uint32_t exponent = index / SubBucketCount + SubBucketBits - 1;
+		uint64_t subBucket = index % SubBucketCount;
+		uint64_t lowerBound = ((uint64_t)1 << exponent) | (subBucket << (exponent - SubBucketBits));
+		return lowerBound + ((uint64_t)1 << (exponent - SubBucketBits)) - 1;
+	}
+
+	void LatencyHistogram::Reset()
+	{
+		for (std::atomic<uint64_t>& bucket : m_Buckets)
+			bucket.store(0, std::memory_order_relaxed);
+
+		m_Sum.store(0, std::memory_order_relaxed);
+		m_Min.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+		m_Max.store(0, std::memory_order_relaxed);
+	}
+
+	HistogramSnapshot LatencyHistogram::GetSnapshot() const
+	{
+		HistogramSnapshot snapshot;
+		snapshot.Buckets.resize(BucketCount);
+		for (uint32_t i = 0; i < BucketCount; i++)
+		{
+			snapshot.Buckets[i] = m_Buckets[i].load(std::memory_order_relaxed);
+			snapshot.Count += snapshot.Buckets[i];
+		}
+
+		snapshot.Sum = m_Sum.load(std::memory_order_relaxed);
+		snapshot.Min = snapshot.Count ? m_Min.load(std::memory_order_relaxed) : 0;
+		snapshot.Max = m_Max.load(std::memory_order_relaxed);
+		return snapshot;
+	}
+
+	uint64_t HistogramSnapshot::GetValueAtPercentile(double percentile) const
+	{
+		if (Count == 0)
+			return 0;
+
+		uint64_t target = (uint64_t)(std::clamp(percentile, 0.0, 100.0) / 100.0 * (double)Count + 0.5);
+		target = std::clamp<uint64_t>(target, 1, Count);
+
+		uint64_t seen = 0;
+		for (uint32_t i = 0; i < (uint32_t)Buckets.size(); i++)
+		{
+			seen += Buckets[i];
+			if (seen >= target)
+				return std::min(LatencyHistogram::GetBucketUpperBound(i), Max);
+		}
+
+		return Max;
+	}
+
+}
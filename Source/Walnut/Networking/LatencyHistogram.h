@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+// Hot-path instrumentation is compiled out of Dist builds unless explicitly enabled
+#ifndef WL_NETWORK_INSTRUMENTATION
+	#ifdef WL_DIST
+		#define WL_NETWORK_INSTRUMENTATION 0
+	#else
+		#define WL_NETWORK_INSTRUMENTATION 1
+	#endif
+#endif
+
+namespace Walnut {
+
+	struct HistogramSnapshot
+	{
+		uint64_t Count = 0;
+		uint64_t Min = 0;
+		uint64_t Max = 0;
+		uint64_t Sum = 0;
+		std::vector<uint64_t> Buckets; // Counts per LatencyHistogram bucket
+
+		double GetMean() const { return Count ? (double)Sum / (double)Count : 0.0; }
+
+		// Upper bound of the bucket containing the percentile (0-100), within ~6% of the real value
+		uint64_t GetValueAtPercentile(double percentile) const;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Lock-free log-linear (HDR-style) histogram
+	// Values below 16 get their own bucket, above that every power of two is split into 16 buckets,
+	// so relative error stays under ~6% for any value. Record() is a couple of relaxed atomic adds.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class LatencyHistogram
+	{
+	public:
+		static constexpr uint32_t SubBucketBits = 4;
+		static constexpr uint32_t SubBucketCount = 1 << SubBucketBits;
+		static constexpr uint32_t MaxExponent = 48; // Values are clamped to 2^48
+		static constexpr uint32_t BucketCount = (MaxExponent - SubBucketBits + 2) * SubBucketCount;
+	public:
+		LatencyHistogram() { Reset(); }
+
+		LatencyHistogram(const LatencyHistogram&) = delete;
+		LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+		// Any thread
+		void Record(uint64_t value)
+		{
+			m_Buckets[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+			m_Sum.fetch_add(value, std::memory_order_relaxed);
+
+			uint64_t min = m_Min.load(std::memory_order_relaxed);
+			while (value < min && !m_Min.compare_exchange_weak(min, value, std::memory_order_relaxed))
+				;
+
+			uint64_t max = m_Max.load(std::memory_order_relaxed);
+			while (value > max && !m_Max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+				;
+		}
+
+		// Not atomic with respect to concurrent Record() calls, which may land on either side
+		void Reset();
+		HistogramSnapshot GetSnapshot() const;
+
+		static uint32_t GetBucketIndex(uint64_t value);
+		static uint64_t GetBucketUpperBound(uint32_t index);
+	private:
+		std::atomic<uint64_t> m_Buckets[BucketCount];
+		std::atomic<uint64_t> m_Sum;
+		std::atomic<uint64_t> m_Min;
+		std::atomic<uint64_t> m_Max;
+	};
+
+	// All durations in nanoseconds
+	struct InstrumentationSnapshot
+	{
+		HistogramSnapshot ReceiveToCallback; // GameNetworkingSockets receiving a message -> its callback starting
+		HistogramSnapshot CallbackDuration;  // Time spent in one data received callback call
+		HistogramSnapshot LoopIteration;     // Network thread work per iteration, excluding the wait
+		HistogramSnapshot SendCall;          // Time spent in library send calls
+	};
+
+#if WL_NETWORK_INSTRUMENTATION
+
+	class NetworkInstrumentation
+	{
+	public:
+		void SetEnabled(bool enabled) { m_Enabled.store(enabled, std::memory_order_relaxed); }
+		bool IsEnabled() const { return m_Enabled.load(std::memory_order_relaxed); }
+
+		LatencyHistogram ReceiveToCallback;
+		LatencyHistogram CallbackDuration;
+		LatencyHistogram LoopIteration;
+		LatencyHistogram SendCall;
+
+		// Timestamps in microseconds, as in SteamNetworkingMessage_t::m_usecTimeReceived
+		void RecordReceiveToCallback(int64_t timeReceived, int64_t now)
+		{
+			if (IsEnabled())
+				ReceiveToCallback.Record(now > timeReceived ? (uint64_t)(now - timeReceived) * 1000 : 0);
+		}
+
+		InstrumentationSnapshot GetSnapshot() const
+		{
+			return { ReceiveToCallback.GetSnapshot(), CallbackDuration.GetSnapshot(), LoopIteration.GetSnapshot(), SendCall.GetSnapshot() };
+		}
+
+		void Reset()
+		{
+			ReceiveToCallback.Reset();
+			CallbackDuration.Reset();
+			LoopIteration.Reset();
+			SendCall.Reset();
+		}
+	private:
+		std::atomic<bool> m_Enabled = false;
+	};
+
+	// Records the time between construction and destruction (or Stop) into the histogram, if instrumentation is enabled
+	class InstrumentationTimer
+	{
+	public:
+		InstrumentationTimer(const NetworkInstrumentation& instrumentation, LatencyHistogram& histogram)
+			: m_Histogram(instrumentation.IsEnabled() ? &histogram : nullptr)
+		{
+			if (m_Histogram)
+				m_Start = std::chrono::steady_clock::now();
+		}
+
+		~InstrumentationTimer() { Stop(); }
+
+		void Stop()
+		{
+			if (!m_Histogram)
+				return;
+
+			m_Histogram->Record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count());
+			m_Histogram = nullptr;
+		}
+	private:
+		LatencyHistogram* m_Histogram;
+		std::chrono::steady_clock::time_point m_Start;
+	};
+
+#else
+
+	// Compiled out - everything is a no-op and the histograms don't exist
+	class NetworkInstrumentation
+	{
+	public:
+		struct NullHistogram { void Record(uint64_t) {} };
+
+		void SetEnabled(bool) {}
+		bool IsEnabled() const { return false; }
+
+		NullHistogram ReceiveToCallback;
+		NullHistogram CallbackDuration;
+		NullHistogram LoopIteration;
+		NullHistogram SendCall;
+
+		void RecordReceiveToCallback(int64_t, int64_t) {}
+
+		InstrumentationSnapshot GetSnapshot() const { return {}; }
+		void Reset() {}
+	};
+
+	class InstrumentationTimer
+	{
+	public:
+		template<typename Histogram>
+		InstrumentationTimer(const NetworkInstrumentation&, Histogram&) {}
+		void Stop() {}
+	};
+
+#endif
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cstdint>
+
+namespace Walnut {
+
+	struct QueueStats
+	{
+		uint32_t Depth = 0;
+		uint32_t HighWater = 0;
+		uint32_t Capacity = 0;
+		uint64_t TotalPushed = 0;
+		uint64_t TotalRejected = 0; // Pushes that failed because the queue was full
+	};
+
+	// Bounded lock-free multi-producer single-consumer queue
+	// Based on Dmitry Vyukov's bounded MPMC queue, with the consumer side simplified
+	// Capacity is rounded up to a power of two
+	template<typename T>
+	class MPSCQueue
+	{
+	public:
+		MPSCQueue() = default;
+		explicit MPSCQueue(uint32_t capacity) { Init(capacity); }
+
+		MPSCQueue(const MPSCQueue&) = delete;
+		MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+		// Not thread-safe, call before using the queue
+		void Init(uint32_t capacity)
+		{
+			uint32_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+
+			m_Capacity = size;
+			m_Mask = size - 1;
+			m_Cells = std::make_unique<Cell[]>(size);
+			for (uint32_t i = 0; i < size; i++)
+				m_Cells[i].Sequence.store(i, std::memory_order_relaxed);
+
+			m_EnqueuePos.store(0, std::memory_order_relaxed);
+			m_DequeuePos.store(0, std::memory_order_relaxed);
+			m_HighWater.store(0, std::memory_order_relaxed);
+			m_RejectedCount.store(0, std::memory_order_relaxed);
+		}
+
+		bool IsInitialized() const { return m_Cells != nullptr; }
+
+		// Any thread. Returns false if the queue is full
+		bool Push(T&& value)
+		{
+			uint64_t pos = m_EnqueuePos.load(std::memory_order_relaxed);
+			Cell* cell;
+			for (;;)
+			{
+				cell = &m_Cells[pos & m_Mask];
+				uint64_t sequence = cell->Sequence.load(std::memory_order_acquire);
+				int64_t diff = (int64_t)sequence - (int64_t)pos;
+				if (diff == 0)
+				{
+					if (m_EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					m_RejectedCount.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				else
+				{
+					pos = m_EnqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			cell->Value = std::move(value);
+			cell->Sequence.store(pos + 1, std::memory_order_release);
+
+			UpdateHighWater((uint32_t)(pos + 1 - m_DequeuePos.load(std::memory_order_relaxed)));
+			return true;
+		}
+
+		// Consumer thread only. Returns false if the queue is empty
+		bool Pop(T& value)
+		{
+			uint64_t pos = m_DequeuePos.load(std::memory_order_relaxed);
+			Cell* cell = &m_Cells[pos & m_Mask];
+			uint64_t sequence = cell->Sequence.load(std::memory_order_acquire);
+			if ((int64_t)sequence - (int64_t)(pos + 1) < 0)
+				return false;
+
+			value = std::move(cell->Value);
+			cell->Value = T();
+			cell->Sequence.store(pos + m_Mask + 1, std::memory_order_release);
+			m_DequeuePos.store(pos + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		// Approximate when called concurrently with Push/Pop
+		uint32_t GetDepth() const
+		{
+			uint64_t enqueuePos = m_EnqueuePos.load(std::memory_order_relaxed);
+			uint64_t dequeuePos = m_DequeuePos.load(std::memory_order_relaxed);
+			return enqueuePos > dequeuePos ? (uint32_t)(enqueuePos - dequeuePos) : 0;
+		}
+
+		uint32_t GetHighWater() const { return m_HighWater.load(std::memory_order_relaxed); }
+		void ResetHighWater() { m_HighWater.store(GetDepth(), std::memory_order_relaxed); }
+		uint32_t GetCapacity() const { return m_Capacity; }
+
+		QueueStats GetStats() const
+		{
+			QueueStats stats;
+			stats.Depth = GetDepth();
+			stats.HighWater = GetHighWater();
+			stats.Capacity = m_Capacity;
+			stats.TotalPushed = m_EnqueuePos.load(std::memory_order_relaxed);
+			stats.TotalRejected = m_RejectedCount.load(std::memory_order_relaxed);
+			return stats;
+		}
+	private:
+		void UpdateHighWater(uint32_t depth)
+		{
+			uint32_t highWater = m_HighWater.load(std::memory_order_relaxed);
+			while (depth > highWater && !m_HighWater.compare_exchange_weak(highWater, depth, std::memory_order_relaxed))
+				;
+		}
+	private:
+		struct Cell
+		{
+			std::atomic<uint64_t> Sequence;
+			T Value{};
+		};
+
+		std::unique_ptr<Cell[]> m_Cells;
+		uint32_t m_Capacity = 0;
+		uint32_t m_Mask = 0;
+
+		// Keep producer and consumer positions on separate cache lines
+		alignas(64) std::atomic<uint64_t> m_EnqueuePos = 0;
+		alignas(64) std::atomic<uint64_t> m_DequeuePos = 0;
+		alignas(64) std::atomic<uint32_t> m_HighWater = 0;
+		std::atomic<uint64_t> m_RejectedCount = 0;
+	};
+
+}
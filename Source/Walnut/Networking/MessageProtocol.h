@@ -0,0 +1,275 @@
+#pragma once
+
+#include "Walnut/Core/Buffer.h"
+
+#include <array>
+#include <span>
+#include <algorithm>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Typed messages
+	//
+	// A message is a trivially copyable struct with a compile-time ID:
+	//
+	//     struct ChatMessage
+	//     {
+	//         static constexpr MessageID ID = 1;
+	//         static constexpr bool HasTrailingData = true; // Optional, allows variable-length data after the struct
+	//         uint32_t SenderID;
+	//     };
+	//
+	// On the wire it's a MessageHeader followed by the struct bytes and any trailing data. Like SendData<T>,
+	// the struct is sent as raw bytes, so both ends need the same layout and endianness.
+	//
+	// MessageProtocol<Messages...> builds a table indexed by message ID for each handler type at compile time,
+	// so dispatching a received buffer is a bounds check, a size check and one indirect call - no virtuals or maps.
+	// Handlers are any callable (eg. a struct with an operator() overload per message) taking the extra
+	// dispatch arguments followed by a MessageView<T>. Messages the handler has no overload for are reported as Unhandled.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	using MessageID = uint16_t;
+
+	// 8 bytes so message structs stay 8-byte aligned in received buffers and can be viewed in place
+	struct MessageHeader
+	{
+		MessageID ID = 0;
+		uint16_t Flags = 0; // Reserved
+		uint32_t PayloadSize = 0; // Struct plus trailing data
+	};
+	static_assert(sizeof(MessageHeader) == 8);
+
+	inline constexpr size_t MessageAlignment = alignof(MessageHeader) > 8 ? alignof(MessageHeader) : 8;
+	inline constexpr MessageID MaxMessageID = 1023; // Keeps dispatch tables small
+
+	// IDs from here to MaxMessageID are used by built-in modules (eg. Replication.h)
+	inline constexpr MessageID FirstReservedMessageID = 1000;
+
+	template<typename T>
+	concept NetworkMessage = std::is_trivially_copyable_v<T> && requires { { T::ID } -> std::convertible_to<MessageID>; } && alignof(T) <= MessageAlignment;
+
+	namespace Utils {
+
+		template<typename T>
+		constexpr bool MessageHasTrailingData()
+		{
+			if constexpr (requires { T::HasTrailingData; })
+				return T::HasTrailingData;
+			else
+				return false;
+		}
+
+	}
+
+	// Zero-copy view of a received message, only valid as long as the buffer it was dispatched from
+	template<NetworkMessage T>
+	class MessageView
+	{
+	public:
+		MessageView(const T* message, std::span<const std::byte> trailingData, const Buffer& buffer)
+			: m_Message(message), m_TrailingData(trailingData), m_Buffer(buffer) {}
+
+		const T& Get() const { return *m_Message; }
+		const T& operator*() const { return *m_Message; }
+		const T* operator->() const { return m_Message; }
+
+		// Bytes after the struct, empty unless T::HasTrailingData
+		std::span<const std::byte> GetTrailingData() const { return m_TrailingData; }
+
+		// The whole received buffer, header included
+		const Buffer& GetBuffer() const { return m_Buffer; }
+	private:
+		const T* m_Message;
+		std::span<const std::byte> m_TrailingData;
+		const Buffer& m_Buffer;
+	};
+
+	enum class DispatchResult
+	{
+		Handled = 0,
+		Unhandled,   // Known message, but the handler has no overload for it
+		UnknownID,
+		InvalidSize, // Buffer too small, or sizes don't match the header/message type
+		Misaligned   // Buffer data isn't aligned to MessageAlignment, so it can't be viewed in place
+	};
+
+	inline const char* DispatchResultToString(DispatchResult result)
+	{
+		switch (result)
+		{
+			case DispatchResult::Handled:     return "Handled";
+			case DispatchResult::Unhandled:   return "Unhandled";
+			case DispatchResult::UnknownID:   return "UnknownID";
+			case DispatchResult::InvalidSize: return "InvalidSize";
+			case DispatchResult::Misaligned:  return "Misaligned";
+		}
+		return "Unknown";
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Encoding
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	template<NetworkMessage T>
+	constexpr uint32_t GetEncodedMessageSize(size_t trailingDataSize = 0)
+	{
+		return (uint32_t)(sizeof(MessageHeader) + sizeof(T) + trailingDataSize);
+	}
+
+	// Destination must have room for GetEncodedMessageSize<T>(trailingData.size()) bytes
+	template<NetworkMessage T>
+	void EncodeMessage(void* destination, const T& message, std::span<const std::byte> trailingData = {})
+	{
+		MessageHeader header;
+		header.ID = T::ID;
+		header.PayloadSize = (uint32_t)(sizeof(T) + trailingData.size());
+
+		std::byte* bytes = (std::byte*)destination;
+		memcpy(bytes, &header, sizeof(MessageHeader));
+		memcpy(bytes + sizeof(MessageHeader), &message, sizeof(T));
+		if (!trailingData.empty())
+			memcpy(bytes + sizeof(MessageHeader) + sizeof(T), trailingData.data(), trailingData.size());
+	}
+
+	// Returns false if the buffer doesn't start with a valid header
+	inline bool ReadMessageHeader(const Buffer& buffer, MessageHeader& header)
+	{
+		if (!buffer.Data || buffer.Size < sizeof(MessageHeader))
+			return false;
+
+		memcpy(&header, buffer.Data, sizeof(MessageHeader));
+		return header.PayloadSize == buffer.Size - sizeof(MessageHeader);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Dispatch
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	template<NetworkMessage... Messages>
+	class MessageProtocol
+	{
+	public:
+		static constexpr MessageID MaxID = std::max({ (MessageID)Messages::ID... });
+		static_assert(MaxID <= MaxMessageID, "Message IDs must be <= MaxMessageID");
+
+		static constexpr bool HasUniqueIDs()
+		{
+			std::array<MessageID, sizeof...(Messages)> ids = { (MessageID)Messages::ID... };
+			std::sort(ids.begin(), ids.end());
+			return std::adjacent_find(ids.begin(), ids.end()) == ids.end();
+		}
+		static_assert(HasUniqueIDs(), "Message IDs must be unique within a protocol");
+
+		template<typename T>
+		static constexpr bool Contains = (std::is_same_v<T, Messages> || ...);
+
+		// Decodes the buffer and calls handler(args..., MessageView<T>)
+		template<typename Handler, typename... Args>
+		static DispatchResult Dispatch(const Buffer& buffer, Handler& handler, Args&... args)
+		{
+			MessageHeader header;
+			if (!ReadMessageHeader(buffer, header))
+				return DispatchResult::InvalidSize;
+
+			if (header.ID > MaxID)
+				return DispatchResult::UnknownID;
+
+			DispatchFunction<Handler, Args...> function = s_DispatchTable<Handler, Args...>[header.ID];
+			if (!function)
+				return DispatchResult::UnknownID;
+
+			return function(buffer, handler, args...);
+		}
+
+		// Callbacks to plug straight into Client::SetDataReceivedCallback and Server::SetDataReceivedCallback.
+		// The handler is moved into the callback, results other than Handled are passed to onError if provided.
+		template<typename Handler>
+		static auto MakeClientCallback(Handler handler)
+		{
+			return [handler = std::move(handler)](const Buffer buffer) mutable
+			{
+				Dispatch(buffer, handler);
+			};
+		}
+
+		template<typename Handler, typename ErrorHandler>
+		static auto MakeClientCallback(Handler handler, ErrorHandler onError)
+		{
+			return [handler = std::move(handler), onError = std::move(onError)](const Buffer buffer) mutable
+			{
+				DispatchResult result = Dispatch(buffer, handler);
+				if (result != DispatchResult::Handled)
+					onError(result, buffer);
+			};
+		}
+
+		template<typename Handler>
+		static auto MakeServerCallback(Handler handler)
+		{
+			return [handler = std::move(handler)](const auto& client, const Buffer buffer) mutable
+			{
+				Dispatch(buffer, handler, client);
+			};
+		}
+
+		template<typename Handler, typename ErrorHandler>
+		static auto MakeServerCallback(Handler handler, ErrorHandler onError)
+		{
+			return [handler = std::move(handler), onError = std::move(onError)](const auto& client, const Buffer buffer) mutable
+			{
+				DispatchResult result = Dispatch(buffer, handler, client);
+				if (result != DispatchResult::Handled)
+					onError(result, client, buffer);
+			};
+		}
+	private:
+		template<typename Handler, typename... Args>
+		using DispatchFunction = DispatchResult(*)(const Buffer&, Handler&, Args&...);
+
+		template<typename T, typename Handler, typename... Args>
+		static DispatchResult DispatchMessage(const Buffer& buffer, Handler& handler, Args&... args)
+		{
+			if constexpr (!std::is_invocable_v<Handler&, Args&..., MessageView<T>>)
+			{
+				return DispatchResult::Unhandled;
+			}
+			else
+			{
+				size_t payloadSize = buffer.Size - sizeof(MessageHeader);
+				if constexpr (Utils::MessageHasTrailingData<T>())
+				{
+					if (payloadSize < sizeof(T))
+						return DispatchResult::InvalidSize;
+				}
+				else
+				{
+					if (payloadSize != sizeof(T))
+						return DispatchResult::InvalidSize;
+				}
+
+				if ((uintptr_t)buffer.Data % MessageAlignment != 0)
+					return DispatchResult::Misaligned;
+
+				const std::byte* payload = (const std::byte*)buffer.Data + sizeof(MessageHeader);
+				std::span<const std::byte> trailingData(payload + sizeof(T), payloadSize - sizeof(T));
+				handler(args..., MessageView<T>((const T*)payload, trailingData, buffer));
+				return DispatchResult::Handled;
+			}
+		}
+
+		template<typename Handler, typename... Args>
+		static constexpr std::array<DispatchFunction<Handler, Args...>, MaxID + 1> CreateDispatchTable()
+		{
+			std::array<DispatchFunction<Handler, Args...>, MaxID + 1> table{};
+			((table[Messages::ID] = &DispatchMessage<Messages, Handler, Args...>), ...);
+			return table;
+		}
+
+		template<typename Handler, typename... Args>
+		static constexpr std::array<DispatchFunction<Handler, Args...>, MaxID + 1> s_DispatchTable = CreateDispatchTable<Handler, Args...>();
+	};
+
+}
@@ -0,0 +1,65 @@
+#include "NetworkScheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace Walnut {
+
+	void NetworkScheduler::Wait(bool hadActivity)
+	{
+		switch (m_Settings.Mode)
+		{
+			case NetworkThreadMode::FixedTick:
+			{
+				auto tickDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) / std::max(m_Settings.TickRate, 1u);
+				auto now = std::chrono::steady_clock::now();
+
+				// Sleep until the next tick boundary rather than a fixed amount after the work,
+				// and don't try to catch up if we fell behind
+				m_NextTick += tickDuration;
+				if (m_NextTick <= now)
+					m_NextTick = now + tickDuration;
+
+				WaitFor(m_NextTick - now);
+				break;
+			}
+
+			case NetworkThreadMode::WaitOnActivity:
+			{
+				if (hadActivity)
+				{
+					m_IdleWait = std::chrono::microseconds(0);
+					break;
+				}
+
+				m_IdleWait = m_IdleWait.count() == 0 ? m_Settings.MinIdleWait : std::min(m_IdleWait * 2, m_Settings.MaxIdleWait);
+				WaitFor(m_IdleWait);
+				break;
+			}
+
+			case NetworkThreadMode::BusyPoll:
+				std::this_thread::yield();
+				break;
+		}
+	}
+
+	void NetworkScheduler::Wake()
+	{
+		// Cheap when called often (e.g. once per queued send) - only the first call per wait takes the lock
+		if (m_WakeRequested.exchange(true))
+			return;
+
+		{
+			std::scoped_lock lock(m_WakeMutex);
+		}
+		m_WakeCondition.notify_one();
+	}
+
+	void NetworkScheduler::WaitFor(std::chrono::steady_clock::duration duration)
+	{
+		std::unique_lock lock(m_WakeMutex);
+		m_WakeCondition.wait_for(lock, duration, [this]() { return m_WakeRequested.load(); });
+		m_WakeRequested = false;
+	}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <steam/steamnetworkingtypes.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+namespace Walnut {
+
+	enum class NetworkThreadMode
+	{
+		// Poll at a fixed tick rate (default is 100 Hz, which matches the old 10ms sleep)
+		FixedTick = 0,
+		// Keep polling while there is work, back off exponentially while idle
+		// and wake immediately when NetworkScheduler::Wake() is called
+		WaitOnActivity,
+		// Never sleep - lowest latency, but burns a core
+		BusyPoll
+	};
+
+	struct NetworkThreadSettings
+	{
+		NetworkThreadMode Mode = NetworkThreadMode::FixedTick;
+
+		// FixedTick only - iterations per second
+		uint32_t TickRate = 100;
+
+		// WaitOnActivity only - idle wait starts at MinIdleWait and doubles up to MaxIdleWait
+		std::chrono::microseconds MinIdleWait = std::chrono::microseconds(100);
+		std::chrono::microseconds MaxIdleWait = std::chrono::milliseconds(10);
+	};
+
+	// Time from GameNetworkingSockets receiving a message to the network thread dispatching it (to the callbacks, or to
+	// the deferred dispatch queue). Always recorded, unlike the instrumentation histograms
+	struct DispatchLatencyStats
+	{
+		uint64_t SampleCount = 0;
+		uint64_t AverageMicroseconds = 0;
+		uint64_t MaxMicroseconds = 0;
+	};
+
+	// Single writer (the network thread, or one shard's thread), readable from any thread.
+	// Sharded servers keep one per shard and combine them, so shards never share the cache line.
+	struct DispatchLatencyCounter
+	{
+		std::atomic<uint64_t> SampleCount = 0;
+		std::atomic<uint64_t> TotalMicroseconds = 0;
+		std::atomic<uint64_t> MaxMicroseconds = 0;
+
+		void Record(SteamNetworkingMicroseconds timeReceived, SteamNetworkingMicroseconds now)
+		{
+			uint64_t latency = now > timeReceived ? (uint64_t)(now - timeReceived) : 0;
+			SampleCount.store(SampleCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			TotalMicroseconds.store(TotalMicroseconds.load(std::memory_order_relaxed) + latency, std::memory_order_relaxed);
+			if (latency > MaxMicroseconds.load(std::memory_order_relaxed))
+				MaxMicroseconds.store(latency, std::memory_order_relaxed);
+		}
+
+		DispatchLatencyStats GetStats() const
+		{
+			DispatchLatencyStats stats;
+			stats.SampleCount = SampleCount.load(std::memory_order_relaxed);
+			stats.AverageMicroseconds = stats.SampleCount ? TotalMicroseconds.load(std::memory_order_relaxed) / stats.SampleCount : 0;
+			stats.MaxMicroseconds = MaxMicroseconds.load(std::memory_order_relaxed);
+			return stats;
+		}
+
+		// Not atomic with respect to a concurrent Record()
+		void Reset()
+		{
+			SampleCount.store(0, std::memory_order_relaxed);
+			TotalMicroseconds.store(0, std::memory_order_relaxed);
+			MaxMicroseconds.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	class NetworkScheduler
+	{
+	public:
+		void SetSettings(const NetworkThreadSettings& settings) { m_Settings = settings; }
+		const NetworkThreadSettings& GetSettings() const { return m_Settings; }
+
+		// Called by the network thread at the end of each iteration
+		void Wait(bool hadActivity);
+
+		// Can be called from any thread to end the current wait early
+		void Wake();
+
+	private:
+		void WaitFor(std::chrono::steady_clock::duration duration);
+	private:
+		NetworkThreadSettings m_Settings;
+
+		std::chrono::steady_clock::time_point m_NextTick{};
+		std::chrono::microseconds m_IdleWait{ 0 };
+
+		std::mutex m_WakeMutex;
+		std::condition_variable m_WakeCondition;
+		std::atomic<bool> m_WakeRequested = false;
+	};
+
+}
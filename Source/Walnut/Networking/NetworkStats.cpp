@@ -0,0 +1,185 @@
+#include "NetworkStats.h"
+
+#include <spdlog/fmt/fmt.h>
+
+#include <iterator>
+#include <algorithm>
+
+namespace Walnut::Utils {
+
+	static constexpr int MaxSampledLanes = 16;
+
+	bool SampleConnectionStats(ISteamNetworkingSockets* networkInterface, HSteamNetConnection connection, ConnectionStats& stats, int laneCount)
+	{
+		SteamNetConnectionRealTimeStatus_t status;
+		SteamNetConnectionRealTimeLaneStatus_t laneStatus[MaxSampledLanes];
+		laneCount = std::min(laneCount, MaxSampledLanes);
+		if (networkInterface->GetConnectionRealTimeStatus(connection, &status, laneCount, laneCount ? laneStatus : nullptr) != k_EResultOK)
+			return false;
+
+		stats.Connection = connection;
+		stats.PingMilliseconds = status.m_nPing;
+		stats.QualityLocal = status.m_flConnectionQualityLocal;
+		stats.QualityRemote = status.m_flConnectionQualityRemote;
+		stats.OutPacketsPerSecond = status.m_flOutPacketsPerSec;
+		stats.OutBytesPerSecond = status.m_flOutBytesPerSec;
+		stats.InPacketsPerSecond = status.m_flInPacketsPerSec;
+		stats.InBytesPerSecond = status.m_flInBytesPerSec;
+		stats.SendRateBytesPerSecond = status.m_nSendRateBytesPerSecond;
+		stats.PendingUnreliableBytes = status.m_cbPendingUnreliable;
+		stats.PendingReliableBytes = status.m_cbPendingReliable;
+		stats.SentUnackedReliableBytes = status.m_cbSentUnackedReliable;
+		stats.QueueTimeMicroseconds = status.m_usecQueueTime;
+
+		stats.Lanes.resize(laneCount);
+		for (int i = 0; i < laneCount; i++)
+		{
+			stats.Lanes[i].PendingUnreliableBytes = laneStatus[i].m_cbPendingUnreliable;
+			stats.Lanes[i].PendingReliableBytes = laneStatus[i].m_cbPendingReliable;
+			stats.Lanes[i].SentUnackedReliableBytes = laneStatus[i].m_cbSentUnackedReliable;
+			stats.Lanes[i].QueueTimeMicroseconds = laneStatus[i].m_usecQueueTime;
+		}
+		return true;
+	}
+
+	static void EscapeLabelValue(std::string& out, std::string_view value)
+	{
+		for (char c : value)
+		{
+			switch (c)
+			{
+				case '\\': out += "\\\\"; break;
+				case '"':  out += "\\\""; break;
+				case '\n': out += "\\n"; break;
+				default:   out += c; break;
+			}
+		}
+	}
+
+	std::string FormatMetricsText(const NetworkStats& stats, std::string_view prefix)
+	{
+		std::string out;
+		auto header = [&](std::string_view name, std::string_view type, std::string_view help)
+		{
+			fmt::format_to(std::back_inserter(out), "# HELP {}_{} {}\n# TYPE {}_{} {}\n", prefix, name, help, prefix, name, type);
+		};
+
+		auto value = [&](std::string_view name, auto metricValue)
+		{
+			fmt::format_to(std::back_inserter(out), "{}_{} {}\n", prefix, name, metricValue);
+		};
+
+		header("messages_received_total", "counter", "Messages received");
+		value("messages_received_total", stats.MessagesIn);
+		header("bytes_received_total", "counter", "Payload bytes received");
+		value("bytes_received_total", stats.BytesIn);
+		header("messages_sent_total", "counter", "Messages sent");
+		value("messages_sent_total", stats.MessagesOut);
+		header("bytes_sent_total", "counter", "Payload bytes sent");
+		value("bytes_sent_total", stats.BytesOut);
+		header("callback_seconds_total", "counter", "Time spent in data received callbacks");
+		value("callback_seconds_total", (double)stats.CallbackMicroseconds / 1e6);
+		header("send_failures_total", "counter", "Messages the library refused to send");
+		value("send_failures_total", stats.SendFailures);
+
+		header("outbound_queue_depth", "gauge", "Messages waiting in the outbound queue");
+		value("outbound_queue_depth", stats.OutboundQueue.Depth);
+		header("outbound_queue_high_water", "gauge", "Highest outbound queue depth seen");
+		value("outbound_queue_high_water", stats.OutboundQueue.HighWater);
+		header("outbound_queue_rejected_total", "counter", "Sends dropped because the outbound queue was full");
+		value("outbound_queue_rejected_total", stats.OutboundQueue.TotalRejected);
+
+		header("dispatch_latency_average_seconds", "gauge", "Average time from receipt to dispatch");
+		value("dispatch_latency_average_seconds", (double)stats.DispatchLatency.AverageMicroseconds / 1e6);
+		header("dispatch_latency_max_seconds", "gauge", "Longest time from receipt to dispatch");
+		value("dispatch_latency_max_seconds", (double)stats.DispatchLatency.MaxMicroseconds / 1e6);
+
+		header("compression_messages_total", "counter", "Messages sent compressed");
+		value("compression_messages_total", stats.Compression.MessagesCompressed);
+		header("compression_skipped_messages_total", "counter", "Messages sent uncompressed with compression enabled");
+		value("compression_skipped_messages_total", stats.Compression.MessagesUncompressed);
+		header("compression_input_bytes_total", "counter", "Bytes of messages before compression");
+		value("compression_input_bytes_total", stats.Compression.BytesBeforeCompression);
+		header("compression_output_bytes_total", "counter", "Bytes of messages after compression");
+		value("compression_output_bytes_total", stats.Compression.BytesAfterCompression);
+		header("compression_ratio", "gauge", "Bytes before compression over bytes after, for compressed messages");
+		value("compression_ratio", stats.Compression.GetCompressionRatio());
+		header("compression_seconds_total", "counter", "Time spent compressing");
+		value("compression_seconds_total", (double)stats.Compression.CompressMicroseconds / 1e6);
+		header("decompression_messages_total", "counter", "Messages received compressed");
+		value("decompression_messages_total", stats.Compression.MessagesDecompressed);
+		header("decompression_seconds_total", "counter", "Time spent decompressing");
+		value("decompression_seconds_total", (double)stats.Compression.DecompressMicroseconds / 1e6);
+		header("decompression_errors_total", "counter", "Received messages dropped because they couldn't be decoded");
+		value("decompression_errors_total", stats.Compression.DecodeErrors);
+
+		header("connections", "gauge", "Open connections");
+		value("connections", stats.Connections.size());
+
+		// Per connection metrics, one family at a time as the format requires
+		std::vector<std::string> labels;
+		labels.reserve(stats.Connections.size());
+		for (const ConnectionStats& connection : stats.Connections)
+		{
+			std::string& label = labels.emplace_back();
+			fmt::format_to(std::back_inserter(label), "{{connection=\"{}\",description=\"", connection.Connection);
+			EscapeLabelValue(label, connection.Description);
+			label += "\"}";
+		}
+
+		auto connectionFamily = [&](std::string_view name, std::string_view type, std::string_view help, auto getter)
+		{
+			if (stats.Connections.empty())
+				return;
+
+			header(name, type, help);
+			for (size_t i = 0; i < stats.Connections.size(); i++)
+				fmt::format_to(std::back_inserter(out), "{}_{}{} {}\n", prefix, name, labels[i], getter(stats.Connections[i]));
+		};
+
+		connectionFamily("connection_ping_seconds", "gauge", "Round trip time", [](const ConnectionStats& c) { return (double)c.PingMilliseconds / 1e3; });
+		connectionFamily("connection_quality_local", "gauge", "Fraction of packets delivered, as seen locally", [](const ConnectionStats& c) { return c.QualityLocal; });
+		connectionFamily("connection_quality_remote", "gauge", "Fraction of packets delivered, as seen by the peer", [](const ConnectionStats& c) { return c.QualityRemote; });
+		connectionFamily("connection_out_bytes_per_second", "gauge", "Current outgoing bandwidth", [](const ConnectionStats& c) { return c.OutBytesPerSecond; });
+		connectionFamily("connection_in_bytes_per_second", "gauge", "Current incoming bandwidth", [](const ConnectionStats& c) { return c.InBytesPerSecond; });
+		connectionFamily("connection_send_rate_bytes_per_second", "gauge", "Estimated available bandwidth", [](const ConnectionStats& c) { return c.SendRateBytesPerSecond; });
+		connectionFamily("connection_pending_reliable_bytes", "gauge", "Reliable bytes queued for sending", [](const ConnectionStats& c) { return c.PendingReliableBytes; });
+		connectionFamily("connection_pending_unreliable_bytes", "gauge", "Unreliable bytes queued for sending", [](const ConnectionStats& c) { return c.PendingUnreliableBytes; });
+		connectionFamily("connection_unacked_reliable_bytes", "gauge", "Reliable bytes sent but not yet acknowledged", [](const ConnectionStats& c) { return c.SentUnackedReliableBytes; });
+		connectionFamily("connection_queue_time_seconds", "gauge", "Expected wait before a message sent now goes out", [](const ConnectionStats& c) { return (double)c.QueueTimeMicroseconds / 1e6; });
+		connectionFamily("connection_congested", "gauge", "1 while the connection's queue time is over the congestion threshold", [](const ConnectionStats& c) { return c.Congested ? 1 : 0; });
+		connectionFamily("connection_messages_received_total", "counter", "Messages received on the connection", [](const ConnectionStats& c) { return c.MessagesIn; });
+		connectionFamily("connection_bytes_received_total", "counter", "Payload bytes received on the connection", [](const ConnectionStats& c) { return c.BytesIn; });
+		connectionFamily("connection_messages_dropped_total", "counter", "Messages dropped for going over the inbound limits", [](const ConnectionStats& c) { return c.MessagesDropped; });
+		connectionFamily("connection_messages_deferred_total", "counter", "Messages held back by the inbound limits", [](const ConnectionStats& c) { return c.MessagesDeferred; });
+
+		// Per lane metrics, labelled with the connection and lane index
+		auto laneFamily = [&](std::string_view name, std::string_view help, auto getter)
+		{
+			bool headerWritten = false;
+			for (size_t i = 0; i < stats.Connections.size(); i++)
+			{
+				const ConnectionStats& connection = stats.Connections[i];
+				for (size_t lane = 0; lane < connection.Lanes.size(); lane++)
+				{
+					if (!headerWritten)
+					{
+						header(name, "gauge", help);
+						headerWritten = true;
+					}
+
+					std::string_view label(labels[i].data(), labels[i].size() - 1); // Without the closing brace
+					fmt::format_to(std::back_inserter(out), "{}_{}{},lane=\"{}\"}} {}\n", prefix, name, label, lane, getter(connection.Lanes[lane]));
+				}
+			}
+		};
+
+		laneFamily("lane_pending_reliable_bytes", "Reliable bytes queued for sending on the lane", [](const LaneStats& l) { return l.PendingReliableBytes; });
+		laneFamily("lane_pending_unreliable_bytes", "Unreliable bytes queued for sending on the lane", [](const LaneStats& l) { return l.PendingUnreliableBytes; });
+		laneFamily("lane_unacked_reliable_bytes", "Reliable bytes sent on the lane but not yet acknowledged", [](const LaneStats& l) { return l.SentUnackedReliableBytes; });
+		laneFamily("lane_queue_time_seconds", "Expected wait before a message sent on the lane now goes out", [](const LaneStats& l) { return (double)l.QueueTimeMicroseconds / 1e6; });
+
+		return out;
+	}
+
+}
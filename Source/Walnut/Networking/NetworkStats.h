@@ -0,0 +1,108 @@
+#pragma once
+
+#include "NetworkScheduler.h"
+#include "MPSCQueue.h"
+#include "Compression.h"
+#include "Lanes.h"
+
+#include <steam/steamnetworkingsockets.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace Walnut {
+
+	// Counters that one thread writes and any thread reads
+	struct TrafficCounter
+	{
+		std::atomic<uint64_t> Messages = 0;
+		std::atomic<uint64_t> Bytes = 0;
+
+		// Single writer only
+		void Add(uint64_t messages, uint64_t bytes)
+		{
+			Messages.store(Messages.load(std::memory_order_relaxed) + messages, std::memory_order_relaxed);
+			Bytes.store(Bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+		}
+
+		// Any number of writers
+		void AddConcurrent(uint64_t messages, uint64_t bytes)
+		{
+			Messages.fetch_add(messages, std::memory_order_relaxed);
+			Bytes.fetch_add(bytes, std::memory_order_relaxed);
+		}
+
+		void Reset()
+		{
+			Messages.store(0, std::memory_order_relaxed);
+			Bytes.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	struct ConnectionStats
+	{
+		HSteamNetConnection Connection = k_HSteamNetConnection_Invalid;
+		std::string Description;
+
+		// From GameNetworkingSockets (GetConnectionRealTimeStatus)
+		int PingMilliseconds = -1;
+		float QualityLocal = -1.0f;  // Fraction of packets delivered end to end, as seen locally (-1 if unknown)
+		float QualityRemote = -1.0f; // As seen by the peer
+		float OutPacketsPerSecond = 0.0f;
+		float OutBytesPerSecond = 0.0f;
+		float InPacketsPerSecond = 0.0f;
+		float InBytesPerSecond = 0.0f;
+		int SendRateBytesPerSecond = 0;   // Estimated bandwidth
+		int PendingUnreliableBytes = 0;   // Queued, not yet sent
+		int PendingReliableBytes = 0;     // Queued, not yet sent
+		int SentUnackedReliableBytes = 0; // Sent, waiting for acknowledgement
+		SteamNetworkingMicroseconds QueueTimeMicroseconds = 0; // Expected wait for a message sent now
+		bool Congested = false; // See CongestionSettings
+
+		// Per configured lane, empty unless lanes were configured (see Lanes.h)
+		std::vector<LaneStats> Lanes;
+
+		// Our counters, totals since the connection was made
+		uint64_t MessagesIn = 0;
+		uint64_t BytesIn = 0;
+		uint64_t MessagesDropped = 0;  // Over the inbound limits (included in MessagesIn)
+		uint64_t MessagesDeferred = 0; // Held back by the inbound limits, dispatched later
+	};
+
+	struct NetworkStats
+	{
+		SteamNetworkingMicroseconds Timestamp = 0;
+
+		// Totals since Start()/ConnectToServer()
+		uint64_t MessagesIn = 0;
+		uint64_t BytesIn = 0;
+		uint64_t MessagesOut = 0;
+		uint64_t BytesOut = 0;
+		uint64_t CallbackMicroseconds = 0; // Time spent inside data received callbacks
+		uint64_t SendFailures = 0;         // Messages the library refused (eg. send buffer full, connection closed)
+
+		QueueStats OutboundQueue;
+		DispatchLatencyStats DispatchLatency;
+		CompressionStats Compression; // All zero unless compression is enabled
+
+		std::vector<ConnectionStats> Connections;
+	};
+
+	// How often the network thread samples connection stats (0 disables sampling)
+	inline constexpr std::chrono::milliseconds DefaultStatsInterval = std::chrono::milliseconds(1000);
+
+	namespace Utils {
+
+		// Fills in the transport part of the stats for one connection, and laneCount entries of ConnectionStats::Lanes
+		bool SampleConnectionStats(ISteamNetworkingSockets* networkInterface, HSteamNetConnection connection, ConnectionStats& stats, int laneCount = 0);
+
+		// Prometheus text exposition format, metric names are prefixed with the given prefix
+		std::string FormatMetricsText(const NetworkStats& stats, std::string_view prefix = "walnut_net");
+
+	}
+
+}
@@ -0,0 +1,136 @@
+#include "NetworkingContext.h"
+
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+namespace Walnut {
+
+	struct InstanceData
+	{
+		std::mutex Mutex;
+		std::vector<SteamNetConnectionStatusChangedCallback_t> PendingStatusChanges;
+	};
+
+	static std::mutex s_InitMutex;
+	static uint32_t s_InitRefCount = 0;
+
+	static std::shared_mutex s_InstancesMutex;
+	static std::unordered_map<NetworkingContext::InstanceID, std::unique_ptr<InstanceData>> s_Instances;
+	static NetworkingContext::InstanceID s_NextInstanceID = 0;
+
+	bool NetworkingContext::Acquire(std::string& errorMessage)
+	{
+		std::scoped_lock lock(s_InitMutex);
+
+		if (s_InitRefCount == 0)
+		{
+			SteamDatagramErrMsg errMsg;
+			if (!GameNetworkingSockets_Init(nullptr, errMsg))
+			{
+				errorMessage = errMsg;
+				return false;
+			}
+		}
+
+		s_InitRefCount++;
+		return true;
+	}
+
+	void NetworkingContext::Release()
+	{
+		std::scoped_lock lock(s_InitMutex);
+
+		if (s_InitRefCount == 0)
+			return;
+
+		if (--s_InitRefCount == 0)
+			GameNetworkingSockets_Kill();
+	}
+
+	NetworkingContext::InstanceID NetworkingContext::RegisterInstance()
+	{
+		std::unique_lock lock(s_InstancesMutex);
+
+		InstanceID instanceID = s_NextInstanceID++;
+		if (s_NextInstanceID == InvalidInstanceID)
+			s_NextInstanceID = 0;
+
+		s_Instances[instanceID] = std::make_unique<InstanceData>();
+		return instanceID;
+	}
+
+	void NetworkingContext::UnregisterInstance(InstanceID instanceID)
+	{
+		std::unique_lock lock(s_InstancesMutex);
+		s_Instances.erase(instanceID);
+	}
+
+	void NetworkingContext::SetConnectionOptions(SteamNetworkingConfigValue_t options[2], InstanceID instanceID)
+	{
+		options[0].SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged, (void*)ConnectionStatusChangedCallback);
+		options[1].SetInt64(k_ESteamNetworkingConfig_ConnectionUserData, MakeUserData(instanceID));
+	}
+
+	void NetworkingContext::RunCallbacks()
+	{
+		// Callbacks for everyone are dispatched from here - if another thread is already doing it,
+		// anything for us will be picked up on our next poll.
+		// Holding the init lock also keeps the library from being shut down underneath us.
+		std::unique_lock lock(s_InitMutex, std::try_to_lock);
+		if (!lock.owns_lock() || s_InitRefCount == 0)
+			return;
+
+		SteamNetworkingSockets()->RunCallbacks();
+	}
+
+	void NetworkingContext::PollConnectionStatusChanges(InstanceID instanceID, const std::function<void(SteamNetConnectionStatusChangedCallback_t*)>& function)
+	{
+		RunCallbacks();
+		ConsumeConnectionStatusChanges(instanceID, function);
+	}
+
+	void NetworkingContext::ConsumeConnectionStatusChanges(InstanceID instanceID, const std::function<void(SteamNetConnectionStatusChangedCallback_t*)>& function)
+	{
+		InstanceData* instance = nullptr;
+		{
+			std::shared_lock lock(s_InstancesMutex);
+			auto it = s_Instances.find(instanceID);
+			if (it == s_Instances.end())
+				return;
+
+			// Only the owning instance unregisters, so this stays valid
+			instance = it->second.get();
+		}
+
+		static thread_local std::vector<SteamNetConnectionStatusChangedCallback_t> statusChanges;
+		{
+			std::scoped_lock lock(instance->Mutex);
+			statusChanges.swap(instance->PendingStatusChanges);
+		}
+
+		for (SteamNetConnectionStatusChangedCallback_t& info : statusChanges)
+			function(&info);
+
+		statusChanges.clear();
+	}
+
+	void NetworkingContext::ConnectionStatusChangedCallback(SteamNetConnectionStatusChangedCallback_t* info)
+	{
+		// User data is bound to the connection when it is created (inherited from the listen socket for
+		// accepted connections) and instances never change the high bits, so reading it from the callback is safe
+		InstanceID instanceID = GetInstanceID(info->m_info.m_nUserData);
+
+		std::shared_lock lock(s_InstancesMutex);
+		auto it = s_Instances.find(instanceID);
+		if (it == s_Instances.end())
+			return;
+
+		InstanceData* instance = it->second.get();
+		std::scoped_lock instanceLock(instance->Mutex);
+		instance->PendingStatusChanges.push_back(*info);
+	}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <steam/steamnetworkingsockets.h>
+#include <steam/isteamnetworkingutils.h>
+
+#include <string>
+#include <functional>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Process-wide GameNetworkingSockets state, shared by every Client and Server
+	//
+	// - GameNetworkingSockets_Init/Kill are refcounted through Acquire/Release
+	// - Connection status callbacks are routed to the owning instance using the high 32 bits
+	//   of the connection user data (the low 32 bits are free for the instance to use).
+	//   Since RunCallbacks dispatches for every connection in the process, callbacks are queued
+	//   per instance and each instance consumes its own from its own thread.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class NetworkingContext
+	{
+	public:
+		using InstanceID = uint32_t;
+		static constexpr InstanceID InvalidInstanceID = 0xFFFFFFFF;
+
+		// Initializes GameNetworkingSockets on first use
+		static bool Acquire(std::string& errorMessage);
+		// Shuts GameNetworkingSockets down once the last user releases it
+		static void Release();
+
+		static InstanceID RegisterInstance();
+		static void UnregisterInstance(InstanceID instanceID);
+
+		// Connection user data layout
+		static int64 MakeUserData(InstanceID instanceID, uint32_t connectionData = 0) { return (int64)(((uint64)instanceID << 32) | connectionData); }
+		static InstanceID GetInstanceID(int64 userData) { return (InstanceID)((uint64)userData >> 32); }
+		static uint32_t GetConnectionData(int64 userData) { return (uint32_t)((uint64)userData & 0xFFFFFFFF); }
+
+		// Config option to pass when creating listen sockets/connections so status callbacks find their way back
+		static void SetConnectionOptions(SteamNetworkingConfigValue_t options[2], InstanceID instanceID);
+
+		// Runs library callbacks, queuing status changes for their instances
+		// Only one thread at a time does this, others return immediately
+		static void RunCallbacks();
+
+		// Calls the function for each status change queued for this instance, in order
+		static void ConsumeConnectionStatusChanges(InstanceID instanceID, const std::function<void(SteamNetConnectionStatusChangedCallback_t*)>& function);
+
+		// RunCallbacks() followed by ConsumeConnectionStatusChanges()
+		static void PollConnectionStatusChanges(InstanceID instanceID, const std::function<void(SteamNetConnectionStatusChangedCallback_t*)>& function);
+	private:
+		static void ConnectionStatusChangedCallback(SteamNetConnectionStatusChangedCallback_t* info);
+	};
+
+}
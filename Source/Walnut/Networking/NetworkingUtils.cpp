@@ -2,6 +2,10 @@
 
 #include <steam/isteamnetworkingutils.h>
 
+#include <atomic>
+#include <new>
+#include <cstring>
+
 namespace Walnut::Utils {
 
 	bool IsValidIPAddress(std::string_view ipAddress)
@@ -12,4 +16,88 @@ namespace Walnut::Utils {
 		return address.ParseString(ipAddressStr.c_str());
 	}
 
-}
\ No newline at end of file
+	static void ReleaseOwnedBuffer(SteamNetworkingMessage_t* message)
+	{
+		// Can be called from any GameNetworkingSockets thread
+		Buffer buffer(message->m_pData, message->m_cbSize);
+		buffer.Release();
+	}
+
+	SteamNetworkingMessage_t* CreateMessageFromOwnedBuffer(Buffer buffer, HSteamNetConnection connection, int sendFlags)
+	{
+		// Allocate just the message header - payload is the buffer we were handed
+		SteamNetworkingMessage_t* message = SteamNetworkingUtils()->AllocateMessage(0);
+		message->m_pData = buffer.Data;
+		message->m_cbSize = (int)buffer.Size;
+		message->m_pfnFreeData = ReleaseOwnedBuffer;
+		message->m_conn = connection;
+		message->m_nFlags = sendFlags;
+		return message;
+	}
+
+	struct SharedPayload
+	{
+		std::atomic<uint32_t> RefCount;
+		uint32_t Size;
+		// Payload follows
+
+		uint8_t* GetData() { return (uint8_t*)(this + 1); }
+	};
+
+	SharedPayload* CreateSharedPayload(const Buffer& payload)
+	{
+		SharedPayload* sharedPayload = new (::operator new(sizeof(SharedPayload) + payload.Size)) SharedPayload{ 1, (uint32_t)payload.Size };
+		memcpy(sharedPayload->GetData(), payload.Data, payload.Size);
+		return sharedPayload;
+	}
+
+	void ReleaseSharedPayload(SharedPayload* payload)
+	{
+		if (payload->RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			payload->~SharedPayload();
+			::operator delete(payload);
+		}
+	}
+
+	static void ReleaseSharedPayloadMessage(SteamNetworkingMessage_t* message)
+	{
+		// Can be called from any GameNetworkingSockets thread
+		ReleaseSharedPayload((SharedPayload*)message->m_nUserData);
+	}
+
+	void CreateBroadcastMessages(SharedPayload* payload, std::span<const HSteamNetConnection> connections, int sendFlags, uint16_t lane, std::vector<SteamNetworkingMessage_t*>& outMessages)
+	{
+		if (connections.empty())
+			return;
+
+		payload->RefCount.fetch_add((uint32_t)connections.size(), std::memory_order_relaxed);
+
+		ISteamNetworkingUtils* utils = SteamNetworkingUtils();
+		outMessages.reserve(outMessages.size() + connections.size());
+		for (HSteamNetConnection connection : connections)
+		{
+			SteamNetworkingMessage_t* message = utils->AllocateMessage(0);
+			message->m_pData = payload->GetData();
+			message->m_cbSize = (int)payload->Size;
+			message->m_pfnFreeData = ReleaseSharedPayloadMessage;
+			message->m_nUserData = (int64)payload;
+			message->m_conn = connection;
+			message->m_nFlags = sendFlags;
+			message->m_idxLane = lane;
+			outMessages.push_back(message);
+		}
+	}
+
+	void CreateBroadcastMessages(const Buffer& payload, std::span<const HSteamNetConnection> connections, int sendFlags, uint16_t lane, std::vector<SteamNetworkingMessage_t*>& outMessages)
+	{
+		if (connections.empty())
+			return;
+
+		// Single copy of the payload for every recipient
+		SharedPayload* sharedPayload = CreateSharedPayload(payload);
+		CreateBroadcastMessages(sharedPayload, connections, sendFlags, lane, outMessages);
+		ReleaseSharedPayload(sharedPayload);
+	}
+
+}
@@ -1,12 +1,58 @@
 #pragma once
 
+#include "Walnut/Core/Buffer.h"
+
+#include <steam/steamnetworkingtypes.h>
+
 #include <string>
+#include <span>
+#include <vector>
+#include <cstdint>
 
 namespace Walnut::Utils {
 
 	bool IsValidIPAddress(std::string_view ipAddress);
 
+	// Wraps a buffer allocated with Buffer::Allocate/Buffer::Copy in a message for ISteamNetworkingSockets::SendMessages
+	// without copying the payload. Ownership of the buffer passes to the message, which releases it once sent.
+	SteamNetworkingMessage_t* CreateMessageFromOwnedBuffer(Buffer buffer, HSteamNetConnection connection, int sendFlags);
+
+	// Refcounted copy of a payload that can be shared between many outgoing messages
+	struct SharedPayload;
+
+	// Returned payload holds one reference for the caller, drop it with ReleaseSharedPayload
+	SharedPayload* CreateSharedPayload(const Buffer& payload);
+	void ReleaseSharedPayload(SharedPayload* payload);
+
+	// Creates one message per connection on the given lane (appended to outMessages), each holding a reference to the shared payload.
+	// The payload is freed once the library has released the last of the messages.
+	void CreateBroadcastMessages(SharedPayload* payload, std::span<const HSteamNetConnection> connections, int sendFlags, uint16_t lane, std::vector<SteamNetworkingMessage_t*>& outMessages);
+	void CreateBroadcastMessages(const Buffer& payload, std::span<const HSteamNetConnection> connections, int sendFlags, uint16_t lane, std::vector<SteamNetworkingMessage_t*>& outMessages);
+
 	// Platform-specific implementations
+
+	// Blocking, returns the first address for the name ("host" or "host:port"), or empty on failure.
+	// Prefer DomainNameResolver, which doesn't block and caches results.
 	std::string ResolveDomainName(std::string_view name);
 
+	// Blocking lookup of every IPv4 and IPv6 address of a host name (no port), IPv4 first
+	std::vector<std::string> LookupHostAddresses(std::string_view hostName);
+
+	// Fills data from the OS cryptographically secure generator, false if it isn't available
+	bool GetSecureRandomBytes(void* data, size_t size);
+
+	struct MappedFile
+	{
+		std::byte* Data = nullptr;
+		uint64_t Size = 0;
+		bool Writable = false;
+		int64_t FileHandle = -1;
+		void* MappingHandle = nullptr; // Windows only
+	};
+
+	// Writable files are created (or truncated) and mapped at the given size, read-only files are mapped whole
+	bool MapFile(const std::string& path, uint64_t size, bool writable, MappedFile& file);
+	// Writable files are cut down to finalSize once unmapped
+	void UnmapFile(MappedFile& file, uint64_t finalSize = 0);
+
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Token bucket
+	// Refills at Rate tokens per second, up to Burst. Consuming more than is available fails without taking anything,
+	// so a bucket allows Rate per second on average with bursts of up to Burst. A rate of 0 means unlimited.
+	// Not thread-safe, each bucket belongs to one thread.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class TokenBucket
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+	public:
+		TokenBucket() = default;
+		TokenBucket(double rate, double burst, Clock::time_point now = Clock::now())
+		{
+			Configure(rate, burst, now);
+		}
+
+		// Starts full
+		void Configure(double rate, double burst, Clock::time_point now = Clock::now())
+		{
+			m_Rate = rate;
+			m_Burst = std::max(burst, rate > 0.0 ? 1.0 : 0.0);
+			m_Tokens = m_Burst;
+			m_LastRefill = now;
+		}
+
+		bool TryConsume(double tokens, Clock::time_point now)
+		{
+			if (IsUnlimited())
+				return true;
+
+			Refill(now);
+			if (m_Tokens < tokens)
+				return false;
+
+			m_Tokens -= tokens;
+			return true;
+		}
+
+		// Like TryConsume, without taking anything
+		bool CanConsume(double tokens, Clock::time_point now)
+		{
+			if (IsUnlimited())
+				return true;
+
+			Refill(now);
+			return m_Tokens >= tokens;
+		}
+
+		void Refill(Clock::time_point now)
+		{
+			if (now <= m_LastRefill)
+				return;
+
+			double elapsed = std::chrono::duration<double>(now - m_LastRefill).count();
+			m_Tokens = std::min(m_Burst, m_Tokens + elapsed * m_Rate);
+			m_LastRefill = now;
+		}
+
+		bool IsUnlimited() const { return m_Rate <= 0.0; }
+
+		// As of the last refill
+		double GetTokens() const { return m_Tokens; }
+		bool IsFull() const { return m_Tokens >= m_Burst; }
+
+		// Would be full if refilled now, eg. a bucket that has been idle long enough to be dropped
+		bool IsFull(Clock::time_point now) const
+		{
+			return IsUnlimited() || m_Tokens + std::chrono::duration<double>(now - m_LastRefill).count() * m_Rate >= m_Burst;
+		}
+
+		double GetRate() const { return m_Rate; }
+		double GetBurst() const { return m_Burst; }
+	private:
+		double m_Rate = 0.0;
+		double m_Burst = 0.0;
+		double m_Tokens = 0.0;
+		Clock::time_point m_LastRefill{};
+	};
+
+}
@@ -0,0 +1,102 @@
+#include "ReceivedMessage.h"
+
+#include <atomic>
+
+namespace Walnut {
+
+	static_assert(std::atomic_ref<int64>::required_alignment <= alignof(int64), "Message user data can't hold the reference count");
+
+	static std::atomic_ref<int64> GetReferenceCount(ISteamNetworkingMessage* message)
+	{
+		return std::atomic_ref<int64>(message->m_nUserData);
+	}
+
+	static void ReleaseReference(ISteamNetworkingMessage* message)
+	{
+		// Last reference - no other thread can be touching the count, so skip the read-modify-write
+		if (GetReferenceCount(message).load(std::memory_order_acquire) == 1 || GetReferenceCount(message).fetch_sub(1, std::memory_order_acq_rel) == 1)
+			message->Release();
+	}
+
+	// Scopes can nest (eg. a callback that pumps another Client), the innermost one is searched first
+	static thread_local Utils::ReceivedMessageScope* s_CurrentScope = nullptr;
+
+	ReceivedMessage ReceivedMessage::Retain(const Buffer& buffer)
+	{
+		for (Utils::ReceivedMessageScope* scope = s_CurrentScope; scope; scope = scope->m_Previous)
+		{
+			for (ISteamNetworkingMessage* message : scope->m_Messages)
+			{
+				if (message->m_pData == buffer.Data && (uint64_t)message->m_cbSize == (uint64_t)buffer.Size)
+				{
+					GetReferenceCount(message).fetch_add(1, std::memory_order_relaxed);
+					return ReceivedMessage(message);
+				}
+			}
+		}
+
+		return ReceivedMessage();
+	}
+
+	ReceivedMessage::ReceivedMessage(const ReceivedMessage& other)
+		: m_Message(other.m_Message)
+	{
+		if (m_Message)
+			GetReferenceCount(m_Message).fetch_add(1, std::memory_order_relaxed);
+	}
+
+	ReceivedMessage& ReceivedMessage::operator=(const ReceivedMessage& other)
+	{
+		if (this != &other)
+		{
+			if (other.m_Message)
+				GetReferenceCount(other.m_Message).fetch_add(1, std::memory_order_relaxed);
+
+			Reset();
+			m_Message = other.m_Message;
+		}
+		return *this;
+	}
+
+	ReceivedMessage& ReceivedMessage::operator=(ReceivedMessage&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Reset();
+			m_Message = other.m_Message;
+			other.m_Message = nullptr;
+		}
+		return *this;
+	}
+
+	void ReceivedMessage::Reset()
+	{
+		if (m_Message)
+			ReleaseReference(m_Message);
+
+		m_Message = nullptr;
+	}
+
+	namespace Utils {
+
+		ReceivedMessageScope::ReceivedMessageScope(std::span<ISteamNetworkingMessage* const> messages)
+			: m_Messages(messages), m_Previous(s_CurrentScope)
+		{
+			// Not shared with anything yet, so plain stores
+			for (ISteamNetworkingMessage* message : m_Messages)
+				message->m_nUserData = 1;
+
+			s_CurrentScope = this;
+		}
+
+		ReceivedMessageScope::~ReceivedMessageScope()
+		{
+			s_CurrentScope = m_Previous;
+
+			for (ISteamNetworkingMessage* message : m_Messages)
+				ReleaseReference(message);
+		}
+
+	}
+
+}
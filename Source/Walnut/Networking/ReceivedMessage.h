@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Walnut/Core/Buffer.h"
+
+#include <steam/steamnetworkingsockets.h>
+
+#include <span>
+#include <cstdint>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Refcounted handle to a received message
+	// Buffers passed to data received callbacks point into the library's message, which is released once the callback
+	// returns. Retaining the message from inside the callback keeps the payload alive without copying it - the message
+	// is released when the last handle goes away, from whichever thread that happens on.
+	//
+	// The count lives in the message itself (SteamNetworkingMessage_t::m_nUserData, unused for received messages),
+	// so retaining and copying handles doesn't allocate.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class ReceivedMessage
+	{
+	public:
+		// Only valid inside a Client/Server data received callback (single or batch) for one of the buffers it was
+		// passed, on the thread calling it. Returns an empty handle otherwise.
+		static ReceivedMessage Retain(const Buffer& buffer);
+	public:
+		ReceivedMessage() = default;
+		~ReceivedMessage() { Reset(); }
+
+		ReceivedMessage(const ReceivedMessage& other);
+		ReceivedMessage& operator=(const ReceivedMessage& other);
+
+		ReceivedMessage(ReceivedMessage&& other) noexcept
+			: m_Message(other.m_Message)
+		{
+			other.m_Message = nullptr;
+		}
+
+		ReceivedMessage& operator=(ReceivedMessage&& other) noexcept;
+
+		void Reset();
+
+		const void* GetData() const { return m_Message ? m_Message->m_pData : nullptr; }
+		uint32_t GetSize() const { return m_Message ? (uint32_t)m_Message->m_cbSize : 0; }
+		Buffer GetBuffer() const { return Buffer(GetData(), GetSize()); }
+
+		uint16_t GetLane() const { return m_Message ? m_Message->m_idxLane : 0; }
+		SteamNetworkingMicroseconds GetTimeReceived() const { return m_Message ? m_Message->m_usecTimeReceived : 0; }
+
+		explicit operator bool() const { return m_Message != nullptr; }
+	private:
+		explicit ReceivedMessage(ISteamNetworkingMessage* message)
+			: m_Message(message) {}
+	private:
+		ISteamNetworkingMessage* m_Message = nullptr;
+	};
+
+	namespace Utils {
+
+		// Brackets the data received callbacks for a batch of messages. Takes the receive loop's reference to
+		// each message, which is dropped (releasing messages that weren't retained) when the scope ends.
+		// Messages must have been received, and not yet exposed to anything else.
+		class ReceivedMessageScope
+		{
+		public:
+			ReceivedMessageScope(std::span<ISteamNetworkingMessage* const> messages);
+			~ReceivedMessageScope();
+
+			ReceivedMessageScope(const ReceivedMessageScope&) = delete;
+			ReceivedMessageScope& operator=(const ReceivedMessageScope&) = delete;
+		private:
+			std::span<ISteamNetworkingMessage* const> m_Messages;
+			ReceivedMessageScope* m_Previous;
+
+			friend class Walnut::ReceivedMessage;
+		};
+
+	}
+
+}
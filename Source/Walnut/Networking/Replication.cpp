@@ -0,0 +1,344 @@
+#include "Replication.h"
+
+#include "Server.h"
+#include "Client.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Walnut {
+
+	namespace {
+
+		// Unchanged gaps shorter than this are cheaper to send as part of the changed run
+		constexpr size_t MinUnchangedRun = 4;
+
+		void WriteVarint(std::vector<std::byte>& out, uint64_t value)
+		{
+			while (value >= 0x80)
+			{
+				out.push_back((std::byte)(value | 0x80));
+				value >>= 7;
+			}
+			out.push_back((std::byte)value);
+		}
+
+		bool ReadVarint(std::span<const std::byte> data, size_t& position, uint64_t& value)
+		{
+			value = 0;
+			for (uint32_t shift = 0; shift < 64; shift += 7)
+			{
+				if (position >= data.size())
+					return false;
+
+				uint8_t byte = (uint8_t)data[position++];
+				value |= (uint64_t)(byte & 0x7F) << shift;
+				if (!(byte & 0x80))
+					return true;
+			}
+			return false;
+		}
+
+		std::byte BaselineByte(std::span<const std::byte> baseline, size_t index)
+		{
+			return index < baseline.size() ? baseline[index] : std::byte(0);
+		}
+
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// SnapshotReplicator
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	SnapshotReplicator::SnapshotReplicator(Server& server, uint32_t historySize)
+		: m_Server(server), m_HistorySize(std::max(historySize, 1u)), m_Counters(std::make_shared<Counters>())
+	{
+	}
+
+	uint32_t SnapshotReplicator::Publish(const Buffer& state)
+	{
+		uint32_t sequence = ++m_Sequence;
+
+		const std::byte* stateBytes = (const std::byte*)state.Data;
+		auto stateData = std::make_shared<const std::vector<std::byte>>(stateBytes, stateBytes + state.Size);
+		m_History.push_back({ sequence, stateData });
+		while (m_History.size() > m_HistorySize)
+			m_History.pop_front();
+
+		m_Counters->SnapshotsPublished.fetch_add(1, std::memory_order_relaxed);
+
+		// Baselines as of now - filters may run later on the server thread, so they get their own copy
+		auto baselines = std::make_shared<std::unordered_map<ClientID, uint32_t>>();
+		{
+			std::scoped_lock lock(m_AckMutex);
+			for (const auto& [clientID, ackedSequence] : m_AckedSequences)
+			{
+				if (FindSnapshot(ackedSequence))
+					baselines->emplace(clientID, ackedSequence);
+			}
+		}
+
+		std::vector<uint32_t> baselineSequences;
+		for (const auto& [clientID, baselineSequence] : *baselines)
+		{
+			if (std::find(baselineSequences.begin(), baselineSequences.end(), baselineSequence) == baselineSequences.end())
+				baselineSequences.push_back(baselineSequence);
+		}
+
+		std::span<const std::byte> stateSpan = *stateData;
+
+		// Full snapshot for clients without a usable baseline (new, or lost too much)
+		SendSnapshot(sequence, 0, stateSpan, stateSpan.size(), [baselines](const ClientInfo& client) { return !baselines->contains(client.ID); });
+
+		// One delta per distinct baseline
+		for (uint32_t baselineSequence : baselineSequences)
+		{
+			const Snapshot* baseline = FindSnapshot(baselineSequence);
+			Utils::EncodeDelta(*baseline->State, stateSpan, m_DeltaBuffer);
+
+			auto filter = [baselines, baselineSequence](const ClientInfo& client)
+			{
+				auto it = baselines->find(client.ID);
+				return it != baselines->end() && it->second == baselineSequence;
+			};
+
+			if (m_DeltaBuffer.size() < stateSpan.size())
+				SendSnapshot(sequence, baselineSequence, m_DeltaBuffer, stateSpan.size(), std::move(filter));
+			else
+				SendSnapshot(sequence, 0, stateSpan, stateSpan.size(), std::move(filter));
+		}
+
+		return sequence;
+	}
+
+	void SnapshotReplicator::SendSnapshot(uint32_t sequence, uint32_t baselineSequence, std::span<const std::byte> data, size_t stateSize, std::function<bool(const ClientInfo&)>&& filter)
+	{
+		SnapshotMessage message;
+		message.Sequence = sequence;
+		message.BaselineSequence = baselineSequence;
+		message.StateSize = (uint32_t)stateSize;
+
+		uint32_t size = GetEncodedMessageSize<SnapshotMessage>(data.size());
+		m_EncodeBuffer.resize(size);
+		EncodeMessage(m_EncodeBuffer.data(), message, data);
+
+		// Recipients are counted as the filter picks them
+		std::shared_ptr<Counters> counters = m_Counters;
+		bool full = baselineSequence == 0;
+		m_Server.SendBufferToAllClients(Buffer(m_EncodeBuffer.data(), size), [counters, full, size, filter = std::move(filter)](const ClientInfo& client)
+		{
+			if (!filter(client))
+				return false;
+
+			(full ? counters->FullSnapshotsSent : counters->DeltaSnapshotsSent).fetch_add(1, std::memory_order_relaxed);
+			(full ? counters->FullBytesSent : counters->DeltaBytesSent).fetch_add(size, std::memory_order_relaxed);
+			return true;
+		}, false);
+	}
+
+	bool SnapshotReplicator::HandleMessage(const ClientInfo& client, const Buffer& buffer)
+	{
+		MessageHeader header;
+		if (!ReadMessageHeader(buffer, header) || (header.ID != SnapshotMessage::ID && header.ID != SnapshotAckMessage::ID))
+			return false;
+
+		auto handler = [this, &client](MessageView<SnapshotAckMessage> ack)
+		{
+			if (ack->Sequence == 0 || ack->Sequence > m_Sequence)
+				return;
+
+			std::scoped_lock lock(m_AckMutex);
+			uint32_t& ackedSequence = m_AckedSequences[client.ID];
+			ackedSequence = std::max(ackedSequence, ack->Sequence);
+		};
+
+		ReplicationProtocol::Dispatch(buffer, handler);
+		return true;
+	}
+
+	void SnapshotReplicator::RemoveClient(ClientID clientID)
+	{
+		std::scoped_lock lock(m_AckMutex);
+		m_AckedSequences.erase(clientID);
+	}
+
+	ReplicationStats SnapshotReplicator::GetStats() const
+	{
+		ReplicationStats stats;
+		stats.SnapshotsPublished = m_Counters->SnapshotsPublished.load(std::memory_order_relaxed);
+		stats.FullSnapshotsSent = m_Counters->FullSnapshotsSent.load(std::memory_order_relaxed);
+		stats.DeltaSnapshotsSent = m_Counters->DeltaSnapshotsSent.load(std::memory_order_relaxed);
+		stats.FullBytesSent = m_Counters->FullBytesSent.load(std::memory_order_relaxed);
+		stats.DeltaBytesSent = m_Counters->DeltaBytesSent.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	const SnapshotReplicator::Snapshot* SnapshotReplicator::FindSnapshot(uint32_t sequence) const
+	{
+		if (m_History.empty() || sequence < m_History.front().Sequence || sequence > m_History.back().Sequence)
+			return nullptr;
+
+		// Sequences in the history are consecutive
+		return &m_History[sequence - m_History.front().Sequence];
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// SnapshotReceiver
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	SnapshotReceiver::SnapshotReceiver(Client& client, uint32_t historySize)
+		: m_Client(client), m_HistorySize(std::max(historySize, 1u))
+	{
+	}
+
+	bool SnapshotReceiver::HandleMessage(const Buffer& buffer)
+	{
+		MessageHeader header;
+		if (!ReadMessageHeader(buffer, header) || (header.ID != SnapshotMessage::ID && header.ID != SnapshotAckMessage::ID))
+			return false;
+
+		auto handler = [this](MessageView<SnapshotMessage> message) { OnSnapshot(message); };
+		if (ReplicationProtocol::Dispatch(buffer, handler) != DispatchResult::Handled && header.ID == SnapshotMessage::ID)
+			m_DroppedCount++;
+
+		return true;
+	}
+
+	void SnapshotReceiver::OnSnapshot(const MessageView<SnapshotMessage>& message)
+	{
+		// Unreliable, so snapshots can arrive late or twice
+		if (message->Sequence <= GetLatestSequence() || message->StateSize > (uint32_t)k_cbMaxSteamNetworkingSocketsMessageSizeSend)
+		{
+			m_DroppedCount++;
+			return;
+		}
+
+		Snapshot snapshot;
+		snapshot.Sequence = message->Sequence;
+
+		std::span<const std::byte> data = message.GetTrailingData();
+		if (message->BaselineSequence == 0)
+		{
+			if (data.size() != message->StateSize)
+			{
+				m_DroppedCount++;
+				return;
+			}
+
+			snapshot.State.assign(data.begin(), data.end());
+		}
+		else
+		{
+			auto baseline = std::find_if(m_History.begin(), m_History.end(), [&](const Snapshot& s) { return s.Sequence == message->BaselineSequence; });
+			if (baseline == m_History.end() || !Utils::ApplyDelta(baseline->State, data, snapshot.State, message->StateSize))
+			{
+				m_DroppedCount++;
+				return;
+			}
+		}
+
+		m_History.push_back(std::move(snapshot));
+		while (m_History.size() > m_HistorySize)
+			m_History.pop_front();
+
+		const Snapshot& latest = m_History.back();
+		m_Client.SendTypedMessage(SnapshotAckMessage{ latest.Sequence }, false);
+
+		if (m_SnapshotCallback)
+			m_SnapshotCallback(latest.Sequence, Buffer(latest.State.data(), latest.State.size()));
+	}
+
+	void SnapshotReceiver::Reset()
+	{
+		m_History.clear();
+	}
+
+	std::span<const std::byte> SnapshotReceiver::GetLatestState() const
+	{
+		if (m_History.empty())
+			return {};
+
+		return m_History.back().State;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Delta encoding
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	namespace Utils {
+
+		void EncodeDelta(std::span<const std::byte> baseline, std::span<const std::byte> target, std::vector<std::byte>& out)
+		{
+			out.clear();
+
+			auto isChanged = [&](size_t index) { return target[index] != BaselineByte(baseline, index); };
+
+			size_t position = 0;
+			while (position < target.size())
+			{
+				size_t unchangedStart = position;
+				while (position < target.size() && !isChanged(position))
+					position++;
+
+				// Unchanged tail is implied
+				if (position == target.size())
+					break;
+
+				size_t changedStart = position;
+				while (position < target.size())
+				{
+					if (isChanged(position))
+					{
+						position++;
+						continue;
+					}
+
+					// Absorb short unchanged gaps into the run
+					size_t gapEnd = position;
+					while (gapEnd < target.size() && !isChanged(gapEnd) && gapEnd - position < MinUnchangedRun)
+						gapEnd++;
+
+					if (gapEnd - position >= MinUnchangedRun || gapEnd == target.size())
+						break;
+
+					position = gapEnd;
+				}
+
+				WriteVarint(out, changedStart - unchangedStart);
+				WriteVarint(out, position - changedStart);
+				for (size_t i = changedStart; i < position; i++)
+					out.push_back(target[i] ^ BaselineByte(baseline, i));
+			}
+		}
+
+		bool ApplyDelta(std::span<const std::byte> baseline, std::span<const std::byte> delta, std::vector<std::byte>& target, size_t targetSize)
+		{
+			target.resize(targetSize);
+
+			size_t deltaPosition = 0;
+			size_t position = 0;
+			while (deltaPosition < delta.size())
+			{
+				uint64_t unchanged, changed;
+				if (!ReadVarint(delta, deltaPosition, unchanged) || !ReadVarint(delta, deltaPosition, changed))
+					return false;
+
+				if (unchanged > targetSize - position || changed > targetSize - position - unchanged || changed > delta.size() - deltaPosition)
+					return false;
+
+				for (size_t end = position + unchanged; position < end; position++)
+					target[position] = BaselineByte(baseline, position);
+
+				for (size_t end = position + changed; position < end; position++)
+					target[position] = delta[deltaPosition++] ^ BaselineByte(baseline, position);
+			}
+
+			for (; position < targetSize; position++)
+				target[position] = BaselineByte(baseline, position);
+
+			return true;
+		}
+
+	}
+
+}
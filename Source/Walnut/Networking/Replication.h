@@ -0,0 +1,171 @@
+#pragma once
+
+#include "Walnut/Core/Buffer.h"
+
+#include "MessageProtocol.h"
+#include "ClientRegistry.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <span>
+#include <functional>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+namespace Walnut {
+
+	class Server;
+	class Client;
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Snapshot/delta state replication
+	//
+	// The server publishes the whole state each tick with SnapshotReplicator::Publish(). Each client is sent
+	// an unreliable delta against the last snapshot it acknowledged, or a full snapshot if it hasn't
+	// acknowledged one that's still in the history (new client, or too much loss). Clients that share a
+	// baseline share one encoded delta, sent as a single broadcast.
+	//
+	// The client reconstructs states with SnapshotReceiver and acknowledges each one (unreliably).
+	// Lost snapshots need no resends - the next delta is simply against an older baseline.
+	//
+	// Deltas are XOR runs against the baseline, so fields that didn't change cost nothing. States must be
+	// stable in layout between ticks for deltas to be small (eg. fixed-size records at fixed offsets).
+	//
+	// Both ends route received data through HandleMessage() first, which consumes replication messages.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct SnapshotMessage
+	{
+		static constexpr MessageID ID = FirstReservedMessageID;
+		static constexpr bool HasTrailingData = true; // Full state, or delta against the baseline
+
+		uint32_t Sequence = 0;
+		uint32_t BaselineSequence = 0; // 0 for full snapshots
+		uint32_t StateSize = 0;
+		uint32_t Reserved = 0;
+	};
+
+	struct SnapshotAckMessage
+	{
+		static constexpr MessageID ID = FirstReservedMessageID + 1;
+
+		uint32_t Sequence = 0;
+	};
+
+	using ReplicationProtocol = MessageProtocol<SnapshotMessage, SnapshotAckMessage>;
+
+	struct ReplicationStats
+	{
+		uint64_t SnapshotsPublished = 0;
+		uint64_t FullSnapshotsSent = 0; // Per client
+		uint64_t DeltaSnapshotsSent = 0;
+		uint64_t FullBytesSent = 0;
+		uint64_t DeltaBytesSent = 0;
+	};
+
+	class SnapshotReplicator
+	{
+	public:
+		static constexpr uint32_t DefaultHistorySize = 32;
+	public:
+		SnapshotReplicator(Server& server, uint32_t historySize = DefaultHistorySize);
+
+		// Sends the state to every connected client. Call from one thread at a time.
+		// Returns the sequence number of the snapshot.
+		uint32_t Publish(const Buffer& state);
+
+		// Call from the server's data received callback before anything else. Returns true if the message was consumed.
+		bool HandleMessage(const ClientInfo& client, const Buffer& buffer);
+
+		// Call from the client disconnected callback
+		void RemoveClient(ClientID clientID);
+
+		uint32_t GetLatestSequence() const { return m_Sequence; }
+		ReplicationStats GetStats() const;
+	private:
+		struct Snapshot
+		{
+			uint32_t Sequence;
+			std::shared_ptr<const std::vector<std::byte>> State;
+		};
+
+		// Shared with the send filters, which can run on the server thread after Publish() returns
+		struct Counters
+		{
+			std::atomic<uint64_t> SnapshotsPublished = 0;
+			std::atomic<uint64_t> FullSnapshotsSent = 0;
+			std::atomic<uint64_t> DeltaSnapshotsSent = 0;
+			std::atomic<uint64_t> FullBytesSent = 0;
+			std::atomic<uint64_t> DeltaBytesSent = 0;
+		};
+
+		const Snapshot* FindSnapshot(uint32_t sequence) const;
+		void SendSnapshot(uint32_t sequence, uint32_t baselineSequence, std::span<const std::byte> data, size_t stateSize, std::function<bool(const ClientInfo&)>&& filter);
+	private:
+		Server& m_Server;
+		uint32_t m_HistorySize;
+		std::atomic<uint32_t> m_Sequence = 0; // Read by HandleMessage() on the server thread
+		std::deque<Snapshot> m_History;
+		std::vector<std::byte> m_DeltaBuffer;
+		std::vector<std::byte> m_EncodeBuffer;
+
+		// Last acknowledged sequence per client, written from the server's callbacks
+		std::mutex m_AckMutex;
+		std::unordered_map<ClientID, uint32_t> m_AckedSequences;
+
+		std::shared_ptr<Counters> m_Counters;
+	};
+
+	class SnapshotReceiver
+	{
+	public:
+		// State is only valid for the duration of the callback
+		using SnapshotCallback = std::function<void(uint32_t sequence, const Buffer& state)>;
+	public:
+		SnapshotReceiver(Client& client, uint32_t historySize = SnapshotReplicator::DefaultHistorySize);
+
+		void SetSnapshotCallback(const SnapshotCallback& function) { m_SnapshotCallback = function; }
+
+		// Call from the client's data received callback before anything else. Returns true if the message was consumed.
+		// Not thread safe - call from one thread (the network thread, or the DispatchPending() thread).
+		bool HandleMessage(const Buffer& buffer);
+
+		// Forget all states, eg. after reconnecting
+		void Reset();
+
+		uint32_t GetLatestSequence() const { return m_History.empty() ? 0 : m_History.back().Sequence; }
+		std::span<const std::byte> GetLatestState() const;
+
+		uint64_t GetDroppedSnapshotCount() const { return m_DroppedCount; }
+	private:
+		void OnSnapshot(const MessageView<SnapshotMessage>& message);
+	private:
+		struct Snapshot
+		{
+			uint32_t Sequence;
+			std::vector<std::byte> State;
+		};
+
+		Client& m_Client;
+		uint32_t m_HistorySize;
+		std::deque<Snapshot> m_History; // Oldest first
+		SnapshotCallback m_SnapshotCallback;
+		uint64_t m_DroppedCount = 0; // Out of order, or baseline no longer available
+	};
+
+	namespace Utils {
+
+		// Delta format: repeated [varint unchanged byte count][varint changed byte count][changed bytes XOR baseline].
+		// Baseline bytes past its end count as zero, so states can grow and shrink.
+		void EncodeDelta(std::span<const std::byte> baseline, std::span<const std::byte> target, std::vector<std::byte>& out);
+
+		// Returns false if the delta is malformed
+		bool ApplyDelta(std::span<const std::byte> baseline, std::span<const std::byte> delta, std::vector<std::byte>& target, size_t targetSize);
+
+	}
+
+}
@@ -0,0 +1,167 @@
+#include "Rooms.h"
+
+#include <algorithm>
+
+namespace Walnut {
+
+	RoomID RoomRegistry::Create()
+	{
+		std::unique_lock lock(m_Mutex);
+
+		if (m_Rooms.empty())
+			m_Rooms.emplace_back(); // InvalidRoom
+
+		RoomID room;
+		if (!m_FreeRooms.empty())
+		{
+			room = m_FreeRooms.back();
+			m_FreeRooms.pop_back();
+		}
+		else
+		{
+			room = (RoomID)m_Rooms.size();
+			m_Rooms.emplace_back();
+		}
+
+		m_Rooms[room].Alive = true;
+		return room;
+	}
+
+	void RoomRegistry::Destroy(RoomID room)
+	{
+		std::unique_lock lock(m_Mutex);
+
+		Room* r = FindRoom(room);
+		if (!r)
+			return;
+
+		// Keep the bitset allocation for the next room
+		r->Alive = false;
+		r->Size = 0;
+		std::fill(r->Bits.begin(), r->Bits.end(), 0);
+		m_FreeRooms.push_back(room);
+	}
+
+	bool RoomRegistry::Add(RoomID room, const ClientInfo& client)
+	{
+		std::unique_lock lock(m_Mutex);
+
+		// Checked under the lock, so a slot can't be reused by another client in between
+		Room* r = FindRoom(room);
+		if (!r || !m_Clients.Get(client.Slot, client.ID))
+			return false;
+
+		size_t word = client.Slot / 64;
+		if (word >= r->Bits.size())
+			r->Bits.resize(word + 1);
+
+		uint64_t mask = 1ull << (client.Slot % 64);
+		if (!(r->Bits[word] & mask))
+		{
+			r->Bits[word] |= mask;
+			r->Size++;
+		}
+		return true;
+	}
+
+	bool RoomRegistry::Remove(RoomID room, const ClientInfo& client)
+	{
+		std::unique_lock lock(m_Mutex);
+
+		Room* r = FindRoom(room);
+		if (!r || !m_Clients.Get(client.Slot, client.ID))
+			return false;
+
+		size_t word = client.Slot / 64;
+		uint64_t mask = 1ull << (client.Slot % 64);
+		if (word < r->Bits.size() && (r->Bits[word] & mask))
+		{
+			r->Bits[word] &= ~mask;
+			r->Size--;
+		}
+		return true;
+	}
+
+	bool RoomRegistry::Contains(RoomID room, const ClientInfo& client) const
+	{
+		std::shared_lock lock(m_Mutex);
+
+		const Room* r = FindRoom(room);
+		size_t word = client.Slot / 64;
+		return r && word < r->Bits.size() && (r->Bits[word] & (1ull << (client.Slot % 64))) && m_Clients.Get(client.Slot, client.ID);
+	}
+
+	void RoomRegistry::Clear(RoomID room)
+	{
+		std::unique_lock lock(m_Mutex);
+
+		if (Room* r = FindRoom(room))
+		{
+			r->Size = 0;
+			std::fill(r->Bits.begin(), r->Bits.end(), 0);
+		}
+	}
+
+	uint32_t RoomRegistry::GetSize(RoomID room) const
+	{
+		std::shared_lock lock(m_Mutex);
+
+		const Room* r = FindRoom(room);
+		return r ? r->Size : 0;
+	}
+
+	void RoomRegistry::RemoveFromAll(uint32_t slot)
+	{
+		std::unique_lock lock(m_Mutex);
+
+		size_t word = slot / 64;
+		uint64_t mask = 1ull << (slot % 64);
+		for (Room& room : m_Rooms)
+		{
+			if (word < room.Bits.size() && (room.Bits[word] & mask))
+			{
+				room.Bits[word] &= ~mask;
+				room.Size--;
+			}
+		}
+	}
+
+	void RoomRegistry::Move(uint32_t slot, uint32_t newSlot)
+	{
+		std::unique_lock lock(m_Mutex);
+
+		size_t word = slot / 64;
+		uint64_t mask = 1ull << (slot % 64);
+		size_t newWord = newSlot / 64;
+		uint64_t newMask = 1ull << (newSlot % 64);
+		for (Room& room : m_Rooms)
+		{
+			if (word >= room.Bits.size() || !(room.Bits[word] & mask))
+				continue;
+
+			room.Bits[word] &= ~mask;
+			room.Size--;
+
+			if (newWord >= room.Bits.size())
+				room.Bits.resize(newWord + 1);
+
+			if (!(room.Bits[newWord] & newMask))
+			{
+				room.Bits[newWord] |= newMask;
+				room.Size++;
+			}
+		}
+	}
+
+	void RoomRegistry::RemoveAllClients()
+	{
+		std::unique_lock lock(m_Mutex);
+
+		for (Room& room : m_Rooms)
+		{
+			room.Size = 0;
+			std::fill(room.Bits.begin(), room.Bits.end(), 0);
+		}
+	}
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "ClientRegistry.h"
+
+#include <algorithm>
+#include <bit>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+namespace Walnut {
+
+	using RoomID = uint32_t;
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Rooms (interest groups) for targeted broadcasts
+	//
+	// - Membership is a bitset over client slots, so joining/leaving is a bit flip and cheap enough to redo every tick
+	//   (eg. proximity-based interest management)
+	// - Sending to several rooms ORs their bitsets word by word, so a client in more than one room gets one copy
+	// - A client leaves every room when it disconnects, and slots are cleared again when reused
+	// - Any thread. Membership changes take the lock exclusively, sends take it shared
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class RoomRegistry
+	{
+	public:
+		static constexpr RoomID InvalidRoom = 0;
+	public:
+		RoomRegistry(const ClientRegistry& clients)
+			: m_Clients(clients) {}
+
+		RoomRegistry(const RoomRegistry&) = delete;
+		RoomRegistry& operator=(const RoomRegistry&) = delete;
+
+		RoomID Create();
+		void Destroy(RoomID room);
+
+		// Returns false if the room doesn't exist, or the client has disconnected
+		bool Add(RoomID room, const ClientInfo& client);
+		bool Remove(RoomID room, const ClientInfo& client);
+		bool Contains(RoomID room, const ClientInfo& client) const;
+		void Clear(RoomID room);
+		uint32_t GetSize(RoomID room) const;
+
+		// Server thread, when a slot is released or reused
+		void RemoveFromAll(uint32_t slot);
+		void RemoveAllClients();
+
+		// When a client resumes its session on a new slot. Puts the new slot in every room the old one is in,
+		// and takes the old one out
+		void Move(uint32_t slot, uint32_t newSlot);
+
+		// Calls function(const ClientInfo&) once for every client in any of the rooms.
+		// The lock is held shared throughout, so the function must not change membership.
+		template<typename Function>
+		void ForEachClient(std::span<const RoomID> rooms, Function&& function) const
+		{
+			std::shared_lock lock(m_Mutex);
+
+			size_t wordCount = 0;
+			for (RoomID room : rooms)
+			{
+				if (const Room* r = FindRoom(room))
+					wordCount = std::max(wordCount, r->Bits.size());
+			}
+
+			for (size_t word = 0; word < wordCount; word++)
+			{
+				uint64_t bits = 0;
+				for (RoomID room : rooms)
+				{
+					const Room* r = FindRoom(room);
+					if (r && word < r->Bits.size())
+						bits |= r->Bits[word];
+				}
+
+				while (bits)
+				{
+					uint32_t slot = (uint32_t)(word * 64 + std::countr_zero(bits));
+					bits &= bits - 1;
+
+					// Clients leave their rooms before their slot can be released
+					if (m_Clients.GetID(slot))
+						function(*m_Clients.Get(slot));
+				}
+			}
+		}
+	private:
+		struct Room
+		{
+			bool Alive = false;
+			uint32_t Size = 0;
+			std::vector<uint64_t> Bits; // Indexed by client slot
+		};
+
+		const Room* FindRoom(RoomID room) const
+		{
+			return room != InvalidRoom && room < m_Rooms.size() && m_Rooms[room].Alive ? &m_Rooms[room] : nullptr;
+		}
+
+		Room* FindRoom(RoomID room) { return const_cast<Room*>(std::as_const(*this).FindRoom(room)); }
+	private:
+		const ClientRegistry& m_Clients;
+
+		std::vector<Room> m_Rooms; // Index is the room ID, 0 is never used
+		std::vector<RoomID> m_FreeRooms;
+		mutable std::shared_mutex m_Mutex;
+	};
+
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+namespace Walnut {
+
+	// Bounded lock-free single-producer single-consumer ring buffer
+	// Capacity is rounded up to a power of two
+	template<typename T>
+	class SPSCQueue
+	{
+	public:
+		SPSCQueue() = default;
+		explicit SPSCQueue(uint32_t capacity) { Init(capacity); }
+
+		SPSCQueue(const SPSCQueue&) = delete;
+		SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+		// Not thread-safe, call before using the queue
+		void Init(uint32_t capacity)
+		{
+			uint32_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+
+			m_Capacity = size;
+			m_Mask = size - 1;
+			m_Slots = std::make_unique<T[]>(size);
+			m_WritePos.store(0, std::memory_order_relaxed);
+			m_ReadPos.store(0, std::memory_order_relaxed);
+			m_CachedReadPos = 0;
+			m_CachedWritePos = 0;
+		}
+
+		bool IsInitialized() const { return m_Slots != nullptr; }
+
+		// Producer thread only. Returns false if the queue is full
+		bool Push(T&& value)
+		{
+			uint64_t writePos = m_WritePos.load(std::memory_order_relaxed);
+			if (writePos - m_CachedReadPos == m_Capacity)
+			{
+				m_CachedReadPos = m_ReadPos.load(std::memory_order_acquire);
+				if (writePos - m_CachedReadPos == m_Capacity)
+					return false;
+			}
+
+			m_Slots[writePos & m_Mask] = std::move(value);
+			m_WritePos.store(writePos + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Producer thread only. Lower bound on how many pushes will succeed
+		uint32_t GetFreeSpace()
+		{
+			m_CachedReadPos = m_ReadPos.load(std::memory_order_acquire);
+			return m_Capacity - (uint32_t)(m_WritePos.load(std::memory_order_relaxed) - m_CachedReadPos);
+		}
+
+		// Consumer thread only. Returns nullptr if the queue is empty,
+		// otherwise the front element which stays valid until PopFront()
+		T* Front()
+		{
+			uint64_t readPos = m_ReadPos.load(std::memory_order_relaxed);
+			if (readPos == m_CachedWritePos)
+			{
+				m_CachedWritePos = m_WritePos.load(std::memory_order_acquire);
+				if (readPos == m_CachedWritePos)
+					return nullptr;
+			}
+
+			return &m_Slots[readPos & m_Mask];
+		}
+
+		// Consumer thread only, after a successful Front()
+		void PopFront()
+		{
+			uint64_t readPos = m_ReadPos.load(std::memory_order_relaxed);
+			m_Slots[readPos & m_Mask] = T();
+			m_ReadPos.store(readPos + 1, std::memory_order_release);
+		}
+
+		// Approximate when called concurrently with Push/Pop
+		uint32_t GetDepth() const
+		{
+			uint64_t writePos = m_WritePos.load(std::memory_order_relaxed);
+			uint64_t readPos = m_ReadPos.load(std::memory_order_relaxed);
+			return writePos > readPos ? (uint32_t)(writePos - readPos) : 0;
+		}
+
+		uint32_t GetCapacity() const { return m_Capacity; }
+	private:
+		std::unique_ptr<T[]> m_Slots;
+		uint32_t m_Capacity = 0;
+		uint32_t m_Mask = 0;
+
+		// Each side caches the other side's position to avoid touching its cache line on every call
+		alignas(64) std::atomic<uint64_t> m_WritePos = 0;
+		uint64_t m_CachedReadPos = 0;
+
+		alignas(64) std::atomic<uint64_t> m_ReadPos = 0;
+		uint64_t m_CachedWritePos = 0;
+	};
+
+}
@@ -1,14 +1,20 @@
 #include "Server.h"
 
+#include "Walnut/Networking/NetworkingUtils.h"
+#include "Walnut/Networking/ReceivedMessage.h"
+
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
 
 #include <spdlog/spdlog.h>
 
 namespace Walnut {
 
-	// Can only have one server instance per-process
-	static Server* s_Instance = nullptr;
+	// How often handshakes and suspended sessions are checked for expiry
+	static constexpr std::chrono::milliseconds SessionCheckInterval = std::chrono::milliseconds(100);
 
 	Server::Server(int port)
 		: m_Port(port)
@@ -26,80 +32,377 @@ namespace Walnut {
 		if (m_Running)
 			return;
 
+		if (m_NetworkThread.joinable())
+			m_NetworkThread.join();
+
+		CreateShards();
 		m_NetworkThread = std::thread([this]() { NetworkThreadFunc(); });
 	}
 
 	void Server::Stop()
 	{
 		m_Running = false;
+		m_Scheduler.Wake();
+		for (auto& shard : m_Shards)
+			shard->Scheduler.Wake();
+	}
+
+	void Server::SetShardCount(uint32_t shardCount, ShardAssignment assignment)
+	{
+		if (m_Running)
+			return;
+
+		m_ShardCount = std::max(shardCount, 1u);
+		m_ShardAssignment = assignment;
 	}
 
 	void Server::NetworkThreadFunc()
 	{
-		s_Instance = this;
 		m_Running = true;
 
-		SteamDatagramErrMsg errMsg;
-		if (!GameNetworkingSockets_Init(nullptr, errMsg))
+		std::string errorMessage;
+		if (!NetworkingContext::Acquire(errorMessage))
 		{
-			OnFatalError(fmt::format("GameNetworkingSockets_Init failed: {}", errMsg));
+			OnFatalError(fmt::format("GameNetworkingSockets_Init failed: {}", errorMessage));
 			return;
 		}
 
 		m_Interface = SteamNetworkingSockets();
+		m_InstanceID = NetworkingContext::RegisterInstance();
 
 		// Start listening
 		SteamNetworkingIPAddr serverLocalAddress;
 		serverLocalAddress.Clear();
 		serverLocalAddress.m_port = m_Port;
 
-		SteamNetworkingConfigValue_t options;
-		options.SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged, (void*)Server::ConnectionStatusChangedCallback);
+		// Accepted connections inherit the user data, which routes their status callbacks back to us
+		SteamNetworkingConfigValue_t options[2];
+		NetworkingContext::SetConnectionOptions(options, m_InstanceID);
 
 		// Try to start listen socket on port
-		m_ListenSocket = m_Interface->CreateListenSocketIP(serverLocalAddress, 1, &options);
+		m_ListenSocket = m_Interface->CreateListenSocketIP(serverLocalAddress, 2, options);
 
 		if (m_ListenSocket == k_HSteamListenSocket_Invalid)
 		{
 			OnFatalError(fmt::format("Fatal error: Failed to listen on port {}", m_Port));
+			ReleaseNetworkingContext();
 			return;
 		}
 
-		// Try to create poll group
+		// Before any shard can dispatch
+		if (IsCaptureEnabled())
+		{
+			m_CaptureStart = SteamNetworkingUtils()->GetLocalTimestamp();
+			if (!m_Capture.Open(m_CapturePath, m_CaptureSettings))
+				std::cout << "Failed to open capture file " << m_CapturePath << std::endl;
+		}
+
+		// Try to create poll groups (one per shard)
 		// TODO(Yan): should be optional, though good for groups which is probably the most common use case
-		m_PollGroup = m_Interface->CreatePollGroup();
-		if (m_PollGroup == k_HSteamNetPollGroup_Invalid)
+		if (!StartShards())
 		{
 			OnFatalError(fmt::format("Fatal error: Failed to listen on port {}", m_Port));
+			StopShards();
+			m_Capture.Close();
+			m_Interface->CloseListenSocket(m_ListenSocket);
+			m_ListenSocket = k_HSteamListenSocket_Invalid;
+			ReleaseNetworkingContext();
 			return;
 		}
 
 		std::cout << "Server listening on port " << m_Port << std::endl;
 
+		// With a single shard, it's updated inline here
+		Shard* inlineShard = m_Shards.size() == 1 ? m_Shards[0].get() : nullptr;
+
 		while (m_Running)
 		{
-			PollIncomingMessages();
+			InstrumentationTimer loopTimer(m_Instrumentation, m_Instrumentation.LoopIteration);
+
+			uint32_t messageCount = inlineShard ? UpdateShard(*inlineShard) : 0;
+			if (IsStreamingEnabled())
+				messageCount += m_Streams.Update(m_Interface);
+			messageCount += FlushOutboundQueue();
 			PollConnectionStateChanges();
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			AcceptPendingConnections();
+			ProcessKicks();
+			if (IsSessionsEnabled())
+				ProcessSessionRequests();
+
+			auto now = std::chrono::steady_clock::now();
+			if (IsSessionsEnabled() && now >= m_NextSessionCheck)
+				CheckSessions();
+
+			if (m_CongestionSettings.CheckInterval.count() > 0 && now >= m_NextCongestionCheck)
+				CheckCongestion();
+
+			if (m_StatsInterval.count() > 0 && now >= m_NextStatsSample)
+				SampleStats();
+
+			loopTimer.Stop();
+			m_Scheduler.Wait(messageCount > 0);
+		}
+
+		// Shard threads see m_Running too
+		for (auto& shard : m_Shards)
+			shard->Scheduler.Wake();
+
+		for (auto& shard : m_Shards)
+		{
+			if (shard->Thread.joinable())
+				shard->Thread.join();
 		}
 
+		// Streams that haven't finished are failed, the rest of their chunks are never sent
+		m_Streams.Clear();
+
+		// Attempts that were never accepted
+		m_Admission.Clear(m_Interface);
+
+		// Suspended clients are dropped along with everyone else
+		m_Sessions.Clear();
+
+		// Send anything still queued before closing (connections linger to deliver it)
+		FlushOutboundQueue();
+
 		// Close all the connections
 		std::cout << "Closing connections..." << std::endl;
-		for (const auto& [clientID, clientInfo] : m_ConnectedClients)
+		for (const ClientInfo& client : m_Clients.GetConnected())
 		{
-			m_Interface->CloseConnection(clientID, 0, "Server Shutdown", true);
+			m_Interface->CloseConnection(client.ID, 0, "Server Shutdown", true);
 		}
-		
-		m_ConnectedClients.clear();
+
+		// Only the connected list is cleared, slot storage is reset by the next Start() so ClientInfo
+		// references the app still holds don't dangle
+		m_Clients.RemoveAll();
+		m_Rooms.RemoveAllClients();
 
 		m_Interface->CloseListenSocket(m_ListenSocket);
 		m_ListenSocket = k_HSteamListenSocket_Invalid;
 
-		m_Interface->DestroyPollGroup(m_PollGroup);
-		m_PollGroup = k_HSteamNetPollGroup_Invalid;
+		StopShards();
+
+		// Shard threads are done, nothing else can be written
+		m_Capture.Close();
+
+		ReleaseNetworkingContext();
+	}
+
+	void Server::ShardThreadFunc(Shard& shard)
+	{
+		while (m_Running)
+		{
+			InstrumentationTimer loopTimer(m_Instrumentation, m_Instrumentation.LoopIteration);
+			uint32_t messageCount = UpdateShard(shard);
+			loopTimer.Stop();
+
+			shard.Scheduler.Wait(messageCount > 0);
+		}
+	}
+
+	void Server::CreateShards()
+	{
+		// Called from Start(), before the server thread exists. Shards are kept around after the
+		// server stops so their stats stay readable and DispatchPending() finds empty queues.
+		m_Shards.clear();
+		m_Clients.Clear();
+		m_Rooms.RemoveAllClients();
+
+		m_Sent.Reset();
+		m_CallbackMicroseconds = 0;
+		m_Compressor.ResetStats();
+		m_Stats.store(nullptr);
+		m_NextStatsSample = {};
+
+		{
+			std::scoped_lock lock(m_KickMutex);
+			m_Kicks.clear();
+		}
+
+		m_Sessions.Clear();
+		m_NextSessionCheck = {};
+		{
+			std::scoped_lock lock(m_SessionRequestMutex);
+			m_SessionRequests.clear();
+		}
+
+		for (uint32_t i = 0; i < m_ShardCount; i++)
+		{
+			auto shard = std::make_unique<Shard>();
+			shard->Index = i;
+			shard->Scheduler.SetSettings(m_Scheduler.GetSettings());
+			shard->ReceiveBatch.resize(std::max(m_ReceiveBatchSize, 1));
+			shard->DispatchBatch.reserve(shard->ReceiveBatch.size());
+			shard->DispatchTimesReceived.reserve(shard->ReceiveBatch.size());
+			if (IsDeferredDispatchEnabled())
+				shard->PendingEvents.Init(m_DeferredDispatchCapacity);
+
+			m_Shards.push_back(std::move(shard));
+		}
+
+		m_NextShard = 0;
+	}
+
+	bool Server::StartShards()
+	{
+		for (auto& shard : m_Shards)
+		{
+			shard->PollGroup = m_Interface->CreatePollGroup();
+			if (shard->PollGroup == k_HSteamNetPollGroup_Invalid)
+				return false;
+		}
+
+		if (m_Shards.size() > 1)
+		{
+			for (auto& shard : m_Shards)
+				shard->Thread = std::thread([this, shard = shard.get()]() { ShardThreadFunc(*shard); });
+		}
+
+		return true;
+	}
+
+	void Server::StopShards()
+	{
+		for (auto& shard : m_Shards)
+		{
+			if (shard->PollGroup != k_HSteamNetPollGroup_Invalid)
+				m_Interface->DestroyPollGroup(shard->PollGroup);
+			shard->PollGroup = k_HSteamNetPollGroup_Invalid;
+
+			shard->Commands.clear();
+			shard->ClientCount = 0;
+
+			for (ISteamNetworkingMessage* message : shard->DeferredMessages)
+				message->Release();
+			shard->DeferredMessages.clear();
+
+			DiscardPendingEvents(*shard);
+		}
+	}
+
+	Server::Shard& Server::SelectShard()
+	{
+		if (m_ShardAssignment == ShardAssignment::LeastLoaded)
+		{
+			Shard* leastLoaded = m_Shards[0].get();
+			for (auto& shard : m_Shards)
+			{
+				if (shard->ClientCount < leastLoaded->ClientCount)
+					leastLoaded = shard.get();
+			}
+			return *leastLoaded;
+		}
+
+		return *m_Shards[m_NextShard++ % m_Shards.size()];
+	}
+
+	void Server::PostShardCommand(Shard& shard, const ShardCommand& command)
+	{
+		{
+			std::scoped_lock lock(shard.CommandMutex);
+			shard.Commands.push_back(command);
+		}
+
+		// Inline shard - apply right away so callbacks fire from the status change, as they always have
+		if (m_Shards.size() == 1)
+			ApplyShardCommands(shard);
+		else
+			shard.Scheduler.Wake();
+	}
+
+	void Server::ApplyShardCommands(Shard& shard)
+	{
+		{
+			std::scoped_lock lock(shard.CommandMutex);
+			if (shard.Commands.empty())
+				return;
+
+			shard.ApplyingCommands.swap(shard.Commands);
+		}
+
+		for (const ShardCommand& command : shard.ApplyingCommands)
+		{
+			ClientInfo& client = *m_Clients.Get(command.Slot);
+			switch (command.CommandType)
+			{
+				case ShardCommand::Type::Connected:
+				{
+					m_Clients.SetActive(command.Slot, true);
+					CaptureClientEvent(CaptureRecordType::ClientConnected, command.Slot);
+
+					// User callback
+					if (IsDeferredDispatchEnabled())
+						PostEvent(shard, { PendingEvent::Type::ClientConnected, command.Slot });
+					else if (m_ClientConnectedCallback)
+						m_ClientConnectedCallback(client);
+					break;
+				}
+
+				case ShardCommand::Type::Disconnected:
+				{
+					m_Clients.SetActive(command.Slot, false);
+					CaptureClientEvent(CaptureRecordType::ClientDisconnected, command.Slot);
+
+					if (IsStreamingEnabled())
+						m_Streams.RemoveConnection(client.ID);
+
+					// User callback. The slot is released once it has been called
+					if (IsDeferredDispatchEnabled())
+					{
+						PostEvent(shard, { PendingEvent::Type::ClientDisconnected, command.Slot });
+						break;
+					}
+
+					if (m_ClientDisconnectedCallback)
+						m_ClientDisconnectedCallback(client);
+
+					m_Clients.Release(command.Slot);
+					break;
+				}
+
+				case ShardCommand::Type::Suspended:
+				{
+					// The slot is kept for the session, streams on the old connection can't continue
+					m_Clients.SetActive(command.Slot, false);
+
+					if (IsStreamingEnabled())
+						m_Streams.RemoveConnection(client.ID);
+
+					if (IsDeferredDispatchEnabled())
+						PostEvent(shard, { PendingEvent::Type::ClientSuspended, command.Slot });
+					else if (m_ClientSuspendedCallback)
+						m_ClientSuspendedCallback(client);
+					break;
+				}
+
+				case ShardCommand::Type::Resumed:
+				{
+					// The previous connection's messages have already been through this shard
+					m_Clients.CarryCounters(command.PreviousSlot, command.Slot);
+					m_Clients.SetActive(command.Slot, true);
+
+					if (m_Capture.IsOpen())
+						m_Capture.Write(CaptureRecordType::ClientResumed, SteamNetworkingUtils()->GetLocalTimestamp() - m_CaptureStart, command.Slot, 0, &command.PreviousSlot, sizeof(command.PreviousSlot));
+
+					// The previous slot is released once the callback has been called
+					if (IsDeferredDispatchEnabled())
+						PostEvent(shard, { PendingEvent::Type::ClientResumed, command.Slot, nullptr, command.PreviousClientID, command.PreviousSlot });
+					else
+						CompleteResume(command.Slot, command.PreviousSlot, command.PreviousClientID);
+					break;
+				}
+			}
+		}
+
+		shard.ApplyingCommands.clear();
 	}
 
-	void Server::ConnectionStatusChangedCallback(SteamNetConnectionStatusChangedCallback_t* info) { s_Instance->OnConnectionStatusChanged(info); }
+	void Server::ReleaseNetworkingContext()
+	{
+		NetworkingContext::UnregisterInstance(m_InstanceID);
+		m_InstanceID = NetworkingContext::InvalidInstanceID;
+		NetworkingContext::Release();
+	}
 
 	void Server::OnConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* status)
 	{
@@ -120,19 +423,42 @@ namespace Walnut {
 					// Locate the client.  Note that it should have been found, because this
 					// is the only codepath where we remove clients (except on shutdown),
 					// and connection change callbacks are dispatched in queue order.
-					auto itClient = m_ConnectedClients.find(status->m_hConn);
-					//assert(itClient != m_mapClients.end());
+					uint32_t slot = NetworkingContext::GetConnectionData(status->m_info.m_nUserData);
+					ClientInfo* client = m_Clients.Get(slot, status->m_hConn);
+					if (!client)
+						client = m_Clients.Find(status->m_hConn);
+					//assert(client);
 
 					// Either ClosedByPeer or ProblemDetectedLocally - should be communicated to user callback
-					// User callback
-					if (m_ClientDisconnectedCallback)
-						m_ClientDisconnectedCallback(itClient->second);
-
-					m_ConnectedClients.erase(itClient);
+					// The owning shard calls the user callback. A kicked client has already been removed
+					if (client && m_Clients.IsConnected(client->Slot))
+					{
+						if (!IsSessionsEnabled())
+						{
+							RemoveClient(*client);
+						}
+						else if (m_Sessions.CompleteHandshake(status->m_hConn) != SessionTable::InvalidSlot)
+						{
+							// Never got as far as the connect callback
+							DiscardClient(*client);
+						}
+						else if (Utils::IsDroppedConnection(status->m_info.m_eEndReason)
+							&& m_Sessions.Suspend(client->Slot, std::chrono::steady_clock::now() + m_SessionSettings.ResumeTimeout))
+						{
+							// Kept for the client to resume, or until CheckSessions() expires it
+							SuspendClient(*client);
+						}
+						else
+						{
+							m_Sessions.Close(client->Slot);
+							RemoveClient(*client);
+						}
+					}
 				}
 				else
 				{
-					//assert(info->m_eOldState == k_ESteamNetworkingConnectionState_Connecting);
+					// Gave up while it was waiting in the admission queue
+					m_Admission.OnClosed(status->m_hConn);
 				}
 
 				// Clean up the connection.  This is important!
@@ -147,38 +473,8 @@ namespace Walnut {
 
 			case k_ESteamNetworkingConnectionState_Connecting:
 			{
-				// This must be a new connection
-				// assert(m_mapClients.find(info->m_hConn) == m_mapClients.end());
-
-				// Try to accept incoming connection
-				if (m_Interface->AcceptConnection(status->m_hConn) != k_EResultOK)
-				{
-					m_Interface->CloseConnection(status->m_hConn, 0, nullptr, false);
-					std::cout << "Couldn't accept connection (it was already closed?)" << std::endl;
-					break;
-				}
-
-				// Assign the poll group
-				if (!m_Interface->SetConnectionPollGroup(status->m_hConn, m_PollGroup))
-				{
-					m_Interface->CloseConnection(status->m_hConn, 0, nullptr, false);
-					std::cout << "Failed to set poll group" << std::endl;
-					break;
-				}
-
-				// Retrieve connection info
-				SteamNetConnectionInfo_t connectionInfo;
-				m_Interface->GetConnectionInfo(status->m_hConn, &connectionInfo);
-
-				// Register connected client
-				auto& client = m_ConnectedClients[status->m_hConn];
-				client.ID = (ClientID)status->m_hConn;
-				client.ConnectionDesc = connectionInfo.m_szConnectionDescription;
-
-				// User callback
-				if (m_ClientConnectedCallback)
-					m_ClientConnectedCallback(client);
-
+				// This must be a new connection. It's queued, and accepted (or rejected) by AcceptPendingConnections()
+				m_Admission.OnConnecting(m_Interface, *status, m_Clients.GetConnectedCount());
 				break;
 			}
 
@@ -194,94 +490,1503 @@ namespace Walnut {
 
 	void Server::PollConnectionStateChanges()
 	{
-		m_Interface->RunCallbacks();
+		NetworkingContext::PollConnectionStatusChanges(m_InstanceID, [this](SteamNetConnectionStatusChangedCallback_t* info) { OnConnectionStatusChanged(info); });
 	}
 
-	void Server::PollIncomingMessages()
+	void Server::AcceptPendingConnections()
 	{
-		// Process all messages
-		while (m_Running)
+		m_Admission.Update(m_Interface, m_Clients.GetConnectedCount(), m_AcceptingConnections);
+		for (HSteamNetConnection connection : m_AcceptingConnections)
+			AcceptConnection(connection);
+
+		m_AcceptingConnections.clear();
+	}
+
+	void Server::AcceptConnection(HSteamNetConnection connection)
+	{
+		// Try to accept incoming connection
+		if (m_Interface->AcceptConnection(connection) != k_EResultOK)
 		{
-			ISteamNetworkingMessage* incomingMessage = nullptr;
-			int messageCount = m_Interface->ReceiveMessagesOnPollGroup(m_PollGroup, &incomingMessage, 1);
-			if (messageCount == 0)
-				break;
+			m_Interface->CloseConnection(connection, 0, nullptr, false);
+			std::cout << "Couldn't accept connection (it was already closed?)" << std::endl;
+			return;
+		}
 
-			if (messageCount < 0)
-			{
-				// messageCount < 0 means critical error?
-				m_Running = false;
+		Shard& shard = SelectShard();
+
+		// Retrieve connection info
+		SteamNetConnectionInfo_t connectionInfo;
+		m_Interface->GetConnectionInfo(connection, &connectionInfo);
+
+		// Register connected client
+		uint32_t slot = m_Clients.Add((ClientID)connection, shard.Index, connectionInfo.m_szConnectionDescription);
+		if (slot == ClientRegistry::InvalidSlot)
+		{
+			m_Interface->CloseConnection(connection, 0, "Server full", false);
+			std::cout << "Client table is full" << std::endl;
+			m_Admission.OnAcceptFailed();
+			return;
+		}
+
+		// The slot may have belonged to a client that was added to a room after it disconnected
+		m_Rooms.RemoveFromAll(slot);
+
+		// Before the shard can see any of its messages
+		m_Clients.GetInboundLimitState(slot).Reset(m_InboundLimits, std::chrono::steady_clock::now());
+
+		// Received messages carry the slot, so they can be matched to the client without a search
+		m_Interface->SetConnectionUserData(connection, NetworkingContext::MakeUserData(m_InstanceID, slot));
+
+		// Lanes for what we send, configured before anything can be sent
+		if (!Utils::ConfigureConnectionLanes(m_Interface, connection, m_Lanes))
+			std::cout << "Failed to configure connection lanes" << std::endl;
+
+		// Assign the poll group
+		if (!m_Interface->SetConnectionPollGroup(connection, shard.PollGroup))
+		{
+			m_Interface->CloseConnection(connection, 0, nullptr, false);
+			std::cout << "Failed to set poll group" << std::endl;
+			m_Clients.Remove(slot);
+			m_Clients.Release(slot);
+			return;
+		}
+
+		// The owning shard calls the user callback. With sessions, that waits for the client's session token
+		shard.ClientCount++;
+		if (IsSessionsEnabled())
+			m_Sessions.AddHandshake(connection, slot, std::chrono::steady_clock::now() + m_SessionSettings.HandshakeTimeout);
+		else
+			PostShardCommand(shard, { ShardCommand::Type::Connected, slot });
+
+		m_Admission.OnAccepted();
+	}
+
+	void Server::RemoveClient(const ClientInfo& client)
+	{
+		Shard& shard = *m_Shards[client.Shard];
+		uint32_t slot = client.Slot;
+		m_Clients.Remove(slot);
+		m_Rooms.RemoveFromAll(slot);
+		shard.ClientCount--;
+		PostShardCommand(shard, { ShardCommand::Type::Disconnected, slot });
+	}
+
+	void Server::DiscardClient(const ClientInfo& client)
+	{
+		// For clients the shard was never told about, there are no callbacks to call
+		Shard& shard = *m_Shards[client.Shard];
+		uint32_t slot = client.Slot;
+		m_Clients.Remove(slot);
+		shard.ClientCount--;
+		m_Clients.Release(slot);
+	}
+
+	void Server::ProcessKicks()
+	{
+		{
+			std::scoped_lock lock(m_KickMutex);
+			if (m_Kicks.empty())
 				return;
-			}
 
-			// assert(numMsgs == 1 && pIncomingMsg);
+			m_ApplyingKicks.swap(m_Kicks);
+		}
 
-			auto itClient = m_ConnectedClients.find(incomingMessage->m_conn);
-			if (itClient == m_ConnectedClients.end())
-			{
-				std::cout << "ERROR: Received data from unregistered client\n";
+		for (const KickRequest& kick : m_ApplyingKicks)
+		{
+			// Already gone
+			ClientInfo* client = m_Clients.Find(kick.Client);
+			if (!client)
 				continue;
-			}
 
-			if (incomingMessage->m_cbSize)
+			// There's no status callback for connections we close ourselves, so the client is removed here
+			m_Interface->CloseConnection(kick.Client, k_ESteamNetConnectionEnd_App_Generic, kick.Reason.c_str(), false);
+			if (m_Sessions.CompleteHandshake(kick.Client) != SessionTable::InvalidSlot)
 			{
-				if (m_DataReceivedCallback)
-					m_DataReceivedCallback(itClient->second, Buffer(incomingMessage->m_pData, incomingMessage->m_cbSize));
+				DiscardClient(*client);
+				continue;
 			}
 
-			// Release when done
-			incomingMessage->Release();
+			m_Sessions.Close(client->Slot);
+			RemoveClient(*client);
 		}
+
+		m_ApplyingKicks.clear();
 	}
 
-	void Server::SetClientNick(HSteamNetConnection hConn, const char* nick)
+	bool Server::HandleSessionMessage(const ISteamNetworkingMessage* message)
 	{
-		// Set the connection name, too, which is useful for debugging
-		m_Interface->SetConnectionName(hConn, nick);
+		SessionHelloMessage hello;
+		if (!Utils::ReadSessionHello(Buffer(message->m_pData, message->m_cbSize), hello))
+			return false;
+
+		// Answered by the server thread, which owns the session table
+		{
+			std::scoped_lock lock(m_SessionRequestMutex);
+			m_SessionRequests.push_back({ message->m_conn, hello.Token });
+		}
+
+		m_Scheduler.Wake();
+		return true;
 	}
 
-	void Server::SetDataReceivedCallback(const DataReceivedCallback& function)
+	void Server::ProcessSessionRequests()
 	{
-		m_DataReceivedCallback = function;
+		{
+			std::scoped_lock lock(m_SessionRequestMutex);
+			if (m_SessionRequests.empty())
+				return;
+
+			m_ApplyingSessionRequests.swap(m_SessionRequests);
+		}
+
+		for (const SessionRequest& request : m_ApplyingSessionRequests)
+		{
+			// Closed, kicked or timed out in the meantime, or a second hello
+			uint32_t slot = m_Sessions.CompleteHandshake(request.Connection);
+			if (slot == SessionTable::InvalidSlot)
+				continue;
+
+			const ClientInfo& client = *m_Clients.Get(slot);
+
+			if (request.Token.IsValid())
+			{
+				// The client noticed the drop before we did, its old connection is still here
+				uint32_t sessionSlot = m_Sessions.Find(request.Token);
+				if (sessionSlot != SessionTable::InvalidSlot && m_Clients.IsConnected(sessionSlot))
+				{
+					const ClientInfo& previous = *m_Clients.Get(sessionSlot);
+					m_Interface->CloseConnection(previous.ID, k_ESteamNetConnectionEnd_App_Generic, "Session resumed on a new connection", false);
+					m_Sessions.Suspend(sessionSlot, std::chrono::steady_clock::now());
+					SuspendClient(previous);
+				}
+
+				SessionToken token;
+				uint32_t resumedSlot = m_Sessions.Resume(request.Token, token);
+				if (resumedSlot != SessionTable::InvalidSlot)
+				{
+					ResumeClient(resumedSlot, client, token);
+					continue;
+				}
+			}
+
+			// Unknown or expired token, start over with a new session
+			SessionWelcomeMessage welcome;
+			welcome.Token = m_Sessions.Open(slot);
+			PostShardCommand(*m_Shards[client.Shard], { ShardCommand::Type::Connected, slot });
+			SendTypedMessageToClient(client.ID, welcome);
+		}
+
+		m_ApplyingSessionRequests.clear();
 	}
 
-	void Server::SetClientConnectedCallback(const ClientConnectedCallback& function)
+	void Server::SuspendClient(const ClientInfo& client)
 	{
-		m_ClientConnectedCallback = function;
+		// Unlike RemoveClient(), the client stays in its rooms
+		Shard& shard = *m_Shards[client.Shard];
+		uint32_t slot = client.Slot;
+		m_Clients.Remove(slot);
+		shard.ClientCount--;
+		PostShardCommand(shard, { ShardCommand::Type::Suspended, slot });
 	}
 
-	void Server::SetClientDisconnectedCallback(const ClientDisconnectedCallback& function)
+	void Server::ResumeClient(uint32_t slot, const ClientInfo& client, const SessionToken& token)
 	{
-		m_ClientDisconnectedCallback = function;
+		HSteamNetConnection connection = (HSteamNetConnection)client.ID;
+		std::string connectionDesc(client.ConnectionDesc);
+
+		// The new connection was given a slot when it was accepted, but it has to go on the session's shard
+		DiscardClient(client);
+
+		const ClientInfo& previous = *m_Clients.Get(slot);
+		Shard& shard = *m_Shards[previous.Shard];
+		ClientID previousClientID = previous.ID;
+
+		// The session's slot may still have events queued, so the client gets a new one. The shard moves
+		// everything over once those have been dispatched, see CompleteResume()
+		uint32_t resumedSlot = m_Clients.Add((ClientID)connection, shard.Index, connectionDesc.c_str());
+		if (resumedSlot == ClientRegistry::InvalidSlot)
+		{
+			m_Interface->CloseConnection(connection, k_ESteamNetConnectionEnd_App_Generic, "Server full", false);
+			std::cout << "Client table is full" << std::endl;
+
+			// The token was rotated and the client never got the new one, so the session can't be resumed again
+			EndSuspendedSession(slot);
+			return;
+		}
+
+		m_Rooms.RemoveFromAll(resumedSlot);
+		m_Clients.GetInboundLimitState(resumedSlot).Reset(m_InboundLimits, std::chrono::steady_clock::now());
+		m_Interface->SetConnectionUserData(connection, NetworkingContext::MakeUserData(m_InstanceID, resumedSlot));
+
+		// Messages are polled by the shard that owns the session
+		if (!m_Interface->SetConnectionPollGroup(connection, shard.PollGroup))
+		{
+			m_Interface->CloseConnection(connection, k_ESteamNetConnectionEnd_App_Generic, "Failed to resume session", false);
+			std::cout << "Failed to set poll group" << std::endl;
+			m_Clients.Remove(resumedSlot);
+			m_Clients.Release(resumedSlot);
+			EndSuspendedSession(slot);
+			return;
+		}
+
+		m_Sessions.Move(slot, resumedSlot);
+		shard.ClientCount++;
+		PostShardCommand(shard, { ShardCommand::Type::Resumed, resumedSlot, previousClientID, slot });
+
+		SessionWelcomeMessage welcome;
+		welcome.Token = token;
+		welcome.Resumed = 1;
+		SendTypedMessageToClient((ClientID)connection, welcome);
 	}
 
-	void Server::SendBufferToClient(ClientID clientID, Buffer buffer, bool reliable)
+	void Server::CompleteResume(uint32_t slot, uint32_t previousSlot, ClientID previousClientID)
 	{
-		m_Interface->SendMessageToConnection((HSteamNetConnection)clientID, buffer.Data, (ClientID)buffer.Size, reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable, nullptr);
+		// Called where the shard's callbacks are, after the previous slot's last event
+		ClientInfo& client = *m_Clients.Get(slot);
+		client.UserData = m_Clients.Get(previousSlot)->UserData;
+		m_Rooms.Move(previousSlot, slot);
+
+		if (m_ClientResumedCallback)
+			m_ClientResumedCallback(client, previousClientID);
+
+		m_Clients.Release(previousSlot);
 	}
 
-	void Server::SendBufferToAllClients(Buffer buffer, ClientID excludeClientID, bool reliable)
+	void Server::EndSuspendedSession(uint32_t slot)
 	{
-		for (const auto& [clientID, clientInfo] : m_ConnectedClients)
-		{
-			if (clientID != excludeClientID)
-				SendBufferToClient(clientID, buffer, reliable);
-		}
+		m_Sessions.Close(slot);
+
+		// Suspended clients were already taken out of the connected set, this is the disconnect they were spared
+		m_Rooms.RemoveFromAll(slot);
+		PostShardCommand(*m_Shards[m_Clients.Get(slot)->Shard], { ShardCommand::Type::Disconnected, slot });
 	}
 
-	void Server::SendStringToClient(ClientID clientID, const std::string& string, bool reliable)
+	void Server::CheckSessions()
 	{
-		SendBufferToClient(clientID, Buffer(string.data(), string.size()), reliable);
+		auto now = std::chrono::steady_clock::now();
+		m_NextSessionCheck = now + SessionCheckInterval;
+
+		m_Sessions.CollectExpired(now, m_ExpiredHandshakes, m_ExpiredSessions);
+
+		for (HSteamNetConnection connection : m_ExpiredHandshakes)
+		{
+			uint32_t slot = NetworkingContext::GetConnectionData(m_Interface->GetConnectionUserData(connection));
+			ClientInfo* client = m_Clients.Get(slot, (ClientID)connection);
+			m_Interface->CloseConnection(connection, k_ESteamNetConnectionEnd_App_Generic, "Session handshake timed out", false);
+			if (client)
+				DiscardClient(*client);
+		}
+
+		for (uint32_t slot : m_ExpiredSessions)
+			EndSuspendedSession(slot);
+
+		m_ExpiredHandshakes.clear();
+		m_ExpiredSessions.clear();
 	}
 
-	void Server::SendStringToAllClients(const std::string& string, ClientID excludeClientID, bool reliable)
+	void Server::CaptureClientEvent(CaptureRecordType type, uint32_t slot)
 	{
-		SendBufferToAllClients(Buffer(string.data(), string.size()), excludeClientID, reliable);
+		if (m_Capture.IsOpen())
+			m_Capture.Write(type, SteamNetworkingUtils()->GetLocalTimestamp() - m_CaptureStart, slot, 0);
 	}
 
-	void Server::KickClient(ClientID clientID)
+	ReplayStats Server::ReplayCapture(const std::string& path, const ReplaySettings& settings)
 	{
-		m_Interface->CloseConnection(clientID, 0, "Kicked by host", false);
+		ReplayStats stats;
+		if (m_Running)
+		{
+			std::cout << "ERROR: ReplayCapture can't be called while the server is running" << std::endl;
+			return stats;
+		}
+
+		if (m_NetworkThread.joinable())
+			m_NetworkThread.join();
+
+		CaptureReader reader;
+		if (!reader.Open(path))
+			return stats;
+
+		// Callbacks may send, which fails cleanly against a real interface
+		std::string errorMessage;
+		if (!NetworkingContext::Acquire(errorMessage))
+		{
+			std::cout << "GameNetworkingSockets_Init failed: " << errorMessage << std::endl;
+			return stats;
+		}
+
+		m_Interface = SteamNetworkingSockets();
+		m_InstanceID = NetworkingContext::RegisterInstance();
+
+		// Everything starts out empty, as if the server had just started. Replayed clients all go on the first shard
+		CreateShards();
+		Shard& shard = *m_Shards[0];
+
+		std::unordered_map<uint32_t, uint32_t> slots; // Recorded slot -> replay slot
+		int batchCount = 0;
+		auto dispatchBatch = [&]()
+		{
+			if (batchCount > 0)
+				DispatchReceivedMessages(shard, std::span(shard.ReceiveBatch.data(), batchCount));
+			batchCount = 0;
+
+			// Events that didn't fit in the queue wait in the overflow, which only drains as the queue does
+			if (IsDeferredDispatchEnabled())
+			{
+				do
+				{
+					FlushPendingOverflow(shard);
+					DispatchPending();
+				} while (!shard.PendingOverflow.empty());
+			}
+		};
+
+		auto replayStart = std::chrono::steady_clock::now();
+		uint64_t callbackMicroseconds = m_CallbackMicroseconds.load();
+
+		CaptureRecord record;
+		while (reader.Next(record))
+		{
+			// At recorded speed, whatever is due by now goes out as one batch
+			if (settings.Speed > 0.0)
+			{
+				auto due = replayStart + std::chrono::microseconds((int64_t)((double)record.Timestamp / settings.Speed));
+				if (due > std::chrono::steady_clock::now())
+				{
+					dispatchBatch();
+					std::this_thread::sleep_until(due);
+				}
+			}
+
+			switch (record.Type)
+			{
+				case CaptureRecordType::Data:
+				{
+					auto it = slots.find(record.Slot);
+					if (it == slots.end())
+						break;
+
+					// A library message, like a received one, so callbacks can retain it
+					const ClientInfo& client = *m_Clients.Get(it->second);
+					SteamNetworkingMessage_t* message = SteamNetworkingUtils()->AllocateMessage((int)record.Payload.Size);
+					memcpy(message->m_pData, record.Payload.Data, record.Payload.Size);
+					message->m_conn = (HSteamNetConnection)client.ID;
+					message->m_nConnUserData = NetworkingContext::MakeUserData(m_InstanceID, client.Slot);
+					message->m_usecTimeReceived = SteamNetworkingUtils()->GetLocalTimestamp();
+					message->m_idxLane = record.Lane;
+
+					shard.ReceiveBatch[batchCount++] = message;
+					stats.Messages++;
+					stats.Bytes += record.Payload.Size;
+
+					if (batchCount == (int)shard.ReceiveBatch.size())
+						dispatchBatch();
+					break;
+				}
+
+				case CaptureRecordType::ClientConnected:
+				{
+					dispatchBatch();
+
+					// The recorded slot is only unique while the client is connected, so it's unique as an ID too
+					uint32_t slot = m_Clients.Add((ClientID)record.Slot, shard.Index, "Replay");
+					if (slot == ClientRegistry::InvalidSlot)
+						break;
+
+					slots[record.Slot] = slot;
+					shard.ClientCount++;
+					PostShardCommand(shard, { ShardCommand::Type::Connected, slot });
+					ApplyShardCommands(shard);
+					stats.Connects++;
+					break;
+				}
+
+				case CaptureRecordType::ClientResumed:
+				{
+					dispatchBatch();
+
+					uint32_t previousSlot = 0;
+					if (record.Payload.Size != sizeof(previousSlot))
+						break;
+
+					memcpy(&previousSlot, record.Payload.Data, sizeof(previousSlot));
+					auto it = slots.find(previousSlot);
+					if (it == slots.end())
+						break;
+
+					// Like ResumeClient(), the client carries on on a new slot (under its new recorded slot as the ID),
+					// and the shard moves its user data and rooms over before the resumed callback
+					uint32_t slot = m_Clients.Add((ClientID)record.Slot, shard.Index, "Replay");
+					if (slot == ClientRegistry::InvalidSlot)
+						break;
+
+					// The suspend wasn't recorded, the previous slot is only suspended now
+					ClientID previousClientID = m_Clients.Get(it->second)->ID;
+					m_Clients.Remove(it->second);
+					m_Clients.SetActive(it->second, false);
+
+					PostShardCommand(shard, { ShardCommand::Type::Resumed, slot, previousClientID, it->second });
+					ApplyShardCommands(shard);
+					slots.erase(it);
+					slots[record.Slot] = slot;
+					stats.Resumes++;
+					break;
+				}
+
+				case CaptureRecordType::ClientDisconnected:
+				{
+					dispatchBatch();
+
+					auto it = slots.find(record.Slot);
+					if (it == slots.end())
+						break;
+
+					RemoveClient(*m_Clients.Get(it->second));
+					ApplyShardCommands(shard);
+					slots.erase(it);
+					stats.Disconnects++;
+					break;
+				}
+
+				default:
+					break;
+			}
+		}
+
+		dispatchBatch();
+
+		stats.Completed = true;
+		stats.Duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - replayStart);
+		stats.CallbackTime = std::chrono::microseconds(m_CallbackMicroseconds.load() - callbackMicroseconds);
+
+		// Clients still connected at the end are dropped without callbacks, like on shutdown
+		m_Clients.RemoveAll();
+		m_Rooms.RemoveAllClients();
+		for (auto& replayShard : m_Shards)
+		{
+			replayShard->ClientCount = 0;
+			DiscardPendingEvents(*replayShard);
+		}
+
+		ReleaseNetworkingContext();
+		return stats;
+	}
+
+	uint32_t Server::UpdateShard(Shard& shard)
+	{
+		ApplyShardCommands(shard);
+		return PollIncomingMessages(shard);
+	}
+
+	uint32_t Server::PollIncomingMessages(Shard& shard)
+	{
+		// Messages held back by the inbound limits go first, they arrived before anything still in the library
+		uint32_t totalMessageCount = shard.DeferredMessages.empty() ? 0 : DispatchDeferredMessages(shard);
+
+		// Process all messages
+		while (m_Running)
+		{
+			int maxMessages = (int)shard.ReceiveBatch.size();
+			if (IsDeferredDispatchEnabled())
+			{
+				// If the application isn't keeping up, leave messages queued in the library
+				if (!FlushPendingOverflow(shard))
+					break;
+
+				maxMessages = std::min(maxMessages, (int)shard.PendingEvents.GetFreeSpace());
+				if (maxMessages == 0)
+					break;
+			}
+
+			int messageCount = m_Interface->ReceiveMessagesOnPollGroup(shard.PollGroup, shard.ReceiveBatch.data(), maxMessages);
+			if (messageCount == 0)
+				break;
+
+			if (messageCount < 0)
+			{
+				// messageCount < 0 means critical error?
+				m_Running = false;
+				break;
+			}
+
+			// Messages that fail to decode are dropped here
+			if (IsCompressionEnabled())
+			{
+				messageCount = m_Compressor.DecodeReceivedMessages(shard.ReceiveBatch.data(), messageCount);
+				if (messageCount == 0)
+					continue;
+			}
+
+			// Messages over a client's limits are dropped or deferred here
+			int dispatchCount = m_InboundLimits.IsEnabled() ? ApplyInboundLimits(shard, messageCount) : messageCount;
+			DispatchReceivedMessages(shard, std::span(shard.ReceiveBatch.data(), dispatchCount));
+
+			totalMessageCount += messageCount;
+
+			// Drained everything that was queued
+			if (messageCount < maxMessages)
+				break;
+		}
+
+		return totalMessageCount;
+	}
+
+	void Server::DispatchReceivedMessages(Shard& shard, std::span<ISteamNetworkingMessage* const> messages)
+	{
+		if (messages.empty())
+			return;
+
+		SteamNetworkingMicroseconds now = SteamNetworkingUtils()->GetLocalTimestamp();
+
+		if (IsDeferredDispatchEnabled())
+		{
+			for (ISteamNetworkingMessage* incomingMessage : messages)
+			{
+				shard.DispatchLatency.Record(incomingMessage->m_usecTimeReceived, now);
+
+				// Sent before the client is known to the shard, so it's handled ahead of the lookup
+				if (IsSessionsEnabled() && HandleSessionMessage(incomingMessage))
+				{
+					incomingMessage->Release();
+					continue;
+				}
+
+				ClientInfo* client = FindReceivingClient(shard, incomingMessage);
+				if (!client)
+				{
+					// The server thread may have assigned the client after we last checked
+					ApplyShardCommands(shard);
+					client = FindReceivingClient(shard, incomingMessage);
+				}
+
+				if (!client)
+				{
+					std::cout << "ERROR: Received data from unregistered client\n";
+					incomingMessage->Release();
+					continue;
+				}
+
+				if (!incomingMessage->m_cbSize)
+				{
+					incomingMessage->Release();
+					continue;
+				}
+
+				m_Clients.GetReceivedCounter(client->Slot).Add(1, incomingMessage->m_cbSize);
+				shard.Received.Add(1, incomingMessage->m_cbSize);
+
+				// Stream messages are handled right away, they never reach the application's queue
+				if (IsStreamingEnabled() && m_Streams.HandleReceivedMessage(client->ID, Buffer(incomingMessage->m_pData, incomingMessage->m_cbSize)))
+				{
+					incomingMessage->Release();
+					continue;
+				}
+
+				if (m_Capture.IsOpen())
+					m_Capture.Write(CaptureRecordType::Data, incomingMessage->m_usecTimeReceived - m_CaptureStart, client->Slot, incomingMessage->m_idxLane, incomingMessage->m_pData, incomingMessage->m_cbSize);
+
+				// Message is released by DispatchPending() once the callback returns
+				PostEvent(shard, { PendingEvent::Type::DataReceived, client->Slot, incomingMessage });
+			}
+
+			return;
+		}
+
+		// Releases the messages when done, unless a callback retained them
+		Utils::ReceivedMessageScope messageScope(messages);
+
+		shard.DispatchBatch.clear();
+		shard.DispatchTimesReceived.clear();
+		for (ISteamNetworkingMessage* incomingMessage : messages)
+		{
+			shard.DispatchLatency.Record(incomingMessage->m_usecTimeReceived, now);
+
+			if (IsSessionsEnabled() && HandleSessionMessage(incomingMessage))
+				continue;
+
+			ClientInfo* client = FindReceivingClient(shard, incomingMessage);
+			if (!client)
+			{
+				// The server thread may have assigned the client after we last checked.
+				// Dispatch what we have first, so it's ordered before any connect/disconnect callbacks.
+				DispatchReceivedBatch(shard);
+				ApplyShardCommands(shard);
+				client = FindReceivingClient(shard, incomingMessage);
+			}
+
+			if (!client)
+			{
+				std::cout << "ERROR: Received data from unregistered client\n";
+				continue;
+			}
+
+			if (incomingMessage->m_cbSize)
+			{
+				m_Clients.GetReceivedCounter(client->Slot).Add(1, incomingMessage->m_cbSize);
+				shard.Received.Add(1, incomingMessage->m_cbSize);
+
+				Buffer buffer(incomingMessage->m_pData, incomingMessage->m_cbSize);
+				if (IsStreamingEnabled() && m_Streams.HandleReceivedMessage(client->ID, buffer))
+					continue;
+
+				if (m_Capture.IsOpen())
+					m_Capture.Write(CaptureRecordType::Data, incomingMessage->m_usecTimeReceived - m_CaptureStart, client->Slot, incomingMessage->m_idxLane, buffer.Data, (uint32_t)buffer.Size);
+
+				shard.DispatchBatch.push_back({ client, buffer });
+				shard.DispatchTimesReceived.push_back(incomingMessage->m_usecTimeReceived);
+			}
+		}
+
+		DispatchReceivedBatch(shard);
+	}
+
+	int Server::ApplyInboundLimits(Shard& shard, int messageCount)
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		// Compacts the batch down to the messages that can be dispatched now
+		int dispatchCount = 0;
+		for (int i = 0; i < messageCount; i++)
+		{
+			ISteamNetworkingMessage* incomingMessage = shard.ReceiveBatch[i];
+
+			// Not registered yet (or not ours) - dispatch sorts it out
+			uint32_t slot = NetworkingContext::GetConnectionData(incomingMessage->m_nConnUserData);
+			ClientInfo* client = m_Clients.Get(slot, incomingMessage->m_conn);
+			if (!client || client->Shard != shard.Index)
+			{
+				shard.ReceiveBatch[dispatchCount++] = incomingMessage;
+				continue;
+			}
+
+			// Behind messages that are already held back, so the client's messages stay in order
+			InboundLimitState& limits = m_Clients.GetInboundLimitState(slot);
+			bool kicked = limits.Kicked.load(std::memory_order_relaxed);
+			if (!kicked && limits.Deferred == 0 && limits.TryConsume(incomingMessage->m_cbSize, now))
+			{
+				shard.ReceiveBatch[dispatchCount++] = incomingMessage;
+				continue;
+			}
+
+			if (!kicked && m_InboundLimits.Policy == InboundLimitPolicy::Defer && limits.Deferred < m_InboundLimits.MaxDeferredMessages)
+			{
+				shard.DeferredMessages.push_back(incomingMessage);
+				limits.Deferred++;
+				limits.DeferredTotal.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			// Still counted as received, it did arrive
+			m_Clients.GetReceivedCounter(slot).Add(1, incomingMessage->m_cbSize);
+			shard.Received.Add(1, incomingMessage->m_cbSize);
+			limits.Dropped.Add(1, incomingMessage->m_cbSize);
+			incomingMessage->Release();
+
+			if (!kicked && m_InboundLimits.Policy == InboundLimitPolicy::Kick)
+			{
+				limits.Kicked.store(true, std::memory_order_relaxed);
+				KickClient(client->ID, "Rate limit exceeded");
+			}
+		}
+
+		return dispatchCount;
+	}
+
+	uint32_t Server::DispatchDeferredMessages(Shard& shard)
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		// Once one of a client's messages doesn't fit, the rest of its messages wait too
+		uint32_t pass = ++shard.DeferredPass;
+
+		size_t keptCount = 0;
+		shard.ReadyMessages.clear();
+		for (ISteamNetworkingMessage* message : shard.DeferredMessages)
+		{
+			uint32_t slot = NetworkingContext::GetConnectionData(message->m_nConnUserData);
+			ClientInfo* client = m_Clients.Get(slot, message->m_conn);
+			if (!client)
+			{
+				// Disconnected, and the slot has been released since
+				message->Release();
+				continue;
+			}
+
+			InboundLimitState& limits = m_Clients.GetInboundLimitState(slot);
+			if (limits.BlockedPass == pass || !limits.TryConsume(message->m_cbSize, now))
+			{
+				limits.BlockedPass = pass;
+				shard.DeferredMessages[keptCount++] = message;
+				continue;
+			}
+
+			limits.Deferred--;
+			shard.ReadyMessages.push_back(message);
+		}
+		shard.DeferredMessages.resize(keptCount);
+
+		DispatchReceivedMessages(shard, shard.ReadyMessages);
+		return (uint32_t)shard.ReadyMessages.size();
+	}
+
+	ClientInfo* Server::FindReceivingClient(Shard& shard, const ISteamNetworkingMessage* message)
+	{
+		// The slot is in the low bits of the connection user data
+		uint32_t slot = NetworkingContext::GetConnectionData(message->m_nConnUserData);
+		ClientInfo* client = m_Clients.Get(slot, message->m_conn);
+		if (!client)
+		{
+			// Received before the user data was set
+			std::shared_lock lock(m_Clients.GetMutex());
+			client = m_Clients.Find(message->m_conn);
+		}
+
+		// Only once the connect callback has been called
+		if (!client || client->Shard != shard.Index || !m_Clients.IsActive(client->Slot))
+			return nullptr;
+
+		return client;
+	}
+
+	void Server::DispatchReceivedBatch(Shard& shard)
+	{
+		if (shard.DispatchBatch.empty())
+			return;
+
+		auto callbackStart = std::chrono::steady_clock::now();
+
+		if (m_DataReceivedBatchCallback)
+		{
+			// One callback starts every message in the batch
+			if (m_Instrumentation.IsEnabled())
+			{
+				SteamNetworkingMicroseconds now = SteamNetworkingUtils()->GetLocalTimestamp();
+				for (SteamNetworkingMicroseconds timeReceived : shard.DispatchTimesReceived)
+					m_Instrumentation.RecordReceiveToCallback(timeReceived, now);
+			}
+
+			InstrumentationTimer callbackTimer(m_Instrumentation, m_Instrumentation.CallbackDuration);
+			m_DataReceivedBatchCallback(shard.DispatchBatch);
+		}
+		else if (m_DataReceivedCallback)
+		{
+			for (size_t i = 0; i < shard.DispatchBatch.size(); i++)
+			{
+				if (m_Instrumentation.IsEnabled())
+					m_Instrumentation.RecordReceiveToCallback(shard.DispatchTimesReceived[i], SteamNetworkingUtils()->GetLocalTimestamp());
+
+				InstrumentationTimer callbackTimer(m_Instrumentation, m_Instrumentation.CallbackDuration);
+				m_DataReceivedCallback(*shard.DispatchBatch[i].Client, shard.DispatchBatch[i].Data);
+			}
+		}
+
+		auto callbackTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - callbackStart);
+		m_CallbackMicroseconds.fetch_add(callbackTime.count(), std::memory_order_relaxed);
+
+		shard.DispatchBatch.clear();
+		shard.DispatchTimesReceived.clear();
+	}
+
+	void Server::EnableDeferredDispatch(uint32_t capacity)
+	{
+		if (m_Running)
+			return;
+
+		m_DeferredDispatchCapacity = std::max(capacity, 1u);
+	}
+
+	void Server::PostEvent(Shard& shard, PendingEvent&& event)
+	{
+		// Keep ordering - once something has overflowed, everything goes through the overflow until it drains
+		if (!shard.PendingOverflow.empty() || !shard.PendingEvents.Push(std::move(event)))
+			shard.PendingOverflow.push_back(std::move(event));
+	}
+
+	bool Server::FlushPendingOverflow(Shard& shard)
+	{
+		size_t flushed = 0;
+		while (flushed < shard.PendingOverflow.size() && shard.PendingEvents.Push(std::move(shard.PendingOverflow[flushed])))
+			flushed++;
+
+		shard.PendingOverflow.erase(shard.PendingOverflow.begin(), shard.PendingOverflow.begin() + flushed);
+		return shard.PendingOverflow.empty();
+	}
+
+	uint32_t Server::DispatchPending(uint32_t maxEvents)
+	{
+		if (!IsDeferredDispatchEnabled())
+			return 0;
+
+		std::scoped_lock lock(m_DispatchMutex);
+
+		// Events are ordered per shard (and so per client), not across shards
+		uint32_t eventCount = 0;
+		for (auto& shard : m_Shards)
+		{
+			while (eventCount < maxEvents)
+			{
+				PendingEvent* event = shard->PendingEvents.Front();
+				if (!event)
+					break;
+
+				switch (event->EventType)
+				{
+					case PendingEvent::Type::DataReceived:
+					{
+						// Slots are only released after the disconnect or resumed event, which comes after this
+						const ClientInfo& client = *m_Clients.Get(event->Slot);
+						if (m_Instrumentation.IsEnabled())
+							m_Instrumentation.RecordReceiveToCallback(event->Message->m_usecTimeReceived, SteamNetworkingUtils()->GetLocalTimestamp());
+
+						if (m_DataReceivedBatchCallback)
+						{
+							// Released together with the rest of the batch
+							m_DeferredBatch.push_back({ &client, Buffer(event->Message->m_pData, event->Message->m_cbSize) });
+							m_DeferredMessages.push_back(event->Message);
+							break;
+						}
+
+						// Released as soon as the callback returns, unless it retained the message
+						Utils::ReceivedMessageScope messageScope(std::span(&event->Message, 1));
+						if (m_DataReceivedCallback)
+						{
+							auto callbackStart = std::chrono::steady_clock::now();
+							InstrumentationTimer callbackTimer(m_Instrumentation, m_Instrumentation.CallbackDuration);
+							m_DataReceivedCallback(client, Buffer(event->Message->m_pData, event->Message->m_cbSize));
+							callbackTimer.Stop();
+							auto callbackTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - callbackStart);
+							m_CallbackMicroseconds.fetch_add(callbackTime.count(), std::memory_order_relaxed);
+						}
+						break;
+					}
+
+					case PendingEvent::Type::ClientConnected:
+					{
+						FlushDeferredBatch();
+
+						if (m_ClientConnectedCallback)
+							m_ClientConnectedCallback(*m_Clients.Get(event->Slot));
+						break;
+					}
+
+					case PendingEvent::Type::ClientDisconnected:
+					{
+						FlushDeferredBatch();
+
+						if (m_ClientDisconnectedCallback)
+							m_ClientDisconnectedCallback(*m_Clients.Get(event->Slot));
+						m_Clients.Release(event->Slot);
+						break;
+					}
+
+					case PendingEvent::Type::ClientSuspended:
+					{
+						FlushDeferredBatch();
+
+						if (m_ClientSuspendedCallback)
+							m_ClientSuspendedCallback(*m_Clients.Get(event->Slot));
+						break;
+					}
+
+					case PendingEvent::Type::ClientResumed:
+					{
+						FlushDeferredBatch();
+						CompleteResume(event->Slot, event->PreviousSlot, event->PreviousClientID);
+						break;
+					}
+
+					default:
+						break;
+				}
+
+				shard->PendingEvents.PopFront();
+				eventCount++;
+			}
+		}
+
+		FlushDeferredBatch();
+		return eventCount;
+	}
+
+	void Server::FlushDeferredBatch()
+	{
+		if (m_DeferredBatch.empty())
+			return;
+
+		auto callbackStart = std::chrono::steady_clock::now();
+		{
+			Utils::ReceivedMessageScope messageScope(m_DeferredMessages);
+			InstrumentationTimer callbackTimer(m_Instrumentation, m_Instrumentation.CallbackDuration);
+			m_DataReceivedBatchCallback(m_DeferredBatch);
+		}
+		auto callbackTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - callbackStart);
+		m_CallbackMicroseconds.fetch_add(callbackTime.count(), std::memory_order_relaxed);
+
+		m_DeferredBatch.clear();
+		m_DeferredMessages.clear();
+	}
+
+	void Server::DiscardPendingEvents(Shard& shard)
+	{
+		// Received messages must go back to the library before it's shut down
+		std::scoped_lock lock(m_DispatchMutex);
+
+		while (PendingEvent* event = shard.PendingEvents.Front())
+		{
+			if (event->EventType == PendingEvent::Type::DataReceived)
+				event->Message->Release();
+			shard.PendingEvents.PopFront();
+		}
+
+		for (PendingEvent& event : shard.PendingOverflow)
+		{
+			if (event.EventType == PendingEvent::Type::DataReceived)
+				event.Message->Release();
+		}
+		shard.PendingOverflow.clear();
+	}
+
+	void Server::SetClientNick(HSteamNetConnection hConn, const char* nick)
+	{
+		// Set the connection name, too, which is useful for debugging
+		m_Interface->SetConnectionName(hConn, nick);
+	}
+
+	void Server::SetDataReceivedCallback(const DataReceivedCallback& function)
+	{
+		m_DataReceivedCallback = function;
+	}
+
+	void Server::SetClientConnectedCallback(const ClientConnectedCallback& function)
+	{
+		m_ClientConnectedCallback = function;
+	}
+
+	void Server::SetClientDisconnectedCallback(const ClientDisconnectedCallback& function)
+	{
+		m_ClientDisconnectedCallback = function;
+	}
+
+	void Server::SetClientCongestionCallback(const ClientCongestionCallback& function)
+	{
+		m_ClientCongestionCallback = function;
+	}
+
+	void Server::SetConnectionRequestCallback(const AdmissionController::ConnectionRequestCallback& function)
+	{
+		if (m_Running)
+			return;
+
+		m_Admission.SetConnectionRequestCallback(function);
+	}
+
+	void Server::SetDataReceivedBatchCallback(const DataReceivedBatchCallback& function)
+	{
+		m_DataReceivedBatchCallback = function;
+	}
+
+	void Server::SetReceiveBatchSize(int batchSize)
+	{
+		m_ReceiveBatchSize = batchSize;
+	}
+
+	SendResult Server::SendBufferToClient(ClientID clientID, const Buffer& buffer, bool reliable, LaneIndex lane)
+	{
+		// Compression adds a trailer, even to payloads it doesn't compress
+		uint32_t maxSize = IsCompressionEnabled() ? PayloadCompressor::GetMaxPayloadSize() : (uint32_t)k_cbMaxSteamNetworkingSocketsMessageSizeSend;
+		if (buffer.Size > maxSize)
+		{
+			std::cout << fmt::format("ERROR: {} byte message is over the {} byte limit, use SendStreamToClient", buffer.Size, maxSize) << std::endl;
+			return SendResult::TooLarge;
+		}
+
+		// SendMessageToConnection can only send on lane 0
+		if (IsOutboundQueueEnabled() || IsCompressionEnabled() || lane != 0)
+		{
+			SteamNetworkingMessage_t* message;
+			if (IsCompressionEnabled())
+			{
+				message = m_Compressor.CreateEncodedMessage(buffer.Data, (uint32_t)buffer.Size);
+			}
+			else
+			{
+				message = AllocateMessage((uint32_t)buffer.Size);
+				memcpy(message->m_pData, buffer.Data, buffer.Size);
+			}
+
+			message->m_conn = (HSteamNetConnection)clientID;
+			message->m_nFlags = reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable;
+			message->m_idxLane = lane;
+			return SubmitMessage(message);
+		}
+
+		InstrumentationTimer sendTimer(m_Instrumentation, m_Instrumentation.SendCall);
+		EResult result = m_Interface->SendMessageToConnection((HSteamNetConnection)clientID, buffer.Data, (ClientID)buffer.Size, reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable, nullptr);
+		sendTimer.Stop();
+
+		if (result != k_EResultOK)
+		{
+			m_SendFailures.fetch_add(1, std::memory_order_relaxed);
+			return Utils::ToSendResult(result);
+		}
+
+		m_Sent.AddConcurrent(1, buffer.Size);
+		return SendResult::Sent;
+	}
+
+	SteamNetworkingMessage_t* Server::AllocateMessage(uint32_t size)
+	{
+		return SteamNetworkingUtils()->AllocateMessage((int)size);
+	}
+
+	SendResult Server::SendAllocatedMessageToClient(ClientID clientID, SteamNetworkingMessage_t* message, bool reliable, LaneIndex lane)
+	{
+		message->m_conn = (HSteamNetConnection)clientID;
+		message->m_nFlags = reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable;
+		message->m_idxLane = lane;
+		return SubmitMessage(IsCompressionEnabled() ? m_Compressor.EncodeMessage(message) : message);
+	}
+
+	SendResult Server::SendOwnedBufferToClient(ClientID clientID, Buffer&& buffer, bool reliable, LaneIndex lane)
+	{
+		SteamNetworkingMessage_t* message = Utils::CreateMessageFromOwnedBuffer(buffer, (HSteamNetConnection)clientID, reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable);
+		message->m_idxLane = lane;
+		buffer = Buffer();
+
+		return SubmitMessage(IsCompressionEnabled() ? m_Compressor.EncodeMessage(message) : message);
+	}
+
+	// Scratch space for building broadcasts, so steady-state broadcasting doesn't allocate
+	static thread_local std::vector<HSteamNetConnection> s_BroadcastRecipients;
+	static thread_local std::vector<SteamNetworkingMessage_t*> s_BroadcastMessages;
+	static thread_local std::vector<std::byte> s_EncodedPayload;
+
+	void Server::SendBufferToAllClients(const Buffer& buffer, ClientID excludeClientID, bool reliable, LaneIndex lane)
+	{
+		if (IsOutboundQueueEnabled())
+		{
+			ClientFilter filter;
+			if (excludeClientID)
+				filter = [excludeClientID](const ClientInfo& client) { return client.ID != excludeClientID; };
+
+			EnqueueBroadcast(buffer, std::move(filter), reliable, lane);
+			return;
+		}
+
+		std::shared_lock lock(m_Clients.GetMutex());
+		s_BroadcastRecipients.clear();
+		for (const ClientInfo& client : m_Clients.GetConnected())
+		{
+			if (client.ID != excludeClientID)
+				s_BroadcastRecipients.push_back(client.ID);
+		}
+
+		BroadcastBuffer(s_BroadcastRecipients, buffer, reliable, lane);
+	}
+
+	void Server::SendBufferToAllClients(const Buffer& buffer, std::span<const ClientID> excludeClientIDs, bool reliable, LaneIndex lane)
+	{
+		if (IsOutboundQueueEnabled())
+		{
+			std::vector<ClientID> excluded(excludeClientIDs.begin(), excludeClientIDs.end());
+			EnqueueBroadcast(buffer, [excluded = std::move(excluded)](const ClientInfo& client)
+			{
+				return std::find(excluded.begin(), excluded.end(), client.ID) == excluded.end();
+			}, reliable, lane);
+			return;
+		}
+
+		std::shared_lock lock(m_Clients.GetMutex());
+		s_BroadcastRecipients.clear();
+		for (const ClientInfo& client : m_Clients.GetConnected())
+		{
+			if (std::find(excludeClientIDs.begin(), excludeClientIDs.end(), client.ID) == excludeClientIDs.end())
+				s_BroadcastRecipients.push_back(client.ID);
+		}
+
+		BroadcastBuffer(s_BroadcastRecipients, buffer, reliable, lane);
+	}
+
+	void Server::SendBufferToAllClients(const Buffer& buffer, const ClientFilter& filter, bool reliable, LaneIndex lane)
+	{
+		if (IsOutboundQueueEnabled())
+		{
+			EnqueueBroadcast(buffer, ClientFilter(filter), reliable, lane);
+			return;
+		}
+
+		std::shared_lock lock(m_Clients.GetMutex());
+		s_BroadcastRecipients.clear();
+		for (const ClientInfo& client : m_Clients.GetConnected())
+		{
+			if (filter(client))
+				s_BroadcastRecipients.push_back(client.ID);
+		}
+
+		BroadcastBuffer(s_BroadcastRecipients, buffer, reliable, lane);
+	}
+
+	void Server::SendBufferToClients(std::span<const ClientID> clientIDs, const Buffer& buffer, bool reliable, LaneIndex lane)
+	{
+		BroadcastBuffer(clientIDs, buffer, reliable, lane);
+	}
+
+	void Server::SendBufferToRoom(RoomID room, const Buffer& buffer, ClientID excludeClientID, bool reliable, LaneIndex lane)
+	{
+		SendBufferToRooms(std::span<const RoomID>(&room, 1), buffer, excludeClientID, reliable, lane);
+	}
+
+	void Server::SendBufferToRooms(std::span<const RoomID> rooms, const Buffer& buffer, ClientID excludeClientID, bool reliable, LaneIndex lane)
+	{
+		// Resolved now rather than on the network thread, so membership changes after this don't affect it
+		s_BroadcastRecipients.clear();
+		m_Rooms.ForEachClient(rooms, [excludeClientID](const ClientInfo& client)
+		{
+			if (client.ID != excludeClientID)
+				s_BroadcastRecipients.push_back(client.ID);
+		});
+
+		BroadcastBuffer(s_BroadcastRecipients, buffer, reliable, lane);
+	}
+
+	void Server::BroadcastBuffer(std::span<const HSteamNetConnection> connections, const Buffer& buffer, bool reliable, LaneIndex lane)
+	{
+		if (connections.empty())
+			return;
+
+		// Compressed once, then shared by every recipient
+		Buffer payload = IsCompressionEnabled() ? m_Compressor.EncodeToBuffer(buffer, s_EncodedPayload) : buffer;
+
+		s_BroadcastMessages.clear();
+		Utils::CreateBroadcastMessages(payload, connections, reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable, lane, s_BroadcastMessages);
+
+		if (IsOutboundQueueEnabled())
+		{
+			for (SteamNetworkingMessage_t* message : s_BroadcastMessages)
+				SubmitMessage(message);
+			return;
+		}
+
+		InstrumentationTimer sendTimer(m_Instrumentation, m_Instrumentation.SendCall);
+		uint32_t failures = Utils::SendNetworkMessages(m_Interface, s_BroadcastMessages);
+		sendTimer.Stop();
+
+		m_Sent.AddConcurrent(connections.size() - failures, (connections.size() - failures) * payload.Size);
+		if (failures)
+			m_SendFailures.fetch_add(failures, std::memory_order_relaxed);
+	}
+
+	void Server::EnableCompression(const CompressionSettings& settings)
+	{
+		if (m_Running)
+			return;
+
+		m_Compressor.Enable(settings);
+	}
+
+	void Server::EnableStreaming(const StreamSettings& settings)
+	{
+		if (m_Running)
+			return;
+
+		m_Streams.Enable(settings, [this](HSteamNetConnection connection, SteamNetworkingMessage_t* message, LaneIndex lane)
+		{
+			SendAllocatedMessageToClient((ClientID)connection, message, true, lane);
+		});
+	}
+
+	StreamID Server::SendStreamToClient(ClientID clientID, Buffer&& data, const StreamOptions& options)
+	{
+		if (!IsStreamingEnabled())
+		{
+			std::cout << "ERROR: SendStreamToClient called without EnableStreaming()" << std::endl;
+			data.Release();
+			return 0;
+		}
+
+		StreamID stream = m_Streams.Send((HSteamNetConnection)clientID, std::move(data), options);
+		if (m_Scheduler.GetSettings().Mode == NetworkThreadMode::WaitOnActivity)
+			m_Scheduler.Wake();
+		return stream;
+	}
+
+	void Server::SetLanes(std::span<const LaneConfig> lanes)
+	{
+		if (m_Running)
+			return;
+
+		m_Lanes.assign(lanes.begin(), lanes.end());
+	}
+
+	void Server::SetAdmissionSettings(const AdmissionSettings& settings)
+	{
+		if (m_Running)
+			return;
+
+		m_Admission.SetSettings(settings);
+	}
+
+	void Server::SetInboundLimits(const InboundLimitSettings& settings)
+	{
+		if (m_Running)
+			return;
+
+		m_InboundLimits = settings;
+	}
+
+	void Server::EnableSessions(const SessionSettings& settings)
+	{
+		if (m_Running)
+			return;
+
+		m_SessionsEnabled = true;
+		m_SessionSettings = settings;
+	}
+
+	void Server::SetClientSuspendedCallback(const ClientSuspendedCallback& function)
+	{
+		m_ClientSuspendedCallback = function;
+	}
+
+	void Server::SetClientResumedCallback(const ClientResumedCallback& function)
+	{
+		m_ClientResumedCallback = function;
+	}
+
+	void Server::EnableCapture(const std::string& path, const CaptureSettings& settings)
+	{
+		if (m_Running)
+			return;
+
+		m_CapturePath = path;
+		m_CaptureSettings = settings;
+	}
+
+	void Server::EnableOutboundQueue(uint32_t capacity)
+	{
+		if (m_Running)
+			return;
+
+		m_OutboundQueue.Init(capacity);
+	}
+
+	SendResult Server::SubmitMessage(SteamNetworkingMessage_t* message)
+	{
+		uint32_t size = (uint32_t)message->m_cbSize;
+		if (!IsOutboundQueueEnabled())
+		{
+			InstrumentationTimer sendTimer(m_Instrumentation, m_Instrumentation.SendCall);
+			SendResult result = Utils::SendNetworkMessage(m_Interface, message);
+			sendTimer.Stop();
+
+			if (result == SendResult::Sent)
+				m_Sent.AddConcurrent(1, size);
+			else
+				m_SendFailures.fetch_add(1, std::memory_order_relaxed);
+			return result;
+		}
+
+		if (!m_OutboundQueue.Push({ message }))
+		{
+			// Queue full - drop (counted in the queue stats)
+			message->Release();
+			return SendResult::QueueFull;
+		}
+
+		if (m_Scheduler.GetSettings().Mode == NetworkThreadMode::WaitOnActivity)
+			m_Scheduler.Wake();
+
+		return SendResult::Queued;
+	}
+
+	void Server::EnqueueBroadcast(const Buffer& buffer, ClientFilter&& filter, bool reliable, LaneIndex lane)
+	{
+		OutboundMessage outbound;
+		outbound.Payload = Utils::CreateSharedPayload(IsCompressionEnabled() ? m_Compressor.EncodeToBuffer(buffer, s_EncodedPayload) : buffer);
+		outbound.Filter = std::move(filter);
+		outbound.SendFlags = reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_Unreliable;
+		outbound.Lane = lane;
+
+		Utils::SharedPayload* payload = outbound.Payload;
+		if (!m_OutboundQueue.Push(std::move(outbound)))
+		{
+			Utils::ReleaseSharedPayload(payload);
+			return;
+		}
+
+		if (m_Scheduler.GetSettings().Mode == NetworkThreadMode::WaitOnActivity)
+			m_Scheduler.Wake();
+	}
+
+	uint32_t Server::FlushOutboundQueue()
+	{
+		if (!IsOutboundQueueEnabled())
+			return 0;
+
+		uint32_t count = 0;
+		m_OutboundBatch.clear();
+
+		OutboundMessage outbound;
+		while (m_OutboundQueue.Pop(outbound))
+		{
+			count++;
+
+			if (outbound.Message)
+			{
+				m_OutboundBatch.push_back(outbound.Message);
+				continue;
+			}
+
+			// Broadcast - now that we're on the network thread it's safe to walk the client list
+			s_BroadcastRecipients.clear();
+			for (const ClientInfo& client : m_Clients.GetConnected())
+			{
+				if (!outbound.Filter || outbound.Filter(client))
+					s_BroadcastRecipients.push_back(client.ID);
+			}
+
+			Utils::CreateBroadcastMessages(outbound.Payload, s_BroadcastRecipients, outbound.SendFlags, outbound.Lane, m_OutboundBatch);
+			Utils::ReleaseSharedPayload(outbound.Payload);
+			outbound = {};
+		}
+
+		if (!m_OutboundBatch.empty())
+		{
+			InstrumentationTimer sendTimer(m_Instrumentation, m_Instrumentation.SendCall);
+			uint64_t sentBytes = 0;
+			uint32_t failures = Utils::SendNetworkMessages(m_Interface, m_OutboundBatch, &sentBytes);
+			sendTimer.Stop();
+
+			// Counted once the library has taken them, not when queued
+			m_Sent.AddConcurrent(m_OutboundBatch.size() - failures, sentBytes);
+			if (failures)
+				m_SendFailures.fetch_add(failures, std::memory_order_relaxed);
+		}
+
+		return count;
+	}
+
+	SendResult Server::SendStringToClient(ClientID clientID, const std::string& string, bool reliable, LaneIndex lane)
+	{
+		return SendBufferToClient(clientID, Buffer(string.data(), string.size()), reliable, lane);
+	}
+
+	void Server::SendStringToAllClients(const std::string& string, ClientID excludeClientID, bool reliable, LaneIndex lane)
+	{
+		SendBufferToAllClients(Buffer(string.data(), string.size()), excludeClientID, reliable, lane);
+	}
+
+	void Server::SampleStats()
+	{
+		m_NextStatsSample = std::chrono::steady_clock::now() + m_StatsInterval;
+
+		auto stats = std::make_shared<NetworkStats>();
+		stats->Timestamp = SteamNetworkingUtils()->GetLocalTimestamp();
+
+		for (const auto& shard : m_Shards)
+		{
+			stats->MessagesIn += shard->Received.Messages.load(std::memory_order_relaxed);
+			stats->BytesIn += shard->Received.Bytes.load(std::memory_order_relaxed);
+		}
+
+		stats->MessagesOut = m_Sent.Messages.load(std::memory_order_relaxed);
+		stats->BytesOut = m_Sent.Bytes.load(std::memory_order_relaxed);
+		stats->CallbackMicroseconds = m_CallbackMicroseconds.load(std::memory_order_relaxed);
+		stats->SendFailures = m_SendFailures.load(std::memory_order_relaxed);
+		stats->OutboundQueue = m_OutboundQueue.GetStats();
+		stats->DispatchLatency = GetDispatchLatencyStats();
+		stats->Compression = m_Compressor.GetStats();
+
+		stats->Connections.reserve(m_Clients.GetConnectedCount());
+		for (const ClientInfo& client : m_Clients.GetConnected())
+		{
+			ConnectionStats& connection = stats->Connections.emplace_back();
+			Utils::SampleConnectionStats(m_Interface, client.ID, connection, (int)m_Lanes.size());
+			connection.Connection = client.ID;
+			connection.Description = client.ConnectionDesc;
+			connection.Congested = m_Clients.IsCongested(client.Slot);
+
+			const TrafficCounter& received = m_Clients.GetReceivedCounter(client.Slot);
+			connection.MessagesIn = received.Messages.load(std::memory_order_relaxed);
+			connection.BytesIn = received.Bytes.load(std::memory_order_relaxed);
+
+			InboundLimitStats limits = m_Clients.GetInboundLimitState(client.Slot).GetStats();
+			connection.MessagesDropped = limits.DroppedMessages;
+			connection.MessagesDeferred = limits.DeferredMessages;
+		}
+
+		m_Stats.store(std::move(stats), std::memory_order_release);
+	}
+
+	void Server::CheckCongestion()
+	{
+		m_NextCongestionCheck = std::chrono::steady_clock::now() + m_CongestionSettings.CheckInterval;
+
+		for (const ClientInfo& client : m_Clients.GetConnected())
+		{
+			FlowControlStatus status;
+			Utils::GetFlowControlStatus(m_Interface, client.ID, status);
+
+			bool wasCongested = m_Clients.IsCongested(client.Slot);
+			status.Congested = Utils::UpdateCongestionState(wasCongested, status, m_CongestionSettings);
+			if (status.Congested == wasCongested)
+				continue;
+
+			m_Clients.SetCongested(client.Slot, status.Congested);
+			if (m_ClientCongestionCallback)
+				m_ClientCongestionCallback(client, status);
+		}
+	}
+
+	FlowControlStatus Server::GetFlowControlStatus(const ClientInfo& client) const
+	{
+		FlowControlStatus status;
+		if (m_Interface && Utils::GetFlowControlStatus(m_Interface, client.ID, status))
+			status.Congested = m_Clients.IsCongested(client.Slot);
+		return status;
+	}
+
+	DispatchLatencyStats Server::GetDispatchLatencyStats() const
+	{
+		// Recorded per shard, so shard threads don't contend on the counters
+		DispatchLatencyStats stats;
+		uint64_t totalMicroseconds = 0;
+		for (const auto& shard : m_Shards)
+		{
+			stats.SampleCount += shard->DispatchLatency.SampleCount.load(std::memory_order_relaxed);
+			totalMicroseconds += shard->DispatchLatency.TotalMicroseconds.load(std::memory_order_relaxed);
+			stats.MaxMicroseconds = std::max(stats.MaxMicroseconds, shard->DispatchLatency.MaxMicroseconds.load(std::memory_order_relaxed));
+		}
+
+		stats.AverageMicroseconds = stats.SampleCount ? totalMicroseconds / stats.SampleCount : 0;
+		return stats;
+	}
+
+	void Server::ResetDispatchLatencyStats()
+	{
+		for (auto& shard : m_Shards)
+			shard->DispatchLatency.Reset();
+	}
+
+	std::string Server::GetMetricsText(std::string_view prefix) const
+	{
+		std::shared_ptr<const NetworkStats> stats = GetStats();
+		return stats ? Utils::FormatMetricsText(*stats, prefix) : std::string();
+	}
+
+	void Server::SetClientUserData(const ClientInfo& client, void* userData)
+	{
+		if (ClientInfo* info = m_Clients.Get(client.Slot, client.ID))
+			info->UserData = userData;
+	}
+
+	void Server::KickClient(ClientID clientID, std::string_view reason)
+	{
+		{
+			std::scoped_lock lock(m_KickMutex);
+			m_Kicks.push_back({ clientID, std::string(reason) });
+		}
+
+		m_Scheduler.Wake();
 	}
 
 	void Server::OnFatalError(const std::string& message)
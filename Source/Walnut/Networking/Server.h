@@ -2,6 +2,26 @@
 
 #include "Walnut/Core/Buffer.h"
 
+#include "NetworkScheduler.h"
+#include "NetworkingContext.h"
+#include "MPSCQueue.h"
+#include "SPSCQueue.h"
+#include "NetworkingUtils.h"
+#include "ClientRegistry.h"
+#include "Rooms.h"
+#include "NetworkStats.h"
+#include "LatencyHistogram.h"
+#include "MessageProtocol.h"
+#include "Lanes.h"
+#include "ReceivedMessage.h"
+#include "BufferPool.h"
+#include "Streaming.h"
+#include "FlowControl.h"
+#include "Admission.h"
+#include "InboundLimits.h"
+#include "Sessions.h"
+#include "TrafficCapture.h"
+
 #include <steam/steamnetworkingsockets.h>
 #include <steam/isteamnetworkingutils.h>
 #ifndef STEAMNETWORKINGSOCKETS_OPENSOURCE
@@ -9,18 +29,27 @@
 #endif
 
 #include <string>
-#include <map>
+#include <string_view>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <span>
 #include <thread>
+#include <chrono>
 #include <functional>
 
 namespace Walnut {
 
-	using ClientID = HSteamNetConnection;
+	enum class ShardAssignment
+	{
+		RoundRobin = 0, LeastLoaded
+	};
 
-	struct ClientInfo
+	struct ClientMessage
 	{
-		ClientID ID;
-		std::string ConnectionDesc;
+		const ClientInfo* Client = nullptr;
+		Buffer Data;
 	};
 
 	class Server
@@ -29,6 +58,21 @@ namespace Walnut {
 		using DataReceivedCallback = std::function<void(const ClientInfo&, const Buffer)>;
 		using ClientConnectedCallback = std::function<void(const ClientInfo&)>;
 		using ClientDisconnectedCallback = std::function<void(const ClientInfo&)>;
+
+		// Sessions only, see Sessions.h. A resumed client has the new connection's ID and a new slot, the previous
+		// slot's ClientInfo is invalid once the resumed callback returns
+		using ClientSuspendedCallback = std::function<void(const ClientInfo&)>;
+		using ClientResumedCallback = std::function<void(const ClientInfo&, ClientID previousClientID)>;
+
+		// Called once per receive batch, instead of DataReceivedCallback per message.
+		// Buffers are only valid for the duration of the callback.
+		using DataReceivedBatchCallback = std::function<void(std::span<const ClientMessage>)>;
+
+		// Return true to include the client in a broadcast
+		using ClientFilter = std::function<bool(const ClientInfo&)>;
+
+		// Called when a client becomes congested or recovers (FlowControlStatus::Congested)
+		using ClientCongestionCallback = std::function<void(const ClientInfo&, const FlowControlStatus&)>;
 	public:
 		Server(int port);
 		~Server();
@@ -41,63 +85,532 @@ namespace Walnut {
 
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		// Set callbacks for server events
-		// These callbacks will be called from the server thread
+		// These callbacks will be called from the server thread (or shard threads, see SetShardCount),
+		// or from DispatchPending() if deferred dispatch is enabled
+		// Received buffers are only valid during the callback. To keep one without copying, retain the message
+		// with ReceivedMessage::Retain(buffer), or copy it into a pooled block with BufferPool::Get().Copy(buffer)
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		void SetDataReceivedCallback(const DataReceivedCallback& function);
 		void SetClientConnectedCallback(const ClientConnectedCallback& function);
 		void SetClientDisconnectedCallback(const ClientDisconnectedCallback& function);
+		void SetDataReceivedBatchCallback(const DataReceivedBatchCallback& function);
+
+		// Max number of messages drained from the poll group per receive call (default 64)
+		// Must be set before Start()
+		void SetReceiveBatchSize(int batchSize);
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Sharding
+		// With more than one shard, accepted connections are spread over that many poll groups, each drained
+		// by its own worker thread. All callbacks for a client (connect, data, disconnect) are called from
+		// its shard's thread (see ClientInfo::Shard), so callbacks for different clients can run concurrently.
+		// The server thread still accepts connections and flushes the outbound queue.
+		// Must be set before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void SetShardCount(uint32_t shardCount, ShardAssignment assignment = ShardAssignment::RoundRobin);
+		uint32_t GetShardCount() const { return m_ShardCount; }
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Deferred Dispatch
+		// When enabled, the server thread only queues events (received messages are not copied) and callbacks
+		// run inside DispatchPending(), which should be called regularly from a single application thread.
+		// Each message is released as soon as its callback returns. If the application falls behind,
+		// the server thread stops receiving and messages stay queued in the library.
+		// Events that haven't been dispatched by the time the server has stopped are discarded.
+		// Must be enabled before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableDeferredDispatch(uint32_t capacity = 8192);
+		bool IsDeferredDispatchEnabled() const { return m_DeferredDispatchCapacity > 0; }
+
+		// Returns number of events dispatched
+		uint32_t DispatchPending(uint32_t maxEvents = UINT32_MAX);
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Network thread scheduling
+		// Settings must be set before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void SetNetworkThreadSettings(const NetworkThreadSettings& settings) { m_Scheduler.SetSettings(settings); }
+		const NetworkThreadSettings& GetNetworkThreadSettings() const { return m_Scheduler.GetSettings(); }
+		DispatchLatencyStats GetDispatchLatencyStats() const;
+		void ResetDispatchLatencyStats();
 
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		// Send Data
+		// The payload is copied, so the buffer can be reused as soon as these return.
+		// Sends to one client return a SendResult (see FlowControl.h), broadcasts count failures in NetworkStats::SendFailures
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		void SendBufferToClient(ClientID clientID, Buffer buffer, bool reliable = true);
-		void SendBufferToAllClients(Buffer buffer, ClientID excludeClientID = 0, bool reliable = true);
+		SendResult SendBufferToClient(ClientID clientID, const Buffer& buffer, bool reliable = true, LaneIndex lane = 0);
+		void SendBufferToAllClients(const Buffer& buffer, ClientID excludeClientID = 0, bool reliable = true, LaneIndex lane = 0);
+		void SendBufferToAllClients(const Buffer& buffer, std::span<const ClientID> excludeClientIDs, bool reliable = true, LaneIndex lane = 0);
+		void SendBufferToAllClients(const Buffer& buffer, const ClientFilter& filter, bool reliable = true, LaneIndex lane = 0);
+		void SendBufferToClients(std::span<const ClientID> clientIDs, const Buffer& buffer, bool reliable = true, LaneIndex lane = 0);
+
+		SendResult SendStringToClient(ClientID clientID, const std::string& string, bool reliable = true, LaneIndex lane = 0);
+		void SendStringToAllClients(const std::string& string, ClientID excludeClientID = 0, bool reliable = true, LaneIndex lane = 0);
 
-		void SendStringToClient(ClientID clientID, const std::string& string, bool reliable = true);
-		void SendStringToAllClients(const std::string& string, ClientID excludeClientID = 0, bool reliable = true);
+		template<typename T>
+		SendResult SendDataToClient(ClientID clientID, const T& data, bool reliable = true, LaneIndex lane = 0)
+		{
+			return SendBufferToClient(clientID, Buffer(&data, sizeof(T)), reliable, lane);
+		}
 
 		template<typename T>
-		void SendDataToClient(ClientID clientID, const T& data, bool reliable = true)
+		void SendDataToAllClients(const T& data, ClientID excludeClientID = 0, bool reliable = true, LaneIndex lane = 0)
+		{
+			SendBufferToAllClients(Buffer(&data, sizeof(T)), excludeClientID, reliable, lane);
+		}
+
+		// Encoded straight into a library message, see MessageProtocol.h
+		template<NetworkMessage T>
+		SendResult SendTypedMessageToClient(ClientID clientID, const T& message, bool reliable = true, std::span<const std::byte> trailingData = {}, LaneIndex lane = 0)
 		{
-			SendBufferToClient(clientID, Buffer(&data, sizeof(T)), reliable);
+			SteamNetworkingMessage_t* networkMessage = AllocateMessage(GetEncodedMessageSize<T>(trailingData.size()));
+			EncodeMessage(networkMessage->m_pData, message, trailingData);
+			return SendAllocatedMessageToClient(clientID, networkMessage, reliable, lane);
 		}
 
+		template<NetworkMessage T>
+		void SendTypedMessageToAllClients(const T& message, ClientID excludeClientID = 0, bool reliable = true, std::span<const std::byte> trailingData = {}, LaneIndex lane = 0)
+		{
+			// Broadcasts copy the payload once into a shared buffer, so encode on the stack when it fits
+			uint32_t size = GetEncodedMessageSize<T>(trailingData.size());
+			alignas(MessageAlignment) std::byte stackBuffer[512];
+			std::vector<std::byte> heapBuffer;
+			std::byte* encoded = stackBuffer;
+			if (size > sizeof(stackBuffer))
+			{
+				heapBuffer.resize(size);
+				encoded = heapBuffer.data();
+			}
+
+			EncodeMessage(encoded, message, trailingData);
+			SendBufferToAllClients(Buffer(encoded, size), excludeClientID, reliable, lane);
+		}
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Rooms
+		// Server-side groups of clients for targeted broadcasts (eg. one per match, or per area of interest).
+		// Membership is a bitset over client slots, cheap enough to update every tick. Sending to several rooms
+		// reaches each client once, and like every broadcast the payload is copied once for all recipients.
+		// Any thread. Clients leave all rooms when they disconnect.
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		RoomID CreateRoom() { return m_Rooms.Create(); }
+		void DestroyRoom(RoomID room) { m_Rooms.Destroy(room); }
+
+		// Return false if the room doesn't exist or the client has disconnected
+		bool AddClientToRoom(RoomID room, const ClientInfo& client) { return m_Rooms.Add(room, client); }
+		bool RemoveClientFromRoom(RoomID room, const ClientInfo& client) { return m_Rooms.Remove(room, client); }
+
+		bool IsClientInRoom(RoomID room, const ClientInfo& client) const { return m_Rooms.Contains(room, client); }
+		void ClearRoom(RoomID room) { m_Rooms.Clear(room); }
+		uint32_t GetRoomClientCount(RoomID room) const { return m_Rooms.GetSize(room); }
+
+		void SendBufferToRoom(RoomID room, const Buffer& buffer, ClientID excludeClientID = 0, bool reliable = true, LaneIndex lane = 0);
+		void SendBufferToRooms(std::span<const RoomID> rooms, const Buffer& buffer, ClientID excludeClientID = 0, bool reliable = true, LaneIndex lane = 0);
+
 		template<typename T>
-		void SendDataToAllClients(const T& data, ClientID excludeClientID = 0, bool reliable = true)
+		void SendDataToRoom(RoomID room, const T& data, ClientID excludeClientID = 0, bool reliable = true, LaneIndex lane = 0)
 		{
-			SendBufferToAllClients(Buffer(&data, sizeof(T)), excludeClientID, reliable);
+			SendBufferToRoom(room, Buffer(&data, sizeof(T)), excludeClientID, reliable, lane);
 		}
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Zero-copy Send
+		// Either allocate a message and write the payload straight into message->m_pData, or hand over a buffer
+		// allocated with Buffer::Allocate/Buffer::Copy. Ownership passes to the library and the payload is freed once sent.
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		SteamNetworkingMessage_t* AllocateMessage(uint32_t size);
+		SendResult SendAllocatedMessageToClient(ClientID clientID, SteamNetworkingMessage_t* message, bool reliable = true, LaneIndex lane = 0);
+		SendResult SendOwnedBufferToClient(ClientID clientID, Buffer&& buffer, bool reliable = true, LaneIndex lane = 0);
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Lanes
+		// Configures the lanes every accepted connection sends on, see Lanes.h. Every Send* function takes a lane index,
+		// and NetworkStats reports the queued bytes of each lane per connection.
+		// Must be set before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void SetLanes(std::span<const LaneConfig> lanes);
+		uint32_t GetLaneCount() const { return m_Lanes.empty() ? 1 : (uint32_t)m_Lanes.size(); }
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Admission
+		// Connection attempts are queued and accepted by the server thread at a limited rate, see Admission.h.
+		// With a connection request callback, every attempt waits until ResolveConnectionRequest() accepts or refuses it.
+		// Settings and callback must be set before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void SetAdmissionSettings(const AdmissionSettings& settings);
+		const AdmissionSettings& GetAdmissionSettings() const { return m_Admission.GetSettings(); }
+
+		void SetConnectionRequestCallback(const AdmissionController::ConnectionRequestCallback& function);
+
+		// Any thread, eg. once an async auth lookup finishes. The reason is sent to the client when refused
+		void ResolveConnectionRequest(HSteamNetConnection connection, bool accept, std::string_view reason = {}) { m_Admission.Resolve(connection, accept, reason); }
+
+		// Any thread
+		AdmissionStats GetAdmissionStats() const { return m_Admission.GetStats(); }
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Sessions
+		// Clients whose connection drops keep their slot (ClientInfo, UserData, rooms) for a while, and move all of it to a
+		// new slot if they reconnect in time, see Sessions.h. Clients must enable sessions too. While suspended, a client is not in
+		// GetConnectedClients() and sends to it fail; the disconnect callback is only called once the session expires.
+		// Callbacks are called like the connect/disconnect callbacks. Must be enabled before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableSessions(const SessionSettings& settings = {});
+		bool IsSessionsEnabled() const { return m_SessionsEnabled; }
+
+		void SetClientSuspendedCallback(const ClientSuspendedCallback& function);
+		void SetClientResumedCallback(const ClientResumedCallback& function);
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Capture & Replay
+		// With capture enabled, what the handlers see is recorded into a memory-mapped file, see TrafficCapture.h. The file is
+		// created when the server starts and closed when it stops. Must be enabled before Start()
+		//
+		// ReplayCapture() feeds a capture back through the dispatch path on the calling thread, while the server isn't running:
+		// each recorded client connects on a slot of its own (with a made-up ClientID), and its messages are dispatched in
+		// batches like received ones - through DispatchPending(), which it calls, with deferred dispatch. Resumed sessions
+		// move to a new slot and get the resumed callback, like live ones. Sends from the callbacks fail, since there's
+		// nobody on the other end.
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableCapture(const std::string& path, const CaptureSettings& settings = {});
+		bool IsCaptureEnabled() const { return !m_CapturePath.empty(); }
+		CaptureStats GetCaptureStats() const { return m_Capture.GetStats(); }
+
+		ReplayStats ReplayCapture(const std::string& path, const ReplaySettings& settings = {});
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Inbound Limits
+		// Per-client message and byte rates, enforced by the client's shard before anything is dispatched, see InboundLimits.h.
+		// Counters can be read from any thread, and are also reported in ConnectionStats.
+		// Settings must be set before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void SetInboundLimits(const InboundLimitSettings& settings);
+		const InboundLimitSettings& GetInboundLimits() const { return m_InboundLimits; }
+		InboundLimitStats GetInboundLimitStats(const ClientInfo& client) const { return m_Clients.GetInboundLimitState(client.Slot).GetStats(); }
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Flow Control
+		// How much the library has queued for a client and how fast it drains, see FlowControl.h. Any thread.
+		// The server thread checks every client at CongestionSettings::CheckInterval and calls the congestion
+		// callback (from the server thread) when a client becomes congested or recovers.
+		// Settings must be set before Start()
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		FlowControlStatus GetFlowControlStatus(const ClientInfo& client) const;
+		bool IsClientCongested(const ClientInfo& client) const { return m_Clients.IsCongested(client.Slot); }
 
-		void KickClient(ClientID clientID);
+		void SetCongestionSettings(const CongestionSettings& settings) { m_CongestionSettings = settings; }
+		const CongestionSettings& GetCongestionSettings() const { return m_CongestionSettings; }
+		void SetClientCongestionCallback(const ClientCongestionCallback& function);
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Outbound Queue
+		// When enabled, all Send* functions can be called from any thread. They only push onto a lock-free queue
+		// which the network thread drains and submits in one SendMessages batch per iteration.
+		// Sends that don't fit in the queue are dropped and counted in QueueStats::TotalRejected.
+		// Must be enabled before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableOutboundQueue(uint32_t capacity = 4096);
+		bool IsOutboundQueueEnabled() const { return m_OutboundQueue.IsInitialized(); }
+		QueueStats GetOutboundQueueStats() const { return m_OutboundQueue.GetStats(); }
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Compression
+		// Opt-in payload compression on every send and receive path. Clients must enable it with the same settings,
+		// since every payload carries a trailer saying how it was encoded. Payloads below the threshold, or that
+		// don't get smaller, are sent as-is. Ratio and CPU time are reported in NetworkStats::Compression.
+		// Must be enabled before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableCompression(const CompressionSettings& settings = {});
+		bool IsCompressionEnabled() const { return m_Compressor.IsEnabled(); }
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Streaming
+		// Sends payloads of any size as paced chunks, see Streaming.h. Unlike the Send* functions, which are limited to
+		// the library's 512KB message size, a stream is released gradually so it never floods the send buffer.
+		// Clients must enable it too. Stream callbacks are called from the server thread (or shard threads).
+		// Must be enabled before Start()
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableStreaming(const StreamSettings& settings = {});
+		bool IsStreamingEnabled() const { return m_Streams.IsEnabled(); }
+
+		void SetIncomingStreamCallback(const StreamManager::IncomingStreamCallback& function) { m_Streams.SetIncomingStreamCallback(function); }
+		void SetStreamChunkCallback(const StreamManager::StreamChunkCallback& function) { m_Streams.SetStreamChunkCallback(function); }
+		void SetStreamProgressCallback(const StreamManager::StreamProgressCallback& function) { m_Streams.SetStreamProgressCallback(function); }
+
+		// Any thread. Takes ownership of data (allocated with Buffer::Allocate/Buffer::Copy). Returns 0 if streaming isn't enabled
+		StreamID SendStreamToClient(ClientID clientID, Buffer&& data, const StreamOptions& options = {});
+		void CancelStream(StreamID stream) { m_Streams.Cancel(stream); }
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Stats
+		// The server thread samples every connection at the stats interval and publishes an immutable snapshot,
+		// so GetStats() is cheap and can be called from any thread (eg. a metrics endpoint).
+		// Interval must be set before Start(), 0 disables sampling
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void SetStatsInterval(std::chrono::milliseconds interval) { m_StatsInterval = interval; }
+		std::chrono::milliseconds GetStatsInterval() const { return m_StatsInterval; }
+
+		// Latest snapshot, nullptr until the first sample
+		std::shared_ptr<const NetworkStats> GetStats() const { return m_Stats.load(std::memory_order_acquire); }
+
+		// Latest snapshot in Prometheus text format
+		std::string GetMetricsText(std::string_view prefix = "walnut_net") const;
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Instrumentation
+		// Hot-path latency histograms, see InstrumentationSnapshot. Off by default, and compiled out entirely
+		// when WL_NETWORK_INSTRUMENTATION is 0 (the default for Dist builds)
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		void EnableInstrumentation(bool enabled = true) { m_Instrumentation.SetEnabled(enabled); }
+		bool IsInstrumentationEnabled() const { return m_Instrumentation.IsEnabled(); }
+		InstrumentationSnapshot GetInstrumentationSnapshot() const { return m_Instrumentation.GetSnapshot(); }
+		void ResetInstrumentation() { m_Instrumentation.Reset(); }
+
+		// Any thread. The client is disconnected (and the disconnect callback called) once the server thread gets to it
+		void KickClient(ClientID clientID, std::string_view reason = "Kicked by host");
 
 		bool IsRunning() const { return m_Running; }
-		const std::map<HSteamNetConnection, ClientInfo>& GetConnectedClients() const { return m_ConnectedClients; }
+
+		// Server thread only
+		ClientRegistry::View GetConnectedClients() const { return m_Clients.GetConnected(); }
+		uint32_t GetConnectedClientCount() const { return m_Clients.GetConnectedCount(); }
+
+		// Per-client pointer for the application, readable as ClientInfo::UserData.
+		// Call from the client's callbacks (or with no callbacks for it in flight)
+		void SetClientUserData(const ClientInfo& client, void* userData);
 	private:
+		struct Shard;
+
 		void NetworkThreadFunc(); // Server thread
+		void ShardThreadFunc(Shard& shard);
 
-		static void ConnectionStatusChangedCallback(SteamNetConnectionStatusChangedCallback_t* info);
 		void OnConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* info);
+		void ReleaseNetworkingContext();
 
 		// Server functionality
-		void PollIncomingMessages();
+		uint32_t UpdateShard(Shard& shard);
+		uint32_t PollIncomingMessages(Shard& shard);
+		void DispatchReceivedMessages(Shard& shard, std::span<ISteamNetworkingMessage* const> messages);
+		void DispatchReceivedBatch(Shard& shard);
+		int ApplyInboundLimits(Shard& shard, int messageCount);
+		uint32_t DispatchDeferredMessages(Shard& shard);
+		void SampleStats();
+		void CheckCongestion();
+		ClientInfo* FindReceivingClient(Shard& shard, const ISteamNetworkingMessage* message);
 		void SetClientNick(HSteamNetConnection hConn, const char* nick);
 		void PollConnectionStateChanges();
+		void AcceptPendingConnections();
+		void AcceptConnection(HSteamNetConnection connection);
+		void RemoveClient(const ClientInfo& client);
+		void DiscardClient(const ClientInfo& client);
+		void ProcessKicks();
+
+		// Sessions
+		bool HandleSessionMessage(const ISteamNetworkingMessage* message); // Shard threads
+		void ProcessSessionRequests();
+		void CheckSessions();
+		void SuspendClient(const ClientInfo& client);
+		void ResumeClient(uint32_t slot, const ClientInfo& client, const SessionToken& token);
+		void CompleteResume(uint32_t slot, uint32_t previousSlot, ClientID previousClientID);
+		void EndSuspendedSession(uint32_t slot);
+
+		// Capture
+		void CaptureClientEvent(CaptureRecordType type, uint32_t slot);
+
+		// Sharding
+		void CreateShards();
+		bool StartShards();
+		void StopShards();
+		Shard& SelectShard();
+		struct ShardCommand;
+		void PostShardCommand(Shard& shard, const ShardCommand& command);
+		void ApplyShardCommands(Shard& shard);
+
+		// Sends one shared copy of the payload to every connection in a single SendMessages call
+		void BroadcastBuffer(std::span<const HSteamNetConnection> connections, const Buffer& buffer, bool reliable, LaneIndex lane);
+
+		// Deferred dispatch
+		struct PendingEvent;
+		void PostEvent(Shard& shard, PendingEvent&& event);
+		bool FlushPendingOverflow(Shard& shard);
+		void FlushDeferredBatch();
+		void DiscardPendingEvents(Shard& shard);
+
+		// Sends right away, or pushes onto the outbound queue if enabled
+		SendResult SubmitMessage(SteamNetworkingMessage_t* message);
+		void EnqueueBroadcast(const Buffer& buffer, ClientFilter&& filter, bool reliable, LaneIndex lane);
+		uint32_t FlushOutboundQueue();
 
 		void OnFatalError(const std::string& message);
 	private:
 		std::thread m_NetworkThread;
+		NetworkScheduler m_Scheduler;
 		DataReceivedCallback m_DataReceivedCallback;
 		ClientConnectedCallback m_ClientConnectedCallback;
 		ClientDisconnectedCallback m_ClientDisconnectedCallback;
+		ClientSuspendedCallback m_ClientSuspendedCallback;
+		ClientResumedCallback m_ClientResumedCallback;
+		DataReceivedBatchCallback m_DataReceivedBatchCallback;
+		ClientCongestionCallback m_ClientCongestionCallback;
+
+		int m_ReceiveBatchSize = 64;
+		std::vector<LaneConfig> m_Lanes;
+
+		struct OutboundMessage
+		{
+			// Either a message ready to send...
+			SteamNetworkingMessage_t* Message = nullptr;
+
+			// ...or a broadcast, resolved against the client list on the network thread
+			Utils::SharedPayload* Payload = nullptr;
+			ClientFilter Filter = {}; // All clients if empty
+			int SendFlags = 0;
+			LaneIndex Lane = 0;
+		};
+		MPSCQueue<OutboundMessage> m_OutboundQueue;
+		std::vector<SteamNetworkingMessage_t*> m_OutboundBatch;
+
+		struct PendingEvent
+		{
+			enum class Type : uint8_t { None = 0, DataReceived, ClientConnected, ClientDisconnected, ClientSuspended, ClientResumed };
+
+			Type EventType = Type::None;
+			uint32_t Slot = ClientRegistry::InvalidSlot;
+			ISteamNetworkingMessage* Message = nullptr;
+			ClientID PreviousClientID = 0; // ClientResumed only
+			uint32_t PreviousSlot = ClientRegistry::InvalidSlot; // ClientResumed only
+		};
+		uint32_t m_DeferredDispatchCapacity = 0;
+
+		// Held by DispatchPending(), so the server thread can discard what's left once it stops
+		std::mutex m_DispatchMutex;
+
+		// Application thread only
+		std::vector<ClientMessage> m_DeferredBatch;
+		std::vector<ISteamNetworkingMessage*> m_DeferredMessages;
+
+		struct ShardCommand
+		{
+			enum class Type : uint8_t { Connected = 0, Disconnected, Suspended, Resumed };
+
+			Type CommandType = Type::Connected;
+			uint32_t Slot = ClientRegistry::InvalidSlot;
+			ClientID PreviousClientID = 0; // Resumed only
+			uint32_t PreviousSlot = ClientRegistry::InvalidSlot; // Resumed only
+		};
+
+		// Each shard drains its own poll group and calls the callbacks for its clients.
+		// With a single shard it is updated inline on the server thread.
+		struct Shard
+		{
+			uint32_t Index = 0;
+			HSteamNetPollGroup PollGroup = k_HSteamNetPollGroup_Invalid;
+			std::thread Thread;
+			NetworkScheduler Scheduler;
+
+			// Shard thread only
+			std::vector<ISteamNetworkingMessage*> ReceiveBatch;
+			std::vector<ClientMessage> DispatchBatch;
+			std::vector<SteamNetworkingMicroseconds> DispatchTimesReceived; // Alongside DispatchBatch, for instrumentation
+
+			// Held back by the inbound limits (Defer policy), in arrival order
+			std::vector<ISteamNetworkingMessage*> DeferredMessages;
+			std::vector<ISteamNetworkingMessage*> ReadyMessages;
+			uint32_t DeferredPass = 0;
+
+			// Deferred dispatch, produced by this shard only
+			SPSCQueue<PendingEvent> PendingEvents;
+			std::vector<PendingEvent> PendingOverflow;
+
+			// Connects/disconnects from the server thread, applied before receiving
+			std::mutex CommandMutex;
+			std::vector<ShardCommand> Commands;
+			std::vector<ShardCommand> ApplyingCommands;
+
+			TrafficCounter Received;
+			DispatchLatencyCounter DispatchLatency;
+
+			// Server thread only
+			uint32_t ClientCount = 0;
+		};
+		std::vector<std::unique_ptr<Shard>> m_Shards;
+		uint32_t m_ShardCount = 1;
+		ShardAssignment m_ShardAssignment = ShardAssignment::RoundRobin;
+		uint32_t m_NextShard = 0;
 
 		int m_Port = 0;
-		bool m_Running = false;
-		std::map<HSteamNetConnection, ClientInfo> m_ConnectedClients;
+		std::atomic<bool> m_Running = false;
+		ClientRegistry m_Clients;
+		RoomRegistry m_Rooms{ m_Clients };
+
+		// Sends can come from any thread
+		TrafficCounter m_Sent;
+		std::atomic<uint64_t> m_SendFailures = 0;
+		std::atomic<uint64_t> m_CallbackMicroseconds = 0;
+
+		std::chrono::milliseconds m_StatsInterval = DefaultStatsInterval;
+		std::chrono::steady_clock::time_point m_NextStatsSample{};
+		std::atomic<std::shared_ptr<const NetworkStats>> m_Stats;
+
+		CongestionSettings m_CongestionSettings;
+		std::chrono::steady_clock::time_point m_NextCongestionCheck{};
+
+		NetworkInstrumentation m_Instrumentation;
+		PayloadCompressor m_Compressor;
+		StreamManager m_Streams;
+
+		AdmissionController m_Admission;
+		std::vector<HSteamNetConnection> m_AcceptingConnections;
+
+		InboundLimitSettings m_InboundLimits;
+
+		// Sessions, server thread only (except the requests)
+		bool m_SessionsEnabled = false;
+		SessionSettings m_SessionSettings;
+		SessionTable m_Sessions;
+		std::chrono::steady_clock::time_point m_NextSessionCheck{};
+		std::vector<HSteamNetConnection> m_ExpiredHandshakes;
+		std::vector<uint32_t> m_ExpiredSessions;
+
+		struct SessionRequest
+		{
+			HSteamNetConnection Connection;
+			SessionToken Token;
+		};
+		std::mutex m_SessionRequestMutex;
+		std::vector<SessionRequest> m_SessionRequests;
+		std::vector<SessionRequest> m_ApplyingSessionRequests;
+
+		// Capture. Opened and closed by the server thread while no shard is running
+		TrafficCapture m_Capture;
+		std::string m_CapturePath;
+		CaptureSettings m_CaptureSettings;
+		SteamNetworkingMicroseconds m_CaptureStart = 0;
+
+		struct KickRequest
+		{
+			ClientID Client;
+			std::string Reason;
+		};
+		std::mutex m_KickMutex;
+		std::vector<KickRequest> m_Kicks;
+		std::vector<KickRequest> m_ApplyingKicks;
 
 		ISteamNetworkingSockets* m_Interface = nullptr;
+		NetworkingContext::InstanceID m_InstanceID = NetworkingContext::InvalidInstanceID;
 		HSteamListenSocket m_ListenSocket = 0u;
-		HSteamNetPollGroup m_PollGroup = 0u;
 	};
 
-}
\ No newline at end of file
+}
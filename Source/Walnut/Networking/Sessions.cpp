@@ -0,0 +1,199 @@
+#include "Sessions.h"
+
+#include "NetworkingUtils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace Walnut {
+
+	// Only for backoff jitter, session tokens come from the OS generator
+	static std::mt19937_64& GetRandomEngine()
+	{
+		static thread_local std::mt19937_64 s_Engine([]()
+		{
+			std::random_device device;
+			return ((uint64_t)device() << 32) ^ device();
+		}());
+		return s_Engine;
+	}
+
+	SessionToken SessionToken::Generate()
+	{
+		SessionToken token;
+		while (!token.IsValid())
+		{
+			if (!Utils::GetSecureRandomBytes(&token, sizeof(token)))
+				return {};
+		}
+		return token;
+	}
+
+	namespace Utils {
+
+		std::chrono::milliseconds GetReconnectDelay(const ReconnectSettings& settings, uint32_t attempt)
+		{
+			double delay = (double)settings.InitialDelay.count() * std::pow(std::max(settings.Multiplier, 1.0), (double)(std::max(attempt, 1u) - 1));
+			delay = std::min(delay, (double)settings.MaxDelay.count());
+
+			double jitter = std::clamp(settings.Jitter, 0.0, 1.0);
+			delay *= 1.0 - jitter * std::uniform_real_distribution<double>(0.0, 1.0)(GetRandomEngine());
+			return std::chrono::milliseconds((int64_t)delay);
+		}
+
+		template<typename T>
+		static bool ReadSessionMessage(const Buffer& buffer, T& message)
+		{
+			MessageHeader header;
+			if (!ReadMessageHeader(buffer, header) || header.ID != T::ID || header.PayloadSize != sizeof(T))
+				return false;
+
+			memcpy(&message, (const std::byte*)buffer.Data + sizeof(MessageHeader), sizeof(T));
+			return true;
+		}
+
+		bool ReadSessionHello(const Buffer& buffer, SessionHelloMessage& message)
+		{
+			return ReadSessionMessage(buffer, message);
+		}
+
+		bool ReadSessionWelcome(const Buffer& buffer, SessionWelcomeMessage& message)
+		{
+			return ReadSessionMessage(buffer, message);
+		}
+
+	}
+
+	void SessionTable::AddHandshake(HSteamNetConnection connection, uint32_t slot, Clock::time_point deadline)
+	{
+		m_Handshakes[connection] = { slot, deadline };
+	}
+
+	uint32_t SessionTable::CompleteHandshake(HSteamNetConnection connection)
+	{
+		auto it = m_Handshakes.find(connection);
+		if (it == m_Handshakes.end())
+			return InvalidSlot;
+
+		uint32_t slot = it->second.Slot;
+		m_Handshakes.erase(it);
+		return slot;
+	}
+
+	SessionToken SessionTable::Open(uint32_t slot)
+	{
+		Close(slot);
+
+		// No session, the client reconnects without resuming
+		SessionToken token = SessionToken::Generate();
+		if (!token.IsValid())
+			return token;
+
+		m_Sessions[slot] = { token, false, {} };
+		m_Slots[token] = slot;
+		return token;
+	}
+
+	void SessionTable::Close(uint32_t slot)
+	{
+		auto it = m_Sessions.find(slot);
+		if (it == m_Sessions.end())
+			return;
+
+		if (it->second.Suspended)
+			m_SuspendedCount--;
+
+		m_Slots.erase(it->second.Token);
+		m_Sessions.erase(it);
+	}
+
+	uint32_t SessionTable::Find(const SessionToken& token) const
+	{
+		auto it = m_Slots.find(token);
+		return it != m_Slots.end() ? it->second : InvalidSlot;
+	}
+
+	bool SessionTable::Suspend(uint32_t slot, Clock::time_point deadline)
+	{
+		auto it = m_Sessions.find(slot);
+		if (it == m_Sessions.end() || it->second.Suspended)
+			return false;
+
+		it->second.Suspended = true;
+		it->second.Deadline = deadline;
+		m_SuspendedCount++;
+		return true;
+	}
+
+	uint32_t SessionTable::Resume(const SessionToken& token, SessionToken& newToken)
+	{
+		auto slotIt = m_Slots.find(token);
+		if (slotIt == m_Slots.end())
+			return InvalidSlot;
+
+		uint32_t slot = slotIt->second;
+		Session& session = m_Sessions[slot];
+		if (!session.Suspended)
+			return InvalidSlot;
+
+		newToken = SessionToken::Generate();
+		if (!newToken.IsValid())
+			return InvalidSlot;
+
+		// A token is only good for one resume
+		m_Slots.erase(slotIt);
+		m_Slots[newToken] = slot;
+
+		session.Token = newToken;
+		session.Suspended = false;
+		m_SuspendedCount--;
+		return slot;
+	}
+
+	void SessionTable::Move(uint32_t slot, uint32_t newSlot)
+	{
+		auto it = m_Sessions.find(slot);
+		if (it == m_Sessions.end())
+			return;
+
+		Session session = it->second;
+		m_Sessions.erase(it);
+
+		m_Sessions[newSlot] = session;
+		m_Slots[session.Token] = newSlot;
+	}
+
+	void SessionTable::CollectExpired(Clock::time_point now, std::vector<HSteamNetConnection>& handshakes, std::vector<uint32_t>& sessions)
+	{
+		std::erase_if(m_Handshakes, [&](const auto& entry)
+		{
+			if (entry.second.Deadline > now)
+				return false;
+
+			handshakes.push_back(entry.first);
+			return true;
+		});
+
+		if (m_SuspendedCount == 0)
+			return;
+
+		for (const auto& [slot, session] : m_Sessions)
+		{
+			if (session.Suspended && session.Deadline <= now)
+				sessions.push_back(slot);
+		}
+
+		for (uint32_t slot : sessions)
+			Close(slot);
+	}
+
+	void SessionTable::Clear()
+	{
+		m_Handshakes.clear();
+		m_Sessions.clear();
+		m_Slots.clear();
+		m_SuspendedCount = 0;
+	}
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "MessageProtocol.h"
+
+#include <steam/steamnetworkingsockets.h>
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Sessions and reconnect
+	//
+	// With sessions enabled on both ends, a client introduces itself with a session token right after connecting, and
+	// the server only calls the connect callback once it has answered. When a client's connection drops (rather than
+	// being closed on purpose by either end), the server keeps its slot - ClientInfo, UserData, room membership and
+	// counters - for ResumeTimeout. A client reconnecting with that token within the timeout gets a new slot and
+	// ClientID, with the old slot's UserData, rooms and counters moved over, and the server calls the resumed callback
+	// instead of connect/disconnect. The old slot is released once the resumed callback returns.
+	//
+	// Reconnect is the client side of this: when the connection drops, the client retries with jittered exponential
+	// backoff, reusing its networking instance and the already resolved address, so a blip costs a round trip
+	// instead of a full reconnect and re-login. It also works without sessions (as a plain reconnect).
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	struct SessionToken
+	{
+		uint64_t High = 0;
+		uint64_t Low = 0;
+
+		bool IsValid() const { return High != 0 || Low != 0; }
+		bool operator==(const SessionToken& other) const { return High == other.High && Low == other.Low; }
+
+		// Random, from the OS secure generator (tokens are credentials). Invalid if that fails.
+		static SessionToken Generate();
+	};
+
+	struct SessionTokenHash
+	{
+		size_t operator()(const SessionToken& token) const { return std::hash<uint64_t>()(token.High ^ (token.Low * 0x9E3779B97F4A7C15ull)); }
+	};
+
+	// Client -> server, right after connecting. An invalid token asks for a new session
+	struct SessionHelloMessage
+	{
+		static constexpr MessageID ID = FirstReservedMessageID + 5;
+
+		SessionToken Token;
+	};
+
+	// Server -> client, the token to resume with next time
+	struct SessionWelcomeMessage
+	{
+		static constexpr MessageID ID = FirstReservedMessageID + 6;
+
+		SessionToken Token;
+		uint32_t Resumed = 0;
+		uint32_t Reserved = 0;
+	};
+
+	struct SessionSettings
+	{
+		// How long a dropped client's slot is kept for it to resume
+		std::chrono::milliseconds ResumeTimeout = std::chrono::milliseconds(30000);
+
+		// Connections that haven't sent their session token by then are closed
+		std::chrono::milliseconds HandshakeTimeout = std::chrono::milliseconds(5000);
+	};
+
+	struct ReconnectSettings
+	{
+		// Delay before the first retry, multiplied for every retry after that up to MaxDelay
+		std::chrono::milliseconds InitialDelay = std::chrono::milliseconds(100);
+		std::chrono::milliseconds MaxDelay = std::chrono::milliseconds(5000);
+		double Multiplier = 2.0;
+
+		// Each delay is shortened by a random fraction up to this, so clients dropped together don't retry together
+		double Jitter = 0.5;
+
+		// Gives up after this many retries in a row (0 = never)
+		uint32_t MaxAttempts = 0;
+
+		// How long one attempt waits for the server before it counts as failed
+		std::chrono::milliseconds AttemptTimeout = std::chrono::milliseconds(5000);
+	};
+
+	namespace Utils {
+
+		// Delay before the given retry (1 for the first)
+		std::chrono::milliseconds GetReconnectDelay(const ReconnectSettings& settings, uint32_t attempt);
+
+		// Closes with an application reason code (kick, refused, Disconnect()) are on purpose, anything else is a
+		// dropped connection that's worth resuming
+		inline bool IsDroppedConnection(int endReason)
+		{
+			return endReason < k_ESteamNetConnectionEnd_App_Min || endReason > k_ESteamNetConnectionEnd_AppException_Max;
+		}
+
+		// Returns false if the buffer isn't the given session message
+		bool ReadSessionHello(const Buffer& buffer, SessionHelloMessage& message);
+		bool ReadSessionWelcome(const Buffer& buffer, SessionWelcomeMessage& message);
+
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Server-side session bookkeeping, by client slot. Server thread only
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	class SessionTable
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+		static constexpr uint32_t InvalidSlot = 0;
+	public:
+		// A connection that's been accepted and is expected to send its token
+		void AddHandshake(HSteamNetConnection connection, uint32_t slot, Clock::time_point deadline);
+		// Returns the connection's slot, InvalidSlot if it has no handshake in progress
+		uint32_t CompleteHandshake(HSteamNetConnection connection);
+		bool IsHandshaking(HSteamNetConnection connection) const { return m_Handshakes.contains(connection); }
+
+		// A new session for the slot, returns its token
+		SessionToken Open(uint32_t slot);
+		void Close(uint32_t slot);
+
+		// Returns the slot of the session with this token, suspended or not, InvalidSlot if there's none
+		uint32_t Find(const SessionToken& token) const;
+
+		// Keeps the slot's session until the deadline. Returns false if the slot has no session
+		bool Suspend(uint32_t slot, Clock::time_point deadline);
+
+		// Reattaches to a suspended session and gives it a new token. Returns the session's slot,
+		// InvalidSlot if the token is unknown or the session isn't suspended
+		uint32_t Resume(const SessionToken& token, SessionToken& newToken);
+		// Moves the slot's session to another slot, for a client that resumed on a new one
+		void Move(uint32_t slot, uint32_t newSlot);
+
+		// Removes expired handshakes and sessions. Expired sessions are closed
+		void CollectExpired(Clock::time_point now, std::vector<HSteamNetConnection>& handshakes, std::vector<uint32_t>& sessions);
+
+		uint32_t GetSuspendedCount() const { return m_SuspendedCount; }
+
+		void Clear();
+	private:
+		struct Handshake
+		{
+			uint32_t Slot;
+			Clock::time_point Deadline;
+		};
+
+		struct Session
+		{
+			SessionToken Token;
+			bool Suspended = false;
+			Clock::time_point Deadline{};
+		};
+
+		std::unordered_map<HSteamNetConnection, Handshake> m_Handshakes;
+		std::unordered_map<uint32_t, Session> m_Sessions;                     // By slot
+		std::unordered_map<SessionToken, uint32_t, SessionTokenHash> m_Slots; // By token
+		uint32_t m_SuspendedCount = 0;
+	};
+
+}
@@ -0,0 +1,393 @@
+#include "Streaming.h"
+
+#include <steam/isteamnetworkingutils.h>
+#include <spdlog/fmt/fmt.h>
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+namespace Walnut {
+
+	namespace {
+
+		// Chunks shrink towards MinChunkSize on slow connections, and never grow past MaxChunkSize so one chunk can't hog a lane
+		constexpr uint32_t MinChunkSize = 1024;
+		constexpr uint32_t MaxChunkSize = 256 * 1024;
+
+	}
+
+	struct StreamManager::MessageHandler
+	{
+		StreamManager& Manager;
+
+		void operator()(HSteamNetConnection connection, MessageView<StreamBeginMessage> message) { Manager.OnStreamBegin(connection, message); }
+		void operator()(HSteamNetConnection connection, MessageView<StreamChunkMessage> message) { Manager.OnStreamChunk(connection, message); }
+		void operator()(HSteamNetConnection connection, MessageView<StreamCancelMessage> message) { Manager.OnStreamCancel(connection, message); }
+	};
+
+	void StreamManager::Enable(const StreamSettings& settings, SendFunction&& sendFunction)
+	{
+		m_Settings = settings;
+		m_SendFunction = std::move(sendFunction);
+		m_Enabled = true;
+	}
+
+	StreamID StreamManager::Send(HSteamNetConnection connection, Buffer&& data, const StreamOptions& options)
+	{
+		auto stream = std::make_unique<OutgoingStream>();
+		stream->Progress.ID = m_NextStreamID.fetch_add(1, std::memory_order_relaxed);
+		stream->Progress.Connection = connection;
+		stream->Progress.Tag = options.Tag;
+		stream->Progress.TotalSize = data.Size;
+		stream->Data = data;
+		stream->Options = options;
+		stream->Options.ChunkSize = std::clamp(options.ChunkSize, MinChunkSize, MaxChunkSize);
+		data = Buffer();
+
+		StreamID id = stream->Progress.ID;
+		m_ActiveOutgoingCount.fetch_add(1, std::memory_order_relaxed);
+
+		std::scoped_lock lock(m_PendingMutex);
+		m_PendingStreams.push_back(std::move(stream));
+		return id;
+	}
+
+	void StreamManager::Cancel(StreamID stream)
+	{
+		std::scoped_lock lock(m_PendingMutex);
+		m_PendingCancels.push_back({ k_HSteamNetConnection_Invalid, stream });
+	}
+
+	template<NetworkMessage T>
+	void StreamManager::SendControlMessage(HSteamNetConnection connection, LaneIndex lane, const T& message)
+	{
+		SteamNetworkingMessage_t* networkMessage = SteamNetworkingUtils()->AllocateMessage((int)GetEncodedMessageSize<T>());
+		EncodeMessage(networkMessage->m_pData, message);
+		m_SendFunction(connection, networkMessage, lane);
+	}
+
+	uint32_t StreamManager::Update(ISteamNetworkingSockets* networkInterface)
+	{
+		{
+			std::scoped_lock lock(m_PendingMutex);
+			for (auto& stream : m_PendingStreams)
+				m_OutgoingStreams.push_back(std::move(stream));
+			m_PendingStreams.clear();
+
+			m_Cancels.swap(m_PendingCancels);
+		}
+
+		if (m_OutgoingStreams.empty())
+		{
+			m_Cancels.clear();
+			return 0;
+		}
+
+		uint32_t chunkCount = 0;
+		for (auto& stream : m_OutgoingStreams)
+		{
+			// Cancelled by the application (any connection), or by the receiver
+			auto cancelled = std::find_if(m_Cancels.begin(), m_Cancels.end(), [&stream](const auto& cancel)
+			{
+				return cancel.second == stream->Progress.ID && (cancel.first == k_HSteamNetConnection_Invalid || cancel.first == stream->Progress.Connection);
+			});
+
+			if (cancelled != m_Cancels.end())
+			{
+				EndOutgoingStream(*stream, StreamState::Cancelled, cancelled->first == k_HSteamNetConnection_Invalid);
+				continue;
+			}
+
+			LaneIndex lane = stream->Options.Lane;
+			m_LaneStatus.resize((size_t)lane + 1);
+
+			SteamNetConnectionRealTimeStatus_t status;
+			if (networkInterface->GetConnectionRealTimeStatus(stream->Progress.Connection, &status, (int)lane + 1, m_LaneStatus.data()) != k_EResultOK)
+			{
+				std::cout << fmt::format("Stream {} failed: connection closed, or lane {} isn't configured", stream->Progress.ID, lane) << std::endl;
+				EndOutgoingStream(*stream, StreamState::Failed, false);
+				continue;
+			}
+
+			if (status.m_eState != k_ESteamNetworkingConnectionState_Connected)
+			{
+				// Not connected yet
+				if (status.m_eState == k_ESteamNetworkingConnectionState_Connecting || status.m_eState == k_ESteamNetworkingConnectionState_FindingRoute)
+					continue;
+
+				EndOutgoingStream(*stream, StreamState::Failed, false);
+				continue;
+			}
+
+			if (!stream->Begun)
+			{
+				StreamBeginMessage begin;
+				begin.Stream = stream->Progress.ID;
+				begin.Tag = stream->Progress.Tag;
+				begin.TotalSize = stream->Progress.TotalSize;
+				SendControlMessage(stream->Progress.Connection, lane, begin);
+				stream->Begun = true;
+			}
+
+			// Keep roughly MaxQueueTime worth of data queued on the lane - enough to use the bandwidth,
+			// without putting the whole stream ahead of messages sent after it. On slow connections
+			// chunks shrink so two of them still fit in the window.
+			int64_t window = (int64_t)status.m_nSendRateBytesPerSecond * stream->Options.MaxQueueTime.count() / 1000;
+			uint32_t chunkSize = (uint32_t)std::clamp<int64_t>(window / 2, MinChunkSize, stream->Options.ChunkSize);
+			window = std::max<int64_t>(window, 2 * (int64_t)chunkSize);
+			int64_t pending = m_LaneStatus[lane].m_cbPendingReliable;
+
+			uint64_t bytesBefore = stream->Progress.Bytes;
+			const std::byte* data = (const std::byte*)stream->Data.Data;
+			while (pending < window && stream->Progress.Bytes < stream->Progress.TotalSize)
+			{
+				uint32_t size = (uint32_t)std::min<uint64_t>(chunkSize, stream->Progress.TotalSize - stream->Progress.Bytes);
+
+				StreamChunkMessage chunk;
+				chunk.Stream = stream->Progress.ID;
+				chunk.Offset = stream->Progress.Bytes;
+
+				SteamNetworkingMessage_t* message = SteamNetworkingUtils()->AllocateMessage((int)GetEncodedMessageSize<StreamChunkMessage>(size));
+				EncodeMessage(message->m_pData, chunk, std::span(data + stream->Progress.Bytes, size));
+				m_SendFunction(stream->Progress.Connection, message, lane);
+
+				stream->Progress.Bytes += size;
+				pending += size;
+				chunkCount++;
+			}
+
+			if (stream->Progress.Bytes == stream->Progress.TotalSize)
+				EndOutgoingStream(*stream, StreamState::Completed, false);
+			else if (stream->Progress.Bytes != bytesBefore)
+				ReportProgress(stream->Progress);
+		}
+
+		m_Cancels.clear();
+
+		std::erase_if(m_OutgoingStreams, [](const auto& stream) { return stream->Progress.State != StreamState::InProgress; });
+		return chunkCount;
+	}
+
+	void StreamManager::EndOutgoingStream(OutgoingStream& stream, StreamState state, bool notifyReceiver)
+	{
+		// Chunks already handed to the library are still delivered, the receiver drops them
+		if (notifyReceiver && stream.Begun)
+		{
+			StreamCancelMessage cancel;
+			cancel.Stream = stream.Progress.ID;
+			cancel.FromSender = 1;
+			SendControlMessage(stream.Progress.Connection, stream.Options.Lane, cancel);
+		}
+
+		stream.Data.Release();
+		stream.Progress.State = state;
+		m_ActiveOutgoingCount.fetch_sub(1, std::memory_order_relaxed);
+
+		ReportProgress(stream.Progress);
+	}
+
+	bool StreamManager::HandleReceivedMessage(HSteamNetConnection connection, const Buffer& buffer)
+	{
+		MessageHeader header;
+		if (!ReadMessageHeader(buffer, header) || header.ID < StreamBeginMessage::ID || header.ID > StreamCancelMessage::ID)
+			return false;
+
+		MessageHandler handler{ *this };
+		DispatchResult result = StreamProtocol::Dispatch(buffer, handler, connection);
+		if (result != DispatchResult::Handled)
+			std::cout << fmt::format("ERROR: Invalid stream message ({})", DispatchResultToString(result)) << std::endl;
+
+		return true;
+	}
+
+	void StreamManager::OnStreamBegin(HSteamNetConnection connection, MessageView<StreamBeginMessage> message)
+	{
+		uint64_t key = GetIncomingKey(connection, message->Stream);
+
+		auto stream = std::make_unique<IncomingStream>();
+		stream->Progress.ID = message->Stream;
+		stream->Progress.Connection = connection;
+		stream->Progress.Incoming = true;
+		stream->Progress.Tag = message->Tag;
+		stream->Progress.TotalSize = message->TotalSize;
+
+		if (message->TotalSize > m_Settings.MaxIncomingSize)
+		{
+			std::cout << fmt::format("Rejected stream {}: {} bytes is over the limit of {} bytes", message->Stream, message->TotalSize, m_Settings.MaxIncomingSize) << std::endl;
+			RejectIncomingStream(stream->Progress, StreamState::Failed);
+			return;
+		}
+
+		if (m_IncomingStreamCallback && !m_IncomingStreamCallback(stream->Progress, stream->Destination))
+		{
+			RejectIncomingStream(stream->Progress, StreamState::Cancelled);
+			return;
+		}
+
+		if (!stream->Destination.empty() && stream->Destination.size() < message->TotalSize)
+		{
+			std::cout << fmt::format("Rejected stream {}: destination is smaller than {} bytes", message->Stream, message->TotalSize) << std::endl;
+			RejectIncomingStream(stream->Progress, StreamState::Failed);
+			return;
+		}
+
+		if (message->TotalSize == 0)
+		{
+			stream->Progress.State = StreamState::Completed;
+			ReportProgress(stream->Progress);
+			return;
+		}
+
+		ReportProgress(stream->Progress);
+
+		std::scoped_lock lock(m_IncomingMutex);
+		m_IncomingStreams[key] = std::move(stream);
+	}
+
+	void StreamManager::OnStreamChunk(HSteamNetConnection connection, MessageView<StreamChunkMessage> message)
+	{
+		uint64_t key = GetIncomingKey(connection, message->Stream);
+
+		IncomingStream* stream;
+		{
+			std::scoped_lock lock(m_IncomingMutex);
+			auto it = m_IncomingStreams.find(key);
+
+			// Rejected, or cancelled with chunks still in flight
+			if (it == m_IncomingStreams.end())
+				return;
+
+			stream = it->second.get();
+		}
+
+		std::span<const std::byte> data = message.GetTrailingData();
+		StreamProgress& progress = stream->Progress;
+
+		// Chunks are reliable and on one lane, so they arrive in order
+		if (message->Offset != progress.Bytes || data.size() > progress.TotalSize - progress.Bytes)
+		{
+			std::cout << fmt::format("Stream {} failed: unexpected chunk at offset {}", progress.ID, message->Offset) << std::endl;
+			EndIncomingStream(key, StreamState::Failed, true);
+			return;
+		}
+
+		if (!stream->Destination.empty())
+			memcpy(stream->Destination.data() + progress.Bytes, data.data(), data.size());
+		else if (m_StreamChunkCallback)
+			m_StreamChunkCallback(progress, message->Offset, Buffer(data.data(), data.size()));
+
+		progress.Bytes += data.size();
+		if (progress.Bytes == progress.TotalSize)
+			EndIncomingStream(key, StreamState::Completed, false);
+		else
+			ReportProgress(progress);
+	}
+
+	void StreamManager::OnStreamCancel(HSteamNetConnection connection, MessageView<StreamCancelMessage> message)
+	{
+		if (message->FromSender)
+		{
+			EndIncomingStream(GetIncomingKey(connection, message->Stream), StreamState::Cancelled, false);
+			return;
+		}
+
+		// The receiver gave up on one of our streams, picked up by the network thread
+		std::scoped_lock lock(m_PendingMutex);
+		m_PendingCancels.push_back({ connection, message->Stream });
+	}
+
+	void StreamManager::RejectIncomingStream(StreamProgress& progress, StreamState state)
+	{
+		StreamCancelMessage cancel;
+		cancel.Stream = progress.ID;
+		SendControlMessage(progress.Connection, 0, cancel);
+
+		progress.State = state;
+		ReportProgress(progress);
+	}
+
+	void StreamManager::EndIncomingStream(uint64_t key, StreamState state, bool notifySender)
+	{
+		std::unique_ptr<IncomingStream> stream;
+		{
+			std::scoped_lock lock(m_IncomingMutex);
+			auto it = m_IncomingStreams.find(key);
+			if (it == m_IncomingStreams.end())
+				return;
+
+			stream = std::move(it->second);
+			m_IncomingStreams.erase(it);
+		}
+
+		if (notifySender)
+		{
+			RejectIncomingStream(stream->Progress, state);
+			return;
+		}
+
+		stream->Progress.State = state;
+		ReportProgress(stream->Progress);
+	}
+
+	void StreamManager::RemoveConnection(HSteamNetConnection connection)
+	{
+		std::vector<std::unique_ptr<IncomingStream>> streams;
+		{
+			std::scoped_lock lock(m_IncomingMutex);
+			for (auto it = m_IncomingStreams.begin(); it != m_IncomingStreams.end();)
+			{
+				if (it->second->Progress.Connection == connection)
+				{
+					streams.push_back(std::move(it->second));
+					it = m_IncomingStreams.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
+
+		for (auto& stream : streams)
+		{
+			stream->Progress.State = StreamState::Failed;
+			ReportProgress(stream->Progress);
+		}
+	}
+
+	void StreamManager::Clear()
+	{
+		{
+			std::scoped_lock lock(m_PendingMutex);
+			for (auto& stream : m_PendingStreams)
+				m_OutgoingStreams.push_back(std::move(stream));
+			m_PendingStreams.clear();
+			m_PendingCancels.clear();
+		}
+
+		for (auto& stream : m_OutgoingStreams)
+			EndOutgoingStream(*stream, StreamState::Failed, false);
+		m_OutgoingStreams.clear();
+		m_Cancels.clear();
+
+		std::unordered_map<uint64_t, std::unique_ptr<IncomingStream>> incomingStreams;
+		{
+			std::scoped_lock lock(m_IncomingMutex);
+			incomingStreams.swap(m_IncomingStreams);
+		}
+
+		for (auto& [key, stream] : incomingStreams)
+		{
+			stream->Progress.State = StreamState::Failed;
+			ReportProgress(stream->Progress);
+		}
+	}
+
+	void StreamManager::ReportProgress(const StreamProgress& progress)
+	{
+		if (m_StreamProgressCallback)
+			m_StreamProgressCallback(progress);
+	}
+
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "Walnut/Core/Buffer.h"
+
+#include "MessageProtocol.h"
+#include "Lanes.h"
+
+#include <steam/steamnetworkingsockets.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Streaming transfers
+	//
+	// Sends blobs of any size (eg. level data, assets) as a stream of reliable chunks. The sender paces chunks to the
+	// connection's measured send rate, keeping at most StreamOptions::MaxQueueTime worth of data queued in the library,
+	// so other messages - especially on a higher priority lane - aren't stuck behind the whole transfer.
+	//
+	// The receiver decides per stream whether to reassemble it into a buffer it provides, or to get each chunk as it
+	// arrives. Progress is reported on both ends.
+	//
+	// Both ends must enable streaming, since stream messages use reserved typed-message IDs (see MessageProtocol.h)
+	// and are consumed by the receive loop before the data received callbacks. Stream callbacks are called from the
+	// network thread (or shard threads on the server), even with deferred dispatch.
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	using StreamID = uint32_t;
+
+	struct StreamBeginMessage
+	{
+		static constexpr MessageID ID = FirstReservedMessageID + 2;
+
+		uint32_t Stream = 0;
+		uint32_t Tag = 0;
+		uint64_t TotalSize = 0;
+	};
+
+	struct StreamChunkMessage
+	{
+		static constexpr MessageID ID = FirstReservedMessageID + 3;
+		static constexpr bool HasTrailingData = true;
+
+		uint32_t Stream = 0;
+		uint32_t Reserved = 0;
+		uint64_t Offset = 0;
+	};
+
+	struct StreamCancelMessage
+	{
+		static constexpr MessageID ID = FirstReservedMessageID + 4;
+
+		uint32_t Stream = 0;
+		uint32_t FromSender = 0; // Otherwise the receiver rejected or cancelled it
+	};
+
+	using StreamProtocol = MessageProtocol<StreamBeginMessage, StreamChunkMessage, StreamCancelMessage>;
+
+	struct StreamOptions
+	{
+		static constexpr uint32_t DefaultChunkSize = 32 * 1024;
+
+		LaneIndex Lane = 0;
+		uint32_t ChunkSize = DefaultChunkSize;
+
+		// Application-defined, eg. what kind of data this is. Passed to the receiver.
+		uint32_t Tag = 0;
+
+		// Pacing - queue at most this long at the connection's current send rate (at least two chunks, which shrink
+		// on slow connections). Throughput is still capped by the connection's send rate limits
+		// (k_ESteamNetworkingConfig_SendRateMin/Max).
+		std::chrono::milliseconds MaxQueueTime = std::chrono::milliseconds(50);
+	};
+
+	struct StreamSettings
+	{
+		// Incoming streams larger than this are rejected
+		uint64_t MaxIncomingSize = 256ull * 1024 * 1024;
+	};
+
+	enum class StreamState
+	{
+		InProgress = 0, Completed, Cancelled, Failed
+	};
+
+	struct StreamProgress
+	{
+		StreamID ID = 0;
+		HSteamNetConnection Connection = k_HSteamNetConnection_Invalid;
+		bool Incoming = false;
+		uint32_t Tag = 0;
+		uint64_t Bytes = 0; // Handed to the library so far when sending, received so far when receiving
+		uint64_t TotalSize = 0;
+		StreamState State = StreamState::InProgress;
+	};
+
+	class StreamManager
+	{
+	public:
+		// Called for each new incoming stream. Return false to reject it. Otherwise either point destination at a buffer
+		// of at least stream.TotalSize bytes to reassemble into, or leave it empty to get chunks through the chunk callback.
+		using IncomingStreamCallback = std::function<bool(const StreamProgress& stream, std::span<std::byte>& destination)>;
+
+		// Chunks of streams that aren't reassembled, only valid for the duration of the callback
+		using StreamChunkCallback = std::function<void(const StreamProgress& stream, uint64_t offset, const Buffer chunk)>;
+
+		// Called as chunks are sent and received, and once more when a stream ends (State other than InProgress)
+		using StreamProgressCallback = std::function<void(const StreamProgress& stream)>;
+
+		// How chunks are sent - through the owner's send path, so compression and the outbound queue apply
+		using SendFunction = std::function<void(HSteamNetConnection connection, SteamNetworkingMessage_t* message, LaneIndex lane)>;
+	public:
+		void Enable(const StreamSettings& settings, SendFunction&& sendFunction);
+		bool IsEnabled() const { return m_Enabled; }
+
+		void SetIncomingStreamCallback(const IncomingStreamCallback& function) { m_IncomingStreamCallback = function; }
+		void SetStreamChunkCallback(const StreamChunkCallback& function) { m_StreamChunkCallback = function; }
+		void SetStreamProgressCallback(const StreamProgressCallback& function) { m_StreamProgressCallback = function; }
+
+		// Any thread. Takes ownership of data (allocated with Buffer::Allocate/Buffer::Copy), which is released once
+		// the last chunk has been handed to the library, or the stream ends early.
+		StreamID Send(HSteamNetConnection connection, Buffer&& data, const StreamOptions& options);
+
+		// Any thread, outgoing streams only
+		void Cancel(StreamID stream);
+
+		// Network thread. Sends the chunks the pacing allows, returns the number sent
+		uint32_t Update(ISteamNetworkingSockets* networkInterface);
+
+		// Thread receiving for the connection. Returns true if the message was a stream message (and was consumed)
+		bool HandleReceivedMessage(HSteamNetConnection connection, const Buffer& buffer);
+
+		// Thread receiving for the connection, once it has closed. Fails its incoming streams
+		void RemoveConnection(HSteamNetConnection connection);
+
+		// Network thread, once nothing is running. Fails every stream
+		void Clear();
+
+		uint32_t GetActiveOutgoingStreamCount() const { return m_ActiveOutgoingCount.load(std::memory_order_relaxed); }
+	private:
+		struct OutgoingStream
+		{
+			StreamProgress Progress;
+			Buffer Data;
+			StreamOptions Options;
+			bool Begun = false;
+		};
+
+		struct IncomingStream
+		{
+			StreamProgress Progress;
+			std::span<std::byte> Destination; // Empty for chunked delivery
+		};
+
+		struct MessageHandler;
+		void OnStreamBegin(HSteamNetConnection connection, MessageView<StreamBeginMessage> message);
+		void OnStreamChunk(HSteamNetConnection connection, MessageView<StreamChunkMessage> message);
+		void OnStreamCancel(HSteamNetConnection connection, MessageView<StreamCancelMessage> message);
+
+		template<NetworkMessage T>
+		void SendControlMessage(HSteamNetConnection connection, LaneIndex lane, const T& message);
+
+		void EndOutgoingStream(OutgoingStream& stream, StreamState state, bool notifyReceiver);
+		void EndIncomingStream(uint64_t key, StreamState state, bool notifySender);
+		void RejectIncomingStream(StreamProgress& progress, StreamState state);
+		void ReportProgress(const StreamProgress& progress);
+
+		static uint64_t GetIncomingKey(HSteamNetConnection connection, StreamID stream) { return ((uint64_t)connection << 32) | stream; }
+	private:
+		bool m_Enabled = false;
+		StreamSettings m_Settings;
+		SendFunction m_SendFunction;
+
+		IncomingStreamCallback m_IncomingStreamCallback;
+		StreamChunkCallback m_StreamChunkCallback;
+		StreamProgressCallback m_StreamProgressCallback;
+
+		std::atomic<StreamID> m_NextStreamID = 1;
+
+		// Handed over to the network thread by Send/Cancel, and by receivers rejecting or cancelling our streams.
+		// Cancels from the application have no connection.
+		std::mutex m_PendingMutex;
+		std::vector<std::unique_ptr<OutgoingStream>> m_PendingStreams;
+		std::vector<std::pair<HSteamNetConnection, StreamID>> m_PendingCancels;
+
+		// Network thread only
+		std::vector<std::unique_ptr<OutgoingStream>> m_OutgoingStreams;
+		std::vector<std::pair<HSteamNetConnection, StreamID>> m_Cancels;
+		std::vector<SteamNetConnectionRealTimeLaneStatus_t> m_LaneStatus;
+		std::atomic<uint32_t> m_ActiveOutgoingCount = 0;
+
+		// Each entry is only used by the thread receiving for its connection, the mutex guards the map itself
+		std::mutex m_IncomingMutex;
+		std::unordered_map<uint64_t, std::unique_ptr<IncomingStream>> m_IncomingStreams;
+	};
+
+}
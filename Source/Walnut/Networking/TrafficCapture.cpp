@@ -0,0 +1,147 @@
+#include "TrafficCapture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace Walnut {
+
+	bool TrafficCapture::Open(const std::string& path, const CaptureSettings& settings)
+	{
+		Close();
+
+		uint64_t size = std::max<uint64_t>(settings.MaxFileSize, sizeof(CaptureFileHeader));
+		if (!Utils::MapFile(path, size, true, m_File))
+			return false;
+
+		// Filled in on close, a capture that's never closed reads as running to the end of the file
+		CaptureFileHeader header;
+		memcpy(m_File.Data, &header, sizeof(header));
+
+		m_WriteOffset = sizeof(CaptureFileHeader);
+		m_Records = 0;
+		m_DroppedRecords = 0;
+		return true;
+	}
+
+	void TrafficCapture::Close()
+	{
+		if (!IsOpen())
+			return;
+
+		uint64_t end = m_WriteOffset.load();
+
+		CaptureFileHeader header;
+		header.DataSize = end - sizeof(CaptureFileHeader);
+		header.RecordCount = m_Records.load();
+		memcpy(m_File.Data, &header, sizeof(header));
+
+		Utils::UnmapFile(m_File, end);
+	}
+
+	void TrafficCapture::Write(CaptureRecordType type, int64_t timestamp, uint32_t slot, uint16_t lane, const void* data, uint32_t size)
+	{
+		uint64_t recordSize = sizeof(CaptureRecordHeader) + size;
+
+		// Reserve space, writers only contend on this
+		uint64_t offset = m_WriteOffset.load(std::memory_order_relaxed);
+		do
+		{
+			if (offset + recordSize > m_File.Size)
+			{
+				m_DroppedRecords.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+		} while (!m_WriteOffset.compare_exchange_weak(offset, offset + recordSize, std::memory_order_relaxed));
+
+		CaptureRecordHeader header;
+		header.Timestamp = timestamp;
+		header.Slot = slot;
+		header.Size = size;
+		header.Lane = lane;
+		header.Type = type;
+
+		std::byte* record = m_File.Data + offset;
+		memcpy(record, &header, sizeof(header));
+		if (size)
+			memcpy(record + sizeof(header), data, size);
+
+		m_Records.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	CaptureStats TrafficCapture::GetStats() const
+	{
+		CaptureStats stats;
+		stats.Records = m_Records.load(std::memory_order_relaxed);
+		stats.DroppedRecords = m_DroppedRecords.load(std::memory_order_relaxed);
+
+		// Kept once closed, for the totals of the last capture
+		uint64_t offset = m_WriteOffset.load(std::memory_order_relaxed);
+		stats.Bytes = offset > sizeof(CaptureFileHeader) ? offset - sizeof(CaptureFileHeader) : 0;
+		return stats;
+	}
+
+	bool CaptureReader::Open(const std::string& path)
+	{
+		Close();
+
+		if (!Utils::MapFile(path, 0, false, m_File))
+			return false;
+
+		CaptureFileHeader header;
+		if (m_File.Size < sizeof(header))
+		{
+			std::cout << "ERROR: " << path << " is not a capture file" << std::endl;
+			Close();
+			return false;
+		}
+
+		memcpy(&header, m_File.Data, sizeof(header));
+		if (header.Magic != CaptureFileHeader::MagicValue || header.Version != CaptureFileHeader::CurrentVersion)
+		{
+			std::cout << "ERROR: " << path << " is not a capture file, or was written by another version" << std::endl;
+			Close();
+			return false;
+		}
+
+		m_ReadOffset = sizeof(CaptureFileHeader);
+		m_EndOffset = header.DataSize ? std::min<uint64_t>(sizeof(CaptureFileHeader) + header.DataSize, m_File.Size) : m_File.Size;
+		m_RecordCount = header.RecordCount;
+		return true;
+	}
+
+	void CaptureReader::Close()
+	{
+		Utils::UnmapFile(m_File);
+		m_ReadOffset = 0;
+		m_EndOffset = 0;
+		m_RecordCount = 0;
+	}
+
+	bool CaptureReader::Next(CaptureRecord& record)
+	{
+		if (m_ReadOffset + sizeof(CaptureRecordHeader) > m_EndOffset)
+			return false;
+
+		CaptureRecordHeader header;
+		memcpy(&header, m_File.Data + m_ReadOffset, sizeof(header));
+
+		// Unwritten space in a capture that wasn't closed - data records are never empty
+		if (header.Type == CaptureRecordType::Data && header.Size == 0)
+			return false;
+
+		uint64_t payloadOffset = m_ReadOffset + sizeof(CaptureRecordHeader);
+		if (payloadOffset + header.Size > m_EndOffset)
+			return false;
+
+		record.Type = header.Type;
+		record.Timestamp = header.Timestamp;
+		record.Slot = header.Slot;
+		record.Lane = header.Lane;
+		record.Payload = Buffer(m_File.Data + payloadOffset, header.Size);
+
+		m_ReadOffset = payloadOffset + header.Size;
+		return true;
+	}
+
+}
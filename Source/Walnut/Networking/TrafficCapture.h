@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Walnut/Core/Buffer.h"
+
+#include "NetworkingUtils.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+namespace Walnut {
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Traffic capture
+	// A capture is what a server's handlers saw: every message as it was handed to the data received callbacks (decoded,
+	// after inbound limits, streams and session messages are not included) and every client connect, disconnect and
+	// session resume, with the time it was received, the client's slot and the lane it arrived on. Server::ReplayCapture() feeds it
+	// back through the same dispatch path, for profiling and regression testing handlers against real traffic.
+	//
+	// The file is memory-mapped at its maximum size up front, so recording a message from any shard is a reservation
+	// (one compare-exchange) and a copy. Once it's full, further records are dropped and counted. The file is cut down
+	// to what was written when it's closed.
+	//
+	// Layout: CaptureFileHeader, then records back to back, each a CaptureRecordHeader followed by its payload
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	enum class CaptureRecordType : uint8_t
+	{
+		Data = 0, ClientConnected, ClientDisconnected,
+		ClientResumed // Payload is the client's previous slot (uint32_t)
+	};
+
+	struct CaptureFileHeader
+	{
+		static constexpr uint32_t MagicValue = 0x50434C57; // "WLCP"
+		static constexpr uint32_t CurrentVersion = 1;
+
+		uint32_t Magic = MagicValue;
+		uint32_t Version = CurrentVersion;
+		uint64_t DataSize = 0;    // Bytes of records after the header, written on close
+		uint64_t RecordCount = 0; // Written on close
+	};
+
+	struct CaptureRecordHeader
+	{
+		int64_t Timestamp = 0; // Microseconds since the capture started
+		uint32_t Slot = 0;     // Client slot on the capturing server
+		uint32_t Size = 0;     // Payload bytes that follow
+		uint16_t Lane = 0;
+		CaptureRecordType Type = CaptureRecordType::Data;
+		uint8_t Reserved0 = 0;
+		uint32_t Reserved1 = 0;
+	};
+
+	struct CaptureSettings
+	{
+		// The file is mapped at this size, records that don't fit are dropped
+		uint64_t MaxFileSize = 256ull * 1024 * 1024;
+	};
+
+	struct CaptureStats
+	{
+		uint64_t Records = 0;
+		uint64_t Bytes = 0;          // Including record headers
+		uint64_t DroppedRecords = 0; // Didn't fit in MaxFileSize
+	};
+
+	struct ReplaySettings
+	{
+		// Playback speed relative to the recording (2 = twice as fast), 0 = as fast as possible
+		double Speed = 1.0;
+	};
+
+	struct ReplayStats
+	{
+		bool Completed = false; // The capture could be opened and was played to the end
+		uint64_t Messages = 0;
+		uint64_t Bytes = 0;
+		uint32_t Connects = 0;
+		uint32_t Disconnects = 0;
+		uint32_t Resumes = 0;
+		std::chrono::microseconds Duration{};
+		std::chrono::microseconds CallbackTime{}; // Spent in the data received callbacks
+	};
+
+	struct CaptureRecord
+	{
+		CaptureRecordType Type = CaptureRecordType::Data;
+		int64_t Timestamp = 0;
+		uint32_t Slot = 0;
+		uint16_t Lane = 0;
+		Buffer Payload; // Points into the mapped file
+	};
+
+	// Writes are thread-safe, Open/Close aren't
+	class TrafficCapture
+	{
+	public:
+		TrafficCapture() = default;
+		~TrafficCapture() { Close(); }
+
+		TrafficCapture(const TrafficCapture&) = delete;
+		TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+		// Creates (or overwrites) the file
+		bool Open(const std::string& path, const CaptureSettings& settings = {});
+		void Close();
+		bool IsOpen() const { return m_File.Data != nullptr; }
+
+		// Any thread. Timestamps are in microseconds since the capture started
+		void Write(CaptureRecordType type, int64_t timestamp, uint32_t slot, uint16_t lane, const void* data = nullptr, uint32_t size = 0);
+
+		CaptureStats GetStats() const;
+	private:
+		Utils::MappedFile m_File;
+		std::atomic<uint64_t> m_WriteOffset = 0;
+		std::atomic<uint64_t> m_Records = 0;
+		std::atomic<uint64_t> m_DroppedRecords = 0;
+	};
+
+	class CaptureReader
+	{
+	public:
+		CaptureReader() = default;
+		~CaptureReader() { Close(); }
+
+		CaptureReader(const CaptureReader&) = delete;
+		CaptureReader& operator=(const CaptureReader&) = delete;
+
+		bool Open(const std::string& path);
+		void Close();
+		bool IsOpen() const { return m_File.Data != nullptr; }
+
+		// Returns false at the end of the capture, or at a record that runs past the end of the file (a capture that
+		// was never closed ends with zeroes or a partly written record)
+		bool Next(CaptureRecord& record);
+		void Rewind() { m_ReadOffset = sizeof(CaptureFileHeader); }
+
+		uint64_t GetRecordCount() const { return m_RecordCount; }
+	private:
+		Utils::MappedFile m_File;
+		uint64_t m_ReadOffset = 0;
+		uint64_t m_EndOffset = 0;
+		uint64_t m_RecordCount = 0;
+	};
+
+}
@@ -0,0 +1,266 @@
+#include "Tests.h"
+
+#include "Walnut/Networking/Compression.h"
+
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Compression codec tests
+// Round trips through CompressBlock/DecompressBlock and PayloadCompressor, and malformed input, which comes straight
+// from peers
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+using namespace Walnut;
+
+namespace {
+
+	std::vector<uint8_t> RandomBytes(std::mt19937& rng, size_t size, uint32_t alphabet = 256)
+	{
+		std::vector<uint8_t> bytes(size);
+		for (uint8_t& b : bytes)
+			b = (uint8_t)(rng() % alphabet);
+		return bytes;
+	}
+
+	// Messages made of a few recurring keys, like typical game traffic
+	std::vector<uint8_t> MessageLikeBytes(std::mt19937& rng, uint32_t parts)
+	{
+		static const char* s_Words[] = { "{\"type\":\"move\",", "\"player\":", "\"x\":", "\"y\":", "\"chat\":\"hello\"", "}", ",", "1234", "56.7" };
+
+		std::string text;
+		for (uint32_t i = 0; i < parts; i++)
+			text += s_Words[rng() % std::size(s_Words)];
+		return std::vector<uint8_t>(text.begin(), text.end());
+	}
+
+	bool RoundTrip(const std::vector<uint8_t>& input, const CompressionDictionary* dictionary)
+	{
+		std::vector<uint8_t> compressed(Utils::GetMaxCompressedSize((uint32_t)input.size()));
+		uint32_t compressedSize = Utils::CompressBlock(input.data(), (uint32_t)input.size(), compressed.data(), (uint32_t)compressed.size(), dictionary);
+		if (compressedSize == 0)
+			return false;
+
+		std::vector<uint8_t> output(input.size());
+		if (!Utils::DecompressBlock(compressed.data(), compressedSize, output.data(), (uint32_t)output.size(), dictionary))
+			return false;
+
+		return output == input;
+	}
+
+	std::shared_ptr<const CompressionDictionary> TrainDictionary(std::mt19937& rng)
+	{
+		std::vector<std::vector<uint8_t>> samples;
+		for (int i = 0; i < 200; i++)
+			samples.push_back(MessageLikeBytes(rng, 1 + rng() % 20));
+
+		std::vector<Buffer> buffers;
+		for (const auto& sample : samples)
+			buffers.emplace_back(sample.data(), sample.size());
+
+		return CompressionDictionary::Train(buffers, 4096);
+	}
+
+	void TestBlockRoundTrip()
+	{
+		std::mt19937 rng(1);
+		auto dictionary = TrainDictionary(rng);
+		CHECK(dictionary && !dictionary->GetData().empty());
+
+		CHECK(RoundTrip({}, nullptr));
+		CHECK(RoundTrip({ 'a' }, nullptr));
+		CHECK(RoundTrip(std::vector<uint8_t>(100000, 'a'), nullptr)); // Overlapping matches
+		CHECK(RoundTrip(RandomBytes(rng, 200000, 4), nullptr));       // Offsets up to the 64KB limit
+
+		for (int i = 0; i < 2000; i++)
+		{
+			std::vector<uint8_t> input;
+			switch (i % 3)
+			{
+				case 0: input = RandomBytes(rng, rng() % 2000, 4); break;
+				case 1: input = RandomBytes(rng, rng() % 300); break;
+				case 2: input = MessageLikeBytes(rng, rng() % 30); break;
+			}
+
+			CHECK(RoundTrip(input, nullptr));
+			CHECK(RoundTrip(input, dictionary.get()));
+		}
+	}
+
+	void TestBlockCapacity()
+	{
+		std::mt19937 rng(2);
+		std::vector<uint8_t> input = RandomBytes(rng, 1000);
+
+		// Random data doesn't compress, so it can't fit in less than its own size
+		std::vector<uint8_t> compressed(input.size());
+		CHECK(Utils::CompressBlock(input.data(), (uint32_t)input.size(), compressed.data(), (uint32_t)input.size() / 2) == 0);
+	}
+
+	void TestMalformedBlocks()
+	{
+		auto decompress = [](std::vector<uint8_t> source, uint32_t destinationSize)
+		{
+			std::vector<uint8_t> destination(destinationSize);
+			return Utils::DecompressBlock(source.data(), (uint32_t)source.size(), destination.data(), destinationSize);
+		};
+
+		CHECK(decompress({ 0x10, 'a' }, 1));
+		CHECK(!decompress({ 0x10, 'a' }, 2));                    // Shorter than expected
+		CHECK(!decompress({}, 0));                               // No sequence at all
+		CHECK(!decompress({ 0x50, 'a', 'b' }, 5));               // Literals past the end of the input
+		CHECK(!decompress({ 0x20, 'a', 'b' }, 1));               // Literals past the end of the output
+		CHECK(!decompress({ 0xF0, 255 }, 300));                  // Truncated length
+		CHECK(!decompress({ 0x10, 'a', 0x00, 0x00 }, 5));        // Zero offset
+		CHECK(!decompress({ 0x10, 'a', 0x05, 0x00 }, 5));        // Offset before the start of the output
+		CHECK(!decompress({ 0x1F, 'a', 0x01, 0x00, 0x10 }, 10)); // Match past the end of the output
+		CHECK(!decompress({ 0x10, 'a', 0x01 }, 5));              // Truncated offset
+		CHECK(decompress({ 0x10, 'a', 0x01, 0x00, 0x00 }, 5));   // Overlapping match, then empty final sequence
+
+		// Junk must be rejected (or happen to decode to exactly the expected size), never read or write out of bounds
+		std::mt19937 rng(3);
+		auto dictionary = TrainDictionary(rng);
+		for (int i = 0; i < 50000; i++)
+		{
+			std::vector<uint8_t> junk = RandomBytes(rng, rng() % 64);
+			std::vector<uint8_t> destination(rng() % 256);
+			Utils::DecompressBlock(junk.data(), (uint32_t)junk.size(), destination.data(), (uint32_t)destination.size(), (i & 1) ? dictionary.get() : nullptr);
+		}
+
+		// Compressed with a dictionary, its matches reach back into history that isn't there without one
+		std::vector<uint8_t> input = MessageLikeBytes(rng, 10);
+		std::vector<uint8_t> compressed(Utils::GetMaxCompressedSize((uint32_t)input.size()));
+		uint32_t compressedSize = Utils::CompressBlock(input.data(), (uint32_t)input.size(), compressed.data(), (uint32_t)compressed.size(), dictionary.get());
+		std::vector<uint8_t> output(input.size());
+		CHECK(compressedSize > 0);
+		CHECK(!Utils::DecompressBlock(compressed.data(), compressedSize, output.data(), (uint32_t)output.size()));
+	}
+
+	// Encodes the payload into a library message and decodes it back, as it would arrive
+	ISteamNetworkingMessage* EncodeAndDecode(PayloadCompressor& sender, PayloadCompressor& receiver, const std::vector<uint8_t>& payload)
+	{
+		ISteamNetworkingMessage* message = sender.CreateEncodedMessage(payload.data(), (uint32_t)payload.size());
+		return receiver.DecodeReceivedMessages(&message, 1) == 1 ? message : nullptr;
+	}
+
+	ISteamNetworkingMessage* Decode(PayloadCompressor& receiver, const std::vector<uint8_t>& data)
+	{
+		ISteamNetworkingMessage* message = SteamNetworkingUtils()->AllocateMessage((int)data.size());
+		if (!data.empty())
+			memcpy(message->m_pData, data.data(), data.size());
+		return receiver.DecodeReceivedMessages(&message, 1) == 1 ? message : nullptr;
+	}
+
+	void TestPayloadRoundTrip()
+	{
+		std::mt19937 rng(4);
+		auto dictionary = TrainDictionary(rng);
+
+		for (bool useDictionary : { false, true })
+		{
+			CompressionSettings settings;
+			settings.Threshold = 16;
+			if (useDictionary)
+				settings.Dictionary = dictionary;
+
+			PayloadCompressor sender, receiver;
+			sender.Enable(settings);
+			receiver.Enable(settings);
+
+			for (int i = 0; i < 500; i++)
+			{
+				std::vector<uint8_t> payload = (i % 2) ? MessageLikeBytes(rng, rng() % 40) : RandomBytes(rng, rng() % 300);
+				ISteamNetworkingMessage* message = EncodeAndDecode(sender, receiver, payload);
+				CHECK(message && message->m_cbSize == (int)payload.size() && (payload.empty() || memcmp(message->m_pData, payload.data(), payload.size()) == 0));
+				if (message)
+					message->Release();
+			}
+
+			CHECK(sender.GetStats().MessagesCompressed > 0);
+			CHECK(sender.GetStats().MessagesUncompressed > 0);
+			CHECK(receiver.GetStats().DecodeErrors == 0);
+		}
+	}
+
+	void TestPayloadSizeLimit()
+	{
+		PayloadCompressor compressor;
+		compressor.Enable({});
+
+		// The largest allowed payload must still fit in one message when it doesn't compress
+		std::mt19937 rng(5);
+		std::vector<uint8_t> payload = RandomBytes(rng, PayloadCompressor::GetMaxPayloadSize());
+		ISteamNetworkingMessage* message = compressor.CreateEncodedMessage(payload.data(), (uint32_t)payload.size());
+		CHECK(message->m_cbSize <= k_cbMaxSteamNetworkingSocketsMessageSizeSend);
+		message->Release();
+	}
+
+	void TestMalformedPayloads()
+	{
+		std::mt19937 rng(6);
+		auto dictionary = TrainDictionary(rng);
+
+		CompressionSettings settings;
+		settings.Dictionary = dictionary;
+		PayloadCompressor receiver;
+		receiver.Enable(settings);
+
+		auto trailer = [](std::vector<uint8_t> data, uint32_t originalSize, uint8_t flags)
+		{
+			data.resize(data.size() + 5);
+			memcpy(data.data() + data.size() - 5, &originalSize, sizeof(uint32_t));
+			data.back() = flags;
+			return data;
+		};
+
+		CHECK(!Decode(receiver, {}));                                    // No trailer
+		CHECK(!Decode(receiver, { 'a', 0x80 }));                         // Unknown flag
+		CHECK(!Decode(receiver, { 'a', 0x02 }));                         // Dictionary without compression
+		CHECK(!Decode(receiver, { 0x01 }));                              // Trailer cut short
+		CHECK(!Decode(receiver, trailer({ 0x10, 'a' }, 0x7FFFFFFF, 1))); // Over the message size limit
+		CHECK(!Decode(receiver, trailer({ 0x10, 'a' }, 2, 1)));          // Wrong original size
+		CHECK(!Decode(receiver, trailer({ 0x10, 'a' }, 0, 1)));          // Empty original
+
+		// Different dictionary ID
+		std::vector<uint8_t> withDictionary = trailer({ 0x10, 'a', 0, 0, 0, 0 }, 1, 3);
+		uint32_t wrongID = dictionary->GetID() + 1;
+		memcpy(withDictionary.data() + 2, &wrongID, sizeof(uint32_t));
+		CHECK(!Decode(receiver, withDictionary));
+
+		CHECK(receiver.GetStats().DecodeErrors == 8);
+
+		// Still decodes valid messages
+		ISteamNetworkingMessage* message = Decode(receiver, trailer({ 0x10, 'a' }, 1, 1));
+		CHECK(message && message->m_cbSize == 1 && *(const char*)message->m_pData == 'a');
+		if (message)
+			message->Release();
+
+		// Junk with every kind of trailer
+		for (int i = 0; i < 50000; i++)
+		{
+			std::vector<uint8_t> junk = RandomBytes(rng, rng() % 64);
+			if (junk.size() >= 5 && (i & 1))
+			{
+				uint32_t originalSize = rng() % 512;
+				memcpy(junk.data() + junk.size() - 5, &originalSize, sizeof(uint32_t));
+				junk.back() = (uint8_t)(1 + rng() % 3);
+			}
+
+			if (ISteamNetworkingMessage* decoded = Decode(receiver, junk))
+				decoded->Release();
+		}
+	}
+
+}
+
+void Walnut::Tests::RunCompressionTests()
+{
+	TestBlockRoundTrip();
+	TestBlockCapacity();
+	TestMalformedBlocks();
+	TestPayloadRoundTrip();
+	TestPayloadSizeLimit();
+	TestMalformedPayloads();
+}
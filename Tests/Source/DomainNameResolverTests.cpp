@@ -0,0 +1,298 @@
+#include "Tests.h"
+
+#include "Walnut/Networking/DomainNameResolver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Domain name resolver tests
+// Caching (TTL, negative TTL), joining lookups that are already in flight, and splitting names into host and port,
+// against a stub lookup function and a temporary hosts file. TTLs are a second, so this takes a few seconds.
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+using namespace Walnut;
+using namespace std::chrono_literals;
+
+namespace {
+
+	using Addresses = std::vector<std::string>;
+
+	// Answers from a table, counts lookups per host, and can hold lookups until released
+	struct StubLookup
+	{
+		std::mutex Mutex;
+		std::condition_variable Unblocked;
+		bool Blocked = false;
+		std::unordered_map<std::string, DomainNameResolver::LookupResult> Answers;
+		std::unordered_map<std::string, int> Lookups;
+
+		DomainNameResolver::LookupFunction GetFunction()
+		{
+			return [this](const std::string& hostName)
+			{
+				std::unique_lock lock(Mutex);
+				Lookups[hostName]++;
+				Unblocked.wait(lock, [this]() { return !Blocked; });
+
+				auto it = Answers.find(hostName);
+				return it != Answers.end() ? it->second : DomainNameResolver::LookupResult();
+			};
+		}
+
+		int GetLookupCount(const std::string& hostName)
+		{
+			std::scoped_lock lock(Mutex);
+			return Lookups[hostName];
+		}
+
+		void Unblock()
+		{
+			{
+				std::scoped_lock lock(Mutex);
+				Blocked = false;
+			}
+			Unblocked.notify_all();
+		}
+	};
+
+	// Results of Resolve() calls, which complete on worker threads unless cached. Shared with the callbacks,
+	// so a callback that arrives after a timed out wait has somewhere to go
+	struct ResolveResults
+	{
+		std::mutex Mutex;
+		std::condition_variable Completed;
+		std::vector<Addresses> Results;
+
+		static DomainNameResolver::ResolveCallback GetCallback(const std::shared_ptr<ResolveResults>& results)
+		{
+			return [results](const Addresses& addresses)
+			{
+				{
+					std::scoped_lock lock(results->Mutex);
+					results->Results.push_back(addresses);
+				}
+				results->Completed.notify_all();
+			};
+		}
+
+		size_t GetCount()
+		{
+			std::scoped_lock lock(Mutex);
+			return Results.size();
+		}
+
+		// False if they didn't all arrive in time
+		bool WaitFor(size_t count)
+		{
+			std::unique_lock lock(Mutex);
+			return Completed.wait_for(lock, 5s, [&]() { return Results.size() >= count; });
+		}
+	};
+
+	Addresses ResolveAndWait(DomainNameResolver& resolver, std::string_view name)
+	{
+		auto results = std::make_shared<ResolveResults>();
+		resolver.Resolve(name, ResolveResults::GetCallback(results));
+		if (!results->WaitFor(1))
+			return { "(timed out)" };
+
+		std::scoped_lock lock(results->Mutex);
+		return results->Results[0];
+	}
+
+	void TestCacheHits()
+	{
+		StubLookup stub;
+		stub.Answers["game.example.com"] = { { "10.0.0.1", "fd00::1" }, 1s };
+		stub.Answers["lobby.example.com"] = { { "10.0.0.2" }, 0s }; // Default TTL
+
+		DomainNameResolver resolver;
+		resolver.SetLookupFunction(stub.GetFunction());
+		resolver.SetDefaultTTL(60s);
+
+		CHECK(ResolveAndWait(resolver, "game.example.com:27020") == Addresses({ "10.0.0.1:27020", "[fd00::1]:27020" }));
+		CHECK(ResolveAndWait(resolver, "lobby.example.com") == Addresses({ "10.0.0.2" }));
+		CHECK(stub.GetLookupCount("game.example.com") == 1);
+
+		// Cached - answered on this thread, before Resolve() returns, with whatever port was asked for
+		auto results = std::make_shared<ResolveResults>();
+		resolver.Resolve("GAME.example.com:1", ResolveResults::GetCallback(results));
+		CHECK(results->GetCount() == 1);
+		CHECK(results->Results.size() == 1 && results->Results[0] == Addresses({ "10.0.0.1:1", "[fd00::1]:1" }));
+		CHECK(stub.GetLookupCount("game.example.com") == 1);
+
+		Addresses cached;
+		CHECK(resolver.TryGetCached("game.example.com", cached) && cached == Addresses({ "10.0.0.1", "fd00::1" }));
+
+		// The result's own TTL has run out, the default one hasn't
+		std::this_thread::sleep_for(1100ms);
+		CHECK(!resolver.TryGetCached("game.example.com", cached));
+		CHECK(resolver.TryGetCached("lobby.example.com", cached));
+
+		CHECK(ResolveAndWait(resolver, "game.example.com") == Addresses({ "10.0.0.1", "fd00::1" }));
+		CHECK(stub.GetLookupCount("game.example.com") == 2);
+		CHECK(stub.GetLookupCount("lobby.example.com") == 1);
+
+		// Cleared entries are looked up again
+		resolver.ClearCache();
+		CHECK(!resolver.TryGetCached("lobby.example.com", cached));
+		CHECK(ResolveAndWait(resolver, "lobby.example.com") == Addresses({ "10.0.0.2" }));
+		CHECK(stub.GetLookupCount("lobby.example.com") == 2);
+	}
+
+	void TestNegativeTTL()
+	{
+		StubLookup stub;
+
+		DomainNameResolver resolver;
+		resolver.SetLookupFunction(stub.GetFunction());
+		resolver.SetNegativeTTL(1s);
+
+		// Failures are cached too, so a reconnect storm against a missing name doesn't hammer DNS
+		CHECK(ResolveAndWait(resolver, "missing.example.com:80").empty());
+		CHECK(ResolveAndWait(resolver, "missing.example.com:80").empty());
+		CHECK(stub.GetLookupCount("missing.example.com") == 1);
+
+		Addresses cached = { "stale" };
+		CHECK(resolver.TryGetCached("missing.example.com", cached) && cached.empty());
+
+		std::this_thread::sleep_for(1100ms);
+		CHECK(!resolver.TryGetCached("missing.example.com", cached));
+
+		// And it can show up later
+		stub.Answers["missing.example.com"] = { { "10.0.0.3" }, 0s };
+		CHECK(ResolveAndWait(resolver, "missing.example.com:80") == Addresses({ "10.0.0.3:80" }));
+		CHECK(stub.GetLookupCount("missing.example.com") == 2);
+	}
+
+	void TestJoinInFlight()
+	{
+		StubLookup stub;
+		stub.Answers["busy.example.com"] = { { "10.0.0.4" }, 0s };
+		stub.Blocked = true;
+
+		DomainNameResolver resolver;
+		resolver.SetLookupFunction(stub.GetFunction());
+		resolver.SetWorkerCount(4);
+
+		// Requests from several threads while the first lookup is held up
+		auto results = std::make_shared<ResolveResults>();
+		std::vector<std::thread> threads;
+		for (int i = 0; i < 4; i++)
+		{
+			threads.emplace_back([&, i]()
+			{
+				resolver.Resolve("busy.example.com:" + std::to_string(1000 + i * 2), ResolveResults::GetCallback(results));
+				resolver.Resolve("busy.example.com:" + std::to_string(1001 + i * 2), ResolveResults::GetCallback(results));
+			});
+		}
+		for (std::thread& thread : threads)
+			thread.join();
+
+		CHECK(results->GetCount() == 0);
+		CHECK(stub.GetLookupCount("busy.example.com") <= 1);
+
+		stub.Unblock();
+		CHECK(results->WaitFor(8));
+		CHECK(stub.GetLookupCount("busy.example.com") == 1);
+
+		// Every request gets the answer with its own port
+		std::scoped_lock lock(results->Mutex);
+		std::vector<std::string> addresses;
+		for (const Addresses& result : results->Results)
+			addresses.insert(addresses.end(), result.begin(), result.end());
+		std::sort(addresses.begin(), addresses.end());
+
+		std::vector<std::string> expected;
+		for (int port = 1000; port < 1008; port++)
+			expected.push_back("10.0.0.4:" + std::to_string(port));
+		CHECK(addresses == expected);
+	}
+
+	void TestNameSplitting()
+	{
+		StubLookup stub;
+		stub.Answers["host.example.com"] = { { "10.0.0.5" }, 0s };
+		stub.Answers["::1"] = { { "::1" }, 0s };
+		stub.Answers["fe80::2"] = { { "fe80::2" }, 0s };
+		stub.Answers["127.0.0.1"] = { { "127.0.0.1" }, 0s };
+
+		DomainNameResolver resolver;
+		resolver.SetLookupFunction(stub.GetFunction());
+
+		// host:port, lower cased
+		CHECK(ResolveAndWait(resolver, "Host.Example.COM:27020") == Addresses({ "10.0.0.5:27020" }));
+		CHECK(stub.GetLookupCount("host.example.com") == 1);
+
+		// Bracketed IPv6 with a port - brackets come off for the lookup, and go back on with the port
+		CHECK(ResolveAndWait(resolver, "[::1]:8080") == Addresses({ "[::1]:8080" }));
+		CHECK(stub.GetLookupCount("::1") == 1);
+
+		// Bare IPv6 - every colon is part of the host
+		CHECK(ResolveAndWait(resolver, "fe80::2") == Addresses({ "fe80::2" }));
+		CHECK(stub.GetLookupCount("fe80::2") == 1);
+		CHECK(stub.GetLookupCount("fe80:") == 0);
+
+		// IPv4 literal with a port
+		CHECK(ResolveAndWait(resolver, "127.0.0.1:80") == Addresses({ "127.0.0.1:80" }));
+		CHECK(stub.GetLookupCount("127.0.0.1") == 1);
+	}
+
+	void TestHostsFile()
+	{
+		std::filesystem::path path = std::filesystem::temp_directory_path() / "walnut-resolver-test-hosts";
+		auto writeHosts = [&](const char* contents)
+		{
+			std::ofstream stream(path, std::ios::trunc);
+			stream << contents;
+		};
+
+		writeHosts(
+			"# Test hosts file\n"
+			"127.0.0.1 localhost\n"
+			"\n"
+			"fd00::10   ip6-game Game.Local # IPv6 listed first\n"
+			"10.0.0.10\tgame.local game\n"
+			"#10.0.0.11 game.local\n");
+
+		DomainNameResolver resolver;
+		resolver.SetLookupFunction(DomainNameResolver::CreateHostsFileLookup(path.string()));
+
+		// Every matching line, IPv4 first, aliases and case don't matter
+		CHECK(ResolveAndWait(resolver, "game.local:7777") == Addresses({ "10.0.0.10:7777", "[fd00::10]:7777" }));
+		CHECK(ResolveAndWait(resolver, "GAME:1") == Addresses({ "10.0.0.10:1" }));
+		CHECK(ResolveAndWait(resolver, "localhost") == Addresses({ "127.0.0.1" }));
+		CHECK(ResolveAndWait(resolver, "nowhere.local:1").empty());
+
+		// The file is read again once the cache entry is gone
+		writeHosts("10.0.0.12 game.local\n");
+		CHECK(ResolveAndWait(resolver, "game.local:7777") == Addresses({ "10.0.0.10:7777", "[fd00::10]:7777" }));
+		resolver.ClearCache();
+		CHECK(ResolveAndWait(resolver, "game.local:7777") == Addresses({ "10.0.0.12:7777" }));
+
+		// A missing file answers nothing
+		std::filesystem::remove(path);
+		resolver.ClearCache();
+		CHECK(ResolveAndWait(resolver, "game.local").empty());
+	}
+
+}
+
+void Walnut::Tests::RunDomainNameResolverTests()
+{
+	TestCacheHits();
+	TestNegativeTTL();
+	TestJoinInFlight();
+	TestNameSplitting();
+	TestHostsFile();
+}
@@ -0,0 +1,161 @@
+#include "Tests.h"
+
+#include "Walnut/Networking/Replication.h"
+
+#include <vector>
+#include <random>
+#include <initializer_list>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Snapshot delta tests
+// Round trips through EncodeDelta/ApplyDelta, and malformed deltas, which come straight from the server
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+using namespace Walnut;
+
+namespace {
+
+	using Bytes = std::vector<std::byte>;
+
+	Bytes MakeBytes(std::initializer_list<int> values)
+	{
+		Bytes bytes;
+		for (int value : values)
+			bytes.push_back((std::byte)value);
+		return bytes;
+	}
+
+	Bytes RandomBytes(std::mt19937& rng, size_t size)
+	{
+		Bytes bytes(size);
+		for (std::byte& b : bytes)
+			b = (std::byte)(rng() % 256);
+		return bytes;
+	}
+
+	// The output starts out holding a stale state, as the receiver's would
+	bool RoundTrip(const Bytes& baseline, const Bytes& target, Bytes* encodedDelta = nullptr)
+	{
+		Bytes delta;
+		Utils::EncodeDelta(baseline, target, delta);
+		if (encodedDelta)
+			*encodedDelta = delta;
+
+		Bytes output(target.size() + 7, std::byte(0xAA));
+		if (!Utils::ApplyDelta(baseline, delta, output, target.size()))
+			return false;
+
+		return output == target;
+	}
+
+	void TestDeltaRoundTrip()
+	{
+		std::mt19937 rng(7);
+		Bytes delta;
+
+		// Nothing changed costs nothing
+		Bytes state = RandomBytes(rng, 500);
+		CHECK(RoundTrip(state, state, &delta) && delta.empty());
+		CHECK(RoundTrip({}, {}, &delta) && delta.empty());
+
+		// Everything changed is one run of the whole state
+		Bytes changed = state;
+		for (std::byte& b : changed)
+			b ^= std::byte(0x5A);
+		CHECK(RoundTrip(state, changed, &delta) && delta.size() == changed.size() + 3); // [0][500 as two bytes][500 bytes]
+
+		// Sparse changes are separate runs
+		Bytes sparse = state;
+		sparse[10] ^= std::byte(1);
+		sparse[200] ^= std::byte(2);
+		sparse[499] ^= std::byte(3);
+		CHECK(RoundTrip(state, sparse, &delta) && delta.size() <= 3 * 4);
+
+		// Short unchanged gaps are folded into the run rather than starting a new one
+		Bytes gap = state;
+		gap[10] ^= std::byte(1);
+		gap[12] ^= std::byte(1);
+		CHECK(RoundTrip(state, gap, &delta) && delta == MakeBytes({ 10, 3, 1, 0, 1 }));
+
+		// Growing - baseline bytes past its end count as zero, so a zero tail is free
+		Bytes grown = state;
+		grown.resize(800);
+		CHECK(RoundTrip(state, grown, &delta) && delta.empty());
+		grown[700] = std::byte(9);
+		CHECK(RoundTrip(state, grown));
+		CHECK(RoundTrip({}, state));
+
+		// Shrinking
+		Bytes shrunk(state.begin(), state.begin() + 100);
+		CHECK(RoundTrip(state, shrunk, &delta) && delta.empty());
+		shrunk[99] ^= std::byte(1);
+		CHECK(RoundTrip(state, shrunk));
+		CHECK(RoundTrip(state, {}, &delta) && delta.empty());
+
+		for (int i = 0; i < 2000; i++)
+		{
+			Bytes baseline = RandomBytes(rng, rng() % 300);
+			Bytes target = baseline;
+			target.resize(rng() % 300);
+			for (uint32_t changes = rng() % 20; changes > 0 && !target.empty(); changes--)
+				target[rng() % target.size()] = (std::byte)(rng() % 256);
+
+			CHECK(RoundTrip(baseline, target));
+		}
+	}
+
+	void TestMalformedDeltas()
+	{
+		Bytes baseline = MakeBytes({ 1, 2, 3, 4 });
+
+		// Deltas are copied into exactly sized buffers, so reading past the end shows up under a sanitizer
+		auto apply = [&](Bytes delta, size_t targetSize)
+		{
+			Bytes target;
+			return Utils::ApplyDelta(baseline, delta, target, targetSize);
+		};
+
+		CHECK(apply({}, 4));
+		CHECK(apply(MakeBytes({ 1, 2, 0, 0 }), 4));
+		CHECK(!apply(MakeBytes({ 0x80 }), 4));                         // Truncated unchanged count
+		CHECK(!apply(MakeBytes({ 1 }), 4));                            // Missing changed count
+		CHECK(!apply(MakeBytes({ 1, 0x81 }), 4));                      // Truncated changed count
+		CHECK(!apply(MakeBytes({ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0 }), 4)); // Varint longer than 64 bits
+		CHECK(!apply(MakeBytes({ 0, 3, 7, 7 }), 4));                   // Run longer than the rest of the delta
+		CHECK(!apply(MakeBytes({ 0, 3, 7, 7, 7 }), 2));                // Run past the end of the target
+		CHECK(!apply(MakeBytes({ 5, 1, 7 }), 4));                      // Offset past the end of the target
+		CHECK(!apply(MakeBytes({ 2, 1, 7, 2, 1, 7 }), 4));             // Second run past the end of the target
+		CHECK(!apply(MakeBytes({ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F, 1, 7 }), 4));       // Offset that wraps
+		CHECK(!apply(MakeBytes({ 1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 7 }), 4)); // Run length that wraps
+
+		// Offsets past the end of the baseline (but not the target) read it as zero
+		Bytes target;
+		CHECK(Utils::ApplyDelta(baseline, MakeBytes({ 6, 1, 7 }), target, 8) && target == MakeBytes({ 1, 2, 3, 4, 0, 0, 7, 0 }));
+		CHECK(Utils::ApplyDelta({}, MakeBytes({ 1, 2, 7, 8 }), target, 3) && target == MakeBytes({ 0, 7, 8 }));
+
+		// Junk must be rejected or decode to exactly the size asked for, never read or write out of bounds
+		std::mt19937 rng(8);
+		for (int i = 0; i < 50000; i++)
+		{
+			Bytes junkBaseline = RandomBytes(rng, rng() % 32);
+			Bytes junk = RandomBytes(rng, rng() % 16);
+			if (i & 1)
+			{
+				// Small counts, so more of them get past the header checks
+				for (std::byte& b : junk)
+					b &= std::byte(0x0F);
+			}
+
+			size_t targetSize = rng() % 48;
+			if (Utils::ApplyDelta(junkBaseline, junk, target, targetSize))
+				CHECK(target.size() == targetSize);
+		}
+	}
+
+}
+
+void Walnut::Tests::RunReplicationTests()
+{
+	TestDeltaRoundTrip();
+	TestMalformedDeltas();
+}
@@ -0,0 +1,28 @@
+#include "Tests.h"
+
+#include "Walnut/Networking/NetworkingContext.h"
+
+#include <string>
+
+using namespace Walnut;
+
+int main()
+{
+	// Library messages are allocated through GameNetworkingSockets
+	std::string errorMessage;
+	if (!NetworkingContext::Acquire(errorMessage))
+	{
+		std::cout << "GameNetworkingSockets_Init failed: " << errorMessage << std::endl;
+		return 1;
+	}
+
+	Tests::RunCompressionTests();
+	Tests::RunDomainNameResolverTests();
+	Tests::RunReplicationTests();
+
+	NetworkingContext::Release();
+
+	if (Tests::s_Failures == 0)
+		std::cout << "All tests passed" << std::endl;
+	return Tests::s_Failures;
+}
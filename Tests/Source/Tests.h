@@ -0,0 +1,28 @@
+#pragma once
+
+#include <iostream>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shared by the test files
+// Every check runs and failures are printed, the exit code is the number of failures.
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace Walnut::Tests {
+
+	inline int s_Failures = 0;
+
+	void RunCompressionTests();
+	void RunDomainNameResolverTests();
+	void RunReplicationTests();
+
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::cout << "FAILED: " << #condition << " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+			Walnut::Tests::s_Failures++; \
+		} \
+	} while (false)